@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Replaces the global operator new of a test program with one that counts
+// allocations. Include this file in only one source file of a test.
+
+#pragma once
+#ifndef TESTS_UNIT_COUNT_ALLOCATIONS_H
+#define TESTS_UNIT_COUNT_ALLOCATIONS_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<std::size_t> g_num_allocations{0};
+} // anon namespace
+
+void* operator new(std::size_t sz) {
+    ++g_num_allocations;
+    void *p = std::malloc(sz == 0 ? 1 : sz);
+    if(p == nullptr) {
+        throw std::bad_alloc{};
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+// Count the number of allocations made by f()
+template<typename F>
+std::size_t count_allocations(F f) {
+    std::size_t start = g_num_allocations;
+    f();
+    return g_num_allocations - start;
+}
+
+#endif // TESTS_UNIT_COUNT_ALLOCATIONS_H
@@ -21,6 +21,7 @@
 #define BOOST_TEST_MODULE dng::cigar
 
 #include <vector>
+#include <chrono>
 
 #include <dng/cigar.h>
 
@@ -142,3 +143,96 @@ BOOST_AUTO_TEST_CASE(test_target_to_query) {
     test(126385650, 60192825, std::make_pair(&v.front(), &v.back()), 499);
     test(126385680, 126385685, std::make_pair(&v.front(), &v.back()), -1);
 }
+
+namespace {
+// Build a cigar string from (length, op) pairs
+std::vector<uint32_t> make_cigar(std::vector<std::pair<uint32_t,int>> ops) {
+    std::vector<uint32_t> v;
+    for(auto && op : ops) {
+        v.push_back(op.first << BAM_CIGAR_SHIFT | op.second);
+    }
+    return v;
+}
+
+// A long read with a small indel every 50 bases
+std::vector<uint32_t> long_read_cigar() {
+    std::vector<std::pair<uint32_t,int>> ops{{500, BAM_CSOFT_CLIP}};
+    for(int i = 0; i < 400; ++i) {
+        ops.emplace_back(50, BAM_CMATCH);
+        ops.emplace_back(1+i%3, (i%2 == 0) ? BAM_CINS : BAM_CDEL);
+    }
+    ops.emplace_back(50, BAM_CMATCH);
+    return make_cigar(ops);
+}
+
+// An RNA read spliced across many introns
+std::vector<uint32_t> spliced_cigar() {
+    std::vector<std::pair<uint32_t,int>> ops;
+    for(int i = 0; i < 30; ++i) {
+        ops.emplace_back(25, BAM_CMATCH);
+        ops.emplace_back(1000, BAM_CREF_SKIP);
+    }
+    ops.emplace_back(25, BAM_CMATCH);
+    return make_cigar(ops);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_cursor) {
+    using dng::cigar::target_to_query;
+    using dng::cigar::target_length;
+    using dng::cigar::Cursor;
+
+    const uint64_t beg = 1000;
+    std::vector<std::vector<uint32_t>> cigars = {
+        make_cigar({{10, BAM_CMATCH}}),
+        make_cigar({{5, BAM_CSOFT_CLIP}, {10, BAM_CMATCH}, {3, BAM_CHARD_CLIP}}),
+        make_cigar({{5, BAM_CINS}, {4, BAM_CMATCH}, {2, BAM_CDEL}, {4, BAM_CEQUAL},
+                    {3, BAM_CINS}, {2, BAM_CPAD}, {6, BAM_CDIFF}}),
+        make_cigar({{3, BAM_CMATCH}, {100, BAM_CREF_SKIP}, {3, BAM_CMATCH}}),
+        make_cigar({{4, BAM_CDEL}, {4, BAM_CMATCH}}),
+        long_read_cigar(),
+        spliced_cigar()
+    };
+    for(size_t i = 0; i < cigars.size(); ++i) {
+        BOOST_TEST_CONTEXT("cigar #" << i) {
+            cigar_t cigar{cigars[i].data(), cigars[i].data()+cigars[i].size()};
+            uint64_t end = beg + target_length(cigar);
+            // step through every position
+            Cursor cursor{beg, cigar};
+            for(uint64_t t = beg-2; t < end+2; ++t) {
+                BOOST_CHECK_EQUAL(cursor.Seek(t), target_to_query(t, beg, cigar));
+            }
+            // jump forward, and back to the start
+            cursor.Reset(beg, cigar);
+            for(uint64_t t = beg; t < end+2; t += 7) {
+                BOOST_CHECK_EQUAL(cursor.Seek(t), target_to_query(t, beg, cigar));
+            }
+            BOOST_CHECK_EQUAL(cursor.Seek(beg+1), target_to_query(beg+1, beg, cigar));
+            BOOST_CHECK_EQUAL(cursor.Seek(end-1), target_to_query(end-1, beg, cigar));
+        }
+    }
+
+    // Microbenchmark of stepping reads through their alignments
+    auto benchmark = [&](const char *name, const std::vector<uint32_t> &v) {
+        using std::chrono::steady_clock;
+        cigar_t cigar{v.data(), v.data()+v.size()};
+        uint64_t end = beg + target_length(cigar);
+        uint64_t total_a = 0, total_b = 0;
+        auto start = steady_clock::now();
+        for(uint64_t t = beg; t < end; ++t) {
+            total_a += target_to_query(t, beg, cigar);
+        }
+        auto middle = steady_clock::now();
+        Cursor cursor{beg, cigar};
+        for(uint64_t t = beg; t < end; ++t) {
+            total_b += cursor.Seek(t);
+        }
+        auto stop = steady_clock::now();
+        BOOST_CHECK_EQUAL(total_a, total_b);
+        std::chrono::duration<double, std::nano> a = middle - start, b = stop - middle;
+        BOOST_TEST_MESSAGE(name << " (" << v.size() << " ops): target_to_query "
+            << a.count()/(end-beg) << " ns/base, Cursor " << b.count()/(end-beg) << " ns/base");
+    };
+    benchmark("long read", long_read_cigar());
+    benchmark("spliced read", spliced_cigar());
+}
@@ -7,6 +7,8 @@
 #include "../testing.h"
 #include "../xorshift64.h"
 
+#include <chrono>
+
 #include <boost/range/algorithm/fill.hpp>
 #include <boost/range/algorithm/max_element.hpp>
 
@@ -213,4 +215,143 @@ BOOST_AUTO_TEST_CASE(test_DirichletMultinomial) {
     test({0.0005, 0.0005, 1, 0.0005, 4}, ad);
     test({0.0005, 0.001, 1.02, 1e-4, 5}, ad);
     test({0, 0, 1, 0, 5}, ad);
+
+    // the size of the cache does not change the results
+    test({0.0005, 0.001, 1.02, 1e-4, 5, 0}, ad);
+    test({0.0005, 0.001, 1.02, 1e-4, 5, 100001}, ad);
+}
+
+BOOST_AUTO_TEST_CASE(test_DirichletMultinomial_cache_size) {
+    BOOST_CHECK_EQUAL(DirichletMultinomial(0.0005, 0.001, 1.02, 1e-4, 5).cache_size(),
+        DirichletMultinomial::DEFAULT_CACHE_SIZE);
+    BOOST_CHECK_EQUAL(DirichletMultinomial(0.0005, 0.001, 1.02, 1e-4, 5, 0).cache_size(), 0);
+    BOOST_CHECK_EQUAL(DirichletMultinomial(0.0005, 0.001, 1.02, 1e-4, 5, -1).cache_size(), 0);
+
+    // Microbenchmark of genotyping deep sites with and without their depths
+    // in the cache
+    DirichletMultinomial small{0.0005, 0.001, 1.02, 1e-4, 4};
+    DirichletMultinomial large{0.0005, 0.001, 1.02, 1e-4, 4, 110000};
+    auto benchmark = [&](int depth) {
+        using std::chrono::steady_clock;
+        const int reps = 2000;
+        GenotypeArray output;
+        double total_a = 0.0, total_b = 0.0;
+        std::vector<int> ad(2);
+        auto start = steady_clock::now();
+        for(int r = 0; r < reps; ++r) {
+            ad[0] = depth - r % 100;
+            ad[1] = r % 100;
+            total_a += small(ad, 2, Mode::LogLikelihood, 2, &output);
+        }
+        auto middle = steady_clock::now();
+        for(int r = 0; r < reps; ++r) {
+            ad[0] = depth - r % 100;
+            ad[1] = r % 100;
+            total_b += large(ad, 2, Mode::LogLikelihood, 2, &output);
+        }
+        auto stop = steady_clock::now();
+        BOOST_CHECK_EQUAL(total_a, total_b);
+        std::chrono::duration<double, std::nano> a = middle - start, b = stop - middle;
+        BOOST_TEST_MESSAGE("depth " << depth << ": cache_size " << small.cache_size() << " "
+            << a.count()/reps << " ns/site, cache_size " << large.cache_size() << " "
+            << b.count()/reps << " ns/site");
+    };
+    benchmark(100);
+    benchmark(1000);
+    benchmark(10000);
+    benchmark(100000);
+}
+
+namespace {
+// Counts the number of times that the genotyper is called
+struct counting_genotyper_t {
+    const DirichletMultinomial &gt;
+    mutable int calls;
+
+    template<typename Range>
+    double operator()(const Range& ad, int num_obs_alleles, Mode mode, int ploidy,
+        GenotypeArray *output) const {
+        calls += 1;
+        return gt(ad, num_obs_alleles, mode, ploidy, output);
+    }
+};
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_LikelihoodCache) {
+    using depths_t = std::vector< std::vector<int> >;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    // a small cache so that entries get replaced
+    LikelihoodCache cache(64);
+    BOOST_CHECK_EQUAL(cache.capacity(), 64);
+    BOOST_CHECK_EQUAL(LikelihoodCache(50).capacity(), 64);
+
+    DirichletMultinomial dm{0.0005, 0.001, 1.02, 1e-4, 5};
+    DirichletMultinomial dm2{0.0005, 0.0005, 1, 0.0005, 4};
+
+    depths_t ad;
+    for(int i=0;i<200;++i) {
+        depths_t::value_type d;
+        for(int j=0;j<=(i%4);++j) {
+            d.push_back(xrand.get_uint64(4));
+        }
+        ad.push_back(d);
+    }
+    // more depths than the cache supports
+    ad.push_back({1,2,3,4,5,6});
+
+    auto test = [&](const counting_genotyper_t &gt) {
+        for(int pass=0;pass<2;++pass) {
+            for(auto &&d : ad) {
+                int k = std::max<int>(d.size(), 2);
+                for(int ploidy = 1; ploidy <= 2; ++ploidy) {
+                    for(auto mode : {Mode::Likelihood, Mode::LogLikelihood}) {
+                        GenotypeArray expected, test;
+                        double expected_scale = gt.gt(d, k, mode, ploidy, &expected);
+                        double test_scale = cache(gt, d, k, mode, ploidy, &test);
+                        BOOST_CHECK_EQUAL(test_scale, expected_scale);
+                        BOOST_REQUIRE_EQUAL(test.size(), expected.size());
+                        BOOST_CHECK(test.matrix() == expected.matrix());
+                    }
+                }
+            }
+        }
+    };
+    const int num_lookups = 2*ad.size()*2*2;
+    counting_genotyper_t counted{dm, 0};
+    test(counted);
+    // some lookups are hits and some are misses
+    BOOST_CHECK_GT(counted.calls, 0);
+    BOOST_CHECK_LT(counted.calls, num_lookups);
+    // depths that are too long are not cached or counted
+    const int num_uncached = 2*2*2;
+    BOOST_CHECK_EQUAL(cache.hits() + cache.misses(), num_lookups - num_uncached);
+    BOOST_CHECK_EQUAL(cache.misses(), counted.calls - num_uncached);
+    // entries for one genotyper must not be used by another
+    counting_genotyper_t counted2{dm2, 0};
+    test(counted2);
+    BOOST_CHECK_EQUAL(cache.hits() + cache.misses(), 2*(num_lookups - num_uncached));
+
+    // copies start out empty
+    LikelihoodCache copy{cache};
+    BOOST_CHECK_EQUAL(copy.capacity(), cache.capacity());
+    BOOST_CHECK_EQUAL(copy.hits(), 0);
+    BOOST_CHECK_EQUAL(copy.misses(), 0);
+    GenotypeArray output;
+    std::vector<int> d = {10, 2};
+    counting_genotyper_t counted3{dm, 0};
+    cache(counted3, d, 2, Mode::Likelihood, 2, &output);
+    copy(counted3, d, 2, Mode::Likelihood, 2, &output);
+    BOOST_CHECK_EQUAL(counted3.calls, 2);
+
+    // repeated depths are hits
+    LikelihoodCache cache2;
+    counting_genotyper_t counted4{dm, 0};
+    for(int i=0;i<10;++i) {
+        cache2(counted4, d, 2, Mode::Likelihood, 2, &output);
+    }
+    BOOST_CHECK_EQUAL(counted4.calls, 1);
+    BOOST_CHECK_EQUAL(cache2.hits(), 9);
+    BOOST_CHECK_EQUAL(cache2.misses(), 1);
 }
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dng::io::ad
+
+#include <dng/io/ad.h>
+#include <dng/detail/varint.h>
+
+#include "../../testing.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace dng;
+using namespace dng::io;
+
+namespace {
+struct temp_path_t {
+    boost::filesystem::path path{boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%.ad")};
+    ~temp_path_t() {
+        boost::system::error_code ec;
+        boost::filesystem::remove(path, ec);
+    }
+};
+
+// Sites used for the tests: three libraries spread over two contigs
+std::vector<ad_site_t> make_sites() {
+    std::vector<ad_site_t> sites;
+    auto add = [&](int contig, int pos, std::vector<int> indexes, std::vector<int> depths) {
+        ad_site_t site;
+        site.location = utility::make_location(contig, pos);
+        site.indexes = indexes;
+        site.depths.resize(utility::make_array(3, indexes.size()));
+        std::copy(depths.begin(), depths.end(), site.depths.data());
+        sites.push_back(std::move(site));
+    };
+    add(0, 10, {0}, {10, 12, 0});
+    add(0, 11, {1, 3}, {5, 1, 7, 0, 9, 2});
+    add(0, 12, {2, 0, 1}, {3, 2, 1, 300, 0, 0, 0, 0, 70000});
+    add(0, 100, {4, 0, 1, 2, 3}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14});
+    add(1, 0, {3, 2}, {1, 1, 1, 1, 1, 1});
+    add(1, 1, {3}, {8, 9, 10});
+    add(1, 5000, {0, 2}, {20, 0, 0, 20, 10, 10});
+    return sites;
+}
+
+std::vector<ad_site_t> read_sites(AdPileup &mpileup) {
+    std::vector<ad_site_t> sites;
+    mpileup([&](const AdPileup::data_type &site) {
+        sites.push_back(site);
+    });
+    return sites;
+}
+
+void check_sites(const std::vector<ad_site_t> &test, const std::vector<ad_site_t> &expected) {
+    BOOST_REQUIRE_EQUAL(test.size(), expected.size());
+    for(size_t i = 0; i < test.size(); ++i) {
+        BOOST_TEST_CONTEXT("site #" << i) {
+            BOOST_CHECK_EQUAL(test[i].location, expected[i].location);
+            CHECK_EQUAL_RANGES(test[i].indexes, expected[i].indexes);
+            BOOST_CHECK(test[i].depths == expected[i].depths);
+        }
+    }
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_varint) {
+    namespace varint = dng::detail::varint;
+    std::vector<uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384,
+        UINT64_C(0xFFFFFFFF), UINT64_C(0x7FFFFFFFFFFFFFFF), UINT64_C(0xFFFFFFFFFFFFFFFF)};
+    std::stringbuf buffer;
+    for(auto && u : values) {
+        BOOST_CHECK(varint::put(&buffer, u));
+    }
+    BOOST_CHECK_EQUAL(buffer.str().substr(0, 5), std::string("\x00\x01\x7F\x80\x01", 5));
+    for(auto && u : values) {
+        auto test = varint::get(&buffer);
+        BOOST_REQUIRE(test);
+        BOOST_CHECK_EQUAL(*test, u);
+    }
+    BOOST_CHECK(!varint::get(&buffer));
+
+    // a truncated value
+    std::stringbuf truncated{std::string("\x80\x80", 2)};
+    BOOST_CHECK(!varint::get(&truncated));
+
+    for(int64_t n : {0, -1, 1, -2, 2, -1000000, 1000000}) {
+        BOOST_CHECK(varint::put_zig_zag(&buffer, n));
+        auto test = varint::get_zig_zag(&buffer);
+        BOOST_REQUIRE(test);
+        BOOST_CHECK_EQUAL(*test, n);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_ad_alleles) {
+    std::vector<std::vector<int>> tests = {{}, {0}, {4}, {1, 3}, {2, 0, 1}, {4, 3, 2, 1, 0}};
+    std::vector<int> indexes;
+    for(auto && a : tests) {
+        uint64_t code = io::detail::encode_ad_alleles(a.data(), a.size());
+        BOOST_CHECK_EQUAL(io::detail::decode_ad_alleles(code, &indexes), a.size());
+        CHECK_EQUAL_RANGES(indexes, a);
+    }
+    BOOST_CHECK_THROW(io::detail::decode_ad_alleles(6, &indexes), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_ad_file) {
+    temp_path_t temp;
+    const std::string path = temp.path.string();
+
+    const std::vector<regions::contig_t> contigs = {{"1", 1000}, {"2", 6000}};
+    libraries_t libraries;
+    libraries.names = {"LB1", "LB2", "LB3"};
+    libraries.samples = {"A", "B", "C"};
+
+    auto sites = make_sites();
+    {
+        // small blocks so that sites are split across several blocks
+        AdWriter out{path, 3};
+        out.WriteHeader(contigs, libraries);
+        for(auto && site : sites) {
+            out.Write(site.location, site.indexes, site.depths);
+        }
+    }
+
+    AdPileup mpileup{path};
+    BOOST_REQUIRE_EQUAL(mpileup.contigs().size(), 2);
+    BOOST_CHECK_EQUAL(mpileup.contigs()[1].name, "2");
+    BOOST_CHECK_EQUAL(mpileup.contigs()[1].length, 6000);
+    CHECK_EQUAL_RANGES(mpileup.libraries().names, libraries.names);
+    CHECK_EQUAL_RANGES(mpileup.libraries().samples, libraries.samples);
+    BOOST_CHECK_EQUAL(mpileup.num_blocks(), 3);
+
+    check_sites(read_sites(mpileup), sites);
+
+    // regions
+    regions::ranges_t ranges;
+    ranges.emplace_back(0, 11, 13);
+    ranges.emplace_back(0, 50, 150);
+    ranges.emplace_back(1, 1, 4000);
+    mpileup.SetRegions(ranges);
+    check_sites(read_sites(mpileup), {sites[1], sites[2], sites[3], sites[5]});
+
+    ranges.clear();
+    ranges.emplace_back(1, 5001, 6000);
+    mpileup.SetRegions(ranges);
+    BOOST_CHECK(read_sites(mpileup).empty());
+
+    // selecting libraries
+    mpileup.SetRegions({});
+    std::vector<std::string> selected = {"LB3", "LBX", "LB1"};
+    mpileup.SelectLibraries(selected);
+    BOOST_CHECK_EQUAL(mpileup.num_libraries(), 2);
+    auto expected = sites;
+    for(auto && site : expected) {
+        pileup::allele_depths_t depths(utility::make_array(2, site.indexes.size()));
+        depths[0] = site.depths[2];
+        depths[1] = site.depths[0];
+        site.depths.resize(utility::make_array(2, site.indexes.size()));
+        site.depths = depths;
+    }
+    check_sites(read_sites(mpileup), expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_ad_file_invalid) {
+    temp_path_t temp;
+    const std::string path = temp.path.string();
+
+    BOOST_CHECK_THROW(AdPileup{path}, std::runtime_error);
+    {
+        std::ofstream out(path);
+        out << "this is not an ad file\n";
+    }
+    BOOST_CHECK_THROW(AdPileup{path}, std::runtime_error);
+
+    {
+        AdWriter out{path};
+        libraries_t libraries;
+        libraries.names = {"LB1"};
+        libraries.samples = {"A"};
+        out.WriteHeader({{"1", 100}}, libraries);
+        pileup::allele_depths_t depths(utility::make_array(1, 2));
+        depths[0][0] = 4;
+        depths[0][1] = 2;
+        out.Write(10, {0, 1}, depths);
+    }
+    // truncate the file
+    auto size = boost::filesystem::file_size(temp.path);
+    boost::filesystem::resize_file(temp.path, size - 4);
+    BOOST_CHECK_THROW(AdPileup{path}, std::runtime_error);
+}
@@ -19,10 +19,20 @@
 #define BOOST_TEST_MODULE dng::io::bam
 
 #include <dng/io/bam.h>
+#include <dng/cigar.h>
 
 #include "../../testing.h"
+#include "../../xorshift64.h"
 
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <numeric>
 #include <vector>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <tuple>
 
 namespace dng { namespace io {
 struct unittest_dng_io_bam {
@@ -54,3 +64,510 @@ BOOST_AUTO_TEST_CASE(test_header_parser) {
         CHECK_EQUAL_RANGES(pileup.libraries().samples, expected_samples);
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_parse_read_group_ids) {
+    vector<string> expected = {"Mom", "Dad1", "Dad2", "Eve1", "Eve2"};
+    CHECK_EQUAL_RANGES(io::detail::parse_read_group_ids(header1), expected);
+    BOOST_CHECK(io::detail::parse_read_group_ids("@HD\tVN:1.4\n").empty());
+    BOOST_CHECK(io::detail::parse_read_group_ids(nullptr).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_read_group_table) {
+    io::detail::ReadGroupTable table;
+    BOOST_CHECK_EQUAL(table.Find("A"), -1);
+
+    utility::StringMap map;
+    for(int i = 0; i < 100; ++i) {
+        std::string id = "H0" + std::to_string(i) + ".LANE" + std::to_string(i % 8);
+        table.Add(id, i/4);
+        map.emplace(id, i/4);
+    }
+    BOOST_CHECK_EQUAL(table.size(), map.size());
+    for(auto && a : map) {
+        BOOST_CHECK_EQUAL(table.Find(a.first.c_str()), a.second);
+    }
+    BOOST_CHECK_EQUAL(table.Find(""), -1);
+    BOOST_CHECK_EQUAL(table.Find("H0"), -1);
+    BOOST_CHECK_EQUAL(table.Find("H01.LANE1x"), -1);
+
+    // Microbenchmark of resolving the read groups of reads
+    std::vector<std::string> reads;
+    for(int i = 0; i < 200000; ++i) {
+        reads.push_back("H0" + std::to_string(i % 100) + ".LANE" + std::to_string(i % 8));
+    }
+    auto time_per_read = [&](std::function<int(const char*)> f) {
+        long long total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(auto && r : reads) {
+            total += f(r.c_str());
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        BOOST_CHECK_GE(total, 0);
+        return elapsed.count()/reads.size();
+    };
+    double map_ns = time_per_read([&](const char *id) -> int {
+        auto it = map.find(id);
+        return (it == map.end()) ? -1 : static_cast<int>(it->second);
+    });
+    double table_ns = time_per_read([&](const char *id) { return table.Find(id); });
+    BOOST_TEST_MESSAGE("read group lookup: StringMap " << map_ns << " ns/read, ReadGroupTable "
+        << table_ns << " ns/read");
+}
+
+namespace {
+// A read constructed from a cigar string, sequence, and qualities
+struct test_read_t {
+    std::vector<uint32_t> cigar;
+    std::vector<uint8_t> seq;
+    std::vector<uint8_t> qual;
+    bam_record_t record;
+
+    test_read_t(utility::location_t beg, std::vector<uint32_t> cigar_ops,
+        const std::string &bases, std::vector<uint8_t> quals) :
+        cigar(std::move(cigar_ops)), seq((bases.size()+1)/2, 0), qual(std::move(quals))
+    {
+        for(size_t i = 0; i < bases.size(); ++i) {
+            seq[i/2] |= seq::encode_base(bases[i]) << ((~i & 1) << 2);
+        }
+        record.cigar = {cigar.data(), cigar.data()+cigar.size()};
+        record.seq = {seq.data(), seq.data()+seq.size()};
+        record.qual = {qual.data(), qual.data()+qual.size()};
+        record.beg = beg;
+        record.end = beg + cigar::target_length(record.cigar);
+    }
+};
+
+uint32_t op(int len, int op) {
+    return (static_cast<uint32_t>(len) << BAM_CIGAR_SHIFT) | op;
+}
+
+// Count the bases at loc by walking the reads
+BamPileup::columns_type::counts_t expected_counts(const std::vector<test_read_t*> &reads,
+    utility::location_t loc, int min_basequal) {
+    BamPileup::columns_type::counts_t ret{};
+    for(auto *r : reads) {
+        if(loc < r->record.beg || r->record.end <= loc) {
+            continue;
+        }
+        uint64_t q = cigar::target_to_query(loc, r->record.beg, r->record.cigar);
+        if(cigar::query_del(q)) {
+            continue;
+        }
+        r->record.pos = cigar::query_pos(q);
+        int base = seq::base_index(r->record.base());
+        if(base >= 4 || r->record.base_qual() < min_basequal) {
+            continue;
+        }
+        ret[base] += 1;
+    }
+    return ret;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_column_depths) {
+    test_read_t read1{10, {op(2, BAM_CSOFT_CLIP), op(4, BAM_CMATCH), op(2, BAM_CDEL),
+        op(3, BAM_CMATCH)}, "TTACGTAAN", {30,30,30,30,10,30,30,30,30}};
+    test_read_t read2{12, {op(2, BAM_CMATCH), op(2, BAM_CINS), op(3, BAM_CREF_SKIP),
+        op(3, BAM_CEQUAL)}, "GGCCTTA", {30,30,30,30,30,30,30}};
+    test_read_t read3{14, {op(6, BAM_CMATCH)}, "AAAAAA", {30,30,30,30,30,30}};
+
+    const int min_basequal = 13;
+    BamPileup::columns_type columns;
+    columns.Reset(2);
+
+    // reads in library 0 are added at position 10, and reads in library 1 are
+    // added at position 15
+    columns.Advance(10);
+    columns.Add(0, read1.record, 10, min_basequal);
+    columns.Add(0, read2.record, 10, min_basequal);
+    for(utility::location_t loc = 10; loc < 15; ++loc) {
+        columns.Advance(loc);
+        auto expected = expected_counts({&read1, &read2}, loc, min_basequal);
+        CHECK_EQUAL_RANGES(columns(0, loc), expected);
+    }
+    columns.Advance(15);
+    columns.Add(1, read3.record, 15, min_basequal);
+    for(utility::location_t loc = 15; loc < 22; ++loc) {
+        columns.Advance(loc);
+        auto expected = expected_counts({&read1, &read2}, loc, min_basequal);
+        CHECK_EQUAL_RANGES(columns(0, loc), expected);
+        expected = expected_counts({&read3}, loc, min_basequal);
+        CHECK_EQUAL_RANGES(columns(1, loc), expected);
+    }
+    // position 14 of read3 was not added
+    BamPileup::columns_type::counts_t zero{};
+    columns.Reset(2);
+    columns.Advance(14);
+    columns.Add(1, read3.record, 15, min_basequal);
+    CHECK_EQUAL_RANGES(columns(1, 14), zero);
+
+    // a read that is longer than the ring buffer
+    test_read_t read4{20, {op(4, BAM_CMATCH), op(1000, BAM_CREF_SKIP), op(2, BAM_CMATCH)},
+        "ACGTCA", {30,30,30,30,30,30}};
+    columns.Reset(2);
+    columns.Advance(16);
+    columns.Add(0, read3.record, 16, min_basequal);
+    columns.Add(0, read4.record, 16, min_basequal);
+    for(utility::location_t loc = 16; loc < read4.record.end; ++loc) {
+        columns.Advance(loc);
+        auto expected = expected_counts({&read3, &read4}, loc, min_basequal);
+        CHECK_EQUAL_RANGES(columns(0, loc), expected);
+        CHECK_EQUAL_RANGES(columns(1, loc), zero);
+    }
+}
+
+namespace {
+// The allele depths from the reads, sorted with the reference first and the
+// other alleles by decreasing depth
+struct expected_alleles_t {
+    std::vector<int> indexes;
+    std::vector<std::vector<int>> depths;
+};
+
+expected_alleles_t expected_alleles(const std::vector<std::array<int,5>> &counts,
+    size_t ref_index) {
+    std::array<int,5> total{};
+    for(auto && c : counts) {
+        for(int b = 0; b < 5; ++b) {
+            total[b] += c[b];
+        }
+    }
+    expected_alleles_t ret;
+    ret.indexes = {0,1,2,3,4};
+    std::stable_sort(ret.indexes.begin(), ret.indexes.end(), [&](int l, int r) {
+        if(l == ref_index || r == ref_index) {
+            return l == ref_index && r != ref_index;
+        }
+        return total[l] > total[r];
+    });
+    size_t sz = 5;
+    while(sz > 0 && total[ret.indexes[sz-1]] == 0) {
+        --sz;
+    }
+    for(auto && c : counts) {
+        ret.depths.emplace_back();
+        for(size_t k = 0; k < sz; ++k) {
+            ret.depths.back().push_back(c[ret.indexes[k]]);
+        }
+    }
+    return ret;
+}
+
+// Single-base reads at position 0, spread over the libraries
+struct allele_pileup_t {
+    std::vector<test_read_t> reads;
+    BamPileup::data_type data;
+    std::vector<std::array<int,5>> counts; // depths that pass min_basequal
+
+    allele_pileup_t(size_t num_libraries, int depth, const std::array<int,5> &weights,
+        int min_basequal, xorshift64 &xrand) : data(num_libraries), counts(num_libraries) {
+        int sum = 0;
+        for(int w : weights) {
+            sum += w;
+        }
+        reads.reserve(depth);
+        for(int i = 0; i < depth; ++i) {
+            int x = xrand.get_uint64(sum), b = 0;
+            for(; x >= weights[b]; ++b) {
+                x -= weights[b];
+            }
+            uint8_t q = xrand.get_uint64(41);
+            reads.emplace_back(0, std::vector<uint32_t>{op(1, BAM_CMATCH)},
+                std::string(1, "ACGTN"[b]), std::vector<uint8_t>{q});
+            bam_record_t &r = reads.back().record;
+            r.pos = 0;
+            r.is_missing = (xrand.get_uint64(20) == 0);
+            size_t u = i % num_libraries;
+            data[u].push_back(r);
+            if(!r.is_missing && q >= min_basequal && b < 4) {
+                counts[u][b] += 1;
+            }
+        }
+    }
+    ~allele_pileup_t() {
+        for(auto && d : data) {
+            d.clear();
+        }
+    }
+};
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_alleles) {
+    const int min_basequal = 13;
+    auto filter_read = [min_basequal](const bam_record_t &r) {
+        return r.is_missing || r.base_qual() < min_basequal || seq::base_index(r.base()) >= 4;
+    };
+    xorshift64 xrand(17);
+    const std::vector<std::array<int,5>> weights = {
+        {10,0,0,0,0}, {1,5,0,0,0}, {0,5,3,3,1}, {2,2,2,2,1}, {0,0,0,0,1}, {1,1,30,1,0}
+    };
+    for(size_t num_libraries : {1, 3, 7}) {
+        BamPileup::Alleles count_alleles(num_libraries);
+        for(auto && w : weights) {
+            for(int depth : {0, 1, 5, 200}) {
+                allele_pileup_t pileup{num_libraries, depth, w, min_basequal, xrand};
+                for(size_t ref_index = 0; ref_index < 5; ++ref_index) {
+                    BOOST_TEST_CONTEXT("libraries=" << num_libraries << ", depth=" << depth
+                        << ", ref_index=" << ref_index) {
+                    auto expected = expected_alleles(pileup.counts, ref_index);
+                    size_t sz = expected.depths[0].size();
+
+                    const auto &test = count_alleles(pileup.data, ref_index, min_basequal);
+                    BOOST_REQUIRE_EQUAL(test.shape()[0], num_libraries);
+                    BOOST_REQUIRE_EQUAL(test.shape()[1], sz);
+                    CHECK_EQUAL_RANGES(count_alleles.indexes, expected.indexes);
+                    for(size_t u = 0; u < num_libraries; ++u) {
+                        CHECK_EQUAL_RANGES(test[u], expected.depths[u]);
+                    }
+                    BOOST_CHECK_EQUAL(count_alleles.alleles_str().size(), sz == 0 ? 0 : 2*sz-1);
+
+                    // a filter gives the same depths
+                    const auto &test2 = count_alleles(pileup.data, ref_index, filter_read);
+                    BOOST_REQUIRE_EQUAL(test2.shape()[1], sz);
+                    for(size_t u = 0; u < num_libraries; ++u) {
+                        CHECK_EQUAL_RANGES(test2[u], expected.depths[u]);
+                    }
+
+                    // and so does a column pileup; the N read is not counted
+                    test_read_t n_read{0, {op(1, BAM_CMATCH)}, "N", {40}};
+                    BamPileup::columns_type columns;
+                    columns.Reset(num_libraries);
+                    columns.Advance(0);
+                    columns.Add(0, n_read.record, 0, min_basequal);
+                    for(size_t u = 0; u < num_libraries; ++u) {
+                        for(auto && r : pileup.data[u]) {
+                            if(!r.is_missing) {
+                                columns.Add(u, r, 0, min_basequal);
+                            }
+                        }
+                    }
+                    const auto &test3 = count_alleles(columns, 0, ref_index);
+                    BOOST_REQUIRE_EQUAL(test3.shape()[1], sz);
+                    CHECK_EQUAL_RANGES(count_alleles.indexes, expected.indexes);
+                    for(size_t u = 0; u < num_libraries; ++u) {
+                        CHECK_EQUAL_RANGES(test3[u], expected.depths[u]);
+                    }
+                    }
+                }
+            }
+        }
+    }
+}
+
+namespace {
+// The counting used before the kernel in Alleles: a type-erased filter, a
+// comparison sort, and a reallocated result.
+struct alleles_baseline_t {
+    pileup::allele_depths_t unsorted, sorted;
+    std::vector<int> indexes;
+
+    alleles_baseline_t(size_t num_libraries) : unsorted{utility::make_array(num_libraries,5u)},
+        sorted{utility::make_array(num_libraries,5u)}, indexes(5) { }
+
+    const pileup::allele_depths_t& operator()(const BamPileup::data_type &data,
+        size_t ref_index, const std::function<bool(const bam_record_t&)> &filter) {
+        std::array<int,5> total{0,0,0,0,0};
+        std::fill_n(unsorted.data(), unsorted.num_elements(), 0);
+        for(std::size_t u = 0; u < data.size(); ++u) {
+            for(auto && r : data[u]) {
+                if(filter(r)) {
+                    continue;
+                }
+                std::size_t base = seq::base_index(r.base());
+                unsorted[u][base] += 1;
+                total[base] += 1;
+            }
+        }
+        return Sort(total, ref_index);
+    }
+
+    const pileup::allele_depths_t& operator()(const BamPileup::columns_type &columns,
+        utility::location_t loc, size_t ref_index) {
+        std::array<int,5> total{0,0,0,0,0};
+        for(std::size_t u = 0; u < columns.num_libraries(); ++u) {
+            const auto &counts = columns(u, loc);
+            for(std::size_t base = 0; base < counts.size(); ++base) {
+                unsorted[u][base] = counts[base];
+                total[base] += counts[base];
+            }
+        }
+        return Sort(total, ref_index);
+    }
+
+    const pileup::allele_depths_t& Sort(const std::array<int,5> &total, size_t ref_index) {
+        std::iota(indexes.begin(), indexes.end(), 0);
+        std::sort(indexes.begin(), indexes.end(), [&](int l, int r) {
+            if(l == ref_index || r == ref_index) {
+                return l == ref_index && r != ref_index;
+            }
+            return total[l] > total[r];
+        });
+        size_t sz = indexes.size();
+        for(; sz > 0 && total[indexes[sz-1]] == 0; --sz) {
+            /*noop*/;
+        }
+        sorted.resize(utility::make_array(sorted.size(), sz));
+        for(size_t i=0;i<sorted.size();++i) {
+            for(size_t u=0;u<sz;++u) {
+                sorted[i][u] = unsorted[i][indexes[u]];
+            }
+        }
+        return sorted;
+    }
+};
+} // anon namespace
+
+// Time per site of counting alleles at high-depth sites
+BOOST_AUTO_TEST_CASE(test_alleles_benchmark) {
+    using namespace std::chrono;
+    const int min_basequal = 13;
+    const size_t num_libraries = 20;
+    const int num_sites = 64;
+    xorshift64 xrand(23);
+
+    // alternate the number of alleles from site to site
+    std::vector<std::unique_ptr<allele_pileup_t>> sites;
+    BamPileup::columns_type columns;
+    columns.Reset(num_libraries);
+    for(int i = 0; i < num_sites; ++i) {
+        std::array<int,5> w = (i % 2 == 0) ? std::array<int,5>{90,0,0,0,1}
+            : std::array<int,5>{50,0,40,0,1};
+        sites.emplace_back(new allele_pileup_t{num_libraries, 1000, w, min_basequal, xrand});
+        for(size_t u = 0; u < num_libraries; ++u) {
+            for(auto && r : sites.back()->data[u]) {
+                test_read_t read{i, {op(1, BAM_CMATCH)}, std::string(1, seq::indexed_char(
+                    seq::base_index(r.base()))), {r.base_qual()}};
+                if(!r.is_missing) {
+                    columns.Add(u, read.record, 0, min_basequal);
+                }
+            }
+        }
+    }
+    auto filter_read = [min_basequal](const bam_record_t &r) {
+        return r.is_missing || r.base_qual() < min_basequal || seq::base_index(r.base()) >= 4;
+    };
+    alleles_baseline_t baseline(num_libraries);
+    BamPileup::Alleles count_alleles(num_libraries);
+
+    auto time_per_site = [&](std::function<int(int)> f) {
+        const int reps = 200;
+        int64_t check = 0;
+        auto start = steady_clock::now();
+        // neighboring positions share their reads, so each site is counted
+        // several times in a row
+        for(int i = 0; i < num_sites; ++i) {
+            for(int k = 0; k < reps; ++k) {
+                check += f(i);
+            }
+        }
+        auto elapsed = duration_cast<duration<double, std::nano>>(steady_clock::now() - start);
+        BOOST_CHECK_GT(check, 0);
+        return elapsed.count() / (reps*num_sites);
+    };
+    double baseline_ns = time_per_site([&](int i) {
+        return baseline(sites[i]->data, 0, filter_read)[0][0];
+    });
+    double kernel_ns = time_per_site([&](int i) {
+        return count_alleles(sites[i]->data, 0, min_basequal)[0][0];
+    });
+    BOOST_TEST_MESSAGE("allele counting from reads at depth 1000: baseline " << baseline_ns
+        << " ns/site, kernel " << kernel_ns << " ns/site");
+    baseline_ns = time_per_site([&](int i) {
+        return baseline(columns, i, 0)[0][0];
+    });
+    kernel_ns = time_per_site([&](int i) {
+        return count_alleles(columns, i, 0)[0][0];
+    });
+    BOOST_TEST_MESSAGE("allele counting from columns with " << num_libraries
+        << " libraries: baseline " << baseline_ns << " ns/site, kernel " << kernel_ns << " ns/site");
+}
+
+namespace {
+struct pileup_arg_t {
+    std::vector<std::string> input;
+    std::string fasta;
+    std::string header;
+    std::string region;
+    std::string rgtag{"LB"};
+    int min_qlen{0};
+    int min_mapqual{0};
+    bool scan_threads{false};
+};
+
+// The reads at each location of a pileup
+struct pileup_read_t {
+    utility::location_t loc;
+    size_t library;
+    utility::location_t beg;
+    utility::location_t pos;
+    bool is_missing;
+    int base;
+    int base_qual;
+    int map_qual;
+
+    bool operator==(const pileup_read_t &other) const {
+        return std::tie(loc, library, beg, pos, is_missing, base, base_qual, map_qual) ==
+            std::tie(other.loc, other.library, other.beg, other.pos, other.is_missing,
+                other.base, other.base_qual, other.map_qual);
+    }
+};
+
+std::vector<pileup_read_t> read_pileup(const pileup_arg_t &arg, size_t queue_size) {
+    auto mpileup = BamPileup::open_and_setup(arg);
+    if(queue_size > 0) {
+        mpileup.EnableScanThreads(queue_size);
+    }
+    std::vector<pileup_read_t> ret;
+    mpileup([&](const BamPileup::data_type &data, utility::location_t loc) {
+        for(size_t u = 0; u < data.size(); ++u) {
+            for(auto && r : data[u]) {
+                ret.push_back({loc, u, r.beg, r.pos, r.is_missing,
+                    r.is_missing ? -1 : r.base(), r.is_missing ? -1 : r.base_qual(),
+                    r.aln.map_qual()});
+            }
+        }
+    });
+    return ret;
+}
+} // anon namespace
+
+// Reading each file on its own thread gives the same pileup as reading the
+// files on the pileup's thread
+BOOST_AUTO_TEST_CASE(test_scan_threads) {
+    const std::string dir = std::string{TESTDATA_DIR} + "/human_trio/";
+    const std::vector<std::vector<std::string>> inputs = {
+        {dir + "trio.bam"},
+        {dir + "trio.bam", dir + "trio.cram"},
+        {dir + "trio.cram", dir + "trio.bam"}
+    };
+    const std::vector<std::string> regions = {
+        "",
+        "5:126,385,924-126,385,924",
+        "5:126,385,700-126,385,704 5:126,385,706-126,385,710",
+        "5:126,385,000-126,386,000"
+    };
+    for(auto && input : inputs) {
+        for(auto && region : regions) {
+            BOOST_TEST_CONTEXT("input=" << input.size() << " files, first " << input[0]
+                << "; region=" << region) {
+                pileup_arg_t arg;
+                arg.input = input;
+                arg.fasta = dir + "trio.fasta.gz";
+                arg.region = region;
+                auto expected = read_pileup(arg, 0);
+                BOOST_CHECK(!expected.empty());
+                // a short queue makes the readers wait for the pileup
+                for(size_t queue_size : {1, 16, 1024}) {
+                BOOST_TEST_CONTEXT("queue_size=" << queue_size) {
+                    auto test = read_pileup(arg, queue_size);
+                    BOOST_CHECK_EQUAL(test.size(), expected.size());
+                    BOOST_CHECK(test == expected);
+                }}
+                arg.scan_threads = true;
+                auto test = read_pileup(arg, 0);
+                BOOST_CHECK_EQUAL(test.size(), expected.size());
+                BOOST_CHECK(test == expected);
+            }
+        }
+    }
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dng::io::fasta
+
+#include <dng/io/fasta.h>
+
+#include "../../testing.h"
+#include "../../xorshift64.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace dng;
+using namespace dng::io;
+
+namespace {
+struct temp_dir_t {
+    boost::filesystem::path path{boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%")};
+    temp_dir_t() {
+        boost::filesystem::create_directory(path);
+    }
+    ~temp_dir_t() {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path, ec);
+    }
+};
+
+// Sequences used for the tests, including soft-masked bases, runs of N,
+// ambiguous bases, and lengths that are not multiples of 4.
+std::vector<std::pair<std::string, std::string>> make_sequences() {
+    std::vector<std::pair<std::string, std::string>> seqs;
+    xorshift64 xrand(1);
+    std::string seq;
+    for(int i = 0; i < 5003; ++i) {
+        seq += "ACGTacgt"[xrand.get_uint64(8)];
+    }
+    seq.replace(0, 10, std::string(10, 'N'));
+    seq.replace(250, 20, std::string(20, 'N'));
+    seq.replace(1000, 600, std::string(600, 'n'));
+    seq[3000] = 'R';
+    seq[3001] = 'Y';
+    seq[5002] = 'N';
+    seqs.emplace_back("chr1", seq);
+    seqs.emplace_back("chr2", "GATTACA");
+    seqs.emplace_back("chrM", "NNNN");
+    return seqs;
+}
+
+std::string write_fasta(const boost::filesystem::path &path) {
+    std::ofstream out(path.string());
+    for(auto && a : make_sequences()) {
+        out << ">" << a.first << "\n";
+        for(std::size_t i = 0; i < a.second.size(); i += 60) {
+            out << a.second.substr(i, 60) << "\n";
+        }
+    }
+    out.close();
+    BOOST_REQUIRE(fai_build(path.c_str()) == 0);
+    return path.string();
+}
+
+char expected_base(char c) {
+    switch(c) {
+    case 'A': case 'a': return 'A';
+    case 'C': case 'c': return 'C';
+    case 'G': case 'g': return 'G';
+    case 'T': case 't': return 'T';
+    default: return 'N';
+    }
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_reference_image) {
+    temp_dir_t temp;
+    std::string fasta = write_fasta(temp.path / "ref.fa");
+    std::string image = (temp.path / "ref.fa.img").string();
+
+    Fasta plain{fasta.c_str()};
+    BOOST_CHECK(!plain.has_image());
+    Fasta packed{fasta.c_str(), image};
+    BOOST_REQUIRE(packed.has_image());
+    BOOST_CHECK(boost::filesystem::exists(image));
+    // the image is a quarter of the size of the sequences
+    BOOST_CHECK_LT(boost::filesystem::file_size(image), 5003/4+1000);
+
+    for(auto && a : make_sequences()) {
+        BOOST_TEST_CONTEXT("contig=" << a.first) {
+        const char *name = a.first.c_str();
+        const std::string &seq = a.second;
+        for(int pos = 0; pos < seq.size(); ++pos) {
+            BOOST_TEST_CONTEXT("pos=" << pos) {
+            BOOST_CHECK_EQUAL(packed.FetchBase(name, pos), expected_base(seq[pos]));
+            BOOST_CHECK_EQUAL(expected_base(plain.FetchBase(name, pos)), expected_base(seq[pos]));
+            }
+        }
+        BOOST_CHECK_EQUAL(packed.FetchBase(name, seq.size()), 'N');
+        BOOST_CHECK_EQUAL(packed.FetchBase(name, -1), 'N');
+
+        int first = std::min<int>(seq.size()-1, 5), last = std::min<int>(seq.size(), 1700);
+        const char *test = packed.FetchSequence(name, first, last);
+        BOOST_REQUIRE(test != nullptr);
+        for(int pos = first; pos < last; ++pos) {
+            BOOST_CHECK_EQUAL(test[pos-first], expected_base(seq[pos]));
+        }
+        }
+    }
+    BOOST_CHECK_EQUAL(packed.FetchBase("chrX", 0), 'N');
+    BOOST_CHECK_EQUAL(packed.FetchBase(nullptr, 0), 'N');
+
+    // an image opened with another key is treated as missing
+    ReferenceImage other;
+    BOOST_CHECK(!other.Open(image, 0));
+    BOOST_CHECK(!other.Open((temp.path / "missing.img").string(), 0));
+}
+
+BOOST_AUTO_TEST_CASE(test_reference_image_rebuild) {
+    temp_dir_t temp;
+    std::string fasta = write_fasta(temp.path / "ref.fa");
+    std::string image = (temp.path / "ref.fa.img").string();
+
+    // a truncated image is rebuilt
+    {
+        Fasta packed{fasta.c_str(), image};
+        BOOST_REQUIRE(packed.has_image());
+    }
+    auto size = boost::filesystem::file_size(image);
+    boost::filesystem::resize_file(image, size/2);
+    {
+        Fasta packed{fasta.c_str(), image};
+        BOOST_REQUIRE(packed.has_image());
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(image), size);
+        BOOST_CHECK_EQUAL(packed.FetchBase("chr2", 2), 'T');
+    }
+
+    // a file that is not an image is replaced
+    {
+        std::ofstream out(image, std::ios::trunc);
+        out << "this is not a reference image\n";
+    }
+    {
+        Fasta packed{fasta.c_str(), image};
+        BOOST_REQUIRE(packed.has_image());
+        BOOST_CHECK_EQUAL(packed.FetchBase("chr2", 0), 'G');
+    }
+}
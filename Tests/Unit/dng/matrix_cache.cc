@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dng::matrix_cache
+
+#include <dng/matrix_cache.h>
+
+#include "../testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace dng;
+
+namespace {
+struct temp_path_t {
+    boost::filesystem::path path{boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%.cache")};
+    ~temp_path_t() {
+        boost::system::error_code ec;
+        boost::filesystem::remove(path, ec);
+    }
+};
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_cache_key) {
+    CacheKey a, b, c;
+    a(1.0)(std::string{"A"});
+    b(1.0)(std::string{"A"});
+    c(1.0)(std::string{"B"});
+
+    BOOST_CHECK_EQUAL(a.value(), b.value());
+    BOOST_CHECK_NE(a.value(), c.value());
+    BOOST_CHECK_NE(a.value(), CacheKey{}.value());
+}
+
+BOOST_AUTO_TEST_CASE(test_matrix_cache) {
+    temp_path_t temp;
+    const std::string path = temp.path.string();
+
+    MatrixCache::entry_t matrices(3);
+    matrices[0] = Eigen::MatrixXd::Random(4, 4);
+    matrices[1] = Eigen::MatrixXd::Random(10, 16);
+    matrices[2] = Eigen::MatrixXd::Random(3, 1);
+
+    {
+        MatrixCache cache{path};
+        BOOST_CHECK(!cache.is_mapped());
+        MatrixCache::entry_t out;
+        BOOST_CHECK(!cache.Get(10, "m", &out));
+        cache.Put(10, "m", matrices);
+        cache.Save();
+        BOOST_CHECK(cache.is_mapped());
+        BOOST_CHECK(boost::filesystem::exists(temp.path));
+    }
+    {
+        MatrixCache cache{path};
+        BOOST_CHECK(cache.is_mapped());
+        MatrixCache::entry_t out;
+        BOOST_CHECK(!cache.Get(11, "m", &out));
+        BOOST_CHECK(!cache.Get(10, "n", &out));
+        BOOST_REQUIRE(cache.Get(10, "m", &out));
+        BOOST_REQUIRE_EQUAL(out.size(), matrices.size());
+        for(size_t i = 0; i < out.size(); ++i) {
+            BOOST_CHECK(out[i] == matrices[i]);
+        }
+
+        // entries with the same key are kept when a new entry is saved
+        cache.Put(10, "n", {matrices[2]});
+        cache.Save();
+        BOOST_CHECK(cache.Get(10, "m", &out));
+        BOOST_REQUIRE(cache.Get(10, "n", &out));
+        BOOST_REQUIRE_EQUAL(out.size(), 1);
+        BOOST_CHECK(out[0] == matrices[2]);
+
+        // entries with a different key replace the file
+        cache.Put(11, "n", {matrices[0]});
+        cache.Save();
+        BOOST_CHECK(!cache.Get(10, "m", &out));
+        BOOST_CHECK(cache.Get(11, "n", &out));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_matrix_cache_invalid) {
+    temp_path_t temp;
+    const std::string path = temp.path.string();
+
+    {
+        MatrixCache cache{path};
+        cache.Put(10, "m", {Eigen::MatrixXd::Random(8, 8)});
+        cache.Save();
+    }
+    // truncate the file
+    auto size = boost::filesystem::file_size(temp.path);
+    boost::filesystem::resize_file(temp.path, size - 8);
+    {
+        MatrixCache cache{path};
+        BOOST_CHECK(!cache.is_mapped());
+        MatrixCache::entry_t out;
+        BOOST_CHECK(!cache.Get(10, "m", &out));
+    }
+    // overwrite the file with text
+    {
+        std::ofstream out(path, std::ios::trunc);
+        out << "this is not a matrix cache file\n";
+    }
+    {
+        MatrixCache cache{path};
+        BOOST_CHECK(!cache.is_mapped());
+    }
+
+    // an empty path disables the cache
+    MatrixCache cache{""};
+    cache.Put(10, "m", {Eigen::MatrixXd::Random(2, 2)});
+    cache.Save();
+    MatrixCache::entry_t out;
+    BOOST_CHECK(!cache.Get(10, "m", &out));
+}
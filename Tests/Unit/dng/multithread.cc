@@ -24,6 +24,7 @@
 #include "../testing.h"
 
 #include <atomic>
+#include <stdexcept>
 #include <iostream>
 
 BOOST_AUTO_TEST_CASE(test_basicpool) {
@@ -43,4 +44,182 @@ BOOST_AUTO_TEST_CASE(test_basicpool) {
 		}
 	}
 	BOOST_CHECK(result == (100*101)/2);
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(test_objectpool) {
+	using namespace std;
+	using namespace dng::multithread;
+
+	ObjectPool<int> objects(4, 0);
+	atomic<int> in_use{0};
+	atomic<bool> shared{false};
+
+	auto f = [&](int x) {
+		auto p = objects.Acquire();
+		if(++in_use > 4) {
+			shared = true;
+		}
+		*p += x;
+		--in_use;
+	};
+
+	{
+		BasicPool<int> pool(f,8);
+		for(int i=0;i<=100;++i) {
+			pool.Enqueue(i);
+		}
+	}
+	BOOST_CHECK(shared == false);
+	int result = 0;
+	for(auto && a : objects.objects()) {
+		result += a;
+	}
+	BOOST_CHECK(result == (100*101)/2);
+}
+
+BOOST_AUTO_TEST_CASE(test_run_in_parallel) {
+	using namespace std;
+	using namespace dng::multithread;
+
+	vector<int> results(8, 0);
+	run_in_parallel(results.size(), [&](size_t i) {
+		results[i] = i*i;
+	});
+	for(size_t i=0;i<results.size();++i) {
+		BOOST_CHECK(results[i] == i*i);
+	}
+
+	BOOST_CHECK_THROW(run_in_parallel(4, [](size_t i) {
+		if(i == 2) {
+			throw std::runtime_error("shard failed");
+		}
+	}), std::runtime_error);
+
+	run_in_parallel(0, [](size_t i) {
+		BOOST_ERROR("function should not be called");
+	});
+}
+
+BOOST_AUTO_TEST_CASE(test_ordered_batch_queue) {
+	using namespace std;
+	using namespace dng::multithread;
+
+	typedef vector<int> batch_t;
+
+	for(size_t threads : {0, 1, 4}) {
+		vector<int> output;
+		OrderedBatchQueue<batch_t> queue(threads, [](batch_t *batch) {
+			for(auto && x : *batch) {
+				x = x*x;
+			}
+		}, [&output](batch_t *batch) {
+			output.insert(output.end(), batch->begin(), batch->end());
+			batch->clear();
+		});
+		for(int i=0;i<100;++i) {
+			batch_t *batch = queue.NewBatch();
+			BOOST_CHECK(batch->empty());
+			for(int j=0;j<i%7;++j) {
+				batch->push_back(i+j);
+			}
+			queue.Submit();
+		}
+		queue.Flush();
+
+		vector<int> expected;
+		for(int i=0;i<100;++i) {
+			for(int j=0;j<i%7;++j) {
+				expected.push_back((i+j)*(i+j));
+			}
+		}
+		BOOST_CHECK(output == expected);
+		BOOST_CHECK(queue.current() == nullptr);
+	}
+
+	// an exception thrown while processing a batch is rethrown in order
+	for(size_t threads : {0, 2}) {
+		vector<int> output;
+		OrderedBatchQueue<batch_t> queue(threads, [](batch_t *batch) {
+			if(batch->front() == 5) {
+				throw std::runtime_error("batch failed");
+			}
+		}, [&output](batch_t *batch) {
+			output.push_back(batch->front());
+			batch->clear();
+		});
+		bool thrown = false;
+		try {
+			for(int i=0;i<10;++i) {
+				queue.NewBatch()->push_back(i);
+				queue.Submit();
+			}
+			queue.Flush();
+		} catch(std::runtime_error &) {
+			thrown = true;
+		}
+		BOOST_CHECK(thrown);
+		BOOST_CHECK(output == (vector<int>{0,1,2,3,4}));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_spsc_queue) {
+	using namespace std;
+	using namespace dng::multithread;
+
+	SpscQueue<int> queue(5);
+	BOOST_CHECK_EQUAL(queue.capacity(), 8);
+	int x = -1;
+	BOOST_CHECK(!queue.TryPop(&x));
+	for(int i=0;i<8;++i) {
+		BOOST_CHECK(queue.TryPush(i));
+	}
+	BOOST_CHECK(!queue.TryPush(8));
+	// a full queue cancels a push
+	BOOST_CHECK(!queue.Push(8, []{ return true; }));
+	for(int i=0;i<8;++i) {
+		BOOST_CHECK(queue.TryPop(&x));
+		BOOST_CHECK_EQUAL(x, i);
+	}
+	BOOST_CHECK(!queue.TryPop(&x));
+
+	// the producer never runs more than capacity items ahead of the consumer
+	const int n = 100000;
+	atomic<int> consumed{0};
+	atomic<bool> too_far{false};
+	thread producer([&]() {
+		for(int i=0;i<n;++i) {
+			queue.Push(i);
+			if(i - consumed.load() > 8) {
+				too_far = true;
+			}
+		}
+	});
+	bool ordered = true;
+	for(int i=0;i<n;++i) {
+		if(queue.Pop() != i) {
+			ordered = false;
+		}
+		consumed = i+1;
+		if(i % 1000 == 0) {
+			// let the producer fill the queue and wait
+			this_thread::sleep_for(chrono::microseconds(200));
+		}
+	}
+	producer.join();
+	BOOST_CHECK(ordered);
+	BOOST_CHECK(!too_far);
+
+	// a waiting producer wakes up when it is cancelled
+	atomic<bool> cancel{false};
+	for(int i=0;i<8;++i) {
+		queue.Push(i);
+	}
+	bool pushed = true;
+	thread blocked([&]() {
+		pushed = queue.Push(8, [&]{ return cancel.load(); });
+	});
+	this_thread::sleep_for(chrono::milliseconds(10));
+	cancel = true;
+	queue.Notify();
+	blocked.join();
+	BOOST_CHECK(!pushed);
+}
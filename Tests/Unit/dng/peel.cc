@@ -1646,3 +1646,220 @@ BOOST_AUTO_TEST_CASE(test_peel_tochild_reverse) {
     test(1,2,2,2);
     test(1,1,2,2);
 }
+
+// Apply a batched operation to every site of a block on its own, and check
+// that the results are identical to the results of the whole block
+void check_block_sites(batch_function_t op, const batch_workspace_t &initial,
+                       const batch_workspace_t &result, const family_members_t &family,
+                       const TransitionMatrixVector &mats) {
+    for(std::size_t j = 0; j < initial.num_sites; ++j) {
+        batch_workspace_t single = initial;
+        single.num_sites = 1;
+        for(size_t n = 0; n < initial.num_nodes; ++n) {
+            single.upper[n] = initial.upper[n].col(j);
+            single.lower[n] = initial.lower[n].col(j);
+        }
+        (*op)(single, family, mats);
+        for(size_t n = 0; n < initial.num_nodes; ++n) {
+            BOOST_TEST_CONTEXT("block site=" << j << ", node=" << n) {
+                BOOST_CHECK((single.upper[n].col(0) == result.upper[n].col(j)).all());
+                BOOST_CHECK((single.lower[n].col(0) == result.lower[n].col(j)).all());
+            }
+        }
+    }
+}
+
+// The batched operations should give the same results as applying the
+// single-site operations to every site.
+BOOST_AUTO_TEST_CASE(test_peel_batch) {
+    const double prec = 16.0*DBL_EPSILON;
+    using boost::generate;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    const int num_sites = 7;
+
+    auto test = [&](Op op, family_members_t family, std::vector<int> ploidies) {
+    BOOST_TEST_CONTEXT("op=" << (int)op << ", family_size=" << family.size()) {
+        const size_t num_nodes = ploidies.size();
+        std::vector<int> sizes(num_nodes);
+        for(size_t n = 0; n < num_nodes; ++n) {
+            sizes[n] = (ploidies[n] == 1) ? 4 : 10;
+        }
+        // Build transition matrices for the children
+        TransitionMatrixVector mats(num_nodes);
+        auto dmod = Model{1e-6, 4};
+        auto mmod = Model{0.7e-6, 4};
+        if(family.size() == 2) {
+            mats[family[1]] = (ploidies[family[1]] == 1) ?
+                gamete_matrix(4, dmod, transition_t{}, ploidies[family[0]]) :
+                mitosis_matrix(4, dmod, transition_t{}, ploidies[family[0]]);
+        } else {
+            for(size_t i = 2; i < family.size(); ++i) {
+                mats[family[i]] = meiosis_matrix(4, dmod, mmod, transition_t{},
+                    ploidies[family[0]], ploidies[family[1]]);
+            }
+        }
+
+        batch_workspace_t batch;
+        batch.Resize(num_nodes);
+        batch.num_sites = num_sites;
+        std::vector<workspace_t> works(num_sites);
+        for(size_t n = 0; n < num_nodes; ++n) {
+            batch.upper[n].resize(sizes[n], num_sites);
+            batch.lower[n].resize(sizes[n], num_sites);
+            generate(make_test_range(batch.upper[n]), [&](){ return xrand.get_double52(); });
+            generate(make_test_range(batch.lower[n]), [&](){ return xrand.get_double52(); });
+        }
+        for(int j = 0; j < num_sites; ++j) {
+            works[j].upper.resize(num_nodes);
+            works[j].lower.resize(num_nodes);
+            for(size_t n = 0; n < num_nodes; ++n) {
+                works[j].upper[n] = batch.upper[n].col(j);
+                works[j].lower[n] = batch.lower[n].col(j);
+            }
+        }
+
+        const batch_workspace_t initial = batch;
+        (*batch_functions[(int)op])(batch, family, mats);
+        for(int j = 0; j < num_sites; ++j) {
+            (*functions[(int)op])(works[j], family, mats);
+        }
+        // the result of a site does not depend on the other sites in the block
+        check_block_sites(batch_functions[(int)op], initial, batch, family, mats);
+
+        for(int j = 0; j < num_sites; ++j) {
+            for(size_t n = 0; n < num_nodes; ++n) {
+                BOOST_TEST_CONTEXT("site=" << j << ", node=" << n) {
+                GenotypeArray test_upper = batch.upper[n].col(j);
+                GenotypeArray test_lower = batch.lower[n].col(j);
+                auto expected_upper = make_test_range(works[j].upper[n]);
+                auto expected_lower = make_test_range(works[j].lower[n]);
+                CHECK_CLOSE_RANGES(make_test_range(test_upper), expected_upper, prec);
+                CHECK_CLOSE_RANGES(make_test_range(test_lower), expected_lower, prec);
+                }
+            }
+        }
+    }};
+
+    for(auto op : {Op::UP, Op::DOWN, Op::UPFAST, Op::DOWNFAST}) {
+        test(op, {0,1}, {2,2});
+        test(op, {0,1}, {2,1});
+        test(op, {0,1}, {1,1});
+    }
+    for(auto op : {Op::TOFATHER, Op::TOMOTHER, Op::TOFATHERFAST, Op::TOMOTHERFAST}) {
+        test(op, {0,1,2}, {2,2,2});
+        test(op, {0,1,2,3}, {2,1,2,2});
+        test(op, {0,1,2,3,4}, {1,2,2,2,2});
+    }
+    test(Op::TOCHILDFAST, {0,1,2}, {2,2,2});
+    test(Op::TOCHILDFAST, {0,1,2}, {1,2,2});
+    test(Op::TOCHILD, {0,1,2,3}, {2,2,2,2});
+    test(Op::TOCHILD, {0,1,2,3,4}, {2,1,2,2,2});
+}
+
+BOOST_AUTO_TEST_CASE(test_peel_meiosis) {
+    const double prec = 1e-13;
+    using boost::generate;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    const int num_sites = 5;
+
+    auto check = [&](const GenotypeArrayVector &test, const GenotypeArrayVector &expected) {
+        BOOST_REQUIRE_EQUAL(test.size(), expected.size());
+        for(size_t n = 0; n < test.size(); ++n) {
+            BOOST_TEST_CONTEXT("node=" << n) {
+                CHECK_CLOSE_RANGES(make_test_range(test[n]), make_test_range(expected[n]), prec);
+            }
+        }
+    };
+
+    // mutype: -2 = transition_t, -1 = mean_t, otherwise the number of mutations
+    auto test = [&](Op op, family_members_t family, std::vector<int> ploidies, int mutype) {
+    BOOST_TEST_CONTEXT("op=" << (int)op << ", family_size=" << family.size() << ", mutype=" << mutype) {
+        const size_t num_nodes = ploidies.size();
+        std::vector<int> sizes(num_nodes);
+        for(size_t n = 0; n < num_nodes; ++n) {
+            sizes[n] = (ploidies[n] == 1) ? 4 : 10;
+        }
+        // Build factored and dense meiosis matrices for the children
+        TransitionMatrixVector mats(num_nodes);
+        mats.meiosis.resize(num_nodes);
+        auto dmod = Model{1e-3, 4};
+        auto mmod = Model{0.7e-3, 4};
+        const int dad_ploidy = ploidies[family[0]];
+        const int mom_ploidy = ploidies[family[1]];
+        for(size_t i = 2; i < family.size(); ++i) {
+            auto &f = mats.meiosis[family[i]];
+            if(mutype == -2) {
+                f = meiosis_factors(4, dmod, mmod, transition_t{}, dad_ploidy, mom_ploidy);
+            } else if(mutype == -1) {
+                f = meiosis_factors(4, dmod, mmod, mean_t{}, dad_ploidy, mom_ploidy);
+            } else {
+                f = meiosis_factors(4, dmod, mmod, mutype, dad_ploidy, mom_ploidy);
+            }
+            mats[family[i]] = meiosis_matrix(f);
+        }
+        TransitionMatrixVector dense_mats(mats.begin(), mats.end());
+
+        batch_workspace_t batch;
+        batch.Resize(num_nodes);
+        batch.num_sites = num_sites;
+        for(size_t n = 0; n < num_nodes; ++n) {
+            batch.upper[n].resize(sizes[n], num_sites);
+            batch.lower[n].resize(sizes[n], num_sites);
+            generate(make_test_range(batch.upper[n]), [&](){ return xrand.get_double52(); });
+            generate(make_test_range(batch.lower[n]), [&](){ return xrand.get_double52(); });
+        }
+        std::vector<workspace_t> works(num_sites);
+        for(int j = 0; j < num_sites; ++j) {
+            works[j].upper.resize(num_nodes);
+            works[j].lower.resize(num_nodes);
+            for(size_t n = 0; n < num_nodes; ++n) {
+                works[j].upper[n] = batch.upper[n].col(j);
+                works[j].lower[n] = batch.lower[n].col(j);
+            }
+        }
+        batch_workspace_t expected_batch = batch;
+        const batch_workspace_t initial = batch;
+
+        (*batch_meiosis_functions[(int)op])(batch, family, mats);
+        (*batch_functions[(int)op])(expected_batch, family, dense_mats);
+        check_block_sites(batch_meiosis_functions[(int)op], initial, batch, family, mats);
+        check_block_sites(batch_functions[(int)op], initial, expected_batch, family, dense_mats);
+
+        for(int j = 0; j < num_sites; ++j) {
+            BOOST_TEST_CONTEXT("site=" << j) {
+            workspace_t expected = works[j];
+            (*meiosis_functions[(int)op])(works[j], family, mats);
+            (*functions[(int)op])(expected, family, dense_mats);
+            check(works[j].upper, expected.upper);
+            check(works[j].lower, expected.lower);
+
+            workspace_t test_batch = expected;
+            for(size_t n = 0; n < num_nodes; ++n) {
+                test_batch.upper[n] = batch.upper[n].col(j);
+                test_batch.lower[n] = batch.lower[n].col(j);
+                expected.upper[n] = expected_batch.upper[n].col(j);
+                expected.lower[n] = expected_batch.lower[n].col(j);
+            }
+            check(test_batch.upper, expected.upper);
+            check(test_batch.lower, expected.lower);
+            }
+        }
+    }};
+
+    for(int mutype : {-2, -1, 0, 1, 2}) {
+        for(auto op : {Op::TOFATHER, Op::TOMOTHER, Op::TOFATHERFAST, Op::TOMOTHERFAST}) {
+            test(op, {0,1,2}, {2,2,2}, mutype);
+            test(op, {0,1,2}, {1,2,2}, mutype);
+            test(op, {0,1,2,3}, {2,1,2,2}, mutype);
+            test(op, {0,1,2,3,4}, {2,2,2,2,2}, mutype);
+        }
+        test(Op::TOCHILDFAST, {0,1,2}, {2,2,2}, mutype);
+        test(Op::TOCHILDFAST, {0,1,2}, {2,1,2}, mutype);
+        test(Op::TOCHILD, {0,1,2,3}, {2,2,2,2}, mutype);
+        test(Op::TOCHILD, {0,1,2,3,4}, {1,2,2,2,2}, mutype);
+    }
+}
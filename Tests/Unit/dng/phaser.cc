@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dng::phaser
+
+#include <dng/phaser.h>
+
+#include "../testing.h"
+#include <dng/hts/hts.h>
+
+#include <string>
+#include <vector>
+
+using namespace dng::phaser;
+using hts::detail::make_data_url;
+
+namespace {
+const char sam_header[] =
+    "@HD\tVN:1.5\tSO:coordinate\n"
+    "@SQ\tSN:ref\tLN:100\n";
+
+// A SAM line for a read of length bases that are all A, except for the
+// bases in changes, which are given by 1-based reference position
+std::string sam_read(const std::string &name, int flag, int pos, int length,
+                     const std::vector<std::pair<int, char>> &changes) {
+    std::string seq(length, 'A');
+    for(auto &&c : changes) {
+        seq[c.first - pos] = c.second;
+    }
+    return name + "\t" + std::to_string(flag) + "\tref\t" + std::to_string(pos) +
+        "\t40\t" + std::to_string(length) + "M\t*\t0\t0\t" + seq + "\t*\n";
+}
+
+// Phase a DNM with the reads of a SAM file, filtering them like dng phaser
+std::vector<site_phase_t> phase(const std::string &reads, const pgt_index_t &index,
+                                long dnm_pos, char variant_base) {
+    std::string url = make_data_url(sam_header + reads);
+    hts::bam::File bam(url.c_str(), "r");
+    BOOST_REQUIRE(bam.is_open());
+    bam.SetFilterFlags(READ_FILTER_FLAGS);
+
+    DnmPhaser phaser{index, "ref", dnm_pos, variant_base, 1000};
+    BOOST_REQUIRE(!phaser.empty());
+    hts::bam::Alignment rec;
+    while(bam.Read(&rec) >= 0) {
+        phaser.Add(rec);
+    }
+    return phaser.Finish();
+}
+
+struct expected_count_t {
+    char dnm_base;
+    char hap_base;
+    std::string parent;
+    int count;
+};
+
+void check_counts(const site_phase_t &site, const std::vector<expected_count_t> &expected) {
+    BOOST_CHECK_EQUAL(site.bad_cigar_op, -1);
+    BOOST_REQUIRE_EQUAL(site.counts.size(), expected.size());
+    for(size_t i = 0; i < expected.size(); ++i) {
+        BOOST_TEST_CONTEXT("i=" << i) {
+            BOOST_CHECK_EQUAL(site.counts[i].dnm_base, expected[i].dnm_base);
+            BOOST_CHECK_EQUAL(site.counts[i].hap_base, expected[i].hap_base);
+            BOOST_CHECK_EQUAL(site.counts[i].parent, expected[i].parent);
+            BOOST_CHECK_EQUAL(site.counts[i].count, expected[i].count);
+        }
+    }
+}
+} // anon namespace
+
+// The DNM is A->T at 30, and the phasing site at 20 is CC in the first
+// parent and GG in the second.
+const pgt_index_t test_index = {
+    {"ref", {{20, 1, "CC", "GG"}}}
+};
+
+BOOST_AUTO_TEST_CASE(test_parent_of_origin) {
+    BOOST_CHECK_EQUAL(std::string{parent_of_origin('T', 'C', "CC", "GG", 'T')}, "p1");
+    BOOST_CHECK_EQUAL(std::string{parent_of_origin('A', 'C', "CC", "GG", 'T')}, "p2");
+    BOOST_CHECK_EQUAL(std::string{parent_of_origin('T', 'G', "CC", "GG", 'T')}, "p2");
+    BOOST_CHECK_EQUAL(std::string{parent_of_origin('T', 'C', "AC", "GG", 'T')}, "p1");
+    BOOST_CHECK_EQUAL(std::string{parent_of_origin('T', 'A', "AC", "AG", 'T')}, "N/A");
+}
+
+// Reads that start at the DNM or at the phasing site use their first base
+BOOST_AUTO_TEST_CASE(test_read_starts) {
+    std::string reads =
+        // starts at the phasing site
+        sam_read("r1", 0, 20, 15, {{20, 'C'}, {30, 'T'}}) +
+        // starts at the DNM and does not reach the phasing site
+        sam_read("r2", 0, 30, 15, {{30, 'T'}});
+    auto result = phase(reads, test_index, 30, 'T');
+    BOOST_REQUIRE_EQUAL(result.size(), 1);
+    check_counts(result[0], {{'T', 'C', "p1", 1}});
+
+    // The DNM is before the phasing site
+    const pgt_index_t index = {{"ref", {{40, 1, "CC", "GG"}}}};
+    reads =
+        // starts at the DNM
+        sam_read("r1", 0, 30, 15, {{30, 'T'}, {40, 'G'}}) +
+        sam_read("r2", 0, 30, 15, {{40, 'C'}}) +
+        // starts at the phasing site and does not reach the DNM
+        sam_read("r3", 0, 40, 15, {{40, 'C'}});
+    result = phase(reads, index, 30, 'T');
+    BOOST_REQUIRE_EQUAL(result.size(), 1);
+    check_counts(result[0], {{'A', 'C', "p2", 1}, {'T', 'G', "p2", 1}});
+}
+
+// Mates phase a DNM and a site that neither of them covers alone
+BOOST_AUTO_TEST_CASE(test_mates) {
+    std::string reads =
+        sam_read("m1", 65, 12, 10, {{20, 'C'}}) +
+        // only one mate of m3 is in the window
+        sam_read("m3", 65, 14, 10, {{20, 'C'}}) +
+        sam_read("m2", 65, 15, 10, {{20, 'G'}}) +
+        sam_read("m1", 129, 25, 10, {{30, 'T'}}) +
+        sam_read("m2", 129, 28, 10, {});
+    auto result = phase(reads, test_index, 30, 'T');
+    BOOST_REQUIRE_EQUAL(result.size(), 1);
+    check_counts(result[0], {{'A', 'G', "p1", 1}, {'T', 'C', "p1", 1}});
+}
+
+// Reads that fail quality control are skipped, and duplicates are counted
+BOOST_AUTO_TEST_CASE(test_filtered_reads) {
+    std::string reads =
+        sam_read("r1", 0, 15, 20, {{20, 'C'}, {30, 'T'}}) +
+        sam_read("r2", 512, 15, 20, {{20, 'G'}, {30, 'T'}}) +
+        sam_read("r3", 1024, 16, 20, {{20, 'C'}, {30, 'T'}}) +
+        sam_read("r4", 4, 17, 20, {{20, 'G'}, {30, 'T'}});
+    auto result = phase(reads, test_index, 30, 'T');
+    BOOST_REQUIRE_EQUAL(result.size(), 1);
+    check_counts(result[0], {{'T', 'C', "p1", 2}});
+}
+
+// Sites overlapped by a read with an unsupported cigar operation are not phased
+BOOST_AUTO_TEST_CASE(test_bad_cigar) {
+    std::string reads =
+        sam_read("r1", 0, 15, 20, {{20, 'C'}, {30, 'T'}}) +
+        "r2\t0\tref\t18\t40\t5M5N5M\t*\t0\t0\tAAAAAAAAAA\t*\n";
+    auto result = phase(reads, test_index, 30, 'T');
+    BOOST_REQUIRE_EQUAL(result.size(), 1);
+    BOOST_CHECK_EQUAL(result[0].bad_cigar_op, BAM_CREF_SKIP);
+    BOOST_CHECK(result[0].counts.empty());
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dng::pool
+
+#include <dng/pool.h>
+
+#include "../testing.h"
+
+#include <condition_variable>
+#include <deque>
+#include <set>
+
+using namespace dng;
+
+namespace {
+struct node_t : public ConcurrentPoolNode {
+    int value{0};
+};
+using pool_t = ConcurrentPool<node_t>;
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_concurrent_pool) {
+    pool_t pool{10, 4};
+    BOOST_CHECK_EQUAL(pool.num_nodes(), 0);
+    {
+        pool_t::Cache cache{pool};
+        node_t *a = cache.Malloc();
+        BOOST_REQUIRE(a != nullptr);
+        BOOST_CHECK_EQUAL(pool.num_nodes(), 4);
+        a->value = 10;
+        cache.Free(a);
+        // freed nodes are reused and keep their values
+        node_t *b = cache.Malloc();
+        BOOST_CHECK_EQUAL(a, b);
+        BOOST_CHECK_EQUAL(b->value, 10);
+
+        // the pool is bounded
+        std::set<node_t*> nodes{b};
+        for(int i = 1; i < 10; ++i) {
+            node_t *p = cache.TryMalloc();
+            BOOST_REQUIRE(p != nullptr);
+            nodes.insert(p);
+        }
+        BOOST_CHECK_EQUAL(nodes.size(), 10);
+        BOOST_CHECK_EQUAL(pool.num_nodes(), 10);
+        BOOST_CHECK(cache.TryMalloc() == nullptr);
+
+        // nodes freed by one cache can be allocated by another
+        pool_t::Cache other{pool};
+        BOOST_CHECK(other.TryMalloc() == nullptr);
+        for(auto p : nodes) {
+            cache.Free(p);
+        }
+        BOOST_CHECK_LT(cache.size(), 8);
+        cache.Flush();
+        BOOST_CHECK_EQUAL(cache.size(), 0);
+        for(int i = 0; i < 10; ++i) {
+            node_t *p = other.TryMalloc();
+            BOOST_REQUIRE(p != nullptr);
+            BOOST_CHECK(nodes.count(p) == 1);
+        }
+        BOOST_CHECK(other.TryMalloc() == nullptr);
+        BOOST_CHECK_EQUAL(pool.num_nodes(), 10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_pool_threads) {
+    // Nodes are allocated by several producers and freed by one consumer
+    const int num_producers = 4;
+    const int num_items = 20000;
+    pool_t pool{1000, 16};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<node_t*> queue;
+
+    std::vector<std::thread> producers;
+    for(int t = 0; t < num_producers; ++t) {
+        producers.emplace_back([&,t]() {
+            pool_t::Cache cache{pool};
+            for(int i = 0; i < num_items; ++i) {
+                node_t *p = cache.Malloc();
+                p->value = t*num_items + i;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(p);
+                }
+                cond.notify_one();
+            }
+        });
+    }
+
+    std::vector<int> seen(num_producers*num_items, 0);
+    {
+        pool_t::Cache cache{pool};
+        for(int n = 0; n < num_producers*num_items; ++n) {
+            node_t *p;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]{ return !queue.empty(); });
+                p = queue.front();
+                queue.pop_front();
+            }
+            seen[p->value] += 1;
+            cache.Free(p);
+        }
+    }
+    for(auto && t : producers) {
+        t.join();
+    }
+    BOOST_CHECK(std::all_of(seen.begin(), seen.end(), [](int x) { return x == 1; }));
+    BOOST_CHECK_LE(pool.num_nodes(), 1000);
+}
@@ -30,7 +30,9 @@
 #include <iostream>
 #include <fstream>
 #include <numeric>
+#include <algorithm>
 
+#include <boost/filesystem.hpp>
 
 #include "../testing.h"
 #include "../xorshift64.h"
@@ -416,3 +418,202 @@ BOOST_AUTO_TEST_CASE(test_calcualte_ldd_trio_xlinked) {
         }
     }
 }
+
+// Peeling sites in blocks should give the same results as peeling them one at a time
+BOOST_AUTO_TEST_CASE(test_calculate_lld_batch) {
+    using ad_t = dng::pileup::allele_depths_t;
+    using dng::utility::make_array;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    const double prec = 1e-12;
+
+    Probability single{g_rel_graph, g_params};
+    Probability batch{g_rel_graph, g_params};
+
+    const size_t num_sites = 500;
+    std::vector<ad_t> sites;
+    for(size_t i = 0; i < num_sites; ++i) {
+        int num_obs_alleles = 1 + xrand.get_uint64(5);
+        ad_t depths(make_array(3, num_obs_alleles));
+        for(auto p = depths.data(); p != depths.data()+depths.num_elements(); ++p) {
+            *p = xrand.get_uint64(20);
+        }
+        sites.push_back(depths);
+    }
+
+    std::vector<double> lld(num_sites), ln_scale(num_sites);
+    batch.CalculateLLD(sites, num_sites, lld.data(), ln_scale.data());
+
+    for(size_t i = 0; i < num_sites; ++i) {
+        BOOST_TEST_CONTEXT("site=" << i << ", num_obs_alleles=" << sites[i].shape()[1]) {
+            double expected = single.CalculateLLD(sites[i], sites[i].shape()[1]);
+            BOOST_CHECK_CLOSE_FRACTION(lld[i], expected, prec);
+            BOOST_CHECK_EQUAL(ln_scale[i], single.work().ln_scale);
+        }
+    }
+}
+
+// The result of a site should not depend on the block that it is peeled in
+BOOST_AUTO_TEST_CASE(test_calculate_lld_batch_blocks) {
+    using ad_t = dng::pileup::allele_depths_t;
+    using dng::utility::make_array;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    Probability model{g_rel_graph, g_params};
+
+    const size_t num_sites = 500;
+    std::vector<ad_t> sites;
+    for(size_t i = 0; i < num_sites; ++i) {
+        int num_obs_alleles = 1 + xrand.get_uint64(5);
+        ad_t depths(make_array(3, num_obs_alleles));
+        for(auto p = depths.data(); p != depths.data()+depths.num_elements(); ++p) {
+            *p = xrand.get_uint64(20);
+        }
+        sites.push_back(depths);
+    }
+
+    std::vector<double> expected(num_sites), ln_scale(num_sites);
+    model.CalculateLLD(sites, num_sites, expected.data(), ln_scale.data());
+
+    // one site at a time
+    for(size_t i = 0; i < num_sites; ++i) {
+        BOOST_TEST_CONTEXT("site=" << i) {
+            double lld, scale;
+            model.CalculateLLD(std::vector<ad_t>{sites[i]}, 1, &lld, &scale);
+            BOOST_CHECK_EQUAL(lld, expected[i]);
+        }
+    }
+
+    // reversed, in batches of different sizes
+    std::vector<ad_t> reversed(sites.rbegin(), sites.rend());
+    for(size_t batch_size : {7, 100, 500}) {
+        std::vector<double> lld(num_sites);
+        for(size_t i = 0; i < num_sites; i += batch_size) {
+            std::vector<ad_t> batch(reversed.begin()+i,
+                reversed.begin()+std::min(i+batch_size, num_sites));
+            model.CalculateLLD(batch, batch.size(), lld.data()+i, ln_scale.data()+i);
+        }
+        for(size_t i = 0; i < num_sites; ++i) {
+            BOOST_TEST_CONTEXT("batch_size=" << batch_size << ", site=" << i) {
+                BOOST_CHECK_EQUAL(lld[num_sites-1-i], expected[i]);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_calculate_lld_fixed) {
+    using ad_t = dng::pileup::allele_depths_t;
+    using dng::utility::make_array;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    const double prec = 1e-12;
+
+    // Two full siblings and an x-linked trio, so that every op is used
+    libraries_t libs = {
+        {"Mom", "Dad", "Eve", "Bob"},
+        {"Mom", "Dad", "Eve", "Bob"}
+    };
+    Pedigree ped;
+    ped.AddMember({"Dad",{},{},{},{},{},Sex::Male,{"Dad"}});
+    ped.AddMember({"Mom",{},{},{},{},{},Sex::Female,{"Mom"}});
+    ped.AddMember({"Eve",{},std::string{"Dad"},{},std::string{"Mom"},{},Sex::Female,{"Eve"}});
+    ped.AddMember({"Bob",{},std::string{"Dad"},{},std::string{"Mom"},{},Sex::Male,{"Bob"}});
+
+    for(auto model : {InheritanceModel::Autosomal, InheritanceModel::XLinked}) {
+        RelationshipGraph graph;
+        graph.Construct(ped, libs, model, 1e-3, 1e-3, 1e-3, true);
+        Probability prob{graph, g_params};
+
+        for(int num_obs_alleles = 2; num_obs_alleles <= 4; ++num_obs_alleles) {
+            auto mats = create_mutation_matrices(graph, num_obs_alleles,
+                g_params.k_alleles, transition_t{});
+            ad_t depths(make_array(4, num_obs_alleles));
+            for(auto p = depths.data(); p != depths.data()+depths.num_elements(); ++p) {
+                *p = xrand.get_uint64(20);
+            }
+            BOOST_TEST_CONTEXT("model=" << (int)model << ", num_obs_alleles=" << num_obs_alleles) {
+                double test = prob.CalculateLLD(depths, num_obs_alleles);
+
+                // CalculateLLD does not modify the workspace
+                peel::workspace_t work = prob.work();
+                double expected = (graph.PeelForwards(work, mats) + work.ln_scale)/M_LN10;
+                BOOST_CHECK_CLOSE_FRACTION(test, expected, prec);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_mono_quality_bound) {
+    using ad_t = dng::pileup::allele_depths_t;
+    using dng::utility::make_array;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    Probability prob{g_rel_graph, g_params};
+
+    // -10*log10(P(Data, mono)) bounds the quality of a site from above
+    for(int num_obs_alleles = 2; num_obs_alleles <= 4; ++num_obs_alleles) {
+        for(int i = 0; i < 20; ++i) {
+            ad_t depths(make_array(3, num_obs_alleles));
+            for(auto p = depths.data(); p != depths.data()+depths.num_elements(); ++p) {
+                *p = xrand.get_uint64(i < 10 ? 3 : 40);
+            }
+            for(auto mode : {genotype::Mode::Likelihood, genotype::Mode::LogLikelihood}) {
+                BOOST_TEST_CONTEXT("num_obs_alleles=" << num_obs_alleles << ", i=" << i
+                    << ", mode=" << (int)mode) {
+                    prob.SetupWorkspace(depths, num_obs_alleles, mode);
+                    double bound = (-10.0/M_LN10)*prob.PeelOnlyReference(mode);
+                    double quality = prob.CalculateMONO(mode).phred_score();
+                    BOOST_CHECK_LE(quality, bound + 1e-9);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_matrix_cache) {
+    using ad_t = dng::pileup::allele_depths_t;
+    using dng::utility::make_array;
+
+    xorshift64 xrand(++g_seed_counter);
+
+    auto path = boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%.cache");
+
+    Probability expected{g_rel_graph, g_params};
+    {
+        MatrixCache cache{path.string()};
+        Probability model{g_rel_graph, g_params, &cache};
+        cache.Save();
+    }
+    MatrixCache cache{path.string()};
+    BOOST_CHECK(cache.is_mapped());
+    Probability model{g_rel_graph, g_params, &cache};
+
+    for(int num_obs_alleles = 1; num_obs_alleles <= 5; ++num_obs_alleles) {
+        ad_t depths(make_array(3, num_obs_alleles));
+        for(auto p = depths.data(); p != depths.data()+depths.num_elements(); ++p) {
+            *p = xrand.get_uint64(20);
+        }
+        BOOST_TEST_CONTEXT("num_obs_alleles=" << num_obs_alleles) {
+            BOOST_CHECK_EQUAL(model.CalculateLLD(depths, num_obs_alleles),
+                expected.CalculateLLD(depths, num_obs_alleles));
+        }
+    }
+
+    // a different set of parameters does not use the cached matrices
+    auto params = g_params;
+    params.theta *= 2;
+    Probability other{g_rel_graph, params, &cache};
+    Probability other_expected{g_rel_graph, params};
+    ad_t depths(make_array(3, 2));
+    std::fill(depths.data(), depths.data()+depths.num_elements(), 5);
+    BOOST_CHECK_EQUAL(other.CalculateLLD(depths, 2), other_expected.CalculateLLD(depths, 2));
+    BOOST_CHECK_NE(other.CalculateLLD(depths, 2), model.CalculateLLD(depths, 2));
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+}
@@ -224,3 +224,37 @@ BOOST_AUTO_TEST_CASE(test_bed_parsing) {
     // Check empty file
     test("", {});
 }
+
+BOOST_AUTO_TEST_CASE(test_shard_ranges) {
+    ContigIndex index;
+    index.AddContig("1", 1000);
+    index.AddContig("2", 500);
+
+    auto test = [&](ranges_t ranges, size_t num_shards, std::vector<ranges_t> expected) -> void {
+    BOOST_TEST_CONTEXT("num_shards=" << num_shards) {
+        using boost::adaptors::transformed;
+
+        auto test = shard_ranges(ranges, num_shards);
+        BOOST_REQUIRE_EQUAL(test.size(), expected.size());
+        for(size_t i = 0; i < test.size(); ++i) {
+            BOOST_TEST_CONTEXT("shard=" << i) {
+            auto test_begs = make_test_range(test[i] | transformed(boost::mem_fn(&range_t::beg)));
+            auto expected_begs = make_test_range(expected[i] | transformed(boost::mem_fn(&range_t::beg)));
+            CHECK_EQUAL_RANGES(test_begs, expected_begs);
+
+            auto test_ends = make_test_range(test[i] | transformed(boost::mem_fn(&range_t::end)));
+            auto expected_ends = make_test_range(expected[i] | transformed(boost::mem_fn(&range_t::end)));
+            CHECK_EQUAL_RANGES(test_ends, expected_ends);
+            }
+        }
+    }};
+
+    auto contigs = contig_ranges(index);
+    test(contigs, 0, {{{0,0,1000},{1,0,500}}});
+    test(contigs, 1, {{{0,0,1000},{1,0,500}}});
+    test(contigs, 2, {{{0,0,750}}, {{0,750,1000},{1,0,500}}});
+    test(contigs, 3, {{{0,0,500}}, {{0,500,1000}}, {{1,0,500}}});
+    test(contigs, 4, {{{0,0,375}}, {{0,375,750}}, {{0,750,1000},{1,0,125}}, {{1,125,500}}});
+    test({{0,10,13}}, 5, {{{0,10,11}}, {{0,11,12}}, {{0,12,13}}});
+    test({}, 4, {});
+}
@@ -22,7 +22,9 @@
 #include <dng/stats.h>
 
 #include "../testing.h"
+#include "../count_allocations.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
@@ -110,6 +112,31 @@ BOOST_AUTO_TEST_CASE(test_exact_sum) {
     BOOST_CHECK(check_sum(exact_sum({1.0, (double)-INFINITY}),-INFINITY));
 }
 
+// Merging partial sums must give the same value no matter how the terms are split
+BOOST_AUTO_TEST_CASE(test_exact_sum_merge) {
+    using dng::stats::ExactSum;
+    std::vector<double> values;
+    for(int i=1;i<10001;++i) {
+        values.push_back(pow(-1.0,i)*log(i)/i + 1e10*(i%7 == 0) - 1e10*(i%7 == 3));
+    }
+    ExactSum expected;
+    for(auto && a : values) {
+        expected(a);
+    }
+    for(int n : {1, 2, 3, 8, 64}) {
+        // split values round-robin into n partial sums
+        std::vector<ExactSum> partials(n);
+        for(size_t i=0;i<values.size();++i) {
+            partials[i % n](values[i]);
+        }
+        ExactSum sum;
+        for(auto it = partials.rbegin(); it != partials.rend(); ++it) {
+            sum(*it);
+        }
+        BOOST_CHECK(check_sum(sum, expected.result()));
+    }
+}
+
 
 // Really the exact test (no approx.), same value as returned by R
 BOOST_AUTO_TEST_CASE(test_fisher_few_reads){
@@ -131,4 +158,26 @@ BOOST_AUTO_TEST_CASE(test_AD){
     BOOST_CHECK_CLOSE(dng::stats::ad_two_sample_test(a,b), -0.52579911592960638, 0.00001);
 }
 
+// The in-place version gives the same answer without allocating memory.
+// This checks only the AD test, not the output of a whole dng call site.
+BOOST_AUTO_TEST_CASE(test_AD_in_place){
+    std::vector<int> a = {40, 31, 35, 40, 40, 32, 33};
+    std::vector<int> b = {21, 31, 33, 34, 34, 40, 42, 20};
+    double expected = dng::stats::ad_two_sample_test(a,b);
+    double test;
+    std::size_t n = count_allocations([&]() {
+        test = dng::stats::ad_two_sample_test(&a, &b);
+    });
+    BOOST_CHECK_EQUAL(test, expected);
+    BOOST_CHECK_EQUAL(n, 0);
+    BOOST_CHECK(std::is_sorted(a.begin(), a.end()));
+    BOOST_CHECK(std::is_sorted(b.begin(), b.end()));
+
+    // degenerate samples
+    std::vector<int> c = {30, 30, 30}, d = {30, 30};
+    expected = dng::stats::ad_two_sample_test(c,d);
+    BOOST_CHECK_EQUAL(dng::stats::ad_two_sample_test(&c, &d), expected);
+    BOOST_CHECK_LT(expected, 0.0);
+}
+
 
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dnm::likeKernel
+
+#include "likeKernel.h"
+
+#include "../testing.h"
+#include "../xorshift64.h"
+
+#include <chrono>
+#include <memory>
+
+#include <Eigen/KroneckerProduct>
+
+int g_seed_counter = 0;
+
+namespace {
+// The dynamically sized matrices and products that trio_like_snp,
+// trio_like_indel, and pair_like used before the fused kernels
+template<int N>
+like_summary_t trio_like_eigen(const Real (&mom)[N], const Real (&dad)[N],
+    const Real (&child)[N], const Eigen::Matrix<Real, N*N, N> &tp,
+    const Eigen::Matrix<Real, N*N, N> *prior, const Eigen::Matrix<Real, N*N, N> &mrate,
+    const Eigen::Matrix<Real, N*N, N> &norm, const Eigen::Matrix<Real, N*N, N> &denovo) {
+    Matrix M(1, N), C(N, 1), D(N, 1), P(N, N), F(N*N, N), L(N*N, N),
+        T(N*N, N), DN(N*N, N), PP(N*N, N);
+    for(int a = 0; a < N; ++a) {
+        M(0, a) = mom[a];
+        D(a, 0) = dad[a];
+        C(a, 0) = child[a];
+    }
+    P = kroneckerProduct(M, D);
+    F = kroneckerProduct(P, C);
+    T = F.cwiseProduct(tp);
+    L = (prior != nullptr) ? Matrix{T.cwiseProduct(*prior)} : T;
+    DN = L.cwiseProduct(mrate);
+
+    like_summary_t result;
+    PP = DN.cwiseProduct(norm);
+    result.maxlike_null = PP.maxCoeff(&result.null_row, &result.null_col);
+    PP = DN.cwiseProduct(denovo);
+    result.maxlike_denovo = PP.maxCoeff(&result.denovo_row, &result.denovo_col);
+    result.denom = DN.sum();
+    return result;
+}
+
+like_summary_t pair_like_eigen(const Real (&normal)[10], const Real (&tumor)[10],
+    const lookup_pair_t &lookup) {
+    Matrix N(1, 10), T(10, 1), P(10, 10), DN(10, 10), PP(10, 10);
+    for(int a = 0; a < 10; ++a) {
+        N(0, a) = normal[a];
+        T(a, 0) = tumor[a];
+    }
+    P = kroneckerProduct(N, T);
+    DN = P.cwiseProduct(lookup.priors);
+
+    like_summary_t result;
+    PP = DN.cwiseProduct(lookup.norm);
+    result.maxlike_null = PP.maxCoeff(&result.null_row, &result.null_col);
+    PP = DN.cwiseProduct(lookup.denovo);
+    result.maxlike_denovo = PP.maxCoeff(&result.denovo_row, &result.denovo_col);
+    result.denom = DN.sum();
+    return result;
+}
+
+// Fill a table with random values. Some tables have ties.
+template<typename M>
+void random_table(xorshift64 &xrand, M *m, int levels = 0) {
+    for(int j = 0; j < m->cols(); ++j) {
+        for(int i = 0; i < m->rows(); ++i) {
+            (*m)(i, j) = (levels == 0) ? xrand.get_double52() :
+                1.0 / (1 + xrand.get_uint64(levels));
+        }
+    }
+}
+
+// The norm and denovo tables select complementary configurations
+template<typename M>
+void random_mask(xorshift64 &xrand, M *norm, M *denovo) {
+    for(int j = 0; j < norm->cols(); ++j) {
+        for(int i = 0; i < norm->rows(); ++i) {
+            bool b = (xrand.get_uint64(4) != 0);
+            (*norm)(i, j) = b;
+            (*denovo)(i, j) = !b;
+        }
+    }
+}
+
+template<int N>
+void random_phred(xorshift64 &xrand, Real (&like)[N]) {
+    int lk[N];
+    for(int a = 0; a < N; ++a) {
+        // many phred-scaled likelihoods are 0 or capped
+        int u = xrand.get_uint64(4);
+        lk[a] = (u == 0) ? 0 : (u == 1) ? 255 : xrand.get_uint64(256);
+    }
+    phred_to_like(lk, like);
+}
+
+void check_summary(const like_summary_t &test, const like_summary_t &expected) {
+    BOOST_CHECK_EQUAL(test.maxlike_null, expected.maxlike_null);
+    BOOST_CHECK_EQUAL(test.null_row, expected.null_row);
+    BOOST_CHECK_EQUAL(test.null_col, expected.null_col);
+    BOOST_CHECK_EQUAL(test.maxlike_denovo, expected.maxlike_denovo);
+    BOOST_CHECK_EQUAL(test.denovo_row, expected.denovo_row);
+    BOOST_CHECK_EQUAL(test.denovo_col, expected.denovo_col);
+    // the kernels add the cells in a different order than Eigen
+    BOOST_CHECK_CLOSE_FRACTION(test.denom, expected.denom, 1e-12);
+}
+
+// Microbenchmark of the fused kernels and the Eigen products they replace
+template<typename E, typename K>
+void benchmark(const char *name, int reps, E eigen, K kernel) {
+    using std::chrono::steady_clock;
+    double total_a = 0.0, total_b = 0.0;
+    auto start = steady_clock::now();
+    for(int r = 0; r < reps; ++r) {
+        total_a += eigen(r).maxlike_denovo;
+    }
+    auto middle = steady_clock::now();
+    for(int r = 0; r < reps; ++r) {
+        total_b += kernel(r).maxlike_denovo;
+    }
+    auto stop = steady_clock::now();
+    BOOST_CHECK_EQUAL(total_a, total_b);
+    std::chrono::duration<double, std::nano> a = middle - start, b = stop - middle;
+    BOOST_TEST_MESSAGE(name << ": Eigen " << a.count()/reps << " ns/call, kernel "
+        << b.count()/reps << " ns/call");
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_trio_like_kernel_snp) {
+    xorshift64 xrand(++g_seed_counter);
+    // lookup_snp_t is too large for the stack
+    std::unique_ptr<lookup_snp_t> lookup{new lookup_snp_t};
+
+    for(int levels : {0, 3}) {
+        random_table(xrand, &lookup->tp, levels);
+        random_table(xrand, &lookup->aref, levels);
+        random_table(xrand, &lookup->mrate, levels);
+        random_mask(xrand, &lookup->norm, &lookup->denovo);
+        for(int rep = 0; rep < 1000; ++rep) {
+            BOOST_TEST_CONTEXT("levels=" << levels << ", rep=" << rep) {
+            Real M[10], D[10], C[10];
+            random_phred(xrand, M);
+            random_phred(xrand, D);
+            random_phred(xrand, C);
+            const SNPMatrix *prior = (rep % 5 == 0) ? nullptr : &lookup->aref;
+            auto expected = trio_like_eigen(M, D, C, lookup->tp, prior,
+                lookup->mrate, lookup->norm, lookup->denovo);
+            auto test = trio_like_kernel(M, D, C, lookup->tp, prior,
+                lookup->mrate, lookup->norm, lookup->denovo);
+            check_summary(test, expected);
+            }
+        }
+    }
+
+    // every configuration ties
+    Real M[10], D[10], C[10];
+    std::fill_n(M, 10, 1.0);
+    std::fill_n(D, 10, 1.0);
+    std::fill_n(C, 10, 1.0);
+    lookup->tp.setOnes();
+    lookup->mrate.setOnes();
+    const SNPMatrix *no_prior = nullptr;
+    auto test = trio_like_kernel(M, D, C, lookup->tp, no_prior,
+        lookup->mrate, lookup->norm, lookup->denovo);
+    check_summary(test, trio_like_eigen(M, D, C, lookup->tp, no_prior,
+        lookup->mrate, lookup->norm, lookup->denovo));
+    BOOST_CHECK_EQUAL(test.denom, 1000.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_trio_like_kernel_indel) {
+    xorshift64 xrand(++g_seed_counter);
+    lookup_indel_t lookup;
+    IndelMatrix mrate;
+
+    for(int levels : {0, 3}) {
+        random_table(xrand, &lookup.tp, levels);
+        random_table(xrand, &lookup.priors, levels);
+        random_table(xrand, &mrate, levels);
+        random_mask(xrand, &lookup.norm, &lookup.denovo);
+        for(int rep = 0; rep < 1000; ++rep) {
+            BOOST_TEST_CONTEXT("levels=" << levels << ", rep=" << rep) {
+            Real M[3], D[3], C[3];
+            random_phred(xrand, M);
+            random_phred(xrand, D);
+            random_phred(xrand, C);
+            auto expected = trio_like_eigen(M, D, C, lookup.tp, &lookup.priors,
+                mrate, lookup.norm, lookup.denovo);
+            auto test = trio_like_kernel(M, D, C, lookup.tp, &lookup.priors,
+                mrate, lookup.norm, lookup.denovo);
+            check_summary(test, expected);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_pair_like_kernel) {
+    xorshift64 xrand(++g_seed_counter);
+    lookup_pair_t lookup;
+
+    for(int levels : {0, 3}) {
+        random_table(xrand, &lookup.priors, levels);
+        random_mask(xrand, &lookup.norm, &lookup.denovo);
+        for(int rep = 0; rep < 1000; ++rep) {
+            BOOST_TEST_CONTEXT("levels=" << levels << ", rep=" << rep) {
+            Real N[10], T[10];
+            random_phred(xrand, N);
+            random_phred(xrand, T);
+            check_summary(pair_like_kernel(N, T, lookup), pair_like_eigen(N, T, lookup));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_like_kernel_speed) {
+    xorshift64 xrand(++g_seed_counter);
+    std::unique_ptr<lookup_snp_t> snp{new lookup_snp_t};
+    random_table(xrand, &snp->tp);
+    random_table(xrand, &snp->aref);
+    random_table(xrand, &snp->mrate);
+    random_mask(xrand, &snp->norm, &snp->denovo);
+    lookup_indel_t indel;
+    random_table(xrand, &indel.tp);
+    random_table(xrand, &indel.priors);
+    random_table(xrand, &indel.mrate);
+    random_mask(xrand, &indel.norm, &indel.denovo);
+    lookup_pair_t pair;
+    random_table(xrand, &pair.priors);
+    random_mask(xrand, &pair.norm, &pair.denovo);
+
+    // vary the likelihoods so that the calls can not be hoisted
+    Real L[10][10];
+    for(auto && a : L) {
+        random_phred(xrand, a);
+    }
+    benchmark("snp", 20000, [&](int r) {
+        return trio_like_eigen(L[r%10], L[(r/10)%10], L[(r/100)%10], snp->tp, &snp->aref,
+            snp->mrate, snp->norm, snp->denovo);
+    }, [&](int r) {
+        return trio_like_kernel(L[r%10], L[(r/10)%10], L[(r/100)%10], snp->tp, &snp->aref,
+            snp->mrate, snp->norm, snp->denovo);
+    });
+
+    Real I[10][3];
+    for(auto && a : I) {
+        random_phred(xrand, a);
+    }
+    benchmark("indel", 200000, [&](int r) {
+        return trio_like_eigen(I[r%10], I[(r/10)%10], I[(r/100)%10], indel.tp, &indel.priors,
+            indel.mrate, indel.norm, indel.denovo);
+    }, [&](int r) {
+        return trio_like_kernel(I[r%10], I[(r/10)%10], I[(r/100)%10], indel.tp, &indel.priors,
+            indel.mrate, indel.norm, indel.denovo);
+    });
+
+    benchmark("pair", 200000, [&](int r) {
+        return pair_like_eigen(L[r%10], L[(r/10)%10], pair);
+    }, [&](int r) {
+        return pair_like_kernel(L[r%10], L[(r/10)%10], pair);
+    });
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE dnm::lookupCache
+
+#include "lookupCache.h"
+
+#include "../testing.h"
+
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+using dng::MatrixCache;
+
+namespace {
+struct temp_dir_t {
+    boost::filesystem::path path{boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%")};
+    temp_dir_t() {
+        boost::filesystem::create_directory(path);
+    }
+    ~temp_dir_t() {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path, ec);
+    }
+};
+
+void check_tables(const lookup_table_t &a, const lookup_table_t &b) {
+    BOOST_REQUIRE_EQUAL(a.rows(), b.rows());
+    BOOST_REQUIRE_EQUAL(a.cols(), b.cols());
+    BOOST_CHECK_EQUAL(a.members(), b.members());
+    CHECK_EQUAL_RANGES(a.codes(), b.codes());
+}
+
+void check_lookups(const lookup_snp_t &a, const lookup_snp_t &b) {
+    BOOST_CHECK(a.aref == b.aref);
+    BOOST_CHECK(a.cref == b.cref);
+    BOOST_CHECK(a.gref == b.gref);
+    BOOST_CHECK(a.tref == b.tref);
+    BOOST_CHECK(a.snpcode == b.snpcode);
+    BOOST_CHECK(a.tp == b.tp);
+    BOOST_CHECK(a.code == b.code);
+    BOOST_CHECK(a.mrate == b.mrate);
+    BOOST_CHECK(a.denovo == b.denovo);
+    BOOST_CHECK(a.norm == b.norm);
+}
+
+void check_lookups(const lookup_indel_t &a, const lookup_indel_t &b) {
+    BOOST_CHECK(a.priors == b.priors);
+    BOOST_CHECK(a.snpcode == b.snpcode);
+    BOOST_CHECK(a.tp == b.tp);
+    BOOST_CHECK(a.code == b.code);
+    BOOST_CHECK(a.denovo == b.denovo);
+    BOOST_CHECK(a.norm == b.norm);
+    BOOST_CHECK(a.hit == b.hit);
+}
+
+void check_lookups(const lookup_pair_t &a, const lookup_pair_t &b) {
+    BOOST_CHECK(a.snpcode == b.snpcode);
+    BOOST_CHECK(a.priors == b.priors);
+    BOOST_CHECK(a.denovo == b.denovo);
+    BOOST_CHECK(a.norm == b.norm);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(test_lookup_table) {
+    lookup_table_t trio(2, 2, 3);
+    trio.set(0, 0, "AA/AA/AA");
+    trio.set(0, 1, "AC/GT/TT");
+    trio.set(1, 1, "RD/RR/DD");
+    BOOST_CHECK_EQUAL(trio(0, 0), "AA/AA/AA");
+    BOOST_CHECK_EQUAL(trio(0, 1), "AC/GT/TT");
+    BOOST_CHECK_EQUAL(trio(1, 1), "RD/RR/DD");
+    BOOST_CHECK_EQUAL(trio.genotype(0, 1, 0), "AC");
+    BOOST_CHECK_EQUAL(trio.genotype(0, 1, 1), "GT");
+    BOOST_CHECK_EQUAL(trio.genotype(0, 1, 2), "TT");
+    BOOST_CHECK_EQUAL(trio.genotype(1, 1, 0), "RD");
+
+    lookup_table_t pair(1, 1, 2);
+    pair.set(0, 0, "CG/TA");
+    BOOST_CHECK_EQUAL(pair(0, 0), "CG/TA");
+    BOOST_CHECK_EQUAL(pair.genotype(0, 0, 1), "TA");
+}
+
+BOOST_AUTO_TEST_CASE(test_make_lookup) {
+    // tables can be built more than once in a process
+    for(auto make : {makeSNPLookup, makeXSSNPLookup, makeXDSNPLookup}) {
+        lookup_table_t tgt_a, tgt_b;
+        std::unique_ptr<lookup_snp_t> a{new lookup_snp_t}, b{new lookup_snp_t};
+        make(1e-8, 1e-3, tgt_a, *a);
+        make(1e-8, 1e-3, tgt_b, *b);
+        check_tables(tgt_a, tgt_b);
+        check_lookups(*a, *b);
+        BOOST_CHECK_EQUAL(tgt_a(0, 0), "AA/AA/AA");
+        BOOST_CHECK_EQUAL(tgt_a(99, 9), "TT/TT/TT");
+    }
+    for(auto make : {makeIndelLookup, makeXSIndelLookup, makeXDIndelLookup}) {
+        lookup_table_t tgt_a, tgt_b;
+        lookup_indel_t a, b;
+        make(1e-3, tgt_a, a);
+        make(1e-3, tgt_b, b);
+        check_tables(tgt_a, tgt_b);
+        check_lookups(a, b);
+        BOOST_CHECK_EQUAL(tgt_a(0, 0), "RR/RR/RR");
+        BOOST_CHECK_EQUAL(tgt_a(8, 2), "DD/DD/DD");
+    }
+    lookup_table_t tgt;
+    lookup_pair_t pair;
+    makePairedLookup(1e-9, tgt, pair);
+    BOOST_CHECK_EQUAL(tgt(0, 0), "AA/AA");
+    BOOST_CHECK_EQUAL(tgt(1, 0), "AA/AC");
+    BOOST_CHECK_EQUAL(tgt(9, 9), "TT/TT");
+}
+
+BOOST_AUTO_TEST_CASE(test_lookup_cache) {
+    temp_dir_t temp;
+    std::string path = (temp.path / "lookup.cache").string();
+
+    parameters params;
+    const uint64_t key = lookup_cache_key(params);
+
+    lookup_table_t tgt_snp, tgt_indel, tgt_pair;
+    std::unique_ptr<lookup_snp_t> snp{new lookup_snp_t};
+    lookup_indel_t indel;
+    lookup_pair_t pair;
+    makeXSSNPLookup(params.snp_mrate, params.poly_rate, tgt_snp, *snp);
+    makeXSIndelLookup(params.poly_rate, tgt_indel, indel);
+    makePairedLookup(params.pair_mrate, tgt_pair, pair);
+
+    {
+        MatrixCache cache{path};
+        BOOST_CHECK(!get_lookup(cache, key, "XS", &tgt_snp, snp.get()));
+        put_lookup(&cache, key, "XS", tgt_snp, *snp);
+        put_lookup(&cache, key, "XS", tgt_indel, indel);
+        put_lookup(&cache, key, tgt_pair, pair);
+        cache.Save();
+    }
+
+    MatrixCache cache{path};
+    BOOST_REQUIRE(cache.is_mapped());
+
+    lookup_table_t test_tgt;
+    std::unique_ptr<lookup_snp_t> test_snp{new lookup_snp_t};
+    BOOST_REQUIRE(get_lookup(cache, key, "XS", &test_tgt, test_snp.get()));
+    check_tables(test_tgt, tgt_snp);
+    check_lookups(*test_snp, *snp);
+    BOOST_CHECK(!get_lookup(cache, key, "auto", &test_tgt, test_snp.get()));
+
+    lookup_indel_t test_indel;
+    BOOST_REQUIRE(get_lookup(cache, key, "XS", &test_tgt, &test_indel));
+    check_tables(test_tgt, tgt_indel);
+    check_lookups(test_indel, indel);
+
+    lookup_pair_t test_pair;
+    BOOST_REQUIRE(get_lookup(cache, key, &test_tgt, &test_pair));
+    check_tables(test_tgt, tgt_pair);
+    check_lookups(test_pair, pair);
+
+    // tables built with other rates are not returned
+    params.snp_mrate = 1e-7;
+    BOOST_CHECK_NE(lookup_cache_key(params), key);
+    BOOST_CHECK(!get_lookup(cache, lookup_cache_key(params), "XS", &test_tgt, test_snp.get()));
+}
@@ -25,6 +25,7 @@
 #include <dng/hts/hts.h>
 
 #include "../testing.h"
+#include "../count_allocations.h"
 
 using namespace hts;
 using namespace hts::bcf;
@@ -452,3 +453,39 @@ BOOST_AUTO_TEST_CASE(test_variant_trim) {
     test(base_n3, 0.5, false, {"G","A"}, {a,a,a, a,a,a, a,a,a, a,a,a},
         {1,0,0,0,0,1,0,0,1,0,0,0,1,0,0,0} );
 }
+
+// Reusing buffers lets TrimAlleles run without allocating memory
+BOOST_AUTO_TEST_CASE(test_variant_trim_buffers) {
+    std::string s = vcftrim;
+    s += "1\t1\t.\tG\tA,AA\t.\t.\t.\tGT:GP\t"
+        "0/0:0.85,0.01,0.02,0.03,0.04,0.05\t"
+        "0/0:0,1,0,0,0,0\t"
+        "0/0:1,.,0\t"
+        "0/0:.\n";
+    s = make_data_url(s);
+
+    trim_buffers_t buffers;
+    for(int i = 0; i < 3; ++i) {
+    BOOST_TEST_CONTEXT("i=" << i) {
+        auto file = bcf::File(s.c_str(), "r");
+        BOOST_REQUIRE(file.is_open());
+        auto record = file.InitVariant();
+        file.ReadRecord(&record);
+        record.Unpack();
+
+        bool result = false;
+        std::size_t n = count_allocations([&]() {
+            result = record.TrimAlleles(0.5, &buffers);
+        });
+        BOOST_CHECK(result);
+        if(i > 0) {
+            BOOST_CHECK_EQUAL(n, 0);
+        }
+        std::vector<std::string> test_alleles;
+        for(int j=0;j<record.num_alleles();++j) {
+            test_alleles.emplace_back(record.allele(j));
+        }
+        std::vector<std::string> expected_alleles = {"G", "A"};
+        CHECK_EQUAL_RANGES(test_alleles, expected_alleles);
+    }}
+}
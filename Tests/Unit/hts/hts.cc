@@ -25,6 +25,11 @@
 
 #include <fstream>
 
+#include <htslib/bgzf.h>
+#include <htslib/kstring.h>
+
+#include <boost/filesystem.hpp>
+
 using namespace hts;
 using hts::version_parse;
 
@@ -46,3 +51,42 @@ BOOST_AUTO_TEST_CASE(test_hts_version) {
     test("1 . 4",0);
     test(" ",0);
 }
+
+BOOST_AUTO_TEST_CASE(test_thread_pool) {
+    auto path = boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("dng-test-%%%%-%%%%-%%%%.txt.gz");
+    std::vector<std::string> lines;
+    for(int i = 0; i < 10000; ++i) {
+        lines.push_back("line " + std::to_string(i) + "\n");
+    }
+
+    for(int num_threads : {0, 1, 4}) {
+        BOOST_TEST_CONTEXT("num_threads=" << num_threads) {
+            ThreadPool pool{num_threads};
+            BOOST_CHECK_EQUAL(pool.num_threads(), num_threads);
+            {
+                File out{path.c_str(), "wz"};
+                BOOST_REQUIRE(out.is_open());
+                BOOST_CHECK_EQUAL(out.SetThreadPool(&pool), 0);
+                for(auto && line : lines) {
+                    BOOST_REQUIRE_EQUAL(bgzf_write(out.handle()->fp.bgzf, line.data(),
+                        line.size()), static_cast<ssize_t>(line.size()));
+                }
+            }
+            File in{path.c_str(), "r"};
+            BOOST_REQUIRE(in.is_open());
+            BOOST_CHECK(in.is_compressed());
+            BOOST_CHECK_EQUAL(in.SetThreadPool(&pool), 0);
+            kstring_t str = {0, 0, nullptr};
+            size_t n = 0;
+            while(hts_getline(in.handle(), KS_SEP_LINE, &str) >= 0) {
+                BOOST_REQUIRE_LT(n, lines.size());
+                BOOST_CHECK_EQUAL(std::string(str.s) + "\n", lines[n]);
+                ++n;
+            }
+            free(str.s);
+            BOOST_CHECK_EQUAL(n, lines.size());
+        }
+    }
+    boost::filesystem::remove(path);
+}
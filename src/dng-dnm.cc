@@ -1,5 +1,7 @@
 #include "denovogear.h"
 #include "pedParser.h"
+#include "bcfCohort.h"
+#include "lookupCache.h"
 
 #include <iostream>
 #include <string>
@@ -7,6 +9,7 @@
 #include <memory>
 
 #include <dng/app.h>
+#include <dng/multithread.h>
 #include <dng/task/dnm.h>
 #include "htslib/synced_bcf_reader.h"
 #include "htslib/vcf.h"
@@ -27,76 +30,72 @@ double mu_scale = 1.0; // scaling factor for indel priors
 */
 
 
-int callMakeSNPLookup(lookup_table_t &tgtSNP, lookup_snp_t &lookupSNP, std::string model, parameters &params) {
-    std::vector<string> tmp;
-    for(int l = 0; l < 10; l++) {
-        tmp.push_back("NA");
-    }
-    for(int l = 0; l < 100; l++) {
-        tgtSNP.push_back(tmp);
-    }
-
-
-    if(model == "auto") { makeSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
-    else if(model == "XS") { makeXSSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
-    else if(model == "XD") { makeXDSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
-    else {
-        cerr << endl << "Invalid model for SNP lookup, exiting.";
-        exit(1);
+int callMakeSNPLookup(lookup_table_t &tgtSNP, lookup_snp_t &lookupSNP, std::string model, parameters &params,
+                      dng::MatrixCache &cache) {
+    const uint64_t key = lookup_cache_key(params);
+    if(get_lookup(cache, key, model, &tgtSNP, &lookupSNP)) {
+        cerr << "\nLoaded SNP lookup table from " << cache.path() << "\n";
+    } else {
+        if(model == "auto") { makeSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
+        else if(model == "XS") { makeXSSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
+        else if(model == "XD") { makeXDSNPLookup(params.snp_mrate, params.poly_rate, tgtSNP, lookupSNP); }
+        else {
+            cerr << endl << "Invalid model for SNP lookup, exiting.";
+            exit(1);
+        }
+        put_lookup(&cache, key, model, tgtSNP, lookupSNP);
+        cerr << "\nCreated SNP lookup table\n";
     }
 
-    cerr << "\nCreated SNP lookup table\n";
     cerr << " First mrate: " << lookupSNP.mrate(0,
             0) << " last: " << lookupSNP.mrate(99, 9) << endl;
     cerr << " First code: " << lookupSNP.code(0,
             0) << " last: " << lookupSNP.code(99, 9) << endl;
-    cerr << " First target string: " << tgtSNP[0][0] << " last: " << tgtSNP[99][9]
+    cerr << " First target string: " << tgtSNP(0, 0) << " last: " << tgtSNP(99, 9)
          << endl;
     cerr << " First tref: " << lookupSNP.tref(0,
             0) << " last: " << lookupSNP.tref(99, 9) << endl;
     return 0;
 }
 
-int callMakeINDELLookup(lookup_table_t &tgtIndel, lookup_indel_t &lookupIndel, std::string model, parameters &params) {
-    std::vector<std::string> tmp;
-    for(int l = 0; l < 3; l++) {
-        tmp.push_back("NA");
-    }
-    for(int l = 0; l < 9; l++) {
-        tgtIndel.push_back(tmp);
-    }
-
-
-    if(model == "auto") { makeIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
-    else if(model == "XS") { makeXSIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
-    else if(model == "XD") { makeXDIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
-    else {
-        std::cerr << std::endl << "Invalid model for INDEL lookup, exiting.";
-        exit(1);
+int callMakeINDELLookup(lookup_table_t &tgtIndel, lookup_indel_t &lookupIndel, std::string model, parameters &params,
+                        dng::MatrixCache &cache) {
+    const uint64_t key = lookup_cache_key(params);
+    if(get_lookup(cache, key, model, &tgtIndel, &lookupIndel)) {
+        std::cerr << "\nLoaded indel lookup table from " << cache.path();
+    } else {
+        if(model == "auto") { makeIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
+        else if(model == "XS") { makeXSIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
+        else if(model == "XD") { makeXDIndelLookup(params.poly_rate, tgtIndel, lookupIndel); }
+        else {
+            std::cerr << std::endl << "Invalid model for INDEL lookup, exiting.";
+            exit(1);
+        }
+        put_lookup(&cache, key, model, tgtIndel, lookupIndel);
+        std::cerr << "\nCreated indel lookup table";
     }
 
-    std::cerr << "\nCreated indel lookup table";
     std::cerr << " First code: " << lookupIndel.code(0,
               0) << " last: " << lookupIndel.code(8, 2) << std::endl;
-    std::cerr << " First target string: " << tgtIndel[0][0] << " last: " <<
-              tgtIndel[8][2] << std::endl;
+    std::cerr << " First target string: " << tgtIndel(0, 0) << " last: " <<
+              tgtIndel(8, 2) << std::endl;
     std::cerr << " First prior: " << lookupIndel.priors(0,
               0) << " last: " << lookupIndel.priors(8, 2) << std::endl;
     return 0;
 }
 
-int callMakePairedLookup(lookup_table_t &tgtPair, lookup_pair_t &lookupPair, parameters &params) {
-    std::vector<std::string> tmp;
-    for(int l = 0; l < 10; l++) {
-        tmp.push_back("NA");
+int callMakePairedLookup(lookup_table_t &tgtPair, lookup_pair_t &lookupPair, parameters &params,
+                         dng::MatrixCache &cache) {
+    const uint64_t key = lookup_cache_key(params);
+    if(get_lookup(cache, key, &tgtPair, &lookupPair)) {
+        std::cerr << "\nLoaded paired lookup table from " << cache.path() << std::endl;
+    } else {
+        makePairedLookup(params.pair_mrate, tgtPair, lookupPair);
+        put_lookup(&cache, key, tgtPair, lookupPair);
+        std::cerr << "\nCreated paired lookup table" << std::endl;
     }
-    for(int l = 0; l < 10; l++) {
-        tgtPair.push_back(tmp);
-    }
-    makePairedLookup(params.pair_mrate, tgtPair, lookupPair);
-    std::cerr << "\nCreated paired lookup table" << std::endl;
-    std::cerr << " First target string: " << tgtPair[0][0] << " last: " <<
-              tgtPair[9][9] << std::endl;
+    std::cerr << " First target string: " << tgtPair(0, 0) << " last: " <<
+              tgtPair(9, 9) << std::endl;
     std::cerr << " First prior " << lookupPair.priors(0,
               0) << " last: " << lookupPair.priors(9, 9) << std::endl;
     return 0;
@@ -184,6 +183,177 @@ void writeVCFHeaderSamples(hts::bcf::File &vcfout, std::vector<Trio> &trios, std
 }
 
 
+namespace {
+// The number of sites that were interrogated and that passed the read-depth
+// filters
+struct site_counts_t {
+    int snp_total{0}, snp_pass{0};
+    int indel_total{0}, indel_pass{0};
+    int pair_total{0}, pair_pass{0};
+};
+
+// The trios and pairs being evaluated, and the tables used to evaluate them.
+// Everything is shared, read-only, by the workers.
+struct cohort_t {
+    const std::vector<Trio> &trios;
+    const std::vector<Pair> &pairs;
+    cohort_columns_t columns;
+    bool use_pairs;
+    const lookup_table_t &tgtSNP;
+    const lookup_snp_t &lookupSNP;
+    const lookup_table_t &tgtIndel;
+    const lookup_indel_t &lookupIndel;
+    const lookup_table_t &tgtPair;
+    const lookup_pair_t &lookupPair;
+    const parameters &params;
+};
+
+// A batch of decoded records, and the space a worker needs to evaluate them
+struct cohort_batch_t {
+    explicit cohort_batch_t(hts::bcf::File *vcfout) : output{vcfout, true} { }
+
+    std::vector<CohortSite> sites;
+    size_t num_sites{0};
+
+    CallOutput output;
+    site_counts_t counts;
+    bool pair_error{false};
+
+    qcall_t mom_snp, dad_snp, child_snp;
+    indel_t mom_indel, dad_indel, child_indel;
+    pair_t tumor, normal;
+};
+
+// Evaluate every trio and pair at a site, in the same order and with the same
+// messages as the serial loop. Returns false if a pair could not be parsed.
+bool evaluate_site(const CohortSite &site, const cohort_t &cohort, cohort_batch_t *batch) {
+    auto &counts = batch->counts;
+    auto &out = batch->output.text();
+    const long pos = site.position() + 1;
+    int flag = 0;
+
+    for(size_t j = 0; j < cohort.trios.size(); j++) {
+        int is_indel = site.Trio(cohort.columns.trios[j],
+                                 &batch->child_snp, &batch->mom_snp, &batch->dad_snp,
+                                 &batch->child_indel, &batch->mom_indel, &batch->dad_indel,
+                                 flag);
+        if(is_indel == 0) {
+            counts.snp_total++;
+            counts.snp_pass += trio_like_snp(batch->child_snp, batch->mom_snp, batch->dad_snp,
+                flag, cohort.tgtSNP, cohort.lookupSNP, batch->output,
+                cohort.params, cohort.trios[j]);
+        } else if(is_indel == 1) {
+            counts.indel_total++;
+            counts.indel_pass += trio_like_indel(batch->child_indel, batch->mom_indel,
+                batch->dad_indel, flag, cohort.tgtIndel, cohort.lookupIndel,
+                batch->output, cohort.params, cohort.trios[j]);
+        } else if(is_indel < 0) {
+            switch(is_indel) {
+            case MISSING_PL:
+                out << "\n BCF PARSING ERROR - Trios - PL fields missing!\n Skipping site " << pos << "\n";
+                break;
+            case NON_EXISTENT_ALT:
+                out << "\n BCF PARSING ERROR - Trios - ALT alleles non existent!\n Skipping site " << pos << "\n";
+                break;
+            case MISSING_MEMBER_1:
+            case MISSING_MEMBER_2:
+            case MISSING_MEMBER_3:
+                out << "\n\n BCF PARSING ERROR - Unable to find trio!\n Members missing: " << std::abs(is_indel)
+                    << "!\n Skipping site" << pos << "\n";
+                break;
+            default:
+                out << "\n BCF PARSING ERROR - Trios!\n Skipping site " << pos << " !\n";
+            };
+        }
+    }
+
+    if(!cohort.use_pairs) {
+        return true;
+    }
+    for(size_t j = 0; j < cohort.pairs.size(); j++) {
+        const auto &columns = cohort.columns.pairs[j];
+        int is_indel = site.Pair(columns, &batch->tumor, &batch->normal, flag);
+        if(is_indel == 0) {
+            counts.pair_total++;
+            pair_like(batch->tumor, batch->normal, cohort.tgtPair, cohort.lookupPair, flag,
+                      batch->output, cohort.params, counts.pair_pass, cohort.pairs[j]);
+        } else if(is_indel < 0) {
+            if(is_indel == -3) {
+                int found = (columns[0] != -1) + (columns[1] != -1);
+                out << "\n\nUnable to find pair, exiting Denovogear! ( " << 2 - found
+                    << ", " << site.num_samples() << ") ";
+            }
+            out << "\n BCF PARSING ERROR - Paired Sample!  " << is_indel << "\n Exiting !\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decode each record once and evaluate its trios and pairs on a pool of
+// workers. Records are decoded on this thread in batches, and each batch is
+// evaluated by one worker. Finished batches are written in the order they
+// were read, so the output matches the serial loop.
+site_counts_t process_cohort(bcf_srs_t *rec_reader, const bcf_hdr_t *hdr,
+    const cohort_t &cohort, hts::bcf::File *vcfout, int threads, int batch_size_arg) {
+    const size_t num_threads = (threads > 0) ? threads : 1;
+    const size_t batch_size = (batch_size_arg > 0) ? batch_size_arg : 1;
+
+    site_counts_t counts;
+
+    auto process_batch = [&](cohort_batch_t *batch) {
+        for(size_t i = 0; i < batch->num_sites; ++i) {
+            if(!evaluate_site(batch->sites[i], cohort, batch)) {
+                batch->pair_error = true;
+                break;
+            }
+        }
+    };
+
+    // The output of a batch with a pair error is written before the error is
+    // reported, which matches the serial loop.
+    auto write_batch = [&](cohort_batch_t *batch) {
+        batch->output.Flush();
+        if(batch->pair_error) {
+            throw std::runtime_error("ERROR ! Unable to process paired samples. Exiting!");
+        }
+        counts.snp_total += batch->counts.snp_total;
+        counts.snp_pass += batch->counts.snp_pass;
+        counts.indel_total += batch->counts.indel_total;
+        counts.indel_pass += batch->counts.indel_pass;
+        counts.pair_total += batch->counts.pair_total;
+        counts.pair_pass += batch->counts.pair_pass;
+        batch->counts = {};
+        batch->num_sites = 0;
+    };
+
+    dng::multithread::OrderedBatchQueue<cohort_batch_t> queue(num_threads,
+        process_batch, write_batch, [vcfout, batch_size]() {
+            cohort_batch_t *batch = new cohort_batch_t{vcfout};
+            batch->sites.resize(batch_size);
+            return batch;
+        });
+
+    while(bcf_sr_next_line(rec_reader)) {
+        bcf1_t *rec = bcf_sr_get_line(rec_reader, 0);
+        cohort_batch_t *current = queue.current();
+        if(current == nullptr) {
+            current = queue.NewBatch();
+        }
+        current->sites[current->num_sites].Decode(hdr, rec);
+        if(++current->num_sites < batch_size) {
+            continue;
+        }
+        queue.Submit();
+    }
+    if(queue.current() != nullptr) {
+        queue.Submit();
+    }
+    queue.Flush();
+    return counts;
+}
+} // anon namespace
+
 int DNM::operator()(std::string &model, DNM::argument_type &arg) {
     if(model != "auto" && model != "XS" && model != "XD") {
         throw std::runtime_error("Invalid model option " + model +
@@ -219,20 +389,25 @@ int DNM::operator()(std::string &model, DNM::argument_type &arg) {
     params.RD_cutoff = arg.rd_cutoff;
 
 
+    // Load the lookup tables from the cache, or create them
+    dng::MatrixCache lookup_cache{arg.lookup_cache};
+
     // Create SNP lookup
     lookup_snp_t lookupSNP;
     lookup_table_t tgtSNP;
-    callMakeSNPLookup(tgtSNP, lookupSNP, model, params);
+    callMakeSNPLookup(tgtSNP, lookupSNP, model, params, lookup_cache);
 
     // Create INDEL lookup
     lookup_indel_t lookupIndel;
     lookup_table_t tgtIndel;
-    callMakeINDELLookup(tgtIndel, lookupIndel, model, params);
+    callMakeINDELLookup(tgtIndel, lookupIndel, model, params, lookup_cache);
 
     // Create paired lookup
     lookup_pair_t lookupPair;
     lookup_table_t tgtPair;
-    callMakePairedLookup(tgtPair, lookupPair, params);
+    callMakePairedLookup(tgtPair, lookupPair, params, lookup_cache);
+
+    lookup_cache.Save();
 
 
     // TODO: Use Reed's PED parser
@@ -309,64 +484,79 @@ int DNM::operator()(std::string &model, DNM::argument_type &arg) {
       throw std::runtime_error("PL field is missing, unable to process records. Exiting!");
     }
     int pl_type = bcf_hdr_id2type(hdr, BCF_HL_FMT, pl_tag);
-   
-    while(bcf_sr_next_line(rec_reader)) {
-        bcf1_t *rec = bcf_sr_get_line(rec_reader, 0);
-        int j = 0;
-        int flag = 0;
-
-
-        for(j = 0; j < trio_count; j++) {
-            bcf_unpack(rec, BCF_UN_STR);
-            int is_indel = bcf_2qcall(hdr, rec, trios[j],
-                                      &mom_snp, &dad_snp, &child_snp,
-                                      &mom_indel, &dad_indel, &child_indel,
-                                      flag, pl_type);
-
-            if(is_indel == 0) {
-                snp_total_count++;
-                snp_pass_count += trio_like_snp(child_snp, mom_snp, dad_snp, flag,
-                              	  tgtSNP, lookupSNP, output_vcf.get(),
-								  params, trios[j]);
-
-            } else if(is_indel == 1) {
-
-                indel_total_count++;
-                indel_pass_count += trio_like_indel(child_indel, mom_indel, dad_indel, flag,
-                                	tgtIndel, lookupIndel, output_vcf.get(), params, trios[j]);
-
-            } else if(is_indel < 0) {
-                // error handling messages
-        	    switch(is_indel) {
-            	    case MISSING_PL:
-            	        printf("\n BCF PARSING ERROR - Trios - PL fields missing!\n Skipping site %d\n", rec->pos+1);
-            	        break;
-            	    case NON_EXISTENT_ALT:
-            	        printf("\n BCF PARSING ERROR - Trios - ALT alleles non existent!\n Skipping site %d\n", rec->pos+1);
-            	        break;
-            	    case MISSING_MEMBER_1:
-            	    case MISSING_MEMBER_2:
-            	    case MISSING_MEMBER_3:
-            	        printf("\n\n BCF PARSING ERROR - Unable to find trio!\n Members missing: %d!\n Skipping site%d\n", std::abs(is_indel), rec->pos+1);
-            	        break;
-            	    default:
-            	        printf("\n BCF PARSING ERROR - Trios!\n Skipping site %d !\n", rec->pos+1);
-        	    };
-            }
-        }
 
-        // PROCESS  PAIRS
-        if(model == "auto") { // paired sample model not developed for XS, XD yet
-            for(j = 0; j < pair_count; j++) {
-            	int is_indel = bcf2Paired(hdr, rec, pairs[j], &tumor, &normal, flag, pl_type);
+    if(arg.threads > 0) {
+        cohort_t cohort{trios, pairs, find_cohort_columns(hdr, trios, pairs),
+            model == "auto", tgtSNP, lookupSNP, tgtIndel, lookupIndel,
+            tgtPair, lookupPair, params};
+        site_counts_t counts = process_cohort(rec_reader, hdr, cohort,
+            output_vcf.get(), arg.threads, arg.batch_size);
+        snp_total_count = counts.snp_total;
+        snp_pass_count = counts.snp_pass;
+        indel_total_count = counts.indel_total;
+        indel_pass_count = counts.indel_pass;
+        pair_total_count = counts.pair_total;
+        pair_pass_count = counts.pair_pass;
+    } else {
+        CallOutput output{output_vcf.get()};
+        while(bcf_sr_next_line(rec_reader)) {
+            bcf1_t *rec = bcf_sr_get_line(rec_reader, 0);
+            int j = 0;
+            int flag = 0;
+
+
+            for(j = 0; j < trio_count; j++) {
+                bcf_unpack(rec, BCF_UN_STR);
+                int is_indel = bcf_2qcall(hdr, rec, trios[j],
+                                          &mom_snp, &dad_snp, &child_snp,
+                                          &mom_indel, &dad_indel, &child_indel,
+                                          flag, pl_type);
+
                 if(is_indel == 0) {
-                    pair_total_count++;
-                    pair_like(tumor, normal, tgtPair, lookupPair, flag, output_vcf.get(),
-                    		  params, pair_pass_count, pairs[j]);
+                    snp_total_count++;
+                    snp_pass_count += trio_like_snp(child_snp, mom_snp, dad_snp, flag,
+                                  	  tgtSNP, lookupSNP, output,
+    								  params, trios[j]);
+
+                } else if(is_indel == 1) {
+
+                    indel_total_count++;
+                    indel_pass_count += trio_like_indel(child_indel, mom_indel, dad_indel, flag,
+                                    	tgtIndel, lookupIndel, output, params, trios[j]);
 
                 } else if(is_indel < 0) {
-                    printf("\n BCF PARSING ERROR - Paired Sample!  %d\n Exiting !\n", is_indel);
-                    exit(1);
+                    // error handling messages
+            	    switch(is_indel) {
+                	    case MISSING_PL:
+                	        printf("\n BCF PARSING ERROR - Trios - PL fields missing!\n Skipping site %d\n", rec->pos+1);
+                	        break;
+                	    case NON_EXISTENT_ALT:
+                	        printf("\n BCF PARSING ERROR - Trios - ALT alleles non existent!\n Skipping site %d\n", rec->pos+1);
+                	        break;
+                	    case MISSING_MEMBER_1:
+                	    case MISSING_MEMBER_2:
+                	    case MISSING_MEMBER_3:
+                	        printf("\n\n BCF PARSING ERROR - Unable to find trio!\n Members missing: %d!\n Skipping site%d\n", std::abs(is_indel), rec->pos+1);
+                	        break;
+                	    default:
+                	        printf("\n BCF PARSING ERROR - Trios!\n Skipping site %d !\n", rec->pos+1);
+            	    };
+                }
+            }
+
+            // PROCESS  PAIRS
+            if(model == "auto") { // paired sample model not developed for XS, XD yet
+                for(j = 0; j < pair_count; j++) {
+                	int is_indel = bcf2Paired(hdr, rec, pairs[j], &tumor, &normal, flag, pl_type);
+                    if(is_indel == 0) {
+                        pair_total_count++;
+                        pair_like(tumor, normal, tgtPair, lookupPair, flag, output,
+                        		  params, pair_pass_count, pairs[j]);
+
+                    } else if(is_indel < 0) {
+                        printf("\n BCF PARSING ERROR - Paired Sample!  %d\n Exiting !\n", is_indel);
+                        exit(1);
+                    }
                 }
             }
         }
@@ -25,7 +25,7 @@
 
    Implements parental phasing by looking at the genotypes of parents at phasing
    sites within a specified window, possible to infer parent as reads are from same
-   molecule as DNM, uses Samtools to pull the required reads
+   molecule as DNM, uses htslib to pull the required reads
 
    Usage - ./denovogear phaser --dnm dnm_f --pgt pgt_f --bam bam_f --window [1000]
    Notes - skips hard clipped reads.
@@ -36,6 +36,10 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <exception>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -50,17 +54,16 @@
 #include <htslib/hts.h>
 #include <dng/hts/bam.h>
 #include <dng/app.h>
+#include <dng/multithread.h>
+#include <dng/phaser.h>
 #include <dng/task/phaser.h>
 
 using namespace std;
 using namespace dng::task;
+using namespace dng::phaser;
 
 const int g_kFileNameLength = 500;
 
-extern "C" { // from utils/sam_view.c
-    int main_samview(int argc, char *argv[]);// to get reads from BAM
-}
-
 // Format Seq string according to cigar operation
 int formatSeq(string &seq, int &pos, char op, int num) {
     //cout<<"\nOriginal seq is "<<seq;
@@ -92,301 +95,258 @@ int formatSeq(string &seq, int &pos, char op, int num) {
     //cout<<"\nModified seq is "<<seq;
 }
 
-inline char indexed_char(std::size_t x) {
-    static const char table[] = "NACNGNNNTN";
-    return table[x];
+namespace {
+// Load the informative sites of the parental GT file into an index
+// PARENTAL GT FILE FORMAT - chr posn child_GT parent1_GT parent2_GT
+pgt_index_t load_pgt_index(const char *parentGT_f) {
+    fstream fin2(parentGT_f, ios::in);
+    if(!fin2.is_open()) {
+        cout << "\nUnable to open parent GT file: " << parentGT_f << " ! Exiting!\n";
+        exit(1);
+    }
+    pgt_index_t index;
+    string chr2;
+    string gt1, gt2, gt_c;
+    long hap_pos;
+    char token2[200];
+    int line_n2 = 0;
+    fin2.getline(token2, 20, '\t');
+    while(fin2.good()) {
+        line_n2++;
+        chr2 = token2;
+        fin2.getline(token2, 20, '\t');
+        hap_pos = atol(token2); // position of phasing site
+        fin2.getline(token2, 20, '\t');
+        gt_c = token2; // genotype of child
+        fin2.getline(token2, 20, '\t');
+        gt1 = token2; // genotype of first parent
+        fin2.getline(token2, 20, '\n');
+        gt2 = token2; // genotype of second parent
+        fin2.getline(token2, 20, '\t'); // for the next lines chr
+
+        if(gt1[0] == 'N' || gt2[0] == 'N'  || gt_c[0] == 'N') { // GT not available
+            continue;
+        }
+        if(gt1 == gt2) { // both parents het or both hom, not informative, // ignore triallelic case for now
+            continue;
+        }
+        if(gt_c[0] == gt_c[1]) { // child hom, not informative
+            continue;
+        }
+        index[chr2].push_back({hap_pos, line_n2, gt1, gt2});
+    }
+    // the GT file does not need to be sorted
+    for(auto &&chr : index) {
+        std::stable_sort(chr.second.begin(), chr.second.end(),
+        [](const pgt_site_t &a, const pgt_site_t &b) {
+            return a.pos < b.pos;
+        });
+    }
+    return index;
 }
 
+// A DNM to be phased
+// DNM FILE FORMAT - chr posn inherited_base variant_base
+struct dnm_t {
+    string chr;
+    long pos;
+    char inherited_base;
+    char variant_base;
+};
 
-// Extract CIGAR from reads, expand reads and get the denovo and hap base
-int processReads(const char *bam_f, std::string &chr1, long dnm_pos,
-                 long hap_pos, string &gt1, string &gt2, char variant_base) {
-
-    map<string, char> read_dnm,
-        read_hap;// the key is the query name, the char is the base. paired reads have the same query name.
-    map<string, int> pair_count;
+// Read the next DNM. Returns false at the end of the file.
+bool read_dnm(ifstream &fin1, dnm_t *dnm) {
+    assert(dnm != nullptr);
+    char token1[200]; // token for parsing
+    fin1.getline(token1, 20, '\t');
+    if(!fin1.good()) {
+        return false;
+    }
+    dnm->chr = token1;
+    fin1.getline(token1, 20, '\t');
+    dnm->pos = atol(token1);// posn of DNM
+    fin1.getline(token1, 20, '\t');
+    dnm->inherited_base = token1[0];// inherited base at DNM position
+    fin1.getline(token1, 20);
+    dnm->variant_base = token1[0];// variant base i.e DNM base
+    return true;
+}
 
-    // Open bam file for reading
-    htsFile *fp = hts_open(bam_f, "r");
-    bam_hdr_t *hdr = sam_hdr_read(fp);
-    bam1_t *rec = bam_init1();
+void write_dnm_text(ostream &out, const dnm_t &dnm) {
+    out << "\nDNM_pos " << dnm.chr << ":" << dnm.pos << "\tINHERITED " <<
+        dnm.inherited_base << "\tVARIANT " << dnm.variant_base;
+}
 
-    // get specific region
-    // TODO: C++'ize this
-    char region[30];
-    long int start = hap_pos, end = dnm_pos;
-    if(dnm_pos < hap_pos) {
-        start = dnm_pos;
-        end = hap_pos;
-    }
-    sprintf(region, "%s:%ld-%ld", chr1.c_str(), start, end);
-
-    // Find only sequences that fall between the dnm_pos and hap_pos
-    // TODO: this is very inefficient, being called multiple times. Just preprocess all the potential positions
-    //       and do the query once
-    hts_idx_t *sam_indx = sam_index_load(fp, bam_f);
-    hts_itr_t *sam_itr = sam_itr_querys(sam_indx, hdr, region);
-    while(sam_itr_next(fp, sam_itr, rec) >= 0) {
-        const char *qname = bam_get_qname(rec); // field 1
-        uint32_t flag = rec->core.flag; // field 2
-
-        // filter unmapped reads, 3rd bit is 1 or mate rescue XT:A:M
-        uint8_t *aux;
-        bool XT = ((aux = bam_aux_get(rec, "XT")) && (bam_aux2A(aux) == 'M'));
-        if((flag & 4) == 4 || XT) {
+// Write the phasing of a DNM as text
+void write_phase_text(ostream &out, const dnm_t &dnm,
+                      const std::vector<site_phase_t> &phase) {
+    write_dnm_text(out, dnm);
+    int returnsum = 0;
+    for(auto &&site : phase) {
+        if(site.bad_cigar_op != -1) {
+            out << "Unable to handle cigar operation (htslib code " << site.bad_cigar_op
+                << ")." << std::endl;
+            returnsum += 1;
             continue;
         }
-
-        if((flag & 512) == 512) {
-            std::cout << "\n\nFailed Quality Control";
-            std::cout << " flag " << flag << std::endl;
+        if(site.counts.empty()) {
             continue;
         }
-
-        // CONSIDER PCR DUPLICATES AS WE ARE NOT GENOTYPING
-        /*if((flag & 1024) == 1024 ) {
-        //cout<<"\n\nPCR DUPLICATE";
-        //cout<<" flag "<<flag;
-        //cout<<"\n\n";
-        getline(fin1, l);
-        continue;
-        }*/
-
-        uint32_t cigar_len = rec->core.n_cigar;
-        uint32_t *cigar = bam_get_cigar(rec); // field 6
-
-        int32_t seq_len = rec->core.l_qseq;
-        uint8_t *seq = bam_get_seq(rec); // field 10
-        std::string
-        seq_formatted; // A string copy of the sequence, will be processed to match the cigar
-        for(int a = 0; a < seq_len; a++) {
-            // A = 1, C = 2, G = 4, T = 8
-            seq_formatted += indexed_char(bam_seqi(seq, a));
-        }
-
-        int32_t pos = rec->core.pos; // field 4
-
-        // reformat the sequence based on the cigar string
-        int cig_index = 0;
-        for(int a = 0; a < cigar_len; a++) {
-            int op = bam_cigar_op(cigar[a]);
-            int op_len = bam_cigar_oplen(cigar[a]);
-
-            switch(op) {
-            case BAM_CSOFT_CLIP:
-                // 'S' soft clip, erase characters
-                seq_formatted.erase(cig_index, op_len);
-                break;
-            case BAM_CMATCH:
-                // 'M' match, retain as is
-                cig_index += op_len;
-                break;
-            case BAM_CDEL:
-                // 'D' deletion, insert a '-'
-                seq_formatted.insert(cig_index, op_len, '-');
-                break;
-            case BAM_CINS:
-                // 'I' insertion, remove insert
-                seq_formatted.erase(cig_index, op_len);
-                break;
-            default:
-                std::cout << "Unable to handle cigar operation (htslib code " << op << ")." <<
-                          std::endl;
-                return 1;
-            }
+        out << endl << "\tHAP POS " << site.site->pos << " p1: " << site.site->gt1
+            << " p2: " << site.site->gt2;
+        for(auto &&c : site.counts) {
+            out << "\n\t\tBase at DNM position: " << c.dnm_base << " Base at phasing position: "
+                << c.hap_base << "\t";
+            out << " INFERRED PARENT OF ORIGIN for DNM: " << c.parent <<
+                " SUPPORTING READ COUNT: " << c.count;
         }
+        returnsum += 10;
+    }
+    if(returnsum == 0) {
+        out << " - Insufficient reads present to phase this site.";
+    }
+}
 
-        int formatted_len = seq_formatted.length();
-        long offset = 0;
-        if((dnm_pos >= pos) && ((pos + formatted_len) > dnm_pos)) {
-            offset = dnm_pos - pos;
-            read_dnm[qname] = seq_formatted[offset - 1];
-        }
-        if((hap_pos >= pos) && ((pos + formatted_len) > hap_pos)) {
-            offset = hap_pos - pos;
-            read_hap[qname] = seq_formatted[offset - 1];
+const char tsv_header[] = "#CHROM\tPOS\tINHERITED\tVARIANT\tHAP_POS\tP1_GT\tP2_GT"
+                          "\tDNM_BASE\tHAP_BASE\tPARENT_OF_ORIGIN\tREAD_COUNT\n";
+
+// Write the phasing of a DNM as tab-separated rows, one for each pair of
+// bases seen at the DNM and a phasing site. A phasing site that overlaps a
+// read with an unsupported cigar operation has a row whose parent of origin is
+// UNHANDLED_CIGAR_OP:<htslib code>. A DNM with no other rows has a single row
+// with missing values.
+void write_phase_tsv(ostream &out, const dnm_t &dnm,
+                     const std::vector<site_phase_t> &phase) {
+    bool written = false;
+    for(auto &&site : phase) {
+        if(site.bad_cigar_op != -1) {
+            out << dnm.chr << '\t' << dnm.pos << '\t' << dnm.inherited_base << '\t'
+                << dnm.variant_base << '\t' << site.site->pos << '\t' << site.site->gt1
+                << '\t' << site.site->gt2 << "\t.\t.\tUNHANDLED_CIGAR_OP:"
+                << site.bad_cigar_op << "\t.\n";
+            written = true;
+            continue;
         }
-        if(read_dnm.count(qname) > 0 && read_hap.count(qname) > 0)  {
-            std::string bases;
-            bases += read_dnm[qname];
-            bases += read_hap[qname];
-
-            if(pair_count.count(bases) == 0) {
-                pair_count[bases] = 1;
-            } else {
-                pair_count[bases]++;
-            }
+        for(auto &&c : site.counts) {
+            out << dnm.chr << '\t' << dnm.pos << '\t' << dnm.inherited_base << '\t'
+                << dnm.variant_base << '\t' << site.site->pos << '\t' << site.site->gt1
+                << '\t' << site.site->gt2 << '\t' << c.dnm_base << '\t' << c.hap_base
+                << '\t' << c.parent << '\t' << c.count << '\n';
+            written = true;
         }
     }
-
-    map<string, int>::iterator it;
-    if(pair_count.size() > 0) {
-        cout << endl << "\tHAP POS " << hap_pos << " p1: " << gt1 << " p2: " << gt2;
-    } else {
-        return 0;
+    if(!written) {
+        out << dnm.chr << '\t' << dnm.pos << '\t' << dnm.inherited_base << '\t'
+            << dnm.variant_base << "\t.\t.\t.\t.\t.\t.\t0\n";
     }
-    //cout<<" Number of denovo-phasing pairs found: "<<pair_count.size();
-    for(it = pair_count.begin(); it != pair_count.end(); it++) {
-        char dnm_b = (*it).first[0];
-        char hap_b = (*it).first[1];
-        int count = (*it).second;
-        string parent_of_origin = "N/A";
-
-        if((hap_b == gt1[0]) || (hap_b == gt1[1])) {
-            if((hap_b != gt2[0]) && (hap_b != gt2[1])) {
-                if(variant_base == dnm_b) {
-                    parent_of_origin = "p1";
-                } else {
-                    parent_of_origin = "p2";
-                }
-            }
+}
+
+// A batch of DNMs from the same chromosome, and their output
+struct phase_batch_t {
+    std::vector<dnm_t> dnms;
+    std::ostringstream output;
+};
+
+// Phase the DNMs of a file. DNMs are read on this thread and split into
+// batches of nearby DNMs. If threads is greater than 0, the batches are
+// phased on a pool of workers. Each worker takes its own handle of the BAM
+// file, so handles and their indexes are reused but never shared between
+// threads. Finished batches are written in the order they were read, so the
+// output matches the serial loop. Returns the number of DNMs read.
+int phase_dnms(ifstream &fin1, const pgt_index_t &pgt_index, const char *bam_f,
+               long window, int threads, int batch_size_arg, ostream &out, bool tsv) {
+    const size_t batch_size = (batch_size_arg > 0) ? batch_size_arg : 1;
+
+    std::vector<std::unique_ptr<hts::bam::File>> handles; // BAM files not in use
+    std::mutex mutex;
+
+    // one handle for each worker
+    for(int i = 0; i < std::max(threads, 1); ++i) {
+        std::unique_ptr<hts::bam::File> bam{new hts::bam::File(bam_f, "r")};
+        if(!bam->is_open()) {
+            throw std::runtime_error("Unable to open BAM file: " + std::string(bam_f) + "!");
         }
+        // mate rescues are skipped by phase_dnm
+        bam->SetFilterFlags(READ_FILTER_FLAGS);
+        handles.push_back(std::move(bam));
+    }
 
-        else if((hap_b == gt2[0]) || (hap_b == gt2[1])) {
-            if((hap_b != gt1[0]) && (hap_b != gt1[1])) {
-                if(variant_base == dnm_b) {
-                    parent_of_origin = "p2";
+    auto process_batch = [&](phase_batch_t *batch) {
+        std::unique_ptr<hts::bam::File> bam;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            assert(!handles.empty());
+            bam = std::move(handles.back());
+            handles.pop_back();
+        }
+        std::exception_ptr error;
+        try {
+            for(auto &&dnm : batch->dnms) {
+                auto phase = phase_dnm(*bam, pgt_index, dnm.chr, dnm.pos, dnm.variant_base, window);
+                if(tsv) {
+                    write_phase_tsv(batch->output, dnm, phase);
                 } else {
-                    parent_of_origin = "p1";
+                    write_phase_text(batch->output, dnm, phase);
                 }
             }
+        } catch(...) {
+            error = std::current_exception();
         }
-
-        if((hap_b == gt1[0]) && (hap_b == gt1[1])) {
-            if(variant_base == dnm_b) {
-                parent_of_origin = "p1";
-            } else {
-                parent_of_origin = "p2";
-            }
-        } else if((hap_b == gt2[0]) && (hap_b == gt2[1])) {
-            if(variant_base == dnm_b) {
-                parent_of_origin = "p2";
-            } else {
-                parent_of_origin = "p1";
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            handles.push_back(std::move(bam));
+        }
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    };
+
+    auto write_batch = [&](phase_batch_t *batch) {
+        out << batch->output.str();
+        batch->output.str("");
+        batch->dnms.clear();
+    };
+
+    dng::multithread::OrderedBatchQueue<phase_batch_t> queue(std::max(threads, 0),
+        process_batch, write_batch);
+
+    int line_n1 = 0;
+    dnm_t dnm;
+    while(read_dnm(fin1, &dnm)) {
+        line_n1++;
+        phase_batch_t *current = queue.current();
+        if(dnm.inherited_base == dnm.variant_base) {
+            if(current != nullptr) {
+                queue.Submit();
             }
+            queue.Flush();
+            out.flush();
+            write_dnm_text(cout, dnm);
+            cout << "\nInherited base same as variant base";
+            cout << "\nline_n1 " << line_n1 << " chr1 " << dnm.chr << " dnm_pos " << dnm.pos;
+            cout << "\nExiting!";
+            exit(1);
         }
-
-        cout << "\n\t\tBase at DNM position: " << dnm_b << " Base at phasing position: "
-             << hap_b << "\t";
-        cout << " INFERRED PARENT OF ORIGIN for DNM: " << parent_of_origin <<
-             " SUPPORTING READ COUNT: " << count;
-
-    }
-    return 10;
-
-}
-
-
-
-// Call samtools to get the reads from the bam file
-// TODO: DELETE
-void getReadsFromBAM(char *bam_f, string chr1, long dnm_pos, long hap_pos,
-                     char *temp_file) {
-    std::cout << std::endl << "---------------------------------" << std::endl;
-
-    htsFile *fp_b = hts_open(bam_f, "r");
-    bam_hdr_t *hdr_b = sam_hdr_read(fp_b);
-    bam1_t *rec_b = bam_init1();
-
-    char region[30];
-    long int start = hap_pos, end = dnm_pos;
-    if(dnm_pos < hap_pos) {
-        start = dnm_pos;
-        end = hap_pos;
-    }
-    sprintf(region, "%s:%ld-%ld", chr1.c_str(), start, end);
-    std::cout << std::endl << "REGION = " << region << std::endl;
-
-    hts_idx_t *sam_indx = sam_index_load(fp_b, bam_f);
-    hts_itr_t *sam_itr = sam_itr_querys(sam_indx, hdr_b, region);
-    bam1_t *rec_i = bam_init1();
-    while(sam_itr_next(fp_b, sam_itr, rec_b) >= 0) {
-        //    std::cout << "HERE" << std::endl;
-        //}
-        //  while(sam_read1(fp_b, hdr_b, rec_b) > 0) {
-        const char *qname_b = bam_get_qname(rec_b);
-        std::cout << "qname = " << qname_b << std::endl;
-
-        uint32_t flag_b = rec_b->core.flag;
-        std::cout << "flag = " << flag_b << std::endl;
-
-        std::cout << "pos = " << rec_b->core.pos << std::endl;
-
-        uint32_t cigar_b_len = rec_b->core.n_cigar;
-        //std::cout << "cigar len = " << cigar_b_len << std::endl;
-        uint32_t *cigar_b = bam_get_cigar(rec_b);
-        std::cout << "cigar = ";
-        for(int a = 0; a < cigar_b_len; a++) {
-            std::cout << bam_cigar_oplen(cigar_b[a]) << "[" << bam_cigar_op(
-                          cigar_b[a]) << "]";
-            //std::cout << "cigar = " << bam_cigar_oplen(cigar_b[0]) << std::endl;
-            //std::cout << "cigar op = " << bam_cigar_op(cigar_b[0]) << std::endl;
+        // nearby DNMs share reads and phasing sites
+        if(current != nullptr && current->dnms.front().chr != dnm.chr) {
+            queue.Submit();
+            current = nullptr;
         }
-        std::cout << std::endl;
-
-        uint8_t *seq_b = bam_get_seq(rec_b);
-        int32_t seq_b_len = rec_b->core.l_qseq;
-        //std::cout << "seq_len = " << seq_b_len << std::endl;
-        std::cout << "seq = ";
-        for(int a = 0; a < seq_b_len; a++) {
-            //std::cout << static_cast<int>(seq_b[a]);
-            std::cout << indexed_char(bam_seqi(seq_b, a));
+        if(current == nullptr) {
+            current = queue.NewBatch();
+        }
+        current->dnms.push_back(dnm);
+        if(current->dnms.size() >= batch_size) {
+            queue.Submit();
         }
-        std::cout << std::endl;
-
-        uint32_t aux_len = bam_get_l_aux(rec_b);
-        std::cout << "size of auxiliary data = " << aux_len << std::endl;
-        const uint8_t *aux_b = bam_aux_get(rec_b, "XS");//bam_get_aux(rec_b, "XS");
-        std::cout << "aux = " << aux_b << std::endl;
-        std::cout << "    = " << bam_aux2A(aux_b) << std::endl;
-        //std::cout << "aux = ";
-        //for(int a = 0; a < aux_len; a++)
-        //  std::cout << (char)aux_b[a];
-        //std::cout << std::endl;
-
-        std::cout << std::endl;
-
     }
-
-    //std::cout << "bam_f = " << bam_f << std::endl;
-    hts::bam::File child_bam(bam_f, "r");
-    //hts::bam::File child_bam(bam_f, "r", "1:1-999999999");
-    const bam_hdr_t *hdr = child_bam.header();
-    hts::bam::Alignment line;
-    //while(child_bam.Read(line)) {
-    //  std::cout << line.target_id() << std::endl;
-    //}
-
-    //std::cout << "HERE: " << child_bam.Read(line) << std::endl;
-    //std::cout << "\tid = " << line.target_id() << std::endl;
-    /*
-      long interval = hap_pos - dnm_pos;
-      if(interval < 0) {
-      interval = -interval;
-      }
-      string reads_f = "reads_temp.txt"; // store reads in this file
-      char program[] = "samtools\0";
-      char command[] = "view\0";
-      //char op1[] = "-S\0"; // SAM format option
-      char op[] = "-o\0";
-      strcpy(temp_file, "XXXXXX");
-      int fd;
-      fd = mkstemp(temp_file);
-      //char file[100];
-      //strcpy(file, bam_f);
-      char region[30];
-      long int start = hap_pos, end = dnm_pos;
-      if(dnm_pos < hap_pos) {
-      start = dnm_pos;
-      end = hap_pos;
-      }
-      sprintf(region, "%s:%ld-%ld", chr1.c_str(), start, end);
-      char *argv1[] = {program, command, op, temp_file, bam_f, region};
-      int argc1 = sizeof(argv1) / sizeof(char *);
-      main_samview(argc1 - 1, argv1 + 1);
-      return;
-    */
+    if(queue.current() != nullptr) {
+        queue.Submit();
+    }
+    queue.Flush();
+    return line_n1;
 }
+} // anon namespace
 
 // Main
 int Phaser::operator()(Phaser::argument_type &arg) {
@@ -468,113 +428,20 @@ int Phaser::operator()(Phaser::argument_type &arg) {
     ifstream fin1(DNM_f, ios::in);
     // DNM FILE FORMAT - chr posn inherited_base variant_base
     if(fin1.is_open()) { // PARSE THROUGH DNMs
-        string chr1;
-        long dnm_pos;
-        char inherited_base, variant_base;
-        char token1[200]; // token for parsing
+        // Load the phasing sites once
+        const pgt_index_t pgt_index = load_pgt_index(parentGT_f);
         int line_n1 = 0;
-        fin1.getline(token1, 20, '\t');
-        while(fin1.good()) {
-            line_n1++;
-
-            /*if (strstr(token1, "chr")) {
-              char* token1_p = token1 + 3;
-              chr1 = atoi(token1_p);
-              }
-              else
-              chr1 = atoi(token1);// chromosome of DNM, PROBLEM WITH SEX CHR*/
-            //cout <<endl<<"token1 is "<<token1;
-            chr1 = token1;
-            fin1.getline(token1, 20, '\t');
-            dnm_pos = atol(token1);// posn of DNM
-            fin1.getline(token1, 20, '\t');
-            inherited_base = token1[0];// inherited base at DNM position
-            fin1.getline(token1, 20);
-            variant_base = token1[0];// variant base i.e DNM base
-            cout << "\nDNM_pos " << chr1 << ":" << dnm_pos << "\tINHERITED " <<
-                 inherited_base << "\tVARIANT " << variant_base;
-            int returnsum = 0;
-            if(inherited_base == variant_base) {
-                cout << "\nInherited base same as variant base";
-                cout << "\nline_n1 " << line_n1 << " chr1 " << chr1 << " dnm_pos " << dnm_pos;
-                cout << "\nExiting!";
-                exit(1);
-            }
-
-            fstream fin2(parentGT_f, ios::in);
-            if(fin2.is_open()) { // PARSE Parental GTs
-                string chr2;
-                string gt1, gt2, gt_c;
-                long hap_pos;
-                //char token2[200]; // token for parsing
-                char token2[200];
-                int line_n2 = 0;
-                fin2.getline(token2, 20, '\t');
-                while(fin2.good()) {
-
-                    /*if (strstr(token2, "chr")) {
-                      char* token2_p = token2 + 3;
-                      //cout<<"\ntoken2_p "<<token2_p;
-                      chr2 = atoi(token2_p);
-                      //cout<<"\nchr2 "<<chr2;
-                      }
-                      else
-                      chr2 = atoi(token2); // chr of phasing site, PROBLEM WITH SEX CHR*/
-
-                    line_n2++;
-                    chr2 = token2;
-                    fin2.getline(token2, 20, '\t');
-                    hap_pos = atol(token2); // position of phasing site
-                    fin2.getline(token2, 20, '\t');
-                    gt_c = token2; // genotype of child
-                    fin2.getline(token2, 20, '\t');
-                    gt1 = token2; // genotype of first parent
-                    fin2.getline(token2, 20, '\n');
-                    gt2 = token2; // genotype of second parent
-                    fin2.getline(token2, 20, '\t'); // for the next lines chr
-                    //cout<<endl<<"c\t"<<gt_c<<"\t"<<"p"<<"\t"<<gt1<<"\t"<<gt2;
-
-                    if(gt1[0] == 'N' || gt2[0] == 'N'  || gt_c[0] == 'N') { // GT not available
-                        continue;
-                    }
-                    if(gt1 == gt2) { // both parents het or both hom, not informative, // ignore triallelic case for now
-                        continue;
-                    }
-                    if(gt_c[0] == gt_c[1]) { // child hom, not informative
-                        continue;
-                    }
-
-
-                    //cout<<"\n\tline_n2 "<<line_n2<<" dist "<<dist;
-                    //cout<<" hap_pos "<<chr2<<":"<<hap_pos<<" gt1 "<<gt1<<" gt2 "<<gt2<<" gt3 "<<gt3;
-                    /*if ((chr2 > chr1) ||
-                      ((chr2 == chr1) && ((hap_pos - dnm_pos) > window))) // the GTs are sorted by position, helps avoid iterating through entire file
-                      break;*/
-
-                    long dist = hap_pos - dnm_pos; // distance b/w DNM and phasing site
-                    if(dist < 0) {
-                        dist = -dist;
-                    }
-                    //cout<<endl<<"dist "<<dist<<"window "<<window;
-                    if((chr2 == chr1) && (dist <= window) && (hap_pos != dnm_pos)) {
-                        //char temp_file[20];
-                        //getReadsFromBAM(bam_f, chr1, dnm_pos, hap_pos,temp_file); // get reads corresponding to the positions
-                        returnsum += processReads(bam_f, chr1, dnm_pos, hap_pos, gt1, gt2,
-                                                  variant_base);
-                        //remove(temp_file);
-                    }
-
-                }
-                fin2.close();
-                if(returnsum == 0) {
-                    cout << " - Insufficient reads present to phase this site.";
-                }
-                //cout<<"\nThe number of lines read GT file is "<<line_n2<<" DNM is "<<line_n1;
-            } else {
-                cout << "\nUnable to open parent GT file: " << parentGT_f << " ! Exiting!\n";
-                exit(1);
+        if(arg.write.empty()) {
+            line_n1 = phase_dnms(fin1, pgt_index, bam_f, window, arg.threads,
+                                 arg.batch_size, cout, false);
+        } else {
+            ofstream tsv_out(arg.write);
+            if(!tsv_out.is_open()) {
+                throw std::runtime_error("Unable to open output file: " + arg.write + "!");
             }
-            fin1.getline(token1, 20, '\t');
+            tsv_out << tsv_header;
+            line_n1 = phase_dnms(fin1, pgt_index, bam_f, window, arg.threads,
+                                 arg.batch_size, tsv_out, true);
         }
         fin1.close();
         cout << "\nThe number of lines read DNM file is " << line_n1;
@@ -618,6 +485,9 @@ protected:
              << "  --pgt filename: File with parental genotypes for phasing sites\n"
              << "  --bam filename: bam file\n"
              << "  --window size: size of window for phasing sites (> insert size)\n"
+             << "  --write filename: write the phasing of each DNM to a tab-separated file\n"
+             << "  --threads n: number of worker threads\n"
+             << "  --batch_size n: number of DNMs given to a worker at a time\n"
              << endl;
         return EXIT_SUCCESS;
     }
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bcfCohort.h"
+
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+#include <unordered_map>
+
+cohort_columns_t find_cohort_columns(const bcf_hdr_t *hdr,
+    const std::vector<Trio> &trios, const std::vector<Pair> &pairs) {
+    std::unordered_map<std::string, int> columns;
+    for(int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+        columns.emplace(hdr->samples[i], i);
+    }
+    auto column = [&](const char *id) {
+        auto it = columns.find(id);
+        return (it != columns.end()) ? it->second : -1;
+    };
+
+    cohort_columns_t result;
+    result.trios.reserve(trios.size());
+    for(auto && trio : trios) {
+        result.trios.push_back({{column(trio.cID), column(trio.mID), column(trio.dID)}});
+    }
+    result.pairs.reserve(pairs.size());
+    for(auto && pair : pairs) {
+        result.pairs.push_back({{column(pair.tumorID), column(pair.normalID)}});
+    }
+    return result;
+}
+
+int CohortSite::Decode(const bcf_hdr_t *hdr, bcf1_t *rec) {
+    bcf_unpack(rec, BCF_UN_STR);
+    pos_ = rec->pos;
+    num_samples_ = bcf_hdr_nsamples(hdr);
+    sample_ids_ = hdr->samples;
+
+    // Check if INDEL or SNP
+    const int indel = (bcf_get_variant_types(rec) == hts::bcf::File::INDEL);
+
+    // Make sure the PL fields (phred-scaled genotype likihoods) exists
+    int n_pl = hts::bcf::get_format_numeric(hdr, rec, "PL", &pl_, &pl_capacity_);
+    if(n_pl <= 0) {
+        return status_ = -6;
+    }
+    pl_size_ = n_pl / num_samples_;
+
+    // get I16 values from INFO field
+    std::array<int, 16> anno = {};
+    int dp = 0;
+    if(read_I16(rec, hdr, anno) == 0) {
+        dp = anno[0] + anno[1] + anno[2] + anno[3];
+    }
+    // Calculate map quality from I16 fields 9 and 11
+    mq_ = (int)(sqrt((double)(anno[9] + anno[11]) / dp) + .499);
+
+    // Check that REF is a valid base
+    char **alleles = rec->d.allele;
+    int a0 = nt4_table[(int)alleles[0][0]];
+    if(a0 > 3) {
+        return status_ = 10;
+    }
+    // Check that ALT alleles exists
+    if(rec->n_allele < 2) {
+        return status_ = -11;
+    }
+
+    // Map the alternative alleles
+    int map[4] = {-2, -2, -2, -2};
+    map[a0] = 0;
+    int k1 = -1;
+    for(int k = 0, s = 1; k < 3 && s < rec->n_allele; ++k, ++s) {
+        int a = nt4_table[(int)alleles[s][0]];
+        if(a >= 0 && a < 4) {
+            map[a] = k + 1;
+        } else {
+            k1 = k + 1;
+        }
+    }
+    for(int k = 0; k < 4; ++k) {
+        if(map[k] < 0) {
+            map[k] = k1;
+        }
+    }
+
+    chr_ = bcf_hdr_id2name(hdr, rec->rid);
+    ref_ = alleles[0];
+    alt_.clear();
+    for(int a = 1; a < rec->n_allele; ++a) {
+        if(a != 1) {
+            alt_ += ",";
+        }
+        alt_ += alleles[a];
+    }
+
+    // Use the "DP" field for each sample if it exists. Otherwise the depth is
+    // estimated.
+    int n_dp = hts::bcf::get_format_int32(hdr, rec, "DP", &dp_, &dp_capacity_);
+    const bool has_dp = (n_dp >= 3);
+
+    genotypes_.resize(10*num_samples_);
+    trio_depths_.resize(num_samples_);
+    pair_depths_.resize(num_samples_);
+    int trio_rest = dp, pair_rest = dp;
+    for(int i = 0; i < num_samples_; ++i) {
+        const int *pl = pl_.get() + i*pl_size_;
+        if(has_dp) {
+            trio_depths_[i] = pair_depths_[i] = dp_[i];
+        } else {
+            // Go to the first non-zero value in the PL field
+            int j = 0;
+            for(; j < pl_size_ && pl[j]; j++);
+
+            // Estimate the depth from I16 fields 1 to 4. bcf_2qcall and
+            // bcf2Paired divide the remaining depth differently.
+            int d = (int)((double)trio_rest / (3 - i) + .4999);
+            if(d == 0) {
+                d = 1;
+            }
+            if(j == pl_size_) {
+                d = 0;
+            }
+            trio_rest -= d;
+            trio_depths_[i] = d;
+
+            d = (int)((double)pair_rest / (num_samples_ - i) + .4999);
+            if(d == 0) {
+                d = 1;
+            }
+            if(j == pl_size_) {
+                d = 0;
+            }
+            pair_rest -= d;
+            pair_depths_[i] = d;
+        }
+
+        int *g = &genotypes_[10*i];
+        for(int k = 0; k < 4; k++) {
+            for(int l = k; l < 4; l++) { //AA,AC,AG,AT,CC,CG,CT,GG,GT,TT
+                int x = map[k], y = map[l];
+                if(x < 0 || y < 0) {
+                    // If PL field is not specified for a given genotype, just assume its likelihood is a close to 0 as possible.
+                    *g++ = MAX_PL;
+                } else {
+                    if(x > y) {
+                        std::swap(x, y);
+                    }
+                    // see VCF specifications, 'GL' format section
+                    *g++ = pl[y * (y + 1) / 2 + x];
+                }
+            }
+        }
+    }
+    return status_ = indel;
+}
+
+void CohortSite::WriteSNP(int sample, int depth, snp_object_t *out) const {
+    strcpy(out->chr, chr_.c_str());
+    out->pos = pos_;
+    out->ref_base = ref_[0];
+    strcpy(out->alt, alt_.c_str());
+    out->rms_mapQ = mq_;
+    strcpy(out->id, sample_ids_[sample]);
+    out->depth = depth;
+    std::copy_n(&genotypes_[10*sample], 10, out->lk);
+}
+
+void CohortSite::WriteIndel(int sample, int depth, indel_t *out) const {
+    strcpy(out->chr, chr_.c_str());
+    out->pos = pos_;
+    strcpy(out->ref_base, ref_.c_str());
+    strcpy(out->alt, alt_.c_str());
+    out->rms_mapQ = mq_;
+    strcpy(out->id, sample_ids_[sample]);
+    out->depth = depth;
+    const int *pl = pl_.get() + sample*pl_size_;
+    for(int j = 0; j < 3; j++) {
+        out->lk[j] = (j < pl_size_) ? pl[j] : MAX_PL;
+    }
+}
+
+int CohortSite::Trio(const std::array<int, 3> &columns, qcall_t *child_snp,
+    qcall_t *mom_snp, qcall_t *dad_snp, indel_t *child_indel,
+    indel_t *mom_indel, indel_t *dad_indel, int &flag) const {
+    if(status_ != 0 && status_ != 1) {
+        return status_;
+    }
+    int missing = std::count(columns.begin(), columns.end(), -1);
+    if(missing > 0) {
+        return -missing;
+    }
+    const int child = columns[0], mom = columns[1], dad = columns[2];
+    if(status_ == 0) {
+        WriteSNP(child, trio_depths_[child], child_snp);
+        WriteSNP(mom, trio_depths_[mom], mom_snp);
+        WriteSNP(dad, trio_depths_[dad], dad_snp);
+    } else {
+        WriteIndel(child, trio_depths_[child], child_indel);
+        WriteIndel(mom, trio_depths_[mom], mom_indel);
+        WriteIndel(dad, trio_depths_[dad], dad_indel);
+    }
+    // bcf_2qcall sets the flag from the last member in the header
+    int last = std::max({child, mom, dad});
+    flag = mq_ < MIN_MAPQ || trio_depths_[last] < MIN_READ_DEPTH;
+    return status_;
+}
+
+int CohortSite::Pair(const std::array<int, 2> &columns, pair_t *tumor,
+    pair_t *normal, int &flag) const {
+    if(status_ != 0 && status_ != 1) {
+        return status_;
+    }
+    if(columns[0] == -1 || columns[1] == -1) {
+        return -3; // missing member
+    }
+    if(status_ == 0) {
+        WriteSNP(columns[0], pair_depths_[columns[0]], tumor);
+        WriteSNP(columns[1], pair_depths_[columns[1]], normal);
+        int last = std::max(columns[0], columns[1]);
+        flag = mq_ < MIN_MAPQ || pair_depths_[last] < MIN_READ_DEPTH;
+    }
+    return status_;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef BCF_COHORT_H_
+#define BCF_COHORT_H_
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+// The header columns of the members of every trio and pair. Members that are
+// not in the header have a column of -1.
+struct cohort_columns_t {
+    std::vector<std::array<int, 3>> trios; // child, mom, dad
+    std::vector<std::array<int, 2>> pairs; // tumor, normal
+};
+
+cohort_columns_t find_cohort_columns(const bcf_hdr_t *hdr,
+    const std::vector<Trio> &trios, const std::vector<Pair> &pairs);
+
+// The values that bcf_2qcall and bcf2Paired extract from a record for each
+// sample. A record is decoded once, and the result is shared by every trio and
+// pair in the cohort.
+class CohortSite {
+public:
+    // Decode rec. Returns 0 for a SNP, 1 for an indel, 10 if the reference is
+    // not a valid base, or MISSING_PL or NON_EXISTENT_ALT.
+    int Decode(const bcf_hdr_t *hdr, bcf1_t *rec);
+
+    // Fill in the members of a trio. Returns the same value as bcf_2qcall.
+    int Trio(const std::array<int, 3> &columns, qcall_t *child_snp,
+        qcall_t *mom_snp, qcall_t *dad_snp, indel_t *child_indel,
+        indel_t *mom_indel, indel_t *dad_indel, int &flag) const;
+
+    // Fill in the members of a pair. Returns the same value as bcf2Paired.
+    int Pair(const std::array<int, 2> &columns, pair_t *tumor, pair_t *normal,
+        int &flag) const;
+
+    int status() const { return status_; }
+    long position() const { return pos_; }
+    int num_samples() const { return num_samples_; }
+
+private:
+    void WriteSNP(int sample, int depth, snp_object_t *out) const;
+    void WriteIndel(int sample, int depth, indel_t *out) const;
+
+    int status_{0};
+
+    std::string chr_;
+    long pos_{0};
+    std::string ref_;
+    std::string alt_;
+    int mq_{0};
+
+    int num_samples_{0};
+    const char * const *sample_ids_{nullptr};
+
+    // the PL fields of every sample, pl_size_ values per sample
+    hts::bcf::buffer_t<int> pl_;
+    int pl_capacity_{0};
+    int pl_size_{0};
+    hts::bcf::buffer_t<int> dp_;
+    int dp_capacity_{0};
+
+    // the ten genotype likelihoods of every sample, in AA,AC,...,TT order
+    std::vector<int> genotypes_;
+    // bcf_2qcall and bcf2Paired estimate depths differently when DP is missing
+    std::vector<int> trio_depths_;
+    std::vector<int> pair_depths_;
+};
+
+#endif // BCF_COHORT_H_
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <memory>
 
 #include "parser.h"
 #include "lookup.h"
@@ -52,21 +53,80 @@ typedef struct {
 } parameters;
 
 
+// Where the trio_like_* and pair_like functions write their calls. Calls are
+// printed to cout and written to vcfout as they are made, unless the output
+// is buffered. A buffered output keeps its calls until Flush() is called, so
+// that calls made on worker threads can be written in order.
+class CallOutput {
+public:
+    explicit CallOutput(hts::bcf::File *vcfout, bool buffered = false) :
+        vcfout_{vcfout}, buffered_{buffered} {
+    }
+
+    std::ostream& text() {
+        return buffered_ ? text_ : std::cout;
+    }
+
+    // the output vcf file, which may be null
+    hts::bcf::File* vcf() const { return vcfout_; }
+
+    // Returns an empty record to be filled in and passed to Write()
+    hts::bcf::Variant& NewRecord() {
+        assert(vcfout_ != nullptr);
+        if(num_records_ == records_.size()) {
+            records_.emplace_back(new hts::bcf::Variant{*vcfout_});
+        }
+        return *records_[num_records_];
+    }
+
+    void Write(hts::bcf::Variant &rec) {
+        assert(num_records_ < records_.size() && &rec == records_[num_records_].get());
+        if(buffered_) {
+            num_records_ += 1;
+            return;
+        }
+        vcfout_->WriteRecord(rec);
+        rec.Clear();
+    }
+
+    // Write the buffered calls
+    void Flush() {
+        if(!buffered_) {
+            return;
+        }
+        std::cout << text_.str();
+        text_.str(std::string{});
+        for(std::size_t i = 0; i < num_records_; ++i) {
+            vcfout_->WriteRecord(*records_[i]);
+            records_[i]->Clear();
+        }
+        num_records_ = 0;
+    }
+
+private:
+    hts::bcf::File *vcfout_;
+    bool buffered_;
+
+    std::ostringstream text_;
+    std::vector<std::unique_ptr<hts::bcf::Variant>> records_;
+    std::size_t num_records_{0};
+};
+
 // Calculate SNP DNM PP
-int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
-                   lookup_table_t &tgt, lookup_snp_t &lookup,
-                   hts::bcf::File *vcfout, parameters &params, Trio &trio);
+int trio_like_snp(const qcall_t &child, const qcall_t &mom, const qcall_t &dad, int flag,
+                  const lookup_table_t &tgt, const lookup_snp_t &lookup,
+                  CallOutput &output, const parameters &params, const Trio &trio);
 
 // Calculate INDEL DNM PP
-int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
-                     lookup_table_t &tgtIndel, lookup_indel_t &lookupIndel,
-                     hts::bcf::File *vcfout, parameters &params, Trio &trio);
+int trio_like_indel(const indel_t &child, const indel_t &mom, const indel_t &dad, int flag,
+                    const lookup_table_t &tgtIndel, const lookup_indel_t &lookupIndel,
+                    CallOutput &output, const parameters &params, const Trio &trio);
 
 // Calculate Pair PP
-void pair_like(pair_t &tumor, pair_t &normal,
-               lookup_table_t &tgtPair, lookup_pair_t &lookupPair,
-			   int flag, hts::bcf::File *vcfout,
-			   parameters &params, int &n_site_pass, Pair &pair);
+void pair_like(const pair_t &tumor, const pair_t &normal,
+               const lookup_table_t &tgtPair, const lookup_pair_t &lookupPair,
+               int flag, CallOutput &output,
+               const parameters &params, int &n_site_pass, const Pair &pair);
 
 
 #endif
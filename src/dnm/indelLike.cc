@@ -27,10 +27,8 @@
 #include "parser.h"
 //#include "newmatap.h"
 //#include "newmatio.h"
-#include <Eigen/Sparse>
-#include <Eigen/KroneckerProduct>
 #include "lookup.h"
-#include <boost/algorithm/string.hpp>
+#include "likeKernel.h"
 
 #define MIN_READ_DEPTH_INDEL 10
 
@@ -44,9 +42,9 @@ const float DELETION_INTERCEPT = -21.9313;
 using namespace std;
 
 // Calculate DNM and Null PP
-int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
-                     lookup_table_t &tgtIndel, lookup_indel_t &lookupIndel,
-                     hts::bcf::File *vcfout, parameters &params, Trio &trio) {
+int trio_like_indel(const indel_t &child, const indel_t &mom, const indel_t &dad, int flag,
+                    const lookup_table_t &tgtIndel, const lookup_indel_t &lookupIndel,
+                    CallOutput &output, const parameters &params, const Trio &trio) {
 
 	int RD_cutoff = params.RD_cutoff;
 	double pp_cutoff = params.PP_cutoff;
@@ -58,17 +56,7 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
         return 0;
     }
 
-    //Real a[3];
-    Real maxlike_null, maxlike_denovo, pp_null, pp_denovo, denom;
-    Matrix M(1, 3);
-    Matrix C(3, 1);
-    Matrix D(3, 1);
-    Matrix P(3, 3);
-    Matrix F(9, 3);
-    Matrix L(9, 3);
-    Matrix T(9, 3);
-    Matrix DN(9, 3);
-    Matrix PP(9, 3);
+    Real pp_null, pp_denovo;
     //int i, j, k, l;
     int coor = child.pos;
     char ref_name[50];
@@ -104,56 +92,41 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
 
     indel_mrate = mu_scale * indel_mrate;
 
+    // the lookup table is shared between threads, so the rates for this site
+    // are kept in a local matrix
+    IndelMatrix mrate;
     for(int j = 0; j < 9; j++) {
         for(int l = 0; l < 3; l++) {
             // hit is 0, 1 or 2 (number of indels in the trio config)
             new_indel_mrate = pow(indel_mrate, lookupIndel.hit(j, l));
-            lookupIndel.mrate(j, l) = new_indel_mrate;
+            mrate(j, l) = new_indel_mrate;
         }
     }
 
     //Load likelihood vectors
-    for(int j = 0; j < 3; ++j) {
-        M(0, j) = pow(10, -mom.lk[j] / 10.);
-    }
-
-    for(int j = 0; j < 3; ++j) {
-        D(j, 0) = pow(10, -dad.lk[j] / 10.);
-    }
-    for(int j = 0; j < 3; ++j) {
-        C(j, 0) = pow(10, -child.lk[j] / 10.);
-    }
-
-    P = kroneckerProduct(M, D);
-    F = kroneckerProduct(P, C);
-
-    // combine with transmission probs
-    T = F.cwiseProduct(lookupIndel.tp);
-
-    // combine with priors
-    L = T.cwiseProduct(lookupIndel.priors);
-
-    // combine with mutation rate
-    DN = L.cwiseProduct(lookupIndel.mrate);
-
-    // Find max likelihood of null configuration
-    PP = DN.cwiseProduct(lookupIndel.norm);
-    int i, j;
-    maxlike_null = PP.maxCoeff(&i, &j);
-
-
-    //Find max likelihood of de novo trio configuration
-    PP = DN.cwiseProduct(lookupIndel.denovo);
-    int k, l;
-    maxlike_denovo = PP.maxCoeff(&k, &l);
+    Real M[3], D[3], C[3];
+    phred_to_like(mom.lk, M);
+    phred_to_like(dad.lk, D);
+    phred_to_like(child.lk, C);
+
+    // combine with transmission probs, priors, and mutation rate, and find
+    // the max likelihoods of the null and de novo trio configurations
+    like_summary_t like = trio_like_kernel(M, D, C, lookupIndel.tp,
+        &lookupIndel.priors, mrate, lookupIndel.norm, lookupIndel.denovo);
+    const Real maxlike_null = like.maxlike_null;
+    const Real maxlike_denovo = like.maxlike_denovo;
+    const int i = like.null_row, j = like.null_col;
+    const int k = like.denovo_row, l = like.denovo_col;
 
     //make proper posterior probs
-    denom = DN.sum();
+    const Real denom = like.denom;
     pp_denovo = maxlike_denovo / denom; // denovo posterior probability
     pp_null = 1 - pp_denovo; // null posterior probability
 
     // Check for PP cutoff
     if(pp_denovo > pp_cutoff) {
+        std::ostream &out = output.text();
+        hts::bcf::File *vcfout = output.vcf();
 
 
 
@@ -169,32 +142,32 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
         }
 
 
-        cout << "DENOVO-INDEL CHILD_ID: " << child.id;
-        cout << " chr: " << ref_name;
-        cout << " pos: " << coor+1; 
-        cout << " ref: " << mom.ref_base;
-        cout << " alt: " << mom.alt;
-        cout << " maxlike_null: " << maxlike_null;
-        cout << " pp_null: " << pp_null;
-        cout << " tgt_null(child/mom/dad): " << tgtIndel[i][j];
-        cout << " snpcode: " << lookupIndel.snpcode(i, j);
-        cout << " code: " << lookupIndel.code(i, j);
-        cout << " maxlike_dnm: " << maxlike_denovo;
-        cout << " pp_dnm: " << pp_denovo;       
-        cout << " tgt_dnm(child/mom/dad): " << tgtIndel[k][l];
-        cout << " lookup: " << lookupIndel.code(k, l);
-        cout << " flag: " << flag;
-        cout << " READ_DEPTH child: " << child.depth;
-        cout << " dad: " << dad.depth;
-        cout << " mom: " << mom.depth;
-        cout << " MAPPING_QUALITY child: " << child.rms_mapQ;
-        cout << " dad: " << dad.rms_mapQ;
-        cout << " mom: " << mom.rms_mapQ;
-        cout << endl;
+        out << "DENOVO-INDEL CHILD_ID: " << child.id;
+        out << " chr: " << ref_name;
+        out << " pos: " << coor+1; 
+        out << " ref: " << mom.ref_base;
+        out << " alt: " << mom.alt;
+        out << " maxlike_null: " << maxlike_null;
+        out << " pp_null: " << pp_null;
+        out << " tgt_null(child/mom/dad): " << tgtIndel(i, j);
+        out << " snpcode: " << lookupIndel.snpcode(i, j);
+        out << " code: " << lookupIndel.code(i, j);
+        out << " maxlike_dnm: " << maxlike_denovo;
+        out << " pp_dnm: " << pp_denovo;       
+        out << " tgt_dnm(child/mom/dad): " << tgtIndel(k, l);
+        out << " lookup: " << lookupIndel.code(k, l);
+        out << " flag: " << flag;
+        out << " READ_DEPTH child: " << child.depth;
+        out << " dad: " << dad.depth;
+        out << " mom: " << mom.depth;
+        out << " MAPPING_QUALITY child: " << child.rms_mapQ;
+        out << " dad: " << dad.rms_mapQ;
+        out << " mom: " << mom.rms_mapQ;
+        out << endl;
 
 
         if(vcfout != nullptr) {
-            auto rec = vcfout->InitVariant();
+            auto &rec = output.NewRecord();
             unsigned int nsamples = vcfout->samples().second;
             rec.target(ref_name);
             rec.position(coor);
@@ -210,7 +183,7 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
             rec.update_info("INDELcode", static_cast<float>(lookupIndel.snpcode(i, j)));
 
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[trio.cpos] = tgtIndel[i][j];
+            null_configs[trio.cpos] = tgtIndel(i, j);
             rec.update_format("NULL_CONFIG(child/mom/dad)", null_configs);
 
             std::vector<float> pp_nulls(nsamples, hts::bcf::float_missing);
@@ -218,7 +191,7 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
             rec.update_format("PP_NULL", pp_nulls);
 
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[trio.cpos] = tgtIndel[k][l];
+            dnm_configs[trio.cpos] = tgtIndel(k, l);
             rec.update_format("DNM_CONFIG(child/mom/dad)", dnm_configs);
 
             std::vector<float> pp_denovos(nsamples, hts::bcf::float_missing);
@@ -251,24 +224,20 @@ int trio_like_indel(indel_t &child, indel_t &mom, indel_t &dad, int flag,
             mqs[trio.dpos] = dad.rms_mapQ;
             rec.update_format("MQ", mqs);
 
-            std::vector<std::string> configs;
-            boost::split(configs, tgtIndel[i][j], boost::is_any_of("/"));
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[trio.cpos] = configs[0];
-            null_configs[trio.mpos] = configs[1];
-            null_configs[trio.dpos] = configs[2];
+            null_configs[trio.cpos] = tgtIndel.genotype(i, j, 0);
+            null_configs[trio.mpos] = tgtIndel.genotype(i, j, 1);
+            null_configs[trio.dpos] = tgtIndel.genotype(i, j, 2);
             rec.update_format("NULL_CONFIG", null_configs);
 
-            boost::split(configs, tgtIndel[k][l], boost::is_any_of("/"));
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[trio.cpos] = configs[0];
-            dnm_configs[trio.mpos] = configs[1];
-            dnm_configs[trio.dpos] = configs[2];
+            dnm_configs[trio.cpos] = tgtIndel.genotype(k, l, 0);
+            dnm_configs[trio.mpos] = tgtIndel.genotype(k, l, 1);
+            dnm_configs[trio.dpos] = tgtIndel.genotype(k, l, 2);
             rec.update_format("DNM_CONFIG", dnm_configs);
 
 #endif
-            vcfout->WriteRecord(rec);
-            rec.Clear();
+            output.Write(rec);
         }
     }
 
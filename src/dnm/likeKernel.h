@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIKE_KERNEL_H_
+#define LIKE_KERNEL_H_
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <math.h>
+
+#include "lookup.h"
+
+// The most likely null and de novo configurations of a site, and the sum of
+// the likelihoods of all configurations.
+struct like_summary_t {
+    Real maxlike_null;
+    int null_row, null_col;
+    Real maxlike_denovo;
+    int denovo_row, denovo_col;
+    Real denom;
+};
+
+// Convert phred-scaled genotype likelihoods to probabilities
+template<int N>
+inline void phred_to_like(const int (&lk)[N], Real (&like)[N]) {
+    for(int a = 0; a < N; ++a) {
+        like[a] = pow(10, -lk[a] / 10.0);
+    }
+}
+
+// Calculate the summary of a trio in one pass over the lookup tables. The
+// likelihood of configuration (row, col) is
+//     mom[col]*dad[row/N]*child[row%N]*tp*prior*mrate,
+// which is the same as kroneckerProduct(kroneckerProduct(M, D), C) multiplied
+// by the tables. The products are taken in the same order, and cells are
+// visited in the same column-major order as Eigen's maxCoeff, so the maximums
+// and the rows and columns they are found in are unchanged. prior may be null.
+template<int N>
+like_summary_t trio_like_kernel(const Real (&mom)[N], const Real (&dad)[N],
+    const Real (&child)[N], const Eigen::Matrix<Real, N*N, N> &tp,
+    const Eigen::Matrix<Real, N*N, N> *prior, const Eigen::Matrix<Real, N*N, N> &mrate,
+    const Eigen::Matrix<Real, N*N, N> &norm, const Eigen::Matrix<Real, N*N, N> &denovo) {
+    like_summary_t result;
+    result.maxlike_null = -std::numeric_limits<Real>::infinity();
+    result.maxlike_denovo = -std::numeric_limits<Real>::infinity();
+    result.null_row = result.null_col = 0;
+    result.denovo_row = result.denovo_col = 0;
+    result.denom = 0.0;
+
+    for(int col = 0; col < N; ++col) {
+        for(int d = 0; d < N; ++d) {
+            const Real md = mom[col] * dad[d];
+            for(int c = 0; c < N; ++c) {
+                const int row = d * N + c;
+                Real x = md * child[c] * tp(row, col);
+                if(prior != nullptr) {
+                    x *= (*prior)(row, col);
+                }
+                x *= mrate(row, col);
+                result.denom += x;
+
+                Real y = x * norm(row, col);
+                if(y > result.maxlike_null) {
+                    result.maxlike_null = y;
+                    result.null_row = row;
+                    result.null_col = col;
+                }
+                y = x * denovo(row, col);
+                if(y > result.maxlike_denovo) {
+                    result.maxlike_denovo = y;
+                    result.denovo_row = row;
+                    result.denovo_col = col;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Calculate the summary of a tumor/normal pair in one pass over the lookup
+// table. The likelihood of configuration (row, col) is
+//     normal[col]*tumor[row]*priors.
+inline like_summary_t pair_like_kernel(const Real (&normal)[10],
+    const Real (&tumor)[10], const lookup_pair_t &lookup) {
+    like_summary_t result;
+    result.maxlike_null = -std::numeric_limits<Real>::infinity();
+    result.maxlike_denovo = -std::numeric_limits<Real>::infinity();
+    result.null_row = result.null_col = 0;
+    result.denovo_row = result.denovo_col = 0;
+    result.denom = 0.0;
+
+    for(int col = 0; col < 10; ++col) {
+        for(int row = 0; row < 10; ++row) {
+            Real x = normal[col] * tumor[row] * lookup.priors(row, col);
+            result.denom += x;
+
+            Real y = x * lookup.norm(row, col);
+            if(y > result.maxlike_null) {
+                result.maxlike_null = y;
+                result.null_row = row;
+                result.null_col = col;
+            }
+            y = x * lookup.denovo(row, col);
+            if(y > result.maxlike_denovo) {
+                result.maxlike_denovo = y;
+                result.denovo_row = row;
+                result.denovo_col = col;
+            }
+        }
+    }
+    return result;
+}
+
+#endif // LIKE_KERNEL_H_
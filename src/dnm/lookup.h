@@ -21,7 +21,12 @@
 #ifndef LOOKUP_H_
 #define LOOKUP_H_
 
+#include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
 #define WANT_STREAM       // include iostream and iomanipulators
 //#include "newmatap.h"
 //#include "newmatio.h"
@@ -38,7 +43,7 @@ typedef double Real;
 typedef Eigen::Matrix<Real, 100, 10> SNPMatrix;
 typedef Eigen::Matrix<Real, 9, 3> IndelMatrix;
 typedef Eigen::Matrix<Real, 10, 10> PairMatrix;
-// TODO: A hack to save time. Should replace Dynamic size with appropiate sizes. Used in the *Like.cc methods.
+// Dynamically sized matrix, used for debugging output in the *Like.cc methods.
 typedef Eigen::Matrix<Real, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 
 // Used to convert array to Eigen matrices in makeLookup.cc
@@ -46,7 +51,74 @@ typedef Eigen::Map<Eigen::Matrix<Real, 100, 10, Eigen::RowMajor> > mapSNPMatrix;
 typedef Eigen::Map<Eigen::Matrix<Real, 9, 3, Eigen::RowMajor> > mapIndelMatrix;
 typedef Eigen::Map<Eigen::Matrix<Real, 10, 10, Eigen::RowMajor> > mapPairMatrix;
 
-typedef std::vector<std::vector<std::string> > lookup_table_t;
+// Genotype labels of the configurations in a lookup table, e.g. "AC/AA/CC"
+// for the child, mom, and dad of a trio. Each label is stored as an integer
+// code with three bits per allele.
+class lookup_table_t {
+public:
+    lookup_table_t() = default;
+    lookup_table_t(int rows, int cols, int members) {
+        resize(rows, cols, members);
+    }
+
+    void resize(int rows, int cols, int members) {
+        assert(0 < members && members <= 5);
+        rows_ = rows;
+        cols_ = cols;
+        members_ = members;
+        codes_.assign(rows*cols, 0);
+    }
+
+    // Set the label of configuration (row, col)
+    void set(int row, int col, const std::string &label) {
+        assert(label.size() == 3*members_-1);
+        uint32_t code = 0;
+        for(int m = 0; m < members_; ++m) {
+            code |= (allele_code(label[3*m]) | allele_code(label[3*m+1]) << 3) << (6*m);
+        }
+        codes_[row*cols_+col] = code;
+    }
+
+    // The label of configuration (row, col)
+    std::string operator()(int row, int col) const {
+        std::string label;
+        for(int m = 0; m < members_; ++m) {
+            if(m > 0) {
+                label += '/';
+            }
+            label += genotype(row, col, m);
+        }
+        return label;
+    }
+
+    // The genotype of one member of configuration (row, col), e.g. "AC"
+    std::string genotype(int row, int col, int member) const {
+        uint32_t code = codes_[row*cols_+col] >> (6*member);
+        return {alleles()[code & 7], alleles()[(code >> 3) & 7]};
+    }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int members() const { return members_; }
+
+    // The codes of every configuration in row-major order
+    std::vector<uint32_t>& codes() { return codes_; }
+    const std::vector<uint32_t>& codes() const { return codes_; }
+
+private:
+    static const char* alleles() { return "ACGTRD"; }
+
+    static uint32_t allele_code(char a) {
+        const char *p = strchr(alleles(), a);
+        assert(p != nullptr && a != '\0');
+        return p - alleles();
+    }
+
+    int rows_{0};
+    int cols_{0};
+    int members_{0};
+    std::vector<uint32_t> codes_;
+};
 
 // SNP Lookup Table
 typedef struct {
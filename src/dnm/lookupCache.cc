@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lookupCache.h"
+
+#include <cassert>
+
+using dng::MatrixCache;
+using dng::CacheKey;
+
+namespace {
+// The genotype labels are stored as a matrix of their codes, which doubles
+// hold exactly
+Eigen::MatrixXd codes_to_matrix(const lookup_table_t &tgt) {
+    Eigen::MatrixXd m(tgt.rows(), tgt.cols());
+    for(int i = 0; i < tgt.rows(); ++i) {
+        for(int j = 0; j < tgt.cols(); ++j) {
+            m(i, j) = tgt.codes()[i*tgt.cols()+j];
+        }
+    }
+    return m;
+}
+
+bool matrix_to_codes(const Eigen::MatrixXd &m, int rows, int cols, int members,
+    lookup_table_t *tgt) {
+    if(m.rows() != rows || m.cols() != cols) {
+        return false;
+    }
+    tgt->resize(rows, cols, members);
+    for(int i = 0; i < rows; ++i) {
+        for(int j = 0; j < cols; ++j) {
+            tgt->codes()[i*cols+j] = static_cast<uint32_t>(m(i, j));
+        }
+    }
+    return true;
+}
+
+// Copy the matrices of an entry into tables of fixed size
+template<typename M>
+bool copy_tables(MatrixCache::entry_t::const_iterator first,
+    std::initializer_list<M*> tables) {
+    for(M *t : tables) {
+        if(first->rows() != t->rows() || first->cols() != t->cols()) {
+            return false;
+        }
+        *t = *first++;
+    }
+    return true;
+}
+} // anon namespace
+
+uint64_t lookup_cache_key(const parameters &params) {
+    CacheKey key;
+    key(std::string{"dng-dnm-lookup-1"});
+    key(params.snp_mrate)(params.poly_rate)(params.pair_mrate);
+    return key.value();
+}
+
+bool get_lookup(const MatrixCache &cache, uint64_t key, const std::string &model,
+    lookup_table_t *tgt, lookup_snp_t *lookup) {
+    assert(tgt != nullptr && lookup != nullptr);
+    MatrixCache::entry_t entry;
+    if(!cache.Get(key, "snp." + model, &entry) || entry.size() != 11) {
+        return false;
+    }
+    return matrix_to_codes(entry[0], 100, 10, 3, tgt) &&
+        copy_tables(entry.cbegin()+1, {&lookup->aref, &lookup->cref, &lookup->gref,
+            &lookup->tref, &lookup->snpcode, &lookup->tp, &lookup->code, &lookup->mrate,
+            &lookup->denovo, &lookup->norm});
+}
+
+bool get_lookup(const MatrixCache &cache, uint64_t key, const std::string &model,
+    lookup_table_t *tgt, lookup_indel_t *lookup) {
+    assert(tgt != nullptr && lookup != nullptr);
+    MatrixCache::entry_t entry;
+    if(!cache.Get(key, "indel." + model, &entry) || entry.size() != 8) {
+        return false;
+    }
+    // lookup->mrate is calculated for each site by trio_like_indel
+    return matrix_to_codes(entry[0], 9, 3, 3, tgt) &&
+        copy_tables(entry.cbegin()+1, {&lookup->priors, &lookup->snpcode, &lookup->tp,
+            &lookup->code, &lookup->denovo, &lookup->norm, &lookup->hit});
+}
+
+bool get_lookup(const MatrixCache &cache, uint64_t key,
+    lookup_table_t *tgt, lookup_pair_t *lookup) {
+    assert(tgt != nullptr && lookup != nullptr);
+    MatrixCache::entry_t entry;
+    if(!cache.Get(key, "pair", &entry) || entry.size() != 5) {
+        return false;
+    }
+    return matrix_to_codes(entry[0], 10, 10, 2, tgt) &&
+        copy_tables(entry.cbegin()+1, {&lookup->snpcode, &lookup->priors,
+            &lookup->denovo, &lookup->norm});
+}
+
+void put_lookup(MatrixCache *cache, uint64_t key, const std::string &model,
+    const lookup_table_t &tgt, const lookup_snp_t &lookup) {
+    assert(cache != nullptr);
+    cache->Put(key, "snp." + model, {codes_to_matrix(tgt), lookup.aref, lookup.cref,
+        lookup.gref, lookup.tref, lookup.snpcode, lookup.tp, lookup.code, lookup.mrate,
+        lookup.denovo, lookup.norm});
+}
+
+void put_lookup(MatrixCache *cache, uint64_t key, const std::string &model,
+    const lookup_table_t &tgt, const lookup_indel_t &lookup) {
+    assert(cache != nullptr);
+    cache->Put(key, "indel." + model, {codes_to_matrix(tgt), lookup.priors,
+        lookup.snpcode, lookup.tp, lookup.code, lookup.denovo, lookup.norm, lookup.hit});
+}
+
+void put_lookup(MatrixCache *cache, uint64_t key,
+    const lookup_table_t &tgt, const lookup_pair_t &lookup) {
+    assert(cache != nullptr);
+    cache->Put(key, "pair", {codes_to_matrix(tgt), lookup.snpcode, lookup.priors,
+        lookup.denovo, lookup.norm});
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LOOKUP_CACHE_H_
+#define LOOKUP_CACHE_H_
+
+#include <string>
+
+#include <dng/matrix_cache.h>
+
+#include "lookup.h"
+#include "denovogear.h"
+
+// Save and load the lookup tables of dng dnm with a MatrixCache. Tables are
+// stored under the name of their kind and model, e.g. "snp.XS", and the key
+// depends on the rates used to build them, so one cache file can hold the
+// tables of every model.
+
+uint64_t lookup_cache_key(const parameters &params);
+
+bool get_lookup(const dng::MatrixCache &cache, uint64_t key, const std::string &model,
+    lookup_table_t *tgt, lookup_snp_t *lookup);
+bool get_lookup(const dng::MatrixCache &cache, uint64_t key, const std::string &model,
+    lookup_table_t *tgt, lookup_indel_t *lookup);
+bool get_lookup(const dng::MatrixCache &cache, uint64_t key,
+    lookup_table_t *tgt, lookup_pair_t *lookup);
+
+void put_lookup(dng::MatrixCache *cache, uint64_t key, const std::string &model,
+    const lookup_table_t &tgt, const lookup_snp_t &lookup);
+void put_lookup(dng::MatrixCache *cache, uint64_t key, const std::string &model,
+    const lookup_table_t &tgt, const lookup_indel_t &lookup);
+void put_lookup(dng::MatrixCache *cache, uint64_t key,
+    const lookup_table_t &tgt, const lookup_pair_t &lookup);
+
+#endif // LOOKUP_CACHE_H_
@@ -66,8 +66,7 @@ int g_khit = 0;
 // Write to SNP Lookup table file and struct
 //void setSNPLines(ofstream& fout, vector<vector<string > > & tgt,
 //float lines[][1000]) -- OLD
-void setSNPLines(lookup_table_t &tgt, Real lines[][1000], int is_X) {
-    static int snp_index = 0, k = 0, l = 0;
+void setSNPLines(lookup_table_t &tgt, Real lines[][1000], int is_X, int l) {
     if(is_X == 1) {  // XS
 #ifdef LOOKUP_ENABLED
         fout_XSsnp << g_n_u_alleles << " " << g_inf << " " << g_t_prob << " " << g_gts
@@ -109,19 +108,14 @@ void setSNPLines(lookup_table_t &tgt, Real lines[][1000], int is_X) {
     lines[6][l] = g_priors[0];
     lines[7][l] = g_priors[1];
     lines[8][l] = g_priors[2];
-    lines[9][l++] = g_priors[3];
-    tgt[k][snp_index++] = g_gts;
-    if(snp_index == 10) {
-        k++;
-        snp_index = 0;
-    }
+    lines[9][l] = g_priors[3];
+    tgt.set(l / 10, l % 10, g_gts);
 }
 
 // Write to Indel lookup table file and struct
 //void setIndelLines(ofstream& fout, vector<vector<string > > & tgt,
 //float lines[][27]) - OLD
-void setIndelLines(lookup_table_t &tgt, Real lines[][27], int is_X) {
-    static int indel_index = 0, k = 0, l = 0;
+void setIndelLines(lookup_table_t &tgt, Real lines[][27], int is_X, int l) {
 
     if(is_X == 1) {  // XS
 #ifdef LOOKUP_ENABLED
@@ -152,12 +146,8 @@ void setIndelLines(lookup_table_t &tgt, Real lines[][27], int is_X) {
     lines[3][l] = g_khit;
     lines[4][l] = g_dflag;
     lines[5][l] = g_nflag;
-    lines[6][l++] = g_priors[0];
-    tgt[k][indel_index++] = g_gts;
-    if(indel_index == 3) {
-        k++;
-        indel_index = 0;
-    }
+    lines[6][l] = g_priors[0];
+    tgt.set(l / 3, l % 3, g_gts);
 
     if(is_X == 1) {  // XS
 #ifdef LOOKUP_ENABLED
@@ -331,6 +321,8 @@ void makeIndelLookup(double PolyRate, lookup_table_t &tgt,
 #endif
 
     int X = 0;
+    int line = 0; // the next line of the table
+    tgt.resize(9, 3, 3);
     g_PolyRate = PolyRate;
 
     Real lines[7][27];
@@ -506,7 +498,7 @@ void makeIndelLookup(double PolyRate, lookup_table_t &tgt,
                 }
 
                 //setIndelLines(fout, tgt, lines);
-                setIndelLines(tgt, lines, X);
+                setIndelLines(tgt, lines, X, line++);
             }
         }
     }
@@ -533,6 +525,8 @@ void makeSNPLookup(double SNPMrate, double PolyRate,
 #endif
 
     int X = 0;
+    int line = 0; // the next line of the table
+    tgt.resize(100, 10, 3);
     g_Mrate = SNPMrate;
     g_PolyRate = PolyRate;
 
@@ -592,7 +586,7 @@ void makeSNPLookup(double SNPMrate, double PolyRate,
                     g_dflag = false;
                     g_nflag = true;
                     //setSNPLines(fout, tgt, lines);
-                    setSNPLines(tgt, lines, X);
+                    setSNPLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -626,7 +620,7 @@ void makeSNPLookup(double SNPMrate, double PolyRate,
                         g_dflag = true;
                         g_nflag = false;
                     }
-                    setSNPLines(tgt, lines, X);
+                    setSNPLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -805,7 +799,7 @@ void makeSNPLookup(double SNPMrate, double PolyRate,
                     g_nflag = true;
                 }
                 //setSNPLines(fout, tgt, lines);	- OLD
-                setSNPLines(tgt, lines, X);
+                setSNPLines(tgt, lines, X, line++);
             }
         }
     }
@@ -835,6 +829,8 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
 #endif
 
     int X = 1;
+    int line = 0; // the next line of the table
+    tgt.resize(100, 10, 3);
     g_Mrate = SNPMrate;
     g_PolyRate = PolyRate;
 
@@ -892,7 +888,7 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
                     g_dflag = false;
                     g_nflag = true;
                     //setSNPLines(fout, tgt, lines);
-                    setSNPLines(tgt, lines, X);
+                    setSNPLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -917,7 +913,7 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -936,7 +932,7 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -950,7 +946,7 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
                     g_inf = 9;
                     g_dflag = false;
                     g_nflag = true;
-                    setSNPLines(tgt, lines, X);
+                    setSNPLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -1070,7 +1066,7 @@ void makeXSSNPLookup(double SNPMrate, double PolyRate,
                     g_nflag = true;
                 }
                 //setSNPLines(fout, tgt, lines);	- OLD
-                setSNPLines(tgt, lines, X);
+                setSNPLines(tgt, lines, X, line++);
             }
         }
     }
@@ -1099,6 +1095,8 @@ void makeXSIndelLookup(double PolyRate, lookup_table_t &tgt,
 #endif
 
     int X = 1;
+    int line = 0; // the next line of the table
+    tgt.resize(9, 3, 3);
     g_PolyRate = PolyRate;
 
     Real lines[7][27];
@@ -1159,7 +1157,7 @@ void makeXSIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -1176,7 +1174,7 @@ void makeXSIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -1188,7 +1186,7 @@ void makeXSIndelLookup(double PolyRate, lookup_table_t &tgt,
                     g_t_prob = 0.0;
                     g_dflag = false;
                     g_nflag = true;
-                    setIndelLines(tgt, lines, X);
+                    setIndelLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -1283,7 +1281,7 @@ void makeXSIndelLookup(double PolyRate, lookup_table_t &tgt,
                     g_nflag = true;
                 }
                 //setIndelLines(fout, tgt, lines);
-                setIndelLines(tgt, lines, X);
+                setIndelLines(tgt, lines, X, line++);
             }
         }
     }
@@ -1309,6 +1307,8 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
 #endif
 
     int X = 2;
+    int line = 0; // the next line of the table
+    tgt.resize(100, 10, 3);
     g_Mrate = SNPMrate;
     g_PolyRate = PolyRate;
 
@@ -1368,7 +1368,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                     g_dflag = false;
                     g_nflag = true;
                     //setSNPLines(fout, tgt, lines);
-                    setSNPLines(tgt, lines, X);
+                    setSNPLines(tgt, lines, X, line++);
                     continue;
                 }
 
@@ -1394,7 +1394,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -1413,7 +1413,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -1436,7 +1436,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -1452,7 +1452,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                         g_inf = 9;
                         g_dflag = false;
                         g_nflag = true;
-                        setSNPLines(tgt, lines, X);
+                        setSNPLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -1584,7 +1584,7 @@ void makeXDSNPLookup(double SNPMrate, double PolyRate, lookup_table_t &tgt,
                     g_nflag = true;
                 }
                 //setSNPLines(fout, tgt, lines);	- OLD
-                setSNPLines(tgt, lines, X);
+                setSNPLines(tgt, lines, X, line++);
             }
         }
     }
@@ -1614,6 +1614,8 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
 #endif
 
     int X = 2;
+    int line = 0; // the next line of the table
+    tgt.resize(9, 3, 3);
     g_PolyRate = PolyRate;
 
     Real lines[7][27];
@@ -1674,7 +1676,7 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -1691,7 +1693,7 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -1710,7 +1712,7 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
 
@@ -1724,7 +1726,7 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
                         g_t_prob = 0.0;
                         g_dflag = false;
                         g_nflag = true;
-                        setIndelLines(tgt, lines, X);
+                        setIndelLines(tgt, lines, X, line++);
                         continue;
                     }
                 }
@@ -1824,7 +1826,7 @@ void makeXDIndelLookup(double PolyRate, lookup_table_t &tgt,
                     g_nflag = true;
                 }
                 //setIndelLines(fout, tgt, lines);
-                setIndelLines(tgt, lines, X);
+                setIndelLines(tgt, lines, X, line++);
             }
         }
     }
@@ -1850,6 +1852,8 @@ void makePairedLookup(double pairMrate, lookup_table_t &tgt,
     fout_pair.precision(10);
 #endif
 
+    tgt.resize(10, 10, 2);
+
     Real d_flag[100], n_flag[100], codes[100], priors[100];
     std::string seq1[] = { "A", "A", "A", "A", "C", "C", "C", "G", "G", "T" };
     std::string seq2[] = { "A", "C", "G", "T", "C", "G", "T", "G", "T", "T" };
@@ -1881,7 +1885,7 @@ void makePairedLookup(double pairMrate, lookup_table_t &tgt,
             u_alleles.insert(seq2[tum]);
             //n_alleles[index] = u_alleles.size(); // number of unique alleles
             std::string alleles = seq1[nor] + seq2[nor] + seq1[tum] + seq2[tum];
-            tgt[tum][nor] = g_gts; // genotype string
+            tgt.set(tum, nor, g_gts); // genotype string
 
             codes[index] = -1;
             // set SNP code
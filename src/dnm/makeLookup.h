@@ -34,10 +34,9 @@ void getSNPPriors(std::string g_gts1, int n_uniqa);
 void makePairedLookup(double pairMrate, lookup_table_t &tgt,
                       lookup_pair_t &lookup);
 
-void setIndelLines(lookup_table_t &tgt, float lines[][27]);
+void setIndelLines(lookup_table_t &tgt, Real lines[][27], int is_X, int line);
 
-void setSNPLines(lookup_table_t &tgt,
-                 float lines[][1000]);
+void setSNPLines(lookup_table_t &tgt, Real lines[][1000], int is_X, int line);
 
 // SNP Lookup for the autosome model
 void makeSNPLookup(double SNPMrate, double PolyRate,
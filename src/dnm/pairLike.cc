@@ -25,11 +25,9 @@
 #include <string.h>
 #include "parser.h"
 #include "lookup.h"
+#include "likeKernel.h"
 //#include "newmatap.h"
 //#include "newmatio.h"
-#include <Eigen/Sparse>
-#include <Eigen/KroneckerProduct>
-#include <boost/algorithm/string.hpp>
 
 using namespace std;
 
@@ -37,9 +35,9 @@ using namespace std;
 //typedef Eigen::MatrixXd Matrix;
 
 // Calculate Pair PP
-void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
-               lookup_pair_t &lookupPair, int flag, /*vector<hts::bcf::File> &vcfout*/ hts::bcf::File *vcfout,
-               parameters &params, int &n_site_pass, Pair &pair) {
+void pair_like(const pair_t &tumor, const pair_t &normal, const lookup_table_t &tgtPair,
+               const lookup_pair_t &lookupPair, int flag, CallOutput &output,
+               const parameters &params, int &n_site_pass, const Pair &pair) {
 
 	int RD_cutoff = params.RD_cutoff;
 	double pp_cutoff = params.PP_cutoff;
@@ -50,57 +48,32 @@ void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
         return;
     }
     n_site_pass += 1;
-    //Real a[10];
-    Real maxlike_null, maxlike_denovo, pp_null, pp_denovo, denom;
-    Matrix N(1, 10);
-    Matrix T(10, 1);
-    Matrix P(10, 10);
-    Matrix DN(10, 10);
-    Matrix PP(100, 10);
-    int i, j, k, l;
+    Real pp_null, pp_denovo;
     int coor = tumor.pos;
     char ref_name[50];
     strcpy(ref_name, tumor.chr);  // Name of the reference sequence
 
-    //Load Likelihood matrices L(D|Gt) and L(D|Gn)
-    for(j = 0; j != 10; ++j) {
-        N(0, j) = pow(10, -normal.lk[j] / 10.);
-        //a[j] = pow(10, -normal.lk[j] / 10.);
-    }
-    //N << a;
-
-    for(j = 0; j != 10; ++j) {
-        T(j, 0) = pow(10, -tumor.lk[j] / 10.);
-        //a[j] = pow(10, -tumor.lk[j] / 10.);
-    }
-    //T << a;
-
-    P = kroneckerProduct(N, T);
-    //P = KP(N, T); // 10 * 10
-    // Combine transmission probs L(Gc | Gm, Gf)
-    DN = P.cwiseProduct(lookupPair.priors);
-    //DN = SP(P, lookupPair.priors); // 10 * 10
-
-
-    // Find max likelihood of null configuration
-    PP = DN.cwiseProduct(lookupPair.norm);
-    maxlike_null = PP.maxCoeff(&i, &j);
-    //PP = SP(DN, lookupPair.norm);   //zeroes out configurations with mendelian error
-    //maxlike_null = PP.maximum2(i, j);
-
-    // Find max likelihood of de novo trio configuration
-    PP = DN.cwiseProduct(lookupPair.denovo);
-    maxlike_denovo = PP.maxCoeff(&k, &l);
-    //PP = SP(DN, lookupPair.denovo);   //zeroes out configurations with mendelian inheritance
-    //maxlike_denovo = PP.maximum2(k, l);
+    //Load Likelihood vectors L(D|Gt) and L(D|Gn)
+    Real N[10], T[10];
+    phred_to_like(normal.lk, N);
+    phred_to_like(tumor.lk, T);
 
-    denom = DN.sum();
+    // Combine with the priors, and find the max likelihoods of the null and
+    // de novo configurations
+    like_summary_t like = pair_like_kernel(N, T, lookupPair);
+    const Real maxlike_null = like.maxlike_null;
+    const Real maxlike_denovo = like.maxlike_denovo;
+    const Real denom = like.denom;
+    const int i = like.null_row, j = like.null_col;
+    const int k = like.denovo_row, l = like.denovo_col;
 
     pp_denovo = maxlike_denovo / denom; // denovo posterior probability
     pp_null = 1 - pp_denovo; // null posterior probability
 
     // Check for PP cutoff
     if(pp_denovo > pp_cutoff) {
+        std::ostream &out = output.text();
+        hts::bcf::File *vcfout = output.vcf();
 
         //remove ",X" from alt, helps with VCF op.
         string alt = tumor.alt;
@@ -110,28 +83,28 @@ void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
         //    alt.replace(start, 2, "");
         //}
 
-        cout << "DENOVO-PAIR-SNP TUMOR_ID: " << tumor.id;
-	cout << " NORMAL_ID: " << normal.id;
-        cout << " chr: " << ref_name;
-	cout << " pos: " << coor+1;
-	cout << " ref: " << tumor.ref_base;
-	cout << " alt: " << alt;
-        cout << " maxlike_null: " << maxlike_null;
-	cout << " pp_null: " << pp_null;
-	cout << " tgt_null(normal/tumor): " << tgtPair[i][j];
-        cout << " maxlike_dnm: " << maxlike_denovo;
-	cout << " pp_dnm: " << pp_denovo;
-        cout << " tgt_dnm(normal/tumor): " << tgtPair[k][l]; 
-        cout << " READ_DEPTH tumor: " << tumor.depth;
-	cout << " normal: " << normal.depth;
-        cout << " MAPPING_QUALITY tumor: " << tumor.rms_mapQ;
-	cout << " normal: " << normal.rms_mapQ;
-        cout << " null_snpcode: " << lookupPair.snpcode(i, j);
-        cout << " dnm_snpcode: " << lookupPair.snpcode(k, l);
-        cout << endl;
+        out << "DENOVO-PAIR-SNP TUMOR_ID: " << tumor.id;
+	out << " NORMAL_ID: " << normal.id;
+        out << " chr: " << ref_name;
+	out << " pos: " << coor+1;
+	out << " ref: " << tumor.ref_base;
+	out << " alt: " << alt;
+        out << " maxlike_null: " << maxlike_null;
+	out << " pp_null: " << pp_null;
+	out << " tgt_null(normal/tumor): " << tgtPair(i, j);
+        out << " maxlike_dnm: " << maxlike_denovo;
+	out << " pp_dnm: " << pp_denovo;
+        out << " tgt_dnm(normal/tumor): " << tgtPair(k, l); 
+        out << " READ_DEPTH tumor: " << tumor.depth;
+	out << " normal: " << normal.depth;
+        out << " MAPPING_QUALITY tumor: " << tumor.rms_mapQ;
+	out << " normal: " << normal.rms_mapQ;
+        out << " null_snpcode: " << lookupPair.snpcode(i, j);
+        out << " dnm_snpcode: " << lookupPair.snpcode(k, l);
+        out << endl;
 
         if(vcfout != nullptr) {
-            auto rec = vcfout->InitVariant();
+            auto &rec = output.NewRecord();
             unsigned int nsamples = vcfout->samples().second;
             rec.target(ref_name);
             rec.position(coor);
@@ -144,7 +117,7 @@ void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
             rec.update_info("MQ_NORMAL", normal.rms_mapQ);
 
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[pair.tpos] = tgtPair[i][j];
+            null_configs[pair.tpos] = tgtPair(i, j);
             rec.update_format("NULL_CONFIG(normal/tumor)", null_configs);
 
             std::vector<float> pair_null_codes(nsamples, hts::bcf::float_missing);
@@ -160,7 +133,7 @@ void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
             rec.update_format("PP_NULL", pp_nulls);
 
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[pair.tpos] = tgtPair[k][l];
+            dnm_configs[pair.tpos] = tgtPair(k, l);
             rec.update_format("DNM_CONFIG(tumor/normal)", dnm_configs);
 
             std::vector<float> pp_denovos(nsamples, hts::bcf::float_missing);
@@ -194,22 +167,18 @@ void pair_like(pair_t &tumor, pair_t &normal, vector<vector<string> > &tgtPair,
             mqs[pair.tpos] = tumor.rms_mapQ;
             rec.update_format("MQ", mqs);
 
-            std::vector<std::string> configs;
-            boost::split(configs, tgtPair[i][j], boost::is_any_of("/"));
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[pair.npos] = configs[0];
-            null_configs[pair.tpos] = configs[1];
+            null_configs[pair.npos] = tgtPair.genotype(i, j, 0);
+            null_configs[pair.tpos] = tgtPair.genotype(i, j, 1);
             rec.update_format("NULL_CONFIG", null_configs);
 
-            boost::split(configs, tgtPair[k][l], boost::is_any_of("/"));
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[pair.npos] = configs[0];
-            dnm_configs[pair.tpos] = configs[1];
+            dnm_configs[pair.npos] = tgtPair.genotype(k, l, 0);
+            dnm_configs[pair.tpos] = tgtPair.genotype(k, l, 1);
             rec.update_format("DNM_CONFIG", dnm_configs);
 
 #endif
-            vcfout->WriteRecord(rec);
-            rec.Clear();
+            output.Write(rec);
         }
     }
 }
@@ -26,11 +26,9 @@
 #include <fstream>
 #include "parser.h"
 #include "lookup.h"
+#include "likeKernel.h"
 #include <string.h>
-#include <Eigen/Sparse>
-#include <Eigen/KroneckerProduct>
 #include <iomanip>
-#include <boost/algorithm/string.hpp>
 
 
 //using namespace dng::task;
@@ -49,9 +47,9 @@ inline void printMatrix(Matrix &m) {
 }
 
 // Calculate DNM and Null PP
-int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
-				   lookup_table_t &tgt, lookup_snp_t &lookup,
-                   hts::bcf::File *vcfout, parameters &params, Trio &trio) {
+int trio_like_snp(const qcall_t &child, const qcall_t &mom, const qcall_t &dad, int flag,
+                  const lookup_table_t &tgt, const lookup_snp_t &lookup,
+                  CallOutput &output, const parameters &params, const Trio &trio) {
 
 	int RD_cutoff = params.RD_cutoff;
 	double pp_cutoff = params.PP_cutoff;
@@ -61,103 +59,62 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
         return 0;
     }
 
-    Real maxlike_null, maxlike_denovo, pp_null, pp_denovo, denom;
-
-    Matrix M(1, 10);
-    Matrix C(10, 1);
-    Matrix D(10, 1);
-    Matrix P(10, 10);
-    Matrix F(100, 10);
-    Matrix L(100, 10);
-    Matrix T(100, 10);
-    Matrix DN(100, 10);
-    Matrix PP(100, 10);
-    int i, j, k, l;
+    Real pp_null, pp_denovo;
     int coor = child.pos;
     char ref_name[50];
     strcpy(ref_name, child.chr); // Name of the reference sequence
 
-    //Load Likelihood matrices L(D|Gm), L(D|Gd) and L(D|Gc)
-    for(size_t a = 0; a < 10; a++) {
-        M(0, a) = pow(10, -mom.lk[a] / 10.0);
-    }
-
-    for(size_t a = 0; a < 10; a++) {
-        D(a, 0) = pow(10, -dad.lk[a] / 10.0);
-    }
-
-    for(size_t a = 0; a < 10; a++) {
-        C(a, 0) = pow(10, -child.lk[a] / 10.0);
-    }
-
-    // Take the Kronecker products
-    P = kroneckerProduct(M, D);
-    F = kroneckerProduct(P, C);
+    //Load Likelihood vectors L(D|Gm), L(D|Gd) and L(D|Gc)
+    Real M[10], D[10], C[10];
+    phred_to_like(mom.lk, M);
+    phred_to_like(dad.lk, D);
+    phred_to_like(child.lk, C);
 
-    // Combine transmission probs L(Gc | Gm, Gf)
-    // Take the entry wise (aka Schur) product of the two matricies
-    T = F.cwiseProduct(lookup.tp);
-
-    // Combine prior L(Gm, Gf)
+    // Prior L(Gm, Gf)
+    const SNPMatrix *prior;
     switch(mom.ref_base) {
     case 'A':
-        L = T.cwiseProduct(lookup.aref);
+        prior = &lookup.aref;
         break;
     case 'C':
-        L = T.cwiseProduct(lookup.cref);
+        prior = &lookup.cref;
         break;
     case 'G':
-        L = T.cwiseProduct(lookup.gref);
+        prior = &lookup.gref;
         break;
     case 'T':
-        L = T.cwiseProduct(lookup.tref);
+        prior = &lookup.tref;
         break;
 
-    default: L = T; break;
+    default: prior = nullptr; break;
     }
 
-    DN = L.cwiseProduct(lookup.mrate);
-
-    // Find max likelihood of null configuration
-    PP = DN.cwiseProduct(lookup.norm);
-    maxlike_null = PP.maxCoeff(&i, &j);
-
-    // Find max likelihood of de novo trio configuration
-    PP = DN.cwiseProduct(lookup.denovo);
-    maxlike_denovo = PP.maxCoeff(&k, &l);
-
-    denom = DN.sum();
-
+    // Combine the likelihoods with the transmission probs L(Gc | Gm, Gf), the
+    // prior, and the mutation rates, and find the max likelihoods of the null
+    // and de novo trio configurations
+    like_summary_t like = trio_like_kernel(M, D, C, lookup.tp, prior,
+        lookup.mrate, lookup.norm, lookup.denovo);
+    const Real maxlike_null = like.maxlike_null;
+    const Real maxlike_denovo = like.maxlike_denovo;
+    const Real denom = like.denom;
+    const int i = like.null_row, j = like.null_col;
+    const int k = like.denovo_row, l = like.denovo_col;
 
 #ifdef DEBUG_ENABLED
     cout << "\n\nMOM\n\n";
-    cout << setw(10) << setprecision(10) << M;
+    cout << setw(10) << setprecision(10) << Eigen::Map<const Eigen::Matrix<Real, 1, 10>>(M);
     cout << "\n\nDAD\n\n";
-    cout << setw(10) << setprecision(10) << D;
+    cout << setw(10) << setprecision(10) << Eigen::Map<const Eigen::Matrix<Real, 10, 1>>(D);
     cout << "\n\nCHILD\n\n";
-    cout << setw(10) << setprecision(10) << C;
-    cout << "\n\nP = L(Gm, Gd)\n\n";
-    cout << setw(10) << setprecision(10) << P;
-    cout << "\n\nF = L(Gc, Gm, Gd)\n\n";
-    cout << setw(10) << setprecision(10) << F;
-    cout << "\n\nT = L(Gc, Gm, Gd) * L(Gc | Gm, Gf)\n\n";
-    cout << setw(10) << setprecision(10) << T;
+    cout << setw(10) << setprecision(10) << Eigen::Map<const Eigen::Matrix<Real, 10, 1>>(C);
     cout << "\n\nlookup.mrate\n\n";
     cout << setw(10) << setprecision(10) << lookup.mrate;
     cout << "\n\nlookup.norm\n\n";
     cout << setw(10) << setprecision(10) << lookup.norm;
     cout << "\n\nlookup.denovo\n\n";
     cout << setw(10) << setprecision(10) << lookup.denovo;
-    cout << "\n\nL = L(Gc, Gm, Gd) * L(Gc | Gm, Gf) * L(Gm, Gf)\n\n";
-    cout << setw(10) << setprecision(10) << L;
-    cout << "\n\nDN\n\n";
-    cout << setw(10) << setprecision(20) << DN;
-    cout << "\n\nPP normal\n\n";
-    cout << setw(10) << setprecision(20) << PP;
-    cout << "\n\nPP denovo\n\n";
-    cout << setw(10) << setprecision(20) << PP;
-    cout << "\nmax_normal i " << i << " j " << j << " GT " << tgt[i][j];
-    cout << "\nmax_denovo k " << k << " l " << l << " GT " << tgt[k][l];;
+    cout << "\nmax_normal i " << i << " j " << j << " GT " << tgt(i, j);
+    cout << "\nmax_denovo k " << k << " l " << l << " GT " << tgt(k, l);;
     cout << "\nDenom is " << denom;
 #endif
 
@@ -166,6 +123,8 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
 
     // Check for PP cutoff
     if(pp_denovo > pp_cutoff) {
+        std::ostream &out = output.text();
+        hts::bcf::File *vcfout = output.vcf();
 
         //remove ",X" from alt, helps with VCF op.
         string alt = mom.alt;
@@ -174,32 +133,32 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
             alt.replace(start, 2, "");
         }
 
-        cout << "DENOVO-SNP CHILD_ID: " << child.id;
-        cout << " chr: " << ref_name;
-        cout << " pos: " << coor+1;
-        cout << " ref: " << mom.ref_base;
-        cout << " alt: " << alt;
-        cout << " maxlike_null: " << maxlike_null;
-        cout << " pp_null: " << pp_null;
-        cout << " tgt_null(child/mom/dad): " << tgt[i][j];
-        cout << " snpcode: " << lookup.snpcode(i, j);
-        cout << " code: " << lookup.code(i, j);
-        cout << " maxlike_dnm: " << maxlike_denovo;
-        cout << " pp_dnm: " << pp_denovo;
-        cout << " tgt_dnm(child/mom/dad): " << tgt[k][l];
-        cout << " lookup: " << lookup.code(k, l);
-        cout << " flag: " << flag;
-        cout << " READ_DEPTH child: " << child.depth;
-        cout << " dad: " << dad.depth;
-        cout << " mom: " << mom.depth;
-        cout << " MAPPING_QUALITY child: " << child.rms_mapQ;
-        cout << " dad: " << dad.rms_mapQ;
-        cout << " mom: " << mom.rms_mapQ;
-        cout << endl;
+        out << "DENOVO-SNP CHILD_ID: " << child.id;
+        out << " chr: " << ref_name;
+        out << " pos: " << coor+1;
+        out << " ref: " << mom.ref_base;
+        out << " alt: " << alt;
+        out << " maxlike_null: " << maxlike_null;
+        out << " pp_null: " << pp_null;
+        out << " tgt_null(child/mom/dad): " << tgt(i, j);
+        out << " snpcode: " << lookup.snpcode(i, j);
+        out << " code: " << lookup.code(i, j);
+        out << " maxlike_dnm: " << maxlike_denovo;
+        out << " pp_dnm: " << pp_denovo;
+        out << " tgt_dnm(child/mom/dad): " << tgt(k, l);
+        out << " lookup: " << lookup.code(k, l);
+        out << " flag: " << flag;
+        out << " READ_DEPTH child: " << child.depth;
+        out << " dad: " << dad.depth;
+        out << " mom: " << mom.depth;
+        out << " MAPPING_QUALITY child: " << child.rms_mapQ;
+        out << " dad: " << dad.rms_mapQ;
+        out << " mom: " << mom.rms_mapQ;
+        out << endl;
 
         if(vcfout != nullptr) {
         	unsigned int nsamples = vcfout->samples().second;
-            auto rec = vcfout->InitVariant();
+            auto &rec = output.NewRecord();
             rec.target(ref_name);
             rec.position(coor);
             rec.update_alleles(std::string(1, mom.ref_base) + "," + alt);
@@ -227,19 +186,16 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
             mqs[trio.dpos] = dad.rms_mapQ;
             rec.update_format("MQ", mqs);
 
-            std::vector<std::string> configs;
-            boost::split(configs, tgt[i][j], boost::is_any_of("/"));
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[trio.cpos] = configs[0];
-            null_configs[trio.mpos] = configs[1];
-            null_configs[trio.dpos] = configs[2];
+            null_configs[trio.cpos] = tgt.genotype(i, j, 0);
+            null_configs[trio.mpos] = tgt.genotype(i, j, 1);
+            null_configs[trio.dpos] = tgt.genotype(i, j, 2);
             rec.update_format("NULL_CONFIG", null_configs);
 
-            boost::split(configs, tgt[k][l], boost::is_any_of("/"));
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[trio.cpos] = configs[0];
-            dnm_configs[trio.mpos] = configs[1];
-            dnm_configs[trio.dpos] = configs[2];
+            dnm_configs[trio.cpos] = tgt.genotype(k, l, 0);
+            dnm_configs[trio.mpos] = tgt.genotype(k, l, 1);
+            dnm_configs[trio.dpos] = tgt.genotype(k, l, 2);
             rec.update_format("DNM_CONFIG", dnm_configs);
 
 
@@ -253,7 +209,7 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
             rec.update_info("code", static_cast<float>(lookup.code(i, j)));
 
             std::vector<std::string> null_configs(nsamples, hts::bcf::str_missing);
-            null_configs[trio.cpos] = tgt[i][j];
+            null_configs[trio.cpos] = tgt(i, j);
             rec.update_format("NULL_CONFIG(child/mom/dad)", null_configs);
 
             std::vector<float> pp_nulls(nsamples, hts::bcf::float_missing);
@@ -265,7 +221,7 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
             rec.update_format("ML_NULL", maxlike_nulls);
 
             std::vector<std::string> dnm_configs(nsamples, hts::bcf::str_missing);
-            dnm_configs[trio.cpos] = tgt[k][l];
+            dnm_configs[trio.cpos] = tgt(k, l);
             rec.update_format("DNM_CONFIG(child/mom/dad)", dnm_configs);
 
             std::vector<float> pp_denovos(nsamples, hts::bcf::float_missing);
@@ -284,8 +240,7 @@ int trio_like_snp(qcall_t &child, qcall_t &mom, qcall_t &dad, int flag,
             mqs[trio.cpos] = child.rms_mapQ;
             rec.update_format("MQ", mqs);
 #endif
-            vcfout->WriteRecord(rec);
-            rec.Clear();
+            output.Write(rec);
         }
 
     }
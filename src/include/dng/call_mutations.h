@@ -32,10 +32,27 @@ namespace dng {
 
 class CallMutations : public Probability {
 public:
-    CallMutations(const RelationshipGraph &graph, params_t params);
+    CallMutations(const RelationshipGraph &graph, params_t params, MatrixCache *cache = nullptr);
 
     struct stats_t;
 
+    struct filter_counts_t {
+        uint64_t reference_only{0}; // no variation in the data
+        uint64_t quality_bound{0};  // upper bound of QUAL is below threshold
+        uint64_t quality{0};        // QUAL is below threshold
+        uint64_t mutq{0};           // MUTQ is below threshold
+        uint64_t passed{0};
+
+        filter_counts_t& operator+=(const filter_counts_t &other) {
+            reference_only += other.reference_only;
+            quality_bound += other.quality_bound;
+            quality += other.quality;
+            mutq += other.mutq;
+            passed += other.passed;
+            return *this;
+        }
+    };
+
     double PeelNoMutations();
 
     bool CalculateMutationStats(genotype::Mode mode, stats_t *stats);
@@ -54,15 +71,21 @@ public:
         all_variants_ = all;
     }
 
+    // Number of sites rejected at each stage of CalculateMutationStats
+    const filter_counts_t& filter_counts() const { return filter_counts_; }
+
 protected:
 
     double min_quality_{0};
     bool all_variants_{false};
 
+    filter_counts_t filter_counts_;
+
     matrices_t zero_mutation_matrices_;
     matrices_t one_mutation_matrices_;
     matrices_t oneplus_mutation_matrices_;
     matrices_t mean_mutation_matrices_;
+    fixed_matrices_t fixed_zero_mutation_matrices_;
 
     double one_mutation_prior_;
     double alt_freq_prior_; 
@@ -107,8 +130,7 @@ struct CallMutations::stats_t {
 
 inline
 double CallMutations::PeelNoMutations() {
-    const int matrix_index = work_.matrix_index;
-    return graph_.PeelForwards(work_, zero_mutation_matrices_[matrix_index]);
+    return PeelForwards(fixed_zero_mutation_matrices_);
 }
 
 } // namespace dng
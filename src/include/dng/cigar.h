@@ -83,6 +83,59 @@ inline uint64_t target_to_query(uint64_t target, uint64_t beg,
     return pos;
 }
 
+// Tracks the position of a read while a pileup moves along the target.
+// Moving forward only walks the cigar operations between the old and the new
+// target positions, so stepping a read through its whole alignment costs
+// O(length + operations) instead of O(length * operations) with
+// target_to_query. Seeking backwards restarts from the left-most edge.
+class Cursor {
+public:
+    Cursor() = default;
+
+    Cursor(uint64_t beg, cigar_t cigar) {
+        Reset(beg, cigar);
+    }
+
+    void Reset(uint64_t beg, cigar_t cigar) {
+        cigar_ = cigar;
+        op_ = cigar.first;
+        beg_ = beg;
+        op_beg_ = beg;
+        query_ = 0;
+    }
+
+    // Returns the same value as target_to_query(target, beg, cigar)
+    uint64_t Seek(uint64_t target) {
+        if(target < beg_) {
+            return -1;
+        }
+        if(target < op_beg_) {
+            op_ = cigar_.first;
+            op_beg_ = beg_;
+            query_ = 0;
+        }
+        for(; op_ != cigar_.second; ++op_) {
+            int type = bam_cigar_type(bam_cigar_op(*op_));
+            uint64_t len = bam_cigar_oplen(*op_);
+            uint64_t t = len * ((type & 2) / 2);
+            if(op_beg_ + t > target) {
+                return (type & 1) ? 2 * (query_ + (target - op_beg_))
+                                  : 2 * query_ - 1;
+            }
+            op_beg_ += t;
+            query_ += len * (type & 1);
+        }
+        return 2 * query_ - 1;
+    }
+
+private:
+    cigar_t cigar_{nullptr, nullptr};
+    const uint32_t *op_{nullptr}; // current operation
+    uint64_t beg_{0};    // left-most edge of the alignment
+    uint64_t op_beg_{0}; // target position of the current operation
+    uint64_t query_{0};  // query bases consumed before the current operation
+};
+
 } // namespace cigar
 } //namespace dng
 
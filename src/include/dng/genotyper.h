@@ -22,6 +22,9 @@
 #define DNG_GENOTYPER_H
 
 #include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <iostream>
@@ -88,9 +91,13 @@ class DirichletMultinomial {
 public:
     using depths_const_reference_type = dng::pileup::allele_depths_ref_t::const_reference;
 
+    static constexpr int DEFAULT_CACHE_SIZE = 512;
+
+    // Terms for depths below cache_size are calculated once, when the
+    // genotyper is constructed. Other depths are calculated when needed.
     DirichletMultinomial(double over_dispersion_hom, 
         double over_dispersion_het, double sequencing_bias,
-        double error_rate, double k_alleles);
+        double error_rate, double k_alleles, int cache_size = DEFAULT_CACHE_SIZE);
 
     template<typename Range>
     double operator()(const Range& ad, int num_obs_alleles, Mode mode, int ploidy,
@@ -101,6 +108,7 @@ public:
     double error_rate() const { return error_rate_; }
     double sequencing_bias() const { return sequencing_bias_; }
     double k_alleles() const { return k_alleles_; }
+    int cache_size() const { return cache_size_; }
 
 protected:
 
@@ -118,8 +126,8 @@ protected:
 
     using cache_t = std::vector<std::array<double,8>>;
     using pochhammers_t = std::array<detail::log_pochhammer,8>; 
-    static constexpr int CACHE_SIZE = 512;
-    cache_t cache_{CACHE_SIZE};
+    int cache_size_;
+    cache_t cache_;
     pochhammers_t pochhammers_;
 
     enum struct alpha {
@@ -132,7 +140,7 @@ protected:
         assert(n >= 0);
         int t = static_cast<int>(a);
         assert(0 <= t && t < 8);
-        return (n < CACHE_SIZE) ? cache_[n][t] : pochhammers_[t](n);
+        return (n < cache_size_) ? cache_[n][t] : pochhammers_[t](n);
     }
 
     friend std::array<double,8> detail::make_alphas(double over_dispersion_hom, 
@@ -248,6 +256,123 @@ double DirichletMultinomial::operator()(const Range &ad, int num_obs_alleles, Mo
 }
 
 
+// A bounded cache of genotype likelihoods, keyed by the allele depths of a
+// library, the number of observed alleles, the ploidy, and the mode. At
+// typical coverage a library only has a small number of distinct depths, so
+// most sites can skip the genotyper. The cache is direct-mapped and an entry
+// is replaced when another key maps to its slot.
+//
+// A cache is not thread-safe; each thread should use its own. Copies start
+// out empty.
+class LikelihoodCache {
+public:
+    static constexpr int MAX_DEPTHS = 5; // longer depth vectors are not cached
+    static constexpr int MAX_GENOTYPES = MAX_DEPTHS*(MAX_DEPTHS+1)/2;
+
+    explicit LikelihoodCache(std::size_t capacity = 4096) {
+        // round capacity up to a power of 2
+        capacity_ = 1;
+        while(capacity_ < capacity) {
+            capacity_ *= 2;
+        }
+    }
+    LikelihoodCache(const LikelihoodCache &other) : capacity_{other.capacity_} { }
+    LikelihoodCache(LikelihoodCache&&) = default;
+    LikelihoodCache& operator=(const LikelihoodCache &other) {
+        capacity_ = other.capacity_;
+        Clear();
+        hits_ = 0;
+        misses_ = 0;
+        return *this;
+    }
+    LikelihoodCache& operator=(LikelihoodCache&&) = default;
+
+    // Equivalent to gt(ad, num_obs_alleles, mode, ploidy, output)
+    template<typename G, typename Range>
+    double operator()(const G &gt, const Range &ad, int num_obs_alleles, Mode mode, int ploidy,
+        GenotypeArray *output);
+
+    void Clear() {
+        entries_.clear();
+        owner_ = nullptr;
+    }
+
+    std::size_t capacity() const { return capacity_; }
+    // Lookups that found and did not find their key. Lookups of keys that
+    // cannot be cached are not counted.
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    struct entry_t {
+        std::array<int32_t, MAX_DEPTHS> depths;
+        uint32_t meta{0}; // 0 if the entry is empty
+        int32_t size;
+        double scale;
+        std::array<double, MAX_GENOTYPES> values;
+    };
+
+    std::size_t capacity_;
+    std::vector<entry_t> entries_; // allocated on first use
+    const void *owner_{nullptr};   // genotyper that calculated the entries
+
+    uint64_t hits_{0};
+    uint64_t misses_{0};
+};
+
+template<typename G, typename Range>
+double LikelihoodCache::operator()(const G &gt, const Range &ad, int num_obs_alleles,
+    Mode mode, int ploidy, GenotypeArray *output) {
+    assert(output != nullptr);
+    // build the key
+    std::array<int32_t, MAX_DEPTHS> depths;
+    depths.fill(0);
+    int n = 0;
+    uint64_t h = UINT64_C(14695981039346656037);
+    for(auto d : ad) {
+        if(n == MAX_DEPTHS) {
+            return gt(ad, num_obs_alleles, mode, ploidy, output);
+        }
+        depths[n++] = d;
+        h = (h ^ static_cast<uint32_t>(d)) * UINT64_C(1099511628211);
+    }
+    if(num_obs_alleles > MAX_DEPTHS) {
+        return gt(ad, num_obs_alleles, mode, ploidy, output);
+    }
+    const uint32_t meta = 1 | (n << 1) | (num_obs_alleles << 4) | (ploidy << 8)
+        | (static_cast<uint32_t>(mode) << 12);
+    h = (h ^ meta) * UINT64_C(1099511628211);
+
+    if(owner_ != &gt) {
+        // entries calculated by another genotyper are not valid
+        entries_.clear();
+        owner_ = &gt;
+    }
+    if(entries_.empty()) {
+        entries_.resize(capacity_);
+    }
+    // finalize the hash so that every bit of the key affects the slot
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    entry_t &entry = entries_[h & (capacity_-1)];
+    if(entry.meta == meta && entry.depths == depths) {
+        hits_ += 1;
+        output->resize(entry.size);
+        std::copy_n(entry.values.begin(), entry.size, output->data());
+        return entry.scale;
+    }
+    misses_ += 1;
+    double scale = gt(ad, num_obs_alleles, mode, ploidy, output);
+    assert(output->size() <= MAX_GENOTYPES);
+    entry.depths = depths;
+    entry.meta = meta;
+    entry.size = output->size();
+    entry.scale = scale;
+    std::copy_n(output->data(), output->size(), entry.values.begin());
+    return scale;
+}
+
 } // namespace genotype
 
 using Genotyper = genotype::DirichletMultinomial;
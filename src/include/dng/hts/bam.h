@@ -84,6 +84,8 @@ public:
 
     inline uint32_t target_id() const { return core.tid; }
     inline uint32_t position() const { return core.pos; }
+    // 0-based position one past the last reference base covered by the read
+    inline uint32_t end_position() const { return bam_endpos(base()); }
     inline uint32_t map_qual() const { return core.qual; }
     inline uint32_t mate_target_id() const { return core.mtid; }
     inline uint32_t mate_position() const { return core.mpos; }
@@ -184,8 +186,7 @@ public:
             if(ret < 0) {
                 break;
             }
-            if(p->is_any(BAM_FUNMAP | BAM_FQCFAIL | BAM_FDUP
-                | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) {
+            if(p->is_any(filter_flags_)) {
                 continue;
             }
             if(p->map_qual() < min_mapQ_) {
@@ -240,6 +241,11 @@ public:
         iter_.reset(nullptr);
     }
 
+    // Reads with any of these flags are skipped by Read
+    void SetFilterFlags(uint16_t flags) {
+        filter_flags_ = flags;
+    }
+
     std::vector<std::pair<const char *, int>> contigs() const;
 
 protected:
@@ -248,6 +254,8 @@ protected:
     std::unique_ptr<hts_idx_t, void(*)(hts_idx_t *)> idx_;  // The current iterator
 
     int min_mapQ_; // mapQ filter
+    uint16_t filter_flags_{BAM_FUNMAP | BAM_FQCFAIL | BAM_FDUP
+        | BAM_FSECONDARY | BAM_FSUPPLEMENTARY}; // flag filter
 };
 
 
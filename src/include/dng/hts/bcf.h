@@ -23,9 +23,12 @@
 
 #include "hts.h"
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <set>
+#include <memory>
+#include <stdexcept>
 #include <cstdlib>
 #include <iostream>
 #include <type_traits>
@@ -224,6 +227,23 @@ int get_info_int32(const bcf_hdr_t *header, BareVariant *record, const char *tag
 
 class File;
 
+// Buffers used by Variant::TrimAlleles that can be reused between records
+struct trim_buffers_t {
+    trim_buffers_t() = default;
+    // the contents are scratch space, so copies start out empty
+    trim_buffers_t(const trim_buffers_t&) { }
+    trim_buffers_t(trim_buffers_t&&) = default;
+    trim_buffers_t& operator=(const trim_buffers_t&) { return *this; }
+    trim_buffers_t& operator=(trim_buffers_t&&) = default;
+
+    buffer_t<int32_t> gt;
+    int gt_capacity{0};
+    buffer_t<float> gp;
+    int gp_capacity{0};
+    std::vector<unsigned char> allele_seen;
+    std::vector<float> allele_freq;
+};
+
 class Variant : protected BareVariant {
 public:
     Variant() = default;
@@ -302,7 +322,11 @@ public:
         return bcf_update_alleles(header(), base(), alleles, num_alleles);
     }
 
-    bool TrimAlleles(double af_min=0.0);
+    bool TrimAlleles(double af_min, trim_buffers_t *buffers);
+    bool TrimAlleles(double af_min=0.0) {
+        trim_buffers_t buffers;
+        return TrimAlleles(af_min, &buffers);
+    }
 
     /**
      * info() - Add another key=Value pair to the INFO field
@@ -550,10 +574,26 @@ public:
         bcf_write(handle(), header(), rec);
     }
 
-    void ReadRecord(Variant *rec) {
+    /** Returns 0 on success, -1 at the end of the file, and < -1 on error */
+    int ReadRecord(Variant *rec) {
         assert(rec != nullptr);
         assert(rec->header() == header());
-        bcf_read(handle(), header(), rec);        
+        return bcf_read(handle(), header(), rec);
+    }
+
+    /** Copies the remaining records of another file, which must have been
+        written with the same header lines, to the end of this file. */
+    void AppendRecords(File *in) {
+        assert(in != nullptr);
+        std::unique_ptr<BareVariant, void(*)(BareVariant*)> rec{bcf_init(), bcf_destroy};
+        int ret;
+        while((ret = bcf_read(in->handle(), in->header(), rec.get())) == 0) {
+            bcf_write(handle(), header(), rec.get());
+        }
+        if(ret < -1) {
+            throw std::runtime_error("unable to read records from '" + std::string(
+                                         in->name()) + "'.");
+        }
     }
 
     /** Explicity closes the file and flushes the stream */
@@ -758,27 +798,27 @@ int bcf_remove_allele_set<int,void>(const bcf_hdr_t *header, bcf1_t *line, const
 };
 
 inline
-bool Variant::TrimAlleles(double af_min) {
+bool Variant::TrimAlleles(double af_min, trim_buffers_t *buffers) {
+    assert(buffers != nullptr);
     // Determine if any alleles can be dropped
-    std::vector<unsigned char> allele_seen(num_alleles(), 0);
+    auto &allele_seen = buffers->allele_seen;
+    allele_seen.assign(num_alleles(), 0);
     // Identify Genotypes
     const int num_vars = num_alleles();
     const int num_cols = num_samples();
-    int gt_sz = 2*num_cols;
-    auto gt_buffer = make_buffer<int32_t>(gt_sz);
-    int gt_n = get_genotypes(&gt_buffer, &gt_sz);
+    const auto &gt_buffer = buffers->gt;
+    int gt_n = get_genotypes(&buffers->gt, &buffers->gt_capacity);
     if(gt_n <= 0) {
         return false; // Failure: there are no GT values
     }
     const int gt_width = gt_n/num_cols;
 
     int num_diploid_gts = num_vars*(num_vars+1)/2;
-    int gp_sz = num_cols*num_diploid_gts;
-    auto gp_buffer = make_buffer<float>(gp_sz);
-    int gp_n = get_format("GP", &gp_buffer, &gp_sz);
+    const auto &gp_buffer = buffers->gp;
+    int gp_n = get_format("GP", &buffers->gp, &buffers->gp_capacity);
     const int gp_width = gp_n/num_cols;
 
-    std::vector<float> ftemp;
+    auto &ftemp = buffers->allele_freq;
     for(int i=0; i<num_cols; ++i) {
         int j = 0;
         for(; j<gt_width; ++j) {
@@ -835,6 +875,11 @@ bool Variant::TrimAlleles(double af_min) {
         }
     }
 
+    // The reference is never removed
+    if(std::find(allele_seen.begin()+1, allele_seen.end(), 0) == allele_seen.end()) {
+        return true;
+    }
+
     std::unique_ptr<kbitset_t,decltype(&kbs_destroy)>
         rm_set(kbs_init(allele_seen.size()), kbs_destroy);
     for(int a=0; a<allele_seen.size(); ++a) {
@@ -27,9 +27,64 @@
 #include <cstring>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+
+#ifdef DNG_HTS_THREAD_POOL
+#include <htslib/thread_pool.h>
+#endif
 
 namespace hts {
 
+// A pool of threads that is shared by files for compression and decompression.
+// It must outlive every file that uses it. If htslib does not support shared
+// pools, each file starts num_threads threads of its own instead.
+class ThreadPool {
+public:
+    explicit ThreadPool(int num_threads) : num_threads_{num_threads} {
+#ifdef DNG_HTS_THREAD_POOL
+        if(num_threads_ > 0) {
+            pool_.pool = hts_tpool_init(num_threads_);
+            if(pool_.pool == nullptr) {
+                throw std::runtime_error("unable to start " + std::to_string(num_threads_)
+                    + " threads for reading and writing files.");
+            }
+        }
+#endif
+    }
+
+    ~ThreadPool() {
+#ifdef DNG_HTS_THREAD_POOL
+        if(pool_.pool != nullptr) {
+            hts_tpool_destroy(pool_.pool);
+        }
+#endif
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int num_threads() const { return num_threads_; }
+
+    // Use the threads of this pool to compress or decompress fp
+    int Attach(htsFile *fp) {
+        assert(fp != nullptr);
+        if(num_threads_ <= 0) {
+            return 0;
+        }
+#ifdef DNG_HTS_THREAD_POOL
+        return hts_set_thread_pool(fp, &pool_);
+#else
+        return hts_set_threads(fp, num_threads_);
+#endif
+    }
+
+private:
+    int num_threads_;
+#ifdef DNG_HTS_THREAD_POOL
+    htsThreadPool pool_{nullptr, 0};
+#endif
+};
+
 class File {
 public:
     File(const char *file, const char *mode) :
@@ -41,6 +96,10 @@ public:
     int SetThreads(int n) {
         return hts_set_threads(handle(), n);
     }
+    int SetThreadPool(ThreadPool *pool) {
+        assert(pool != nullptr);
+        return pool->Attach(handle());
+    }
 
     bool is_open() const { return (bool)fp_; }
     bool is_bin() const { return handle()->is_bin; }
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DNG_IO_AD_H
+#define DNG_IO_AD_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#include <dng/depths.h>
+#include <dng/library.h>
+#include <dng/regions.h>
+#include <dng/utility.h>
+#include <dng/io/file.h>
+#include <dng/io/utility.h>
+
+#include <boost/range/begin.hpp>
+#include <boost/range/end.hpp>
+
+namespace dng {
+namespace io {
+
+// Binary allele-depth files (.ad) store the depths of every library at the
+// sites of a pileup, so that the pileup can be made once and used many times.
+//
+//   header: magic, contigs (name and length), libraries (name and sample)
+//   blocks: number of sites, uncompressed size, compressed size, and data
+//   index:  first location, last location, offset, and number of sites of
+//           every block
+//   footer: offset of the index and the magic
+//
+// Block data is zlib compressed and stores its sites by column: location
+// deltas, allele codes, and depths in library-major order. All integers,
+// except the footer, are varints.
+
+// A site in an ad file
+struct ad_site_t {
+    utility::location_t location;
+    std::vector<int> indexes;       // nucleotide index of each allele, reference first
+    pileup::allele_depths_t depths; // libraries x alleles
+};
+
+namespace detail {
+// Location range and file offset of a block
+struct ad_block_t {
+    utility::location_t first;
+    utility::location_t last;
+    uint64_t offset;
+    uint64_t num_sites;
+};
+
+// Pack up to 5 nucleotide indexes into an integer
+uint64_t encode_ad_alleles(const int *indexes, size_t num_alleles);
+// Returns the number of alleles and unpacks their indexes
+size_t decode_ad_alleles(uint64_t code, std::vector<int> *indexes);
+} // namespace detail
+
+class AdWriter {
+public:
+    // Sites are compressed in blocks of block_size sites
+    explicit AdWriter(const std::string &filename, size_t block_size = 4096);
+    ~AdWriter();
+
+    AdWriter(AdWriter&&) = default;
+    AdWriter& operator=(AdWriter&&) = default;
+
+    void WriteHeader(const std::vector<regions::contig_t> &contigs,
+        const libraries_t &libraries);
+
+    // Add a site. Locations must be increasing, and only the first
+    // depths.shape()[1] indexes are used.
+    void Write(utility::location_t location, const std::vector<int> &indexes,
+        const pileup::allele_depths_t &depths);
+
+    // Write the last block and the index. Called by the destructor if needed.
+    void Close();
+
+private:
+    void WriteBlock();
+    void WriteBuffer(std::stringbuf *buffer);
+    void WriteBytes(const char *data, size_t size);
+
+    BinaryFile file_;
+    std::string filename_;
+    size_t block_size_;
+    size_t num_libraries_{0};
+    bool is_closed_{false};
+
+    uint64_t offset_{0}; // bytes written so far
+    std::vector<detail::ad_block_t> index_;
+
+    // columns of the current block
+    size_t num_sites_{0};
+    utility::location_t first_location_{0};
+    utility::location_t last_location_{0};
+    std::stringbuf locations_, alleles_, depths_;
+    std::string compressed_;
+};
+
+class AdPileup {
+public:
+    using data_type = ad_site_t;
+
+    explicit AdPileup(const std::string &filename);
+
+    AdPileup(AdPileup&&) = default;
+    AdPileup& operator=(AdPileup&&) = default;
+
+    template<typename R>
+    void SelectLibraries(R &range);
+
+    void ResetLibraries();
+
+    // Only read the sites in regions. Uses the index to skip blocks.
+    void SetRegions(regions::ranges_t regions) {
+        regions_ = std::move(regions);
+    }
+
+    const std::vector<regions::contig_t>& contigs() const {
+        return contigs_;
+    }
+
+    const libraries_t& libraries() const {
+        return output_libraries_;
+    }
+    size_t num_libraries() const {
+        return output_libraries_.names.size();
+    }
+
+    size_t num_blocks() const {
+        return index_.size();
+    }
+
+    // Call func(const data_type &) on every site in the regions
+    template<typename CallBack>
+    void operator()(CallBack func);
+
+    // Seconds spent reading and decompressing blocks
+    std::vector<file_time_t> read_times() const {
+        return {{filename_, std::chrono::duration<double>(read_time_).count()}};
+    }
+
+    template<typename A>
+    static AdPileup open_and_setup(const A& arg);
+
+private:
+    void ReadBlock(size_t b);
+    void MakeSite(size_t i);
+    size_t FindSite(utility::location_t loc) const;
+
+    BinaryFile file_;
+    std::string filename_;
+    std::chrono::steady_clock::duration read_time_{0};
+
+    std::vector<regions::contig_t> contigs_;
+    libraries_t input_libraries_;
+    libraries_t output_libraries_;
+    std::vector<size_t> selected_; // input index of each output library
+
+    std::vector<detail::ad_block_t> index_;
+    regions::ranges_t regions_;
+
+    // the decoded sites of the current block
+    size_t current_block_{static_cast<size_t>(-1)};
+    std::vector<utility::location_t> locations_;
+    std::vector<uint64_t> alleles_;
+    std::vector<size_t> depth_offsets_;
+    std::vector<int32_t> depths_;
+    std::string buffer_, data_;
+
+    ad_site_t site_;
+};
+
+template<typename R>
+void AdPileup::SelectLibraries(R &range) {
+    output_libraries_ = {};
+    selected_.clear();
+    for(auto it = boost::begin(range); it != boost::end(range); ++it) {
+        auto pos = utility::find_position(input_libraries_.names, *it);
+        if(pos == input_libraries_.names.size()) {
+            // Do nothing if library was not found.
+            continue;
+        }
+        output_libraries_.names.push_back(input_libraries_.names[pos]);
+        output_libraries_.samples.push_back(input_libraries_.samples[pos]);
+        selected_.push_back(pos);
+    }
+}
+
+template<typename CallBack>
+void AdPileup::operator()(CallBack func) {
+    if(regions_.empty()) {
+        for(size_t b = 0; b < index_.size(); ++b) {
+            ReadBlock(b);
+            for(size_t i = 0; i < locations_.size(); ++i) {
+                MakeSite(i);
+                func(site_);
+            }
+        }
+        return;
+    }
+    for(auto && range : regions_) {
+        // first block that can contain range.beg
+        auto it = std::partition_point(index_.begin(), index_.end(),
+            [&range](const detail::ad_block_t &block) { return block.last < range.beg; });
+        for(size_t b = it - index_.begin(); b < index_.size() && index_[b].first < range.end; ++b) {
+            ReadBlock(b);
+            for(size_t i = FindSite(range.beg); i < locations_.size(); ++i) {
+                if(locations_[i] >= range.end) {
+                    break;
+                }
+                MakeSite(i);
+                func(site_);
+            }
+        }
+    }
+}
+
+template<typename A>
+inline
+AdPileup AdPileup::open_and_setup(const A& arg) {
+    if(arg.input.size() > 1) {
+        throw std::invalid_argument("processing more than one ad file at a time is not supported.");
+    }
+    AdPileup mpileup{utility::extract_file_type(arg.input[0]).path};
+
+    // Load contigs into an index
+    regions::ContigIndex index;
+    for(auto && a : mpileup.contigs()) {
+        index.AddContig(a);
+    }
+    regions::set_regions(arg.region, index, &mpileup);
+
+    return mpileup;
+}
+
+} // namespace io
+} // namespace dng
+
+#endif // DNG_IO_AD_H
@@ -22,7 +22,14 @@
 #define DNG_IO_BAM_H
 
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <cstring>
+#include <string>
 #include <queue>
+#include <chrono>
 #include <unordered_map>
 #include <utility>
 
@@ -39,22 +46,26 @@
 #include <dng/depths.h>
 #include <dng/utility.h>
 #include <dng/seq.h>
+#include <dng/io/utility.h>
 
 #include <dng/hts/bam.h>
+#include <dng/cigar.h>
 
 #include <dng/detail/unit_test.h>
 
 namespace dng {
 namespace io {
 
-struct bam_record_t : public PoolNode {
+struct bam_record_t : public ConcurrentPoolNode {
     hts::bam::Alignment aln; // sequence record
     utility::location_t beg; // 0-based left-most edge, [beg,end)
     utility::location_t end; // 0-based right-most edge, [beg,end)
     utility::location_t pos; // current position of the pileup in this query/read
     bool is_missing; // is there no base call at the pileup position?
+    int library; // library of the read, or -1 if its read group is unknown
 
     hts::bam::cigar_t cigar; // cigar
+    cigar::Cursor cursor;    // tracks pos as the pileup advances
     hts::bam::data_t seq;    // encoded sequence
     hts::bam::data_t qual;   // quality scores
 
@@ -70,19 +81,112 @@ struct bam_record_t : public PoolNode {
 };
 
 namespace detail {
-using BamPool = IntrusivePool<bam_record_t>; 
+using ConcurrentBamPool = ConcurrentPool<bam_record_t>;
+
+// Maps read group IDs to library indexes. Lookups hash the ID in place and
+// compare it against the stored IDs, so no strings are created per read.
+class ReadGroupTable {
+public:
+    ReadGroupTable() = default;
+
+    // Add id, which must not already be in the table
+    void Add(const std::string &id, int library);
+
+    // Returns the library of id, or -1 if id is not in the table
+    int Find(const char *id) const {
+        assert(id != nullptr);
+        if(slots_.empty()) {
+            return -1;
+        }
+        uint64_t h = hash(id);
+        for(size_t i = h & mask_; ; i = (i+1) & mask_) {
+            const auto &slot = slots_[i];
+            if(slot.library == EMPTY) {
+                return -1;
+            }
+            if(slot.hash == h && std::strcmp(slot.id.c_str(), id) == 0) {
+                return slot.library;
+            }
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    // FNV-1a
+    static uint64_t hash(const char *str) {
+        uint64_t h = 14695981039346656037ULL;
+        for(; *str != '\0'; ++str) {
+            h = (h ^ static_cast<unsigned char>(*str)) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+private:
+    static constexpr int EMPTY = -2;
+
+    struct slot_t {
+        uint64_t hash;
+        std::string id;
+        int library{EMPTY};
+    };
+    std::vector<slot_t> slots_; // open addressing, at most half full
+    size_t mask_{0};
+    size_t size_{0};
+};
+
+// IDs of the read groups in the @RG lines of a sam header
+std::vector<std::string> parse_read_group_ids(const char *text);
+
+// Base counts of the positions in a pileup window. Each read is decoded once,
+// when it enters the pileup, and its bases are added to the positions that it
+// covers. Positions are stored in a ring buffer that grows to fit the longest
+// read, and a position is removed when the pileup moves past it.
+class ColumnDepths {
+public:
+    typedef std::array<int,5> counts_t;
+
+    void Reset(size_t num_libraries);
+
+    // Add the bases of read r at positions >= from to library
+    void Add(size_t library, const bam_record_t &r, utility::location_t from,
+        int min_basequal);
+
+    // Remove all positions before loc
+    void Advance(utility::location_t loc);
+
+    const counts_t& operator()(size_t library, utility::location_t loc) const {
+        assert(first_ <= loc && loc < first_ + capacity_);
+        return counts_[(loc & (capacity_-1))*num_libraries_ + library];
+    }
+
+    // The counts of every library at loc, which are stored contiguously
+    const counts_t* column(utility::location_t loc) const {
+        assert(first_ <= loc && loc < first_ + capacity_);
+        return &counts_[(loc & (capacity_-1))*num_libraries_];
+    }
+
+    size_t num_libraries() const { return num_libraries_; }
+
+private:
+    void Grow(size_t width);
+
+    utility::location_t first_{0}; // first position in the window
+    size_t capacity_{0};           // number of positions, a power of 2
+    size_t num_libraries_{0};
+    std::vector<counts_t> counts_; // capacity_ x num_libraries_
+};
 
 class BamScan {
 public:
     typedef hts::bam::File File;
-    typedef detail::BamPool pool_type;
-    typedef pool_type::list_type list_type;
-    typedef pool_type::node_type node_type;
+    typedef detail::ConcurrentBamPool::Cache pool_type;
+    typedef bam_record_t node_type;
+    typedef boost::intrusive::list<node_type> list_type;
 
-    explicit BamScan(File in, int min_qlen = 0) : in_(std::move(in)), next_loc_{0},
-        min_qlen_{min_qlen} {}
+    explicit BamScan(File in, int min_qlen = 0);
 
-    BamScan(BamScan&&) = default;
+    BamScan(BamScan&&);
+    ~BamScan();
 
     list_type operator()(utility::location_t target_loc, pool_type &pool);
 
@@ -90,20 +194,66 @@ public:
 
     const File& file() const { return in_; }
 
-    void SetRegion(const regions::range_t &region) {
-        int tid = utility::location_to_contig(region.beg);
-        assert( tid == utility::location_to_contig(region.end));
-        int beg = utility::location_to_position(region.beg);
-        int end = utility::location_to_position(region.end);
-        in_.SetRegion(tid, beg, end);
-        next_loc_ = 0;
-    }
+    // time spent reading records from the file
+    std::chrono::steady_clock::duration read_time() const;
+
+    // Resolve the library of each read when it is scanned. Reads whose read
+    // group is not in read_group_to_libraries are dropped. If the header of
+    // the file has only one read group, every read is assigned to its library
+    // without looking at the RG tag.
+    void SetLibraries(const utility::StringMap &read_group_to_libraries);
+
+    const std::vector<std::string>& read_group_ids() const { return read_group_ids_; }
+
+    void SetRegion(const regions::range_t &region);
+
+    // Read records on a background thread, which decodes up to queue_size
+    // records ahead of the pileup. Records are allocated from pool. The
+    // scanner must not be moved until StopThread() is called.
+    void StartThread(detail::ConcurrentBamPool &pool, size_t queue_size);
+    void StopThread();
+
+    bool has_thread() const { return reader_ != nullptr; }
 
 private:
+    struct reader_t;
+
+    void Read(utility::location_t target_loc, pool_type &pool);
+    void ReadFromThread(utility::location_t target_loc, pool_type &pool);
+
+    // Read the next record that passes the filters that do not depend on the
+    // pileup. Returns false at the end of the file or region.
+    bool ReadRecord(node_type *p);
+
+    // Run by the background thread
+    void ReaderLoop();
+
+    // Stop the background thread from reading and drop its queued records
+    void PauseThread();
+
+    int FindLibrary(hts::bam::Alignment *aln) const {
+        if(single_read_group_) {
+            return single_library_;
+        }
+        const uint8_t *rg = aln->aux_get("RG");
+        if(rg == nullptr) {
+            return -1;
+        }
+        return read_groups_.Find(reinterpret_cast<const char *>(rg + 1));
+    }
+
     File in_;
     utility::location_t next_loc_;
     list_type buffer_;
     int min_qlen_;
+    std::chrono::steady_clock::duration read_time_{0};
+
+    std::vector<std::string> read_group_ids_; // from the header
+    ReadGroupTable read_groups_;
+    bool single_read_group_{false};
+    int single_library_{-1};
+
+    std::unique_ptr<reader_t> reader_; // the background thread, if any
 };
 } // namespace detail
 
@@ -116,19 +266,21 @@ public:
     using data_type = std::vector<list_type>;
     using callback_type = void(const data_type &, utility::location_t);
 
+    using columns_type = detail::ColumnDepths;
+
     struct Alleles; // functor class for calculating depths from data_type
 
     template<typename CallBack>
     void operator()(CallBack func);
 
-    BamPileup(int min_qlen = 0, std::string lbtag = "LB") : pool_{4048}, min_qlen_{min_qlen},
+    BamPileup(int min_qlen = 0, std::string lbtag = "LB") :
+        node_pool_{new detail::ConcurrentBamPool}, pool_{*node_pool_}, min_qlen_{min_qlen},
         lbtag_{std::move(lbtag)} {
         if(lbtag_.empty()) {
             lbtag_ = "LB";
         }
     }
     BamPileup(BamPileup&&) = default;
-    BamPileup& operator=(BamPileup&&) = default;
 
     template<typename InFile>
     void AddFile(InFile&& f);
@@ -166,8 +318,42 @@ public:
         return ret;
     }
 
+    // Seconds spent reading records from each input file
+    std::vector<file_time_t> read_times() const {
+        std::vector<file_time_t> ret;
+        for(auto && s : scanners_) {
+            ret.push_back({s.file().name(),
+                std::chrono::duration<double>(s.read_time()).count()});
+        }
+        return ret;
+    }
+
+    // If io_pool is not null, its threads are used to decompress the inputs
     template<typename A>
-    static BamPileup open_and_setup(const A& arg);
+    static BamPileup open_and_setup(const A& arg, hts::ThreadPool *io_pool = nullptr);
+
+    // Enable the column-oriented pileup. Reads are decoded when they enter the
+    // pileup, and depths of bases with quality >= min_basequal are available
+    // from columns(). The positions of the reads passed to the callback are no
+    // longer updated at each location; call UpdateReads() before using them.
+    void EnableColumns(int min_basequal) {
+        use_columns_ = true;
+        column_min_basequal_ = min_basequal;
+    }
+
+    const columns_type& columns() const {
+        return columns_;
+    }
+
+    // Read each input file on its own thread while the pileup runs. Each
+    // thread decodes up to queue_size reads ahead of the pileup.
+    void EnableScanThreads(size_t queue_size = 1024) {
+        assert(queue_size > 0);
+        scan_queue_size_ = queue_size;
+    }
+
+    // Update the position of every read in the pileup to loc
+    const data_type& UpdateReads(utility::location_t loc);
 
 private:
     int Advance(regions::range_t *target_range);
@@ -180,11 +366,25 @@ private:
                 d.erase(it++);
                 pool_.Free(p);
             }
-        }    
+        }
+        for(auto & e : expiring_) {
+            e.clear();
+        }
+        if(use_columns_) {
+            columns_.Reset(num_libraries());
+        }
     }
 
+    // reads ordered by their right-most edge, used by the column pileup
+    typedef std::pair<utility::location_t, node_type*> expiring_t;
+    typedef std::vector<expiring_t> expiring_heap_t;
+    void ExpireReads(utility::location_t loc);
+
     boost::optional<regions::range_t> LoadNextRegion();
 
+    // Order the scanners by the location of their next read
+    void ResetScanHeap();
+
     template<typename It>
     void ParseHeaderTokens(It it, It it_last);
 
@@ -195,11 +395,25 @@ private:
         std::vector<utility::StringSet> read_groups;
     };
 
+    // Nodes of the reads; declared first so that it outlives every list of reads
+    std::unique_ptr<detail::ConcurrentBamPool> node_pool_;
+
     // Data Used for Pileup
     data_type data_; // Store pileup
+    columns_type columns_; // Depths of the column pileup
+    std::vector<expiring_heap_t> expiring_; // min-heaps of reads in data_
+    bool use_columns_{false};
+    int column_min_basequal_{0};
     utility::location_t next_scanner_location_; // Next location off the scanners
 
     std::vector<detail::BamScan> scanners_;
+    size_t scan_queue_size_{0}; // 0 if the scanners run on the calling thread
+
+    // min-heap of the scanners by the location of their next read, used to
+    // merge the reads of the scanners in order
+    typedef std::pair<utility::location_t, size_t> scan_heap_entry_t;
+    std::vector<scan_heap_entry_t> scan_heap_;
+    std::vector<size_t> due_scanners_; // scanners that have reads to add
 
     regions::ranges_queue_t regions_;
 
@@ -218,7 +432,7 @@ private:
 };
 
 template<typename A>
-BamPileup BamPileup::open_and_setup(const A& arg) {
+BamPileup BamPileup::open_and_setup(const A& arg, hts::ThreadPool *io_pool) {
 
     BamPileup mpileup{arg.min_qlen, arg.rgtag};
     
@@ -229,8 +443,14 @@ BamPileup BamPileup::open_and_setup(const A& arg) {
         if(!input.is_open()) {
             throw std::runtime_error("Unable to open bam/sam/cram input file '" + str + "' for reading.");
         }
+        if(io_pool != nullptr) {
+            input.SetThreadPool(io_pool);
+        }
         mpileup.AddFile(std::move(input));
     }
+    if(arg.scan_threads) {
+        mpileup.EnableScanThreads();
+    }
 
     // Load contigs into an index
     regions::ContigIndex index;
@@ -262,9 +482,19 @@ boost::optional<regions::range_t> BamPileup::LoadNextRegion() {
     for(auto &&s : scanners_) {
         s.SetRegion(region);
     }
+    ResetScanHeap();
     return region;
 }
 
+inline
+void BamPileup::ResetScanHeap() {
+    scan_heap_.clear();
+    for(size_t i = 0; i < scanners_.size(); ++i) {
+        scan_heap_.emplace_back(scanners_[i].next_loc(), i);
+    }
+    std::make_heap(scan_heap_.begin(), scan_heap_.end(), std::greater<scan_heap_entry_t>{});
+}
+
 template<typename CallBack>
 void BamPileup::operator()(CallBack call_back) {
     using namespace std;
@@ -272,7 +502,27 @@ void BamPileup::operator()(CallBack call_back) {
     using dng::regions::range_t;
 
     // Resize data and free any existing nodes
+    for(auto && s : scanners_) {
+        s.SetLibraries(read_group_to_libraries_);
+    }
+    // the threads only run while the pileup does, so they stop even if
+    // call_back throws
+    struct scan_threads_t {
+        std::vector<detail::BamScan> &scanners;
+        ~scan_threads_t() {
+            for(auto && s : scanners) {
+                s.StopThread();
+            }
+        }
+    } scan_threads{scanners_};
+    if(scan_queue_size_ > 0) {
+        for(auto && s : scanners_) {
+            s.StartThread(*node_pool_, scan_queue_size_);
+        }
+    }
+    ResetScanHeap();
     data_.resize(num_libraries());
+    expiring_.resize(use_columns_ ? num_libraries() : 0);
     ClearData();
 
     range_t current_range = {0, utility::LOCATION_MAX};
@@ -332,18 +582,29 @@ void BamPileup::SelectLibraries(R &range) {
 struct BamPileup::Alleles {
     using read_depths_t = dng::pileup::allele_depths_t;
     using data_type = BamPileup::data_type;
+    using columns_type = BamPileup::columns_type;
+    using counts_t = columns_type::counts_t;
     using filter_signature = bool(const data_type::value_type &);
 
     Alleles(size_t num_libraries);
 
+    // Depths of the reads at their current positions. Reads without a base at
+    // the position, with a base quality below min_basequal, or whose base is
+    // not A, C, G, or T are not counted.
+    const read_depths_t& operator()(const data_type &data, size_t ref_index,
+        int min_basequal);
+
     template<typename F = filter_signature>
     const read_depths_t& operator()(const data_type &data, size_t ref_index, F filter
         = [](const data_type::value_type &) { return true; } );
 
+    // Depths at loc from a column pileup
+    const read_depths_t& operator()(const columns_type &columns,
+        utility::location_t loc, size_t ref_index);
+
     const std::string& alleles_str() const {
         buffer.clear();
-        size_t sz = sorted.shape()[1];
-        for(size_t u=0;u<sz;++u) {
+        for(size_t u=0;u<width_;++u) {
             if(u > 0) {
                 buffer += ',';
             }
@@ -352,59 +613,124 @@ struct BamPileup::Alleles {
         return buffer;
     }
 
-    // temporary data
-    read_depths_t unsorted;
-    read_depths_t sorted;
+    // the order of the alleles in the depths, reference first
     std::vector<int> indexes;
 
 private:
+    // Sort the alleles and copy the depths of the alleles that have reads
+    const read_depths_t& Sort(const counts_t *counts, size_t ref_index);
+
+    std::vector<counts_t> counts_; // num_libraries x 5 counters
+    // depths with k alleles are stored in sorted_[k], so that they are not
+    // reallocated when the number of alleles changes
+    std::array<read_depths_t,6> sorted_;
+    size_t width_{0};
+
     mutable std::string buffer;
 };
 
 // Allocate workspace based on number of libraries
 inline BamPileup::Alleles::Alleles(size_t num_libraries) :
-    unsorted{utility::make_array(num_libraries,5u)},
-    sorted{utility::make_array(num_libraries,5u)},
-    indexes(5)
+    indexes(5), counts_(num_libraries)
 {
-    /*noop*/;
+    for(size_t k = 0; k < sorted_.size(); ++k) {
+        sorted_[k].resize(utility::make_array(num_libraries, k));
+    }
+}
+
+inline
+const BamPileup::Alleles::read_depths_t&
+BamPileup::Alleles::operator()(const data_type &data, size_t ref_index, int min_basequal) {
+    assert(data.size() == counts_.size());
+    std::fill(counts_.begin(), counts_.end(), counts_t{});
+    for(std::size_t u = 0; u < data.size(); ++u) {
+        auto &counts = counts_[u];
+        for(auto && r : data[u]) {
+            // Count every read, adding 0 for the ones that are filtered.
+            // Index 4 holds N and ambiguous bases, so it is always valid.
+            int base = seq::base_index(r.base());
+            int keep = !r.is_missing & (r.base_qual() >= min_basequal) & (base < 4);
+            assert(counts[base] < 65535);
+            counts[base] += keep;
+        }
+    }
+    return Sort(counts_.data(), ref_index);
 }
 
 template<typename F>
 inline
 const BamPileup::Alleles::read_depths_t&
 BamPileup::Alleles::operator()(const data_type &data, size_t ref_index, F filter) {
-    // reset all depth counters
-    std::array<int,5> total_unsorted{0,0,0,0,0};
-    std::fill_n(unsorted.data(), unsorted.num_elements(), 0);
-
-    // pileup on read counts
+    assert(data.size() == counts_.size());
+    std::fill(counts_.begin(), counts_.end(), counts_t{});
     for(std::size_t u = 0; u < data.size(); ++u) {
         for(auto && r : data[u]) {
             if(filter(r)) {
                 continue;
             }
             std::size_t base = seq::base_index(r.base());
-            assert(unsorted[u][base] < 65535);
-            unsorted[u][base] += 1;
-            total_unsorted[base] += 1;
+            assert(counts_[u][base] < 65535);
+            counts_[u][base] += 1;
         }
     }
+    return Sort(counts_.data(), ref_index);
+}
 
-    // sort read counts
-    indexes.resize(total_unsorted.size());
-    boost::iota(indexes,0);
-    boost::sort(indexes, [&total_unsorted,ref_index](int l, int r) {
-        return l == ref_index || total_unsorted[l] > total_unsorted[r];
-    });
-    size_t sz = indexes.size();
-    for(; sz > 0 && total_unsorted[indexes[sz-1]] == 0; --sz) {
+inline
+const BamPileup::Alleles::read_depths_t&
+BamPileup::Alleles::operator()(const columns_type &columns,
+    utility::location_t loc, size_t ref_index) {
+    assert(columns.num_libraries() == counts_.size());
+    return Sort(columns.column(loc), ref_index);
+}
+
+inline
+const BamPileup::Alleles::read_depths_t&
+BamPileup::Alleles::Sort(const counts_t *counts, size_t ref_index) {
+    const size_t num_libraries = counts_.size();
+    std::array<int64_t,5> total{0,0,0,0,0};
+    for(size_t u = 0; u < num_libraries; ++u) {
+        for(size_t base = 0; base < 5; ++base) {
+            total[base] += counts[u][base];
+        }
+    }
+    // Order the reference first and the other alleles by decreasing depth,
+    // breaking ties by base. Each allele gets a unique key, with its index in
+    // the low bits, so a sorting network gives the order of a stable sort.
+    std::array<uint64_t,5> key;
+    for(size_t base = 0; base < 5; ++base) {
+        key[base] = (static_cast<uint64_t>(total[base]) << 3) | (7 - base);
+    }
+    if(ref_index < 5) {
+        key[ref_index] |= UINT64_C(1) << 62;
+    }
+    auto swap_less = [&key](int a, int b) {
+        uint64_t hi = std::max(key[a], key[b]);
+        uint64_t lo = std::min(key[a], key[b]);
+        key[a] = hi;
+        key[b] = lo;
+    };
+    // optimal 9-comparator network for 5 items
+    swap_less(0,1); swap_less(3,4);
+    swap_less(2,4);
+    swap_less(2,3); swap_less(1,4);
+    swap_less(0,3);
+    swap_less(0,2); swap_less(1,3);
+    swap_less(1,2);
+    for(size_t k = 0; k < 5; ++k) {
+        indexes[k] = 7 - static_cast<int>(key[k] & 7);
+    }
+    // drop alleles without reads
+    size_t sz = 5;
+    for(; sz > 0 && total[indexes[sz-1]] == 0; --sz) {
         /*noop*/;
     }
-    sorted.resize(utility::make_array(sorted.size(), sz));
-    for(size_t i=0;i<sorted.size();++i) {
-        for(size_t u=0;u<sz;++u) {
-            sorted[i][u] = unsorted[i][indexes[u]];
+    width_ = sz;
+    read_depths_t &sorted = sorted_[sz];
+    int32_t *out = sorted.data();
+    for(size_t u = 0; u < num_libraries; ++u) {
+        for(size_t k = 0; k < sz; ++k) {
+            *out++ = counts[u][indexes[k]];
         }
     }
     return sorted;
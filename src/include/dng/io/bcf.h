@@ -22,10 +22,12 @@
 #define DNG_IO_BCF_H
 
 #include <cstring>
+#include <chrono>
 
 #include <dng/hts/bcf.h>
 
 #include <dng/utility.h>
+#include <dng/io/utility.h>
 #include <dng/depths.h>
 #include <dng/library.h>
 #include <dng/regions.h>
@@ -42,7 +44,8 @@ public:
 
     typedef void (callback_type)(const data_type &, utility::location_t);
 
-    int AddFile(const char* filename);
+    // If io_pool is not null, its threads are used to decompress the file
+    int AddFile(const char* filename, hts::ThreadPool *io_pool = nullptr);
 
     template<typename R>
     void SelectLibraries(R &range);
@@ -69,11 +72,22 @@ public:
         return reader_;
     }
 
+    // Seconds spent reading records from each input file
+    std::vector<file_time_t> read_times() const {
+        std::vector<file_time_t> ret;
+        for(int i = 0; i < reader_.num_readers(); ++i) {
+            ret.push_back({reader_.reader(i)->fname,
+                std::chrono::duration<double>(read_time_).count()});
+        }
+        return ret;
+    }
+
     template<typename A>
-    static BcfPileup open_and_setup(const A& arg);
+    static BcfPileup open_and_setup(const A& arg, hts::ThreadPool *io_pool = nullptr);
 
 private:
     hts::bcf::SyncedReader reader_;
+    std::chrono::steady_clock::duration read_time_{0};
 
     void ParseSampleLabels(int index);
     void ParseContigs(int index);
@@ -87,7 +101,7 @@ private:
 
 template<typename A>
 inline
-BcfPileup BcfPileup::open_and_setup(const A& arg) {
+BcfPileup BcfPileup::open_and_setup(const A& arg, hts::ThreadPool *io_pool) {
     if(arg.input.size() > 1) {
         throw std::invalid_argument("processing more than one variant file at a time is not supported.");
     }
@@ -96,7 +110,7 @@ BcfPileup BcfPileup::open_and_setup(const A& arg) {
 
     regions::set_regions(arg.region, &mpileup);
 
-    if(mpileup.AddFile(arg.input[0].c_str()) == 0) {
+    if(mpileup.AddFile(arg.input[0].c_str(), io_pool) == 0) {
         int errnum = mpileup.reader().handle()->errnum;
         throw std::runtime_error(bcf_sr_strerror(errnum));
     }
@@ -108,7 +122,13 @@ template<typename CallBack>
 void BcfPileup::operator()(CallBack call_back) {
     assert(reader_.num_readers() == 1); // only support one reader
 
-    while(reader_.NextLine()) {
+    for(;;) {
+        auto start = std::chrono::steady_clock::now();
+        int has_line = reader_.NextLine();
+        read_time_ += std::chrono::steady_clock::now() - start;
+        if(!has_line) {
+            break;
+        }
         bcf1_t *rec = reader_.GetLine(0);
         if(rec == nullptr) {
             continue;
@@ -128,7 +148,7 @@ void BcfPileup::operator()(CallBack call_back) {
 }
 
 inline
-int BcfPileup::AddFile(const char* filename) {
+int BcfPileup::AddFile(const char* filename, hts::ThreadPool *io_pool) {
     assert(filename != nullptr);
     
     int index = reader_.num_readers();
@@ -139,6 +159,9 @@ int BcfPileup::AddFile(const char* filename) {
     if(reader_.AddReader(file.path.c_str()) == 0) {
         return 0;
     }
+    if(io_pool != nullptr) {
+        io_pool->Attach(reader_.reader(index)->file);
+    }
     ParseSampleLabels(index);
     ParseContigs(index);
 
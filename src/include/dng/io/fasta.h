@@ -33,6 +33,7 @@
 #include <boost/filesystem/fstream.hpp>
 
 #include <dng/io/utility.h>
+#include <dng/io/reference_image.h>
 #include <dng/utility.h>
 
 namespace dng {
@@ -42,10 +43,14 @@ class Fasta {
 public:
     typedef dng::utility::location_t location_t;
 
-    explicit Fasta(const char* path);
+    // If image_path is not empty, bases are read from a packed image of the
+    // reference stored there. The image is built if it is missing or out of
+    // date.
+    explicit Fasta(const char* path, const std::string &image_path = {});
 
     const std::string& path() const { return path_.native(); }
     bool is_open() const { return (bool)fai_; }
+    bool has_image() const { return image_.is_mapped(); }
 
     explicit operator bool() const { return is_open(); }
 
@@ -77,9 +82,13 @@ protected:
     int buffer_last_;
 
     boost::filesystem::path path_;
+
+    ReferenceImage image_;
+    const char *image_contig_{nullptr};
+    int image_index_{-1};
 };
 
-inline Fasta::Fasta(const char* path) : path_{path} {
+inline Fasta::Fasta(const char* path, const std::string &image_path) : path_{path} {
     if(path_.empty())
         return;
     fai_.reset(fai_load(path_.c_str()));
@@ -87,6 +96,16 @@ inline Fasta::Fasta(const char* path) : path_{path} {
         throw std::runtime_error("unable to open faidx-indexed reference file '"
                                      + path_.native() + "'.");
     }
+    if(image_path.empty()) {
+        return;
+    }
+    uint64_t key = ReferenceImage::Key(path_.native(), fai_.get());
+    if(!image_.Open(image_path, key)) {
+        ReferenceImage::Build(fai_.get(), key, image_path);
+        if(!image_.Open(image_path, key)) {
+            throw std::runtime_error("unable to open reference image '" + image_path + "'.");
+        }
+    }
 }
 
 inline
@@ -153,7 +172,16 @@ bool Fasta::UpdateBuffer(const char* contig, int first, int buffer_length) {
     // faidx_fetch_seq assumes inclusive
     int last = first+buffer_length-1;
 
-    buffer_.reset(faidx_fetch_seq(fai_.get(), contig, first, last, &buffer_length_));
+    int index = image_.is_mapped() ? image_.contig_index(contig) : -1;
+    if(index >= 0) {
+        // decode the sequence from the image
+        buffer_.reset(static_cast<char*>(malloc(buffer_length+1)));
+        image_.Copy(index, first, last+1, buffer_.get());
+        buffer_[buffer_length] = '\0';
+        buffer_length_ = buffer_length;
+    } else {
+        buffer_.reset(faidx_fetch_seq(fai_.get(), contig, first, last, &buffer_length_));
+    }
     if(buffer_length_ < 0) {
         buffer_contig_ = nullptr;
         return false;
@@ -166,6 +194,13 @@ bool Fasta::UpdateBuffer(const char* contig, int first, int buffer_length) {
 
 inline
 char Fasta::FetchBase(const char* contig, int pos) {
+    if(image_.is_mapped()) {
+        if(contig != image_contig_) {
+            image_contig_ = contig;
+            image_index_ = image_.contig_index(contig);
+        }
+        return (image_index_ >= 0) ? image_.Base(image_index_, pos) : 'N';
+    }
     if(BufferContains(contig,pos)) {
         return *(buffer_.get()+(pos-buffer_first_));
     }
@@ -80,6 +80,8 @@ public:
 
     std::string path() const { return path_.native(); }
 
+    std::streambuf* rdbuf() const { return stream_.rdbuf(); }
+
 protected:
     std::iostream stream_{nullptr};
     boost::filesystem::path path_;
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DNG_IO_REFERENCE_IMAGE_H
+#define DNG_IO_REFERENCE_IMAGE_H
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <htslib/faidx.h>
+
+namespace dng {
+namespace io {
+
+// A binary file holding a 2-bit packed copy of a faidx-indexed reference.
+// The file is memory-mapped read-only, so one copy of the reference is
+// shared by every thread and process that opens it. Bases other than
+// A, C, G, and T are stored as runs and returned as 'N'; case is not kept.
+//
+// Images are tied to a key, which is built from the reference file and its
+// index. An image with the wrong key is treated as missing.
+class ReferenceImage {
+public:
+    ReferenceImage() = default;
+
+    ~ReferenceImage() {
+        Close();
+    }
+
+    // Map an image into memory. Returns false if the file does not exist, is
+    // not a valid image, or was not built with key.
+    bool Open(const std::string &path, uint64_t key);
+
+    void Close();
+
+    // Write an image of every sequence in fai to path
+    static void Build(faidx_t *fai, uint64_t key, const std::string &path);
+
+    // The key of the faidx-indexed reference at fasta_path
+    static uint64_t Key(const std::string &fasta_path, const faidx_t *fai);
+
+    bool is_mapped() const { return data_ != nullptr; }
+
+    // Returns -1 if the image does not contain a sequence called name
+    int contig_index(const char *name) const;
+
+    int count() const { return static_cast<int>(contigs_.size()); }
+    int length(int contig) const { return contigs_[contig].length; }
+
+    // Returns the base at pos as one of "ACGTN"
+    char Base(int contig, int pos) const;
+
+    // Copy the bases in [first, last) to out
+    void Copy(int contig, int first, int last, char *out) const;
+
+    // do not copy or assign
+    ReferenceImage(const ReferenceImage&) = delete;
+    ReferenceImage& operator=(const ReferenceImage&) = delete;
+
+    // Each bit of a sequence's mask marks a block of 2^MASK_SHIFT bases that
+    // contains at least one 'N'.
+    static constexpr int MASK_SHIFT = 8;
+
+private:
+    struct contig_t {
+        int length;
+        const uint8_t *bases;   // 4 bases per byte, first base in the lowest bits
+        const uint64_t *mask;
+        const uint32_t *n_runs; // sorted [begin, end) pairs
+        uint64_t num_n_runs;
+    };
+
+    bool InNRun(const contig_t &c, int pos) const;
+
+    // the memory-mapped file
+    const char *data_{nullptr};
+    std::size_t size_{0};
+
+    std::vector<contig_t> contigs_;
+    std::unordered_map<std::string, int> names_;
+};
+
+inline
+char ReferenceImage::Base(int contig, int pos) const {
+    assert(0 <= contig && contig < count());
+    const contig_t &c = contigs_[contig];
+    if(pos < 0 || pos >= c.length) {
+        return 'N';
+    }
+    const int block = pos >> MASK_SHIFT;
+    if(((c.mask[block >> 6] >> (block & 63)) & 1) && InNRun(c, pos)) {
+        return 'N';
+    }
+    return "ACGT"[(c.bases[pos >> 2] >> ((pos & 3)*2)) & 3];
+}
+
+}} // namespace dng::io
+
+#endif // DNG_IO_REFERENCE_IMAGE_H
@@ -26,6 +26,9 @@
 #include <iosfwd>
 #include <istream>
 #include <fstream>
+#include <ostream>
+#include <vector>
+#include <cassert>
 
 #include <dng/utility.h>
 
@@ -101,6 +104,31 @@ inline std::string at_slurp(std::string &ss, std::ios_base::openmode mode = std:
     return filename.type_ext;
 }
 
+// Seconds spent reading and decoding records from a file
+struct file_time_t {
+    std::string name;
+    double seconds;
+};
+
+// Add times to the matching files in total
+inline void add_file_times(std::vector<file_time_t> *total, const std::vector<file_time_t> &times) {
+    if(total->empty()) {
+        *total = times;
+        return;
+    }
+    assert(total->size() == times.size());
+    for(size_t i = 0; i < times.size(); ++i) {
+        (*total)[i].seconds += times[i].seconds;
+    }
+}
+
+inline void print_file_times(std::ostream &out, const std::vector<file_time_t> &times) {
+    out << "file\tread_seconds\n";
+    for(auto && a : times) {
+        out << a.name << '\t' << a.seconds << '\n';
+    }
+}
+
 }
 } //namespace dng::io
 
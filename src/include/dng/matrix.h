@@ -24,6 +24,7 @@
 #include <cfloat>
 #include <algorithm>
 #include <initializer_list>
+#include <vector>
 
 #include <Eigen/Dense>
 #include <Eigen/StdVector>
@@ -43,10 +44,37 @@ typedef std::vector<GenotypeArray, Eigen::aligned_allocator<GenotypeArray>>
 #define DNG_INDIVIDUAL_BUFFER_MIN DBL_MIN
 
 typedef Eigen::MatrixXd TransitionMatrix; // element (i,j) is the P(j|i)
-typedef std::vector<TransitionMatrix> TransitionMatrixVector;
+
+// A meiosis matrix in factored form. Element ((x,y),(a,b)) of the matrix is
+// sum_k dad[k](x,a)*mom[k](y,b) + dad[k](x,b)*mom[k](y,a), where the second
+// term is only included if a != b. dad[k] and mom[k] are gamete matrices,
+// parent genotypes x alleles.
+struct MeiosisFactors {
+    std::vector<TransitionMatrix> dad;
+    std::vector<TransitionMatrix> mom;
+
+    bool empty() const { return dad.empty(); }
+};
+
+// The transition matrices of every node of a pedigree. The meiosis matrices of
+// trio children can also be stored in factored form, which peeling uses to
+// avoid multiplying dense meiosis matrices.
+class TransitionMatrixVector : public std::vector<TransitionMatrix> {
+public:
+    using std::vector<TransitionMatrix>::vector;
+
+    const MeiosisFactors* meiosis_factors(std::size_t child) const {
+        return (child < meiosis.size() && !meiosis[child].empty()) ? &meiosis[child] : nullptr;
+    }
+
+    std::vector<MeiosisFactors> meiosis; // empty if not available
+};
 
 typedef Eigen::ArrayXXd TemporaryMatrix;
 
+typedef Eigen::ArrayXXd GenotypeArrayBlock; // column j holds the values of site j
+typedef std::vector<GenotypeArrayBlock> GenotypeArrayBlockVector;
+
 typedef Eigen::ArrayXd ParentArray;
 typedef std::vector<ParentArray> ParentArrayVector;
 
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DNG_MATRIX_CACHE_H
+#define DNG_MATRIX_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <type_traits>
+
+#include <dng/matrix.h>
+
+namespace dng {
+
+// 64-bit FNV-1a hash used to build the keys of a MatrixCache
+class CacheKey {
+public:
+    CacheKey& operator()(const void *p, std::size_t n) {
+        const unsigned char *c = static_cast<const unsigned char *>(p);
+        for(std::size_t i = 0; i < n; ++i) {
+            value_ = (value_ ^ c[i]) * UINT64_C(0x100000001b3);
+        }
+        return *this;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, CacheKey&>::type
+    operator()(T x) {
+        return operator()(&x, sizeof(x));
+    }
+
+    CacheKey& operator()(const std::string &str) {
+        operator()(static_cast<uint64_t>(str.size()));
+        return operator()(str.data(), str.size());
+    }
+
+    uint64_t value() const { return value_; }
+
+private:
+    uint64_t value_{UINT64_C(0xcbf29ce484222325)};
+};
+
+// A binary file of precomputed matrices, e.g. transition matrices and priors,
+// that can be reused by every run with the same pedigree and parameters.
+// Matrices are stored in named entries. Entries are only returned if the key
+// of the file matches the requested key. The file is memory-mapped when
+// opened, and a cache without a path does nothing.
+class MatrixCache {
+public:
+    typedef std::vector<Eigen::MatrixXd> entry_t;
+
+    MatrixCache() = default;
+    explicit MatrixCache(std::string path) {
+        Open(std::move(path));
+    }
+
+    ~MatrixCache() {
+        Close();
+    }
+
+    // Map a cache file into memory. Returns false if the file does not exist or
+    // is not a valid cache; new entries will still be saved to path.
+    bool Open(std::string path);
+
+    void Close();
+
+    // Copy the matrices of an entry, if the file was built with key
+    bool Get(uint64_t key, const std::string &name, entry_t *out) const;
+
+    // Add an entry to the cache. Entries are written by Save().
+    void Put(uint64_t key, const std::string &name, entry_t matrices);
+
+    // Write the cache file if entries have been added
+    void Save();
+
+    const std::string& path() const { return path_; }
+    bool is_mapped() const { return data_ != nullptr; }
+
+    // do not copy or assign
+    MatrixCache(const MatrixCache&) = delete;
+    MatrixCache& operator=(const MatrixCache&) = delete;
+
+private:
+    std::string path_;
+
+    // the memory-mapped file
+    const char *data_{nullptr};
+    std::size_t size_{0};
+    uint64_t key_{0};
+    std::map<std::string, std::size_t> index_; // entry name -> offset of its matrices
+
+    // entries that need to be written
+    uint64_t pending_key_{0};
+    std::map<std::string, entry_t> pending_;
+};
+
+} // namespace dng
+
+#endif // DNG_MATRIX_CACHE_H
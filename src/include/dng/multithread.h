@@ -23,6 +23,10 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <tuple>
 #include <thread>
 #include <mutex>
@@ -31,6 +35,7 @@
 #include <memory>
 #include <functional>
 #include <type_traits>
+#include <exception>
 
 #include <boost/fusion/functional/invocation/invoke.hpp>
 #include <boost/fusion/adapted/std_tuple.hpp>
@@ -145,6 +150,397 @@ Clear() {
     tasks_.clear();
 }
 
+// a fixed set of objects, e.g. model clones, that jobs running on a pool
+// can borrow exclusively
+template<typename T>
+class ObjectPool {
+public:
+    typedef T value_type;
+
+    class Lease;
+
+    // construct num_objects copies of obj
+    ObjectPool(size_t num_objects, const T& obj) : objects_(num_objects, obj) {
+        idle_.reserve(objects_.size());
+        for(auto && a : objects_) {
+            idle_.push_back(&a);
+        }
+    }
+
+    // borrow an object, waiting until one becomes available
+    Lease Acquire();
+
+    // access all objects; only safe when no objects are leased
+    std::vector<T>& objects() { return objects_; }
+    const std::vector<T>& objects() const { return objects_; }
+
+    // do not copy, move, or assign
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+    ObjectPool(ObjectPool&&) = delete;
+    ObjectPool& operator=(ObjectPool&&) = delete;
+
+private:
+    void Release(T *p) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.push_back(p);
+        }
+        condition_.notify_one();
+    }
+
+    std::vector<T> objects_;
+    std::vector<T*> idle_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+// returns the borrowed object to its pool when destroyed
+template<typename T>
+class ObjectPool<T>::Lease {
+public:
+    Lease(Lease&& other) : pool_{other.pool_}, p_{other.p_} {
+        other.p_ = nullptr;
+    }
+    ~Lease() {
+        if(p_ != nullptr) {
+            pool_->Release(p_);
+        }
+    }
+
+    T& operator*() const { return *p_; }
+    T* operator->() const { return p_; }
+    T* get() const { return p_; }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease& operator=(Lease&&) = delete;
+
+private:
+    Lease(ObjectPool *pool, T *p) : pool_{pool}, p_{p} { }
+
+    ObjectPool *pool_;
+    T *p_;
+
+    friend class ObjectPool;
+};
+
+template<typename T>
+typename ObjectPool<T>::Lease ObjectPool<T>::
+Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]{ return !idle_.empty(); });
+    T *p = idle_.back();
+    idle_.pop_back();
+    return Lease{this, p};
+}
+
+// call f(i) for i in [0, n), each on its own thread; f(0) runs on the calling
+// thread. If any call throws, the first exception is rethrown after all
+// threads have finished.
+template<typename F>
+void run_in_parallel(size_t n, F f) {
+    std::vector<std::exception_ptr> errors(n);
+    auto g = [&f,&errors](size_t i) {
+        try {
+            f(i);
+        } catch(...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(n);
+    for(size_t i = 1; i < n; ++i) {
+        workers.emplace_back(g, i);
+    }
+    if(n > 0) {
+        g(0);
+    }
+    for(auto && worker : workers) {
+        worker.join();
+    }
+    for(auto && e : errors) {
+        if(e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+// Batches of work that are filled on one thread, processed on a pool of
+// workers, and written on the filling thread in the order they were
+// submitted, so output matches a serial loop. Written batches are reused, and
+// write(B*) must reset a batch before it is reused. If process(B*) throws,
+// the exception is rethrown on the filling thread when the batch would have
+// been written. With 0 threads, batches are processed when submitted.
+template<typename B>
+class OrderedBatchQueue {
+public:
+    typedef B value_type;
+
+    template<typename P, typename W>
+    OrderedBatchQueue(size_t num_threads, P process, W write,
+        std::function<B*()> make = []{ return new B; }) :
+        process_(process), write_(write), make_(make),
+        max_pending_{2*std::max<size_t>(num_threads, 1)}
+    {
+        if(num_threads > 0) {
+            pool_.reset(new BasicPool<slot_t*>([this](slot_t *slot) { Process(slot); },
+                num_threads));
+        }
+    }
+
+    // Returns an empty batch to fill. Only one batch is filled at a time.
+    B* NewBatch() {
+        assert(!current_);
+        if(spares_.empty()) {
+            current_.reset(new slot_t(make_()));
+        } else {
+            current_ = std::move(spares_.back());
+            spares_.pop_back();
+        }
+        return current_->batch.get();
+    }
+
+    // The batch returned by NewBatch that has not been submitted, or null
+    B* current() const {
+        return current_ ? current_->batch.get() : nullptr;
+    }
+
+    // Process the current batch and write finished batches. Waits for the
+    // oldest batch if too many are pending, which bounds memory use.
+    void Submit() {
+        assert(current_);
+        slot_t *slot = current_.get();
+        pending_.push_back(std::move(current_));
+        if(pool_) {
+            pool_->Enqueue(slot);
+        } else {
+            Process(slot);
+        }
+        Write(pending_.size() >= max_pending_);
+    }
+
+    // Wait for every submitted batch and write it
+    void Flush() {
+        while(!pending_.empty()) {
+            Write(true);
+        }
+    }
+
+    // do not copy, move, or assign
+    OrderedBatchQueue(const OrderedBatchQueue&) = delete;
+    OrderedBatchQueue& operator=(const OrderedBatchQueue&) = delete;
+
+private:
+    struct slot_t {
+        explicit slot_t(B *p) : batch{p} { }
+
+        std::unique_ptr<B> batch;
+        bool done{false};
+        std::exception_ptr error;
+    };
+
+    void Process(slot_t *slot) {
+        try {
+            process_(slot->batch.get());
+        } catch(...) {
+            slot->error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->done = true;
+        }
+        condition_.notify_all();
+    }
+
+    // Write finished batches at the front of the queue. If wait is true,
+    // block until at least the first pending batch is written.
+    void Write(bool wait) {
+        while(!pending_.empty()) {
+            slot_t *slot = pending_.front().get();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if(wait) {
+                    condition_.wait(lock, [slot]{ return slot->done; });
+                } else if(!slot->done) {
+                    return;
+                }
+            }
+            wait = false;
+            std::unique_ptr<slot_t> p = std::move(pending_.front());
+            pending_.pop_front();
+            if(p->error) {
+                std::rethrow_exception(p->error);
+            }
+            write_(p->batch.get());
+            p->done = false;
+            spares_.push_back(std::move(p));
+        }
+    }
+
+    std::function<void(B*)> process_;
+    std::function<void(B*)> write_;
+    std::function<B*()> make_;
+    const size_t max_pending_;
+
+    std::deque<std::unique_ptr<slot_t>> pending_; // batches in submission order
+    std::vector<std::unique_ptr<slot_t>> spares_; // batches that can be reused
+    std::unique_ptr<slot_t> current_;             // the batch being filled
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+
+    // declared last so that the workers stop before the batches are destroyed
+    std::unique_ptr<BasicPool<slot_t*>> pool_;
+};
+
+// A bounded queue between one producer thread and one consumer thread. The
+// producer waits while the queue is full, so it can run at most capacity()
+// items ahead of the consumer. Threads spin briefly before sleeping.
+template<typename T>
+class SpscQueue {
+public:
+    typedef T value_type;
+
+    // capacity is rounded up to a power of 2
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 2;
+        while(n < capacity) {
+            n *= 2;
+        }
+        slots_.resize(n);
+        mask_ = n-1;
+    }
+
+    size_t capacity() const { return slots_.size(); }
+
+    // Add x unless the queue is full; only called by the producer
+    bool TryPush(const T &x) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_cache_ == slots_.size()) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if(tail - head_cache_ == slots_.size()) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = x;
+        tail_.store(tail+1, std::memory_order_release);
+        Wake(consumer_waiting_, not_empty_);
+        return true;
+    }
+
+    // Add x, waiting while the queue is full. Returns false, without adding x,
+    // if cancel() becomes true while waiting; call Notify() after changing
+    // what cancel() returns.
+    template<typename Cancel>
+    bool Push(const T &x, Cancel cancel) {
+        for(int spin = 0; !TryPush(x); ++spin) {
+            if(cancel()) {
+                return false;
+            }
+            if(spin < SPIN_COUNT) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            producer_waiting_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire)
+                == slots_.size() && !cancel()) {
+                not_full_.wait(lock);
+            }
+            producer_waiting_.store(false, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void Push(const T &x) {
+        Push(x, []{ return false; });
+    }
+
+    // Remove the first item unless the queue is empty; only called by the consumer
+    bool TryPop(T *x) {
+        assert(x != nullptr);
+        size_t head = head_.load(std::memory_order_relaxed);
+        if(head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if(head == tail_cache_) {
+                return false;
+            }
+        }
+        *x = std::move(slots_[head & mask_]);
+        head_.store(head+1, std::memory_order_release);
+        Wake(producer_waiting_, not_full_);
+        return true;
+    }
+
+    // Remove the first item, waiting while the queue is empty
+    T Pop() {
+        T x;
+        for(int spin = 0; !TryPop(&x); ++spin) {
+            if(spin < SPIN_COUNT) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            consumer_waiting_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire)) {
+                not_empty_.wait(lock);
+            }
+            consumer_waiting_.store(false, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    // Wake both threads so that they recheck their conditions
+    void Notify() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+    // do not copy, move, or assign
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+private:
+    static constexpr int SPIN_COUNT = 16;
+
+    // A thread sets its waiting flag before it checks the queue a final time,
+    // and the other thread checks the flag after it updates the queue. The
+    // fences ensure that at least one of them sees the other's write.
+    void Wake(const std::atomic<bool> &waiting, std::condition_variable &condition) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            condition.notify_one();
+        }
+    }
+
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // the indexes are written by different threads, so keep them on separate
+    // cache lines
+    std::atomic<size_t> head_{0};  // written by the consumer
+    size_t tail_cache_{0};         // the consumer's copy of tail_
+    char pad1_[64];
+    std::atomic<size_t> tail_{0};  // written by the producer
+    size_t head_cache_{0};         // the producer's copy of head_
+    char pad2_[64];
+
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::atomic<bool> producer_waiting_{false};
+    std::atomic<bool> consumer_waiting_{false};
+};
+
+template<typename T>
+constexpr int SpscQueue<T>::SPIN_COUNT;
+
 } // namespace dng::multithread
 } // namespace dng
 
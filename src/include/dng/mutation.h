@@ -313,67 +313,81 @@ void meiosis_matrix_op(const Matrix& matA, const Matrix& matB, Matrix *p) {
 }
 } // detail
 
+namespace detail {
+inline
+void meiosis_factors_op(const Matrix& matA, const Matrix& matB, MeiosisFactors *p) {
+    assert(matA.cols() == matB.cols());
+    assert(p != nullptr);
+    p->dad.push_back(matA);
+    p->mom.push_back(matB);
+}
+} // detail
+
 inline
-Matrix meiosis_matrix(int size, Model dad_m, Model mom_m, transition_t, int dad_ploidy, int mom_ploidy) {
+MeiosisFactors meiosis_factors(int size, Model dad_m, Model mom_m, transition_t, int dad_ploidy, int mom_ploidy) {
     assert(dad_ploidy == 1 || dad_ploidy == 2);
     assert(mom_ploidy == 1 || mom_ploidy == 2);
 
-    const int num_alleles = size;
-    const int num_genotypes = num_alleles*(num_alleles+1)/2;
-
-    // Construct Mutation Process
-    Matrix ret = Matrix::Zero(number_of_parent_genotype_pairs(num_alleles,
-            dad_ploidy, mom_ploidy), num_genotypes);
+    MeiosisFactors ret;
     auto dad = gamete_matrix(size, dad_m, transition_t{}, dad_ploidy);
     auto mom = gamete_matrix(size, mom_m, transition_t{}, mom_ploidy);
 
-    detail::meiosis_matrix_op(dad,mom,&ret);
+    detail::meiosis_factors_op(dad,mom,&ret);
     return ret;
 }
 
 inline
-Matrix meiosis_matrix(int size, Model dad_m, Model mom_m, mean_t, int dad_ploidy, int mom_ploidy) {
+MeiosisFactors meiosis_factors(int size, Model dad_m, Model mom_m, mean_t, int dad_ploidy, int mom_ploidy) {
     assert(dad_ploidy == 1 || dad_ploidy == 2);
     assert(mom_ploidy == 1 || mom_ploidy == 2);
 
-    const int num_alleles = size;
-    const int num_genotypes = num_alleles*(num_alleles+1)/2;
-
-    // Construct Mutation Process
-    Matrix ret = Matrix::Zero(number_of_parent_genotype_pairs(num_alleles,
-            dad_ploidy, mom_ploidy), num_genotypes);
-
+    MeiosisFactors ret;
     auto dad = gamete_matrix(size, dad_m, transition_t{}, dad_ploidy);
     auto dad_mean = gamete_matrix(size, dad_m, mean_t{}, dad_ploidy);
     auto mom = gamete_matrix(size, mom_m, transition_t{}, mom_ploidy);
     auto mom_mean = gamete_matrix(size, mom_m, mean_t{}, mom_ploidy);
 
-    detail::meiosis_matrix_op(dad,mom_mean,&ret);
-    detail::meiosis_matrix_op(dad_mean,mom,&ret);    
+    detail::meiosis_factors_op(dad,mom_mean,&ret);
+    detail::meiosis_factors_op(dad_mean,mom,&ret);
     return ret;
 }
 
 inline
-Matrix meiosis_matrix(int size, Model dad_m, Model mom_m, int count, int dad_ploidy, int mom_ploidy) {
+MeiosisFactors meiosis_factors(int size, Model dad_m, Model mom_m, int count, int dad_ploidy, int mom_ploidy) {
     assert(dad_ploidy == 1 || dad_ploidy == 2);
     assert(mom_ploidy == 1 || mom_ploidy == 2);
 
-    const int num_alleles = size;
-    const int num_genotypes = num_alleles*(num_alleles+1)/2;
-
-    // Construct Mutation Process
-    Matrix ret = Matrix::Zero(number_of_parent_genotype_pairs(num_alleles,
-            dad_ploidy, mom_ploidy), num_genotypes);
-
-   for(int n=0; n<=count; ++n) {
+    MeiosisFactors ret;
+    for(int n=0; n<=count; ++n) {
         auto dad = gamete_matrix(size, dad_m, n, dad_ploidy);
         auto mom = gamete_matrix(size, mom_m, count-n, mom_ploidy);
-     
-        detail::meiosis_matrix_op(dad,mom,&ret);
+
+        detail::meiosis_factors_op(dad,mom,&ret);
+    }
+    return ret;
+}
+
+// Construct a dense meiosis matrix from its factors
+inline
+Matrix meiosis_matrix(const MeiosisFactors &factors) {
+    assert(!factors.empty() && factors.dad.size() == factors.mom.size());
+
+    const int num_alleles = factors.dad[0].cols();
+    const int num_genotypes = num_alleles*(num_alleles+1)/2;
+
+    Matrix ret = Matrix::Zero(factors.dad[0].rows()*factors.mom[0].rows(), num_genotypes);
+    for(size_t k = 0; k < factors.dad.size(); ++k) {
+        detail::meiosis_matrix_op(factors.dad[k], factors.mom[k], &ret);
     }
     return ret;
 }
 
+template<typename T>
+inline
+Matrix meiosis_matrix(int size, Model dad_m, Model mom_m, T arg, int dad_ploidy, int mom_ploidy) {
+    return meiosis_matrix(meiosis_factors(size, dad_m, mom_m, arg, dad_ploidy, mom_ploidy));
+}
+
 // k-alleles model from Watterson and Guess (1977) https://doi.org/10.1016/0040-5809(77)90023-5
 
 inline
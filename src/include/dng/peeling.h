@@ -59,6 +59,8 @@ struct workspace_t {
 
     std::vector<int> ploidies;
 
+    genotype::LikelihoodCache likelihood_cache;
+
     template<typename Rng>
     static auto make_slice(Rng& rng, node_range_t n) -> boost::sliced_range<Rng> {
         return boost::adaptors::slice(rng, n.first, n.second);
@@ -153,12 +155,16 @@ struct workspace_t {
         }
     }
 
-    template<typename G, typename D, typename ...A>
-    void CalculateGenotypeLikelihoods(const G& gt, const D& d, A&&... args) {
+    // Calculate the genotype likelihoods of the libraries, using values from
+    // likelihood_cache when possible
+    template<typename G, typename D>
+    void CalculateGenotypeLikelihoods(const G& gt, const D& d, int num_obs_alleles,
+        genotype::Mode mode) {
         ln_scale = 0.0;
         size_t u = 0;
         for(auto pos = library_nodes.first; pos < library_nodes.second; ++pos) {
-            ln_scale += gt(d[u++], std::forward<A>(args)..., ploidies[pos], &lower[pos]);
+            ln_scale += likelihood_cache(gt, d[u++], num_obs_alleles, mode, ploidies[pos],
+                &lower[pos]);
         }
     }
 
@@ -213,6 +219,94 @@ struct workspace_t {
     }   
 };
 
+// Holds the peeling state of a block of sites that share the same transition
+// matrices. Column j of each array holds the values of site j, which allows
+// the peeling operations to apply a transition matrix to every site at once.
+struct batch_workspace_t {
+    GenotypeArrayBlockVector upper; // Holds P(~Descendent_Data & G=g)
+    GenotypeArrayBlockVector lower; // Holds P( Descendent_Data | G=g)
+
+    std::size_t num_sites = 0;
+    size_t matrix_index = 0;
+
+    // Temporary data used by some peeling ops
+    TemporaryMatrix temp_buffer;
+    TemporaryMatrix temp_parent;
+
+    // Information about the pedigree
+    std::size_t num_nodes = 0;
+    using node_range_t = workspace_t::node_range_t;
+    node_range_t founder_nodes,
+                 germline_nodes,
+                 somatic_nodes,
+                 library_nodes;
+
+    std::vector<int> ploidies;
+
+    // Resize the workspace to fit a pedigree with sz nodes
+    void Resize(std::size_t sz) {
+        num_nodes = sz;
+        upper.resize(num_nodes);
+        lower.resize(num_nodes);
+        num_sites = 0;
+    }
+
+    // Start a new block of sz sites. Sets the prior probability of the
+    // founders and the lowers of every node to 1.
+    void SetGermline(const GenotypeArray &diploid_prior, const GenotypeArray &haploid_prior,
+        std::size_t sz) {
+        assert(founder_nodes.first <= founder_nodes.second);
+        assert(founder_nodes.second <= germline_nodes.second);
+        num_sites = sz;
+
+        // Set the Upper of the Founder Nodes
+        for(auto i = founder_nodes.first; i < founder_nodes.second; ++i) {
+            assert(ploidies[i] == 2 || ploidies[i] == 1);
+            const GenotypeArray &prior = (ploidies[i] == 2) ? diploid_prior : haploid_prior;
+            upper[i] = prior.replicate(1, num_sites);
+        }
+        // Set the lowers of every node
+        for(auto i = founder_nodes.first; i < num_nodes; ++i) {
+            assert(ploidies[i] == 2 || ploidies[i] == 1);
+            auto gt_sz = (ploidies[i] == 2) ? diploid_prior.size() : haploid_prior.size();
+            lower[i].setOnes(gt_sz, num_sites);
+        }
+    }
+
+    // Copy the genotype likelihoods of the library nodes of a single-site
+    // workspace into column j
+    void CopyGenotypeLikelihoods(std::size_t j, const workspace_t &work) {
+        assert(j < num_sites);
+        for(auto pos = library_nodes.first; pos < library_nodes.second; ++pos) {
+            assert(lower[pos].rows() == work.lower[pos].size());
+            lower[pos].col(j) = work.lower[pos];
+        }
+    }
+
+    // Keep only the first sz sites of the block
+    void Truncate(std::size_t sz) {
+        assert(sz <= num_sites);
+        num_sites = sz;
+        for(auto i = founder_nodes.first; i < founder_nodes.second; ++i) {
+            upper[i].conservativeResize(Eigen::NoChange, num_sites);
+        }
+        for(auto i = founder_nodes.first; i < num_nodes; ++i) {
+            lower[i].conservativeResize(Eigen::NoChange, num_sites);
+        }
+    }
+};
+
+// Sum the rows of a block of sites. Rows are added one at a time, so that the
+// sum of a site does not depend on its position in the block.
+template<typename A>
+Eigen::Array<double, 1, Eigen::Dynamic> column_sums(const Eigen::ArrayBase<A> &a) {
+    Eigen::Array<double, 1, Eigen::Dynamic> ret = a.row(0);
+    for(decltype(a.rows()) i = 1; i < a.rows(); ++i) {
+        ret += a.row(i);
+    }
+    return ret;
+}
+
 typedef std::vector<std::size_t> family_members_t;
 
 // Basic peeling operations
@@ -251,7 +345,58 @@ void to_mother_reverse(workspace_t &work, const family_members_t &family,
 void to_child_reverse(workspace_t &work, const family_members_t &family,
                       const TransitionMatrixVector &mat);
 
-typedef decltype(&down) function_t;
+// Batched versions of the forward operations
+void up(batch_workspace_t &work, const family_members_t &family,
+        const TransitionMatrixVector &mat);
+void down(batch_workspace_t &work, const family_members_t &family,
+          const TransitionMatrixVector &mat);
+void to_father(batch_workspace_t &work, const family_members_t &family,
+               const TransitionMatrixVector &mat);
+void to_mother(batch_workspace_t &work, const family_members_t &family,
+               const TransitionMatrixVector &mat);
+void to_child(batch_workspace_t &work, const family_members_t &family,
+              const TransitionMatrixVector &mat);
+void up_fast(batch_workspace_t &work, const family_members_t &family,
+             const TransitionMatrixVector &mat);
+void down_fast(batch_workspace_t &work, const family_members_t &family,
+               const TransitionMatrixVector &mat);
+void to_father_fast(batch_workspace_t &work, const family_members_t &family,
+                    const TransitionMatrixVector &mat);
+void to_mother_fast(batch_workspace_t &work, const family_members_t &family,
+                    const TransitionMatrixVector &mat);
+void to_child_fast(batch_workspace_t &work, const family_members_t &family,
+                   const TransitionMatrixVector &mat);
+
+// Versions of the trio operations that use factored meiosis matrices
+void to_father_meiosis(workspace_t &work, const family_members_t &family,
+                       const TransitionMatrixVector &mat);
+void to_mother_meiosis(workspace_t &work, const family_members_t &family,
+                       const TransitionMatrixVector &mat);
+void to_child_meiosis(workspace_t &work, const family_members_t &family,
+                      const TransitionMatrixVector &mat);
+void to_father_fast_meiosis(workspace_t &work, const family_members_t &family,
+                            const TransitionMatrixVector &mat);
+void to_mother_fast_meiosis(workspace_t &work, const family_members_t &family,
+                            const TransitionMatrixVector &mat);
+void to_child_fast_meiosis(workspace_t &work, const family_members_t &family,
+                           const TransitionMatrixVector &mat);
+void to_father_meiosis(batch_workspace_t &work, const family_members_t &family,
+                       const TransitionMatrixVector &mat);
+void to_mother_meiosis(batch_workspace_t &work, const family_members_t &family,
+                       const TransitionMatrixVector &mat);
+void to_child_meiosis(batch_workspace_t &work, const family_members_t &family,
+                      const TransitionMatrixVector &mat);
+void to_father_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                            const TransitionMatrixVector &mat);
+void to_mother_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                            const TransitionMatrixVector &mat);
+void to_child_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                           const TransitionMatrixVector &mat);
+
+typedef void (*function_t)(workspace_t &, const family_members_t &,
+                           const TransitionMatrixVector &);
+typedef void (*batch_function_t)(batch_workspace_t &, const family_members_t &,
+                                 const TransitionMatrixVector &);
 
 struct info_t {
     bool writes_lower;
@@ -285,6 +430,25 @@ constexpr function_t functions[(int)Op::NUM] = {
     &to_child_fast
 };
 
+constexpr batch_function_t batch_functions[(int)Op::NUM] = {
+    &up, &down, &to_father, &to_mother, &to_child,
+    &up_fast, &down_fast, &to_father_fast, &to_mother_fast,
+    &to_child_fast
+};
+
+// Forward operations used for trio families
+constexpr function_t meiosis_functions[(int)Op::NUM] = {
+    &up, &down, &to_father_meiosis, &to_mother_meiosis, &to_child_meiosis,
+    &up_fast, &down_fast, &to_father_fast_meiosis, &to_mother_fast_meiosis,
+    &to_child_fast_meiosis
+};
+
+constexpr batch_function_t batch_meiosis_functions[(int)Op::NUM] = {
+    &up, &down, &to_father_meiosis, &to_mother_meiosis, &to_child_meiosis,
+    &up_fast, &down_fast, &to_father_fast_meiosis, &to_mother_fast_meiosis,
+    &to_child_fast_meiosis
+};
+
 constexpr function_t reverse_functions[(int)Op::NUM] = {
     &up_reverse, &down_reverse, &to_father_reverse,
     &to_mother_reverse, &to_child_reverse,
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DNG_PEELING_FIXED_H
+#define DNG_PEELING_FIXED_H
+
+#include <vector>
+
+#include <dng/matrix.h>
+#include <dng/peeling.h>
+
+namespace dng {
+namespace peel {
+
+// Types used to peel sites with N observed alleles. The sizes of the arrays
+// depend on the ploidy of a node, but their maximum sizes are known at compile
+// time. Eigen stores them inline, so peeling a site does not allocate memory.
+template<int N>
+struct fixed_traits {
+    static constexpr int num_genotypes = N*(N+1)/2;
+
+    typedef Eigen::Array<double, Eigen::Dynamic, 1, Eigen::ColMajor,
+        num_genotypes, 1> array_t;
+    // pair transitions, and P(child data | dad, mom) as a mom x dad matrix
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor,
+        num_genotypes, num_genotypes> matrix_t;
+    // parent genotypes x alleles
+    typedef Eigen::Matrix<double, Eigen::Dynamic, N, Eigen::ColMajor,
+        num_genotypes, N> gamete_t;
+    typedef Eigen::Matrix<double, N, N> allele_matrix_t;
+    typedef Eigen::Matrix<double, N, 1> allele_vector_t;
+
+    typedef std::vector<array_t, Eigen::aligned_allocator<array_t>> array_vector_t;
+    typedef std::vector<matrix_t, Eigen::aligned_allocator<matrix_t>> matrix_vector_t;
+    typedef std::vector<gamete_t, Eigen::aligned_allocator<gamete_t>> gamete_vector_t;
+};
+
+// The transition matrices of every node of a pedigree for N alleles. Trio
+// children are only stored in factored form (see MeiosisFactors).
+template<int N>
+struct fixed_matrices_t {
+    typedef fixed_traits<N> traits;
+
+    struct meiosis_t {
+        typename traits::gamete_vector_t dad;
+        typename traits::gamete_vector_t mom;
+    };
+
+    typename traits::matrix_vector_t pair;
+    std::vector<meiosis_t> meiosis;
+
+    fixed_matrices_t() = default;
+
+    explicit fixed_matrices_t(const TransitionMatrixVector &mat) :
+        pair(mat.size()), meiosis(mat.size())
+    {
+        for(std::size_t child = 0; child < mat.size(); ++child) {
+            const MeiosisFactors *f = mat.meiosis_factors(child);
+            if(f != nullptr) {
+                meiosis[child].dad.assign(f->dad.begin(), f->dad.end());
+                meiosis[child].mom.assign(f->mom.begin(), f->mom.end());
+            } else {
+                assert(mat[child].rows() <= traits::num_genotypes &&
+                       mat[child].cols() <= traits::num_genotypes);
+                pair[child] = mat[child];
+            }
+        }
+    }
+};
+
+// Holds the peeling state of a single site with N observed alleles
+template<int N>
+struct fixed_workspace_t {
+    typedef fixed_traits<N> traits;
+
+    typename traits::array_vector_t upper; // Holds P(~Descendent_Data & G=g)
+    typename traits::array_vector_t lower; // Holds P( Descendent_Data | G=g)
+
+    // Copy the founder priors and library genotype likelihoods of work and
+    // set the lowers of every other node to 1
+    void Assign(const workspace_t &work) {
+        upper.resize(work.num_nodes);
+        lower.resize(work.num_nodes);
+        for(auto i = work.founder_nodes.first; i < work.founder_nodes.second; ++i) {
+            assert(work.upper[i].size() <= traits::num_genotypes);
+            upper[i] = work.upper[i];
+        }
+        for(auto i = work.founder_nodes.first; i < work.library_nodes.first; ++i) {
+            assert(work.ploidies[i] == 2 || work.ploidies[i] == 1);
+            lower[i].setOnes((work.ploidies[i] == 2) ? traits::num_genotypes : N);
+        }
+        for(auto i = work.library_nodes.first; i < work.library_nodes.second; ++i) {
+            assert(work.lower[i].size() <= traits::num_genotypes);
+            lower[i] = work.lower[i];
+        }
+    }
+};
+
+namespace fixed {
+
+// Family Order: Parent, Child
+template<int N>
+void down(fixed_workspace_t<N> &work, const family_members_t &family,
+          const fixed_matrices_t<N> &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.upper[child] = (mat.pair[child].transpose() * (work.upper[parent] *
+                         work.lower[parent]).matrix()).array();
+}
+
+// Family Order: Parent, Child
+template<int N>
+void down_fast(fixed_workspace_t<N> &work, const family_members_t &family,
+               const fixed_matrices_t<N> &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.upper[child] = (mat.pair[child].transpose() *
+                         work.upper[parent].matrix()).array();
+}
+
+// Family Order: Parent, Child
+template<int N>
+void up(fixed_workspace_t<N> &work, const family_members_t &family,
+        const fixed_matrices_t<N> &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.lower[parent] *= (mat.pair[child] * work.lower[child].matrix()).array();
+}
+
+// Family Order: Parent, Child
+template<int N>
+void up_fast(fixed_workspace_t<N> &work, const family_members_t &family,
+             const fixed_matrices_t<N> &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.lower[parent] = (mat.pair[child] * work.lower[child].matrix()).array();
+}
+
+// Calculate P(child data | dad=x, mom=y) as a mom_width x dad_width matrix
+template<int N>
+typename fixed_traits<N>::matrix_t meiosis_lower(const fixed_matrices_t<N> &mat,
+    std::size_t child, const typename fixed_traits<N>::array_t &lower) {
+    const auto &f = mat.meiosis[child];
+    assert(!f.dad.empty());
+    typename fixed_traits<N>::allele_matrix_t sym;
+    for(int a = 0, i = 0; a < N; ++a) {
+        for(int b = 0; b <= a; ++b, ++i) {
+            sym(a, b) = sym(b, a) = lower(i);
+        }
+    }
+    typename fixed_traits<N>::matrix_t ret;
+    ret.setZero(f.mom[0].rows(), f.dad[0].rows());
+    for(std::size_t k = 0; k < f.dad.size(); ++k) {
+        ret.noalias() += f.mom[k] * sym * f.dad[k].transpose();
+    }
+    return ret;
+}
+
+// Calculate P(child data & data of the other parent | parent)
+template<int N>
+typename fixed_traits<N>::array_t sum_over_meiosis(fixed_workspace_t<N> &work,
+    const family_members_t &family, const fixed_matrices_t<N> &mat, bool to_father) {
+    typedef fixed_traits<N> traits;
+    auto dad = family[0];
+    auto mom = family[1];
+    auto other = to_father ? mom : dad;
+    typename traits::array_t other_v = work.upper[other] * work.lower[other];
+
+    if(family.size() == 3) {
+        // sum_k to[k] * L * from[k]^T * other, where L is the symmetric
+        // allele x allele matrix of the child's lower values
+        const auto &f = mat.meiosis[family[2]];
+        assert(!f.dad.empty());
+        const auto &to = to_father ? f.dad : f.mom;
+        const auto &from = to_father ? f.mom : f.dad;
+        const auto &lower = work.lower[family[2]];
+        typename traits::array_t ret = traits::array_t::Zero(to[0].rows());
+        typename traits::allele_vector_t v, w;
+        for(std::size_t k = 0; k < to.size(); ++k) {
+            v.noalias() = from[k].transpose() * other_v.matrix();
+            w.setZero();
+            for(int a = 0, i = 0; a < N; ++a) {
+                for(int b = 0; b <= a; ++b, ++i) {
+                    w(a) += lower(i) * v(b);
+                    if(a != b) {
+                        w(b) += lower(i) * v(a);
+                    }
+                }
+            }
+            ret += (to[k] * w).array();
+        }
+        return ret;
+    }
+    // Sum over children
+    typename traits::matrix_t buffer = meiosis_lower(mat, family[2], work.lower[family[2]]);
+    for(std::size_t i = 3; i < family.size(); ++i) {
+        buffer.array() *= meiosis_lower(mat, family[i], work.lower[family[i]]).array();
+    }
+    if(to_father) {
+        return (buffer.transpose() * other_v.matrix()).array();
+    }
+    return (buffer * other_v.matrix()).array();
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+template<int N>
+void to_father(fixed_workspace_t<N> &work, const family_members_t &family,
+               const fixed_matrices_t<N> &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[0]] *= sum_over_meiosis(work, family, mat, true);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+template<int N>
+void to_father_fast(fixed_workspace_t<N> &work, const family_members_t &family,
+                    const fixed_matrices_t<N> &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[0]] = sum_over_meiosis(work, family, mat, true);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+template<int N>
+void to_mother(fixed_workspace_t<N> &work, const family_members_t &family,
+               const fixed_matrices_t<N> &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[1]] *= sum_over_meiosis(work, family, mat, false);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+template<int N>
+void to_mother_fast(fixed_workspace_t<N> &work, const family_members_t &family,
+                    const fixed_matrices_t<N> &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[1]] = sum_over_meiosis(work, family, mat, false);
+}
+
+// Family Order: Father, Mother, Child, Child2, ....
+// Also used for the fast version, since both overwrite the upper of the child
+template<int N>
+void to_child(fixed_workspace_t<N> &work, const family_members_t &family,
+              const fixed_matrices_t<N> &mat) {
+    typedef fixed_traits<N> traits;
+    assert(family.size() >= 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    const auto &f = mat.meiosis[child];
+    assert(!f.dad.empty());
+    typename traits::array_t dad_v = work.lower[dad] * work.upper[dad];
+    typename traits::array_t mom_v = work.lower[mom] * work.upper[mom];
+
+    // Sum over parents for each phased child genotype
+    typename traits::allele_matrix_t phased = traits::allele_matrix_t::Zero();
+    if(family.size() == 3) {
+        for(std::size_t k = 0; k < f.dad.size(); ++k) {
+            phased.noalias() += (f.dad[k].transpose() * dad_v.matrix()) *
+                                (f.mom[k].transpose() * mom_v.matrix()).transpose();
+        }
+    } else {
+        // P(~child data & dad=x, mom=y) as a mom_width x dad_width matrix
+        typename traits::matrix_t parents = mom_v.matrix() * dad_v.matrix().transpose();
+        for(std::size_t i = 3; i < family.size(); ++i) {
+            parents.array() *= meiosis_lower(mat, family[i], work.lower[family[i]]).array();
+        }
+        for(std::size_t k = 0; k < f.dad.size(); ++k) {
+            phased.noalias() += f.dad[k].transpose() * parents.transpose() * f.mom[k];
+        }
+    }
+    // Fold the phased genotypes
+    work.upper[child].resize(traits::num_genotypes);
+    for(int a = 0, i = 0; a < N; ++a) {
+        for(int b = 0; b <= a; ++b, ++i) {
+            work.upper[child](i) = (a == b) ? phased(a, a) : phased(a, b) + phased(b, a);
+        }
+    }
+}
+
+// Apply a forward peeling operation
+template<int N>
+void apply(Op op, fixed_workspace_t<N> &work, const family_members_t &family,
+           const fixed_matrices_t<N> &mat) {
+    switch(op) {
+    case Op::UP:
+        return up(work, family, mat);
+    case Op::DOWN:
+        return down(work, family, mat);
+    case Op::TOFATHER:
+        return to_father(work, family, mat);
+    case Op::TOMOTHER:
+        return to_mother(work, family, mat);
+    case Op::TOCHILD:
+    case Op::TOCHILDFAST:
+        return to_child(work, family, mat);
+    case Op::UPFAST:
+        return up_fast(work, family, mat);
+    case Op::DOWNFAST:
+        return down_fast(work, family, mat);
+    case Op::TOFATHERFAST:
+        return to_father_fast(work, family, mat);
+    case Op::TOMOTHERFAST:
+        return to_mother_fast(work, family, mat);
+    default:
+        assert(false); // should never get here
+        break;
+    }
+}
+
+} // namespace dng::peel::fixed
+} // namespace dng::peel
+} // namespace dng
+
+#endif // DNG_PEELING_FIXED_H
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DNG_PHASER_H
+#define DNG_PHASER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <dng/hts/bam.h>
+
+namespace dng {
+namespace phaser {
+
+// Reads with these flags are not used for phasing. Duplicates are counted
+// because reads are not genotyped.
+constexpr uint16_t READ_FILTER_FLAGS = BAM_FUNMAP | BAM_FQCFAIL;
+
+// An informative phasing site from the parental GT file
+struct pgt_site_t {
+    long pos;        // 1-based position of phasing site
+    int line;        // line of the site in the file
+    std::string gt1; // genotype of first parent
+    std::string gt2; // genotype of second parent
+};
+
+// The phasing sites of each chromosome, sorted by position
+typedef std::unordered_map<std::string, std::vector<pgt_site_t>> pgt_index_t;
+
+// Reads supporting a pair of bases at the DNM and a phasing site
+struct phase_count_t {
+    char dnm_base;
+    char hap_base;
+    const char *parent; // inferred parent of origin of the DNM
+    int count;
+};
+
+// The result of phasing a DNM with a phasing site
+struct site_phase_t {
+    const pgt_site_t *site;
+    int bad_cigar_op; // htslib code of a cigar operation that could not be handled, or -1
+    std::vector<phase_count_t> counts;
+};
+
+// Returns "p1" or "p2" if the bases seen at the DNM and a phasing site show
+// which parent the DNM came from, and "N/A" otherwise
+const char *parent_of_origin(char dnm_b, char hap_b, const std::string &gt1,
+                             const std::string &gt2, char variant_base);
+
+// Expand a read so that its bases line up with the reference. Returns the
+// htslib code of the first cigar operation that can not be handled, or -1.
+int format_read(const hts::bam::Alignment &rec, std::string *seq_formatted);
+
+// Phases a DNM with every informative site within window bases of it.
+//
+// The reads of the window, in the order of the BAM file, are passed to Add().
+// Each site only looks at the reads that overlap the span between itself and
+// the DNM, and counts the bases seen at both positions by reads with the same
+// name, so mates can phase a DNM and a site that neither covers alone.
+class DnmPhaser {
+public:
+    // dnm_pos is 1-based
+    DnmPhaser(const pgt_index_t &index, const std::string &chr, long dnm_pos,
+              char variant_base, long window);
+
+    // True if there are no phasing sites near the DNM
+    bool empty() const { return result_.empty(); }
+
+    // 0-based span of the reads needed to phase the DNM, [beg,end)
+    long window_beg() const { return window_beg_; }
+    long window_end() const { return window_end_; }
+
+    // Add a read that overlaps the window
+    void Add(hts::bam::Alignment &rec);
+
+    // Returns the phasing of each site, in the order of the GT file
+    std::vector<site_phase_t> Finish();
+
+private:
+    // 0-based span between a site and the DNM, [beg,end)
+    struct state_t {
+        long beg, end;
+        std::map<std::string, int> pair_count;
+    };
+    // Bases of a read and its mates
+    struct read_t {
+        bool has_dnm{false};
+        char dnm_base{0};
+        std::vector<std::pair<size_t, char>> hap_bases; // (site, base)
+    };
+
+    long dnm_pos_;
+    char variant_base_;
+    std::vector<site_phase_t> result_;
+    std::vector<state_t> state_;
+    long window_beg_{0};
+    long window_end_{0};
+
+    // the key is the hashed query name, which mates share
+    std::unordered_map<uint64_t, read_t> reads_;
+    std::string seq_formatted_;
+};
+
+// Phase a DNM with the reads of bam
+std::vector<site_phase_t> phase_dnm(hts::bam::File &bam, const pgt_index_t &index,
+                                    const std::string &chr, long dnm_pos,
+                                    char variant_base, long window);
+
+} // namespace dng::phaser
+} // namespace dng
+
+#endif // DNG_PHASER_H
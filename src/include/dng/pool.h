@@ -21,8 +21,14 @@
 #ifndef DNG_POOL_H
 #define DNG_POOL_H
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <boost/version.hpp>
@@ -154,6 +160,218 @@ private:
     node_type *next_, * end_;
 };
 
+// A node that can be stored in a ConcurrentPool or an IntrusivePool
+struct ConcurrentPoolNode : public PoolNode {
+    ConcurrentPoolNode *pool_next_{nullptr}; // next node in a free list
+};
+
+// A pool of nodes that can be allocated and freed by several threads. Each
+// thread allocates and frees nodes through its own Cache, which keeps a local
+// free list. Caches exchange nodes with the pool in batches through a
+// lock-free free list, so a node can be allocated on one thread and freed on
+// another. New nodes are constructed in blocks of batch_size nodes.
+//
+// The pool constructs at most max_nodes nodes. When all of them are in use,
+// Cache::Malloc() waits until another thread frees one. Because each cache
+// can hold up to 2*batch_size free nodes, max_nodes should be much larger
+// than batch_size times the number of caches.
+template<typename Node>
+class ConcurrentPool {
+public:
+    typedef Node node_type;
+    static_assert(std::is_base_of<ConcurrentPoolNode, Node>::value,
+        "nodes of a ConcurrentPool must derive from ConcurrentPoolNode");
+
+    class Cache;
+
+    explicit ConcurrentPool(std::size_t max_nodes = std::numeric_limits<std::size_t>::max(),
+        std::size_t batch_size = 256) : max_nodes_{max_nodes},
+        batch_size_{std::max<std::size_t>(batch_size, 1)} {
+    }
+
+    // the number of nodes that have been constructed
+    std::size_t num_nodes() const { return num_nodes_.load(std::memory_order_relaxed); }
+    std::size_t max_nodes() const { return max_nodes_; }
+    std::size_t batch_size() const { return batch_size_; }
+
+    // do not copy, move, or assign
+    ConcurrentPool(const ConcurrentPool&) = delete;
+    ConcurrentPool& operator=(const ConcurrentPool&) = delete;
+
+private:
+    // Push the chain of nodes from first to last onto the free list
+    void Push(ConcurrentPoolNode *first, ConcurrentPoolNode *last) noexcept {
+        ConcurrentPoolNode *head = free_.load(std::memory_order_relaxed);
+        do {
+            last->pool_next_ = head;
+        } while(!free_.compare_exchange_weak(head, first, std::memory_order_release,
+            std::memory_order_relaxed));
+    }
+
+    // Take every node on the free list. Taking the whole list, instead of
+    // popping one node, avoids the ABA problem.
+    ConcurrentPoolNode* PopAll() noexcept {
+        return free_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    // Construct up to batch_size new nodes, returning them as a chain
+    ConcurrentPoolNode* Expand(std::size_t *count);
+
+    std::atomic<ConcurrentPoolNode*> free_{nullptr};
+
+    std::size_t max_nodes_;
+    std::size_t batch_size_;
+
+    std::mutex mutex_; // protects blocks_
+    std::vector<std::unique_ptr<node_type[]>> blocks_;
+    std::atomic<std::size_t> num_nodes_{0};
+};
+
+template<typename Node>
+ConcurrentPoolNode* ConcurrentPool<Node>::Expand(std::size_t *count) {
+    assert(count != nullptr);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t n = std::min(batch_size_, max_nodes_ - num_nodes());
+    *count = n;
+    if(n == 0) {
+        return nullptr;
+    }
+    std::unique_ptr<node_type[]> block{new node_type[n]};
+    for(std::size_t i = 0; i+1 < n; ++i) {
+        block[i].pool_next_ = &block[i+1];
+    }
+    block[n-1].pool_next_ = nullptr;
+    ConcurrentPoolNode *first = &block[0];
+    blocks_.push_back(std::move(block));
+    num_nodes_.store(num_nodes() + n, std::memory_order_relaxed);
+    return first;
+}
+
+// A thread's handle to a ConcurrentPool. A cache must only be used by one
+// thread at a time, and it returns its free nodes to the pool when it is
+// destroyed.
+template<typename Node>
+class ConcurrentPool<Node>::Cache {
+public:
+    explicit Cache(ConcurrentPool &pool) : pool_{&pool} { }
+
+    Cache(Cache &&other) noexcept : pool_{other.pool_}, head_{other.head_}, size_{other.size_} {
+        other.head_ = nullptr;
+        other.size_ = 0;
+    }
+
+    Cache& operator=(Cache &&other) noexcept {
+        if(this != &other) {
+            Flush();
+            pool_ = other.pool_;
+            head_ = other.head_;
+            size_ = other.size_;
+            other.head_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    ~Cache() {
+        Flush();
+    }
+
+    // Allocate a node, waiting if the pool is at its limit
+    node_type* Malloc() {
+        for(;;) {
+            node_type *p = TryMalloc();
+            if(p != nullptr) {
+                return p;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // Allocate a node, or return nullptr if the pool is at its limit
+    node_type* TryMalloc() {
+        if(head_ == nullptr) {
+            Refill();
+            if(head_ == nullptr) {
+                return nullptr;
+            }
+        }
+        ConcurrentPoolNode *p = head_;
+        head_ = p->pool_next_;
+        size_ -= 1;
+        return static_cast<node_type*>(p);
+    }
+
+    void Free(node_type *p) noexcept {
+        assert(p != nullptr);
+        p->pool_next_ = head_;
+        head_ = p;
+        size_ += 1;
+        // give a batch back to the pool so other threads can use it
+        if(size_ >= 2*pool_->batch_size_) {
+            ConcurrentPoolNode *last = head_;
+            for(std::size_t i = 1; i < pool_->batch_size_; ++i) {
+                last = last->pool_next_;
+            }
+            ConcurrentPoolNode *first = head_;
+            head_ = last->pool_next_;
+            size_ -= pool_->batch_size_;
+            pool_->Push(first, last);
+        }
+    }
+
+    // Return every free node in the cache to the pool
+    void Flush() noexcept {
+        if(head_ == nullptr) {
+            return;
+        }
+        ConcurrentPoolNode *last = head_;
+        while(last->pool_next_ != nullptr) {
+            last = last->pool_next_;
+        }
+        pool_->Push(head_, last);
+        head_ = nullptr;
+        size_ = 0;
+    }
+
+    // the number of free nodes in the cache
+    std::size_t size() const { return size_; }
+
+    // do not copy or assign
+    Cache(const Cache&) = delete;
+    Cache& operator=(const Cache&) = delete;
+
+private:
+    void Refill() {
+        assert(head_ == nullptr);
+        head_ = pool_->PopAll();
+        if(head_ == nullptr) {
+            head_ = pool_->Expand(&size_);
+            return;
+        }
+        // keep one batch and return the rest, so that other threads are not
+        // starved of nodes
+        ConcurrentPoolNode *last = head_;
+        size_ = 1;
+        while(size_ < pool_->batch_size_ && last->pool_next_ != nullptr) {
+            last = last->pool_next_;
+            size_ += 1;
+        }
+        ConcurrentPoolNode *rest = last->pool_next_;
+        last->pool_next_ = nullptr;
+        if(rest != nullptr) {
+            ConcurrentPoolNode *rest_last = rest;
+            while(rest_last->pool_next_ != nullptr) {
+                rest_last = rest_last->pool_next_;
+            }
+            pool_->Push(rest, rest_last);
+        }
+    }
+
+    ConcurrentPool *pool_;
+    ConcurrentPoolNode *head_{nullptr};
+    std::size_t size_{0};
+};
+
 } // namespace dng
 
 #endif //DNG_POOL_H
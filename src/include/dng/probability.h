@@ -21,11 +21,13 @@
 #define DNG_PROBABILITY_H
 
 #include <array>
+#include <tuple>
 #include <vector>
 
 #include <dng/genotyper.h>
 #include <dng/relationship_graph.h>
 #include <dng/mutation.h>
+#include <dng/matrix_cache.h>
 
 #include <dng/detail/unit_test.h>
 
@@ -42,7 +44,9 @@ public:
         return (num <= MAXIMUM_NUMBER_ALLELES) ? num : MAXIMUM_NUMBER_ALLELES;
     }
 
-    Probability(RelationshipGraph graph, params_t params);
+    // If cache is not null, transition matrices and priors are loaded from it
+    // when possible and added to it otherwise.
+    Probability(RelationshipGraph graph, params_t params, MatrixCache *cache = nullptr);
 
     template<typename A>
     void SetupWorkspace(const A &depths, int num_obs_alleles, genotype::Mode mode);
@@ -56,6 +60,14 @@ public:
     template<typename A>
     double CalculateLLD(const A &depths, int num_obs_alleles);
 
+    // Calculate 'log10 P(Data ; model)' of sites[0] to sites[num_sites-1] and
+    // store the results in lld and the scales of the genotype likelihoods in
+    // ln_scale. Sites with the same number of alleles are peeled in blocks.
+    // The result of a site does not depend on the other sites, but it can
+    // differ from the single-site CalculateLLD in the last bits.
+    template<typename R>
+    void CalculateLLD(const R &sites, size_t num_sites, double *lld, double *ln_scale);
+
     const peel::workspace_t& work() const { return work_; }
 
     struct params_t {
@@ -69,6 +81,7 @@ public:
         double sequencing_bias;
         double error_rate;
         double lib_k_alleles;
+        int lib_depth_cache = genotype::DirichletMultinomial::DEFAULT_CACHE_SIZE;
 
         double k_alleles;
     };
@@ -76,9 +89,32 @@ public:
 protected:
     using matrices_t = std::array<TransitionMatrixVector, MAXIMUM_NUMBER_ALLELES>;
 
+    // Matrices with fixed maximum sizes, one per number of alleles
+    template<template<int> class T>
+    using per_allele_t = std::tuple<T<1>, T<2>, T<3>, T<4>>;
+    static_assert(MAXIMUM_NUMBER_ALLELES == std::tuple_size<per_allele_t<peel::fixed_workspace_t>>::value,
+        "per_allele_t must hold one element per number of alleles");
+    using fixed_matrices_t = per_allele_t<peel::fixed_matrices_t>;
+
+    static fixed_matrices_t CreateFixedMatrices(const matrices_t &matrices);
+
+    // Peel work_ forwards using fixed-size storage for its number of alleles
+    double PeelForwards(const fixed_matrices_t &mat);
+    template<int N>
+    double PeelForwards(const peel::fixed_matrices_t<N> &mat);
+
     template<typename T>
     matrices_t CreateMutationMatrices(T mutype) const;
 
+    template<typename T>
+    matrices_t CreateMutationMatrices(T mutype, MatrixCache *cache, const std::string &name) const;
+
+    // identifies the graph and parameters that matrices were calculated from
+    uint64_t MatrixCacheKey() const;
+
+    static MatrixCache::entry_t FlattenMatrices(const matrices_t &matrices);
+    bool UnflattenMatrices(const MatrixCache::entry_t &entry, matrices_t *matrices) const;
+
     GenotypeArray DiploidPrior(int num_obs_alleles);
     GenotypeArray HaploidPrior(int num_obs_alleles);
 
@@ -87,11 +123,19 @@ protected:
     peel::workspace_t work_; // must be declared after graph_ (see constructor)
 
     matrices_t transition_matrices_;
+    fixed_matrices_t fixed_transition_matrices_;
+
+    per_allele_t<peel::fixed_workspace_t> fixed_work_;
 
     double ln_monomorphic_;
 
     Genotyper genotyper_;
 
+    // Workspaces used to peel blocks of sites, one per number of alleles
+    static constexpr size_t BLOCK_SIZE{64};
+    std::array<peel::batch_workspace_t, MAXIMUM_NUMBER_ALLELES> block_work_;
+    std::array<std::vector<size_t>, MAXIMUM_NUMBER_ALLELES> block_sites_;
+
     using prior_t = std::array<GenotypeArray, MAXIMUM_NUMBER_ALLELES>;
 
     prior_t diploid_prior_; // Holds P(G | theta)
@@ -137,7 +181,7 @@ Probability::logdiff_t Probability::CalculateMONO(genotype::Mode mode) {
     if(mode != genotype::Mode::Likelihood) {
         work_.ExpGenotypeLikelihoods();
     }
-    double ln_data = graph_.PeelForwards(work_, transition_matrices_[work_.matrix_index]);
+    double ln_data = PeelForwards(fixed_transition_matrices_);
     return {ln_mono, ln_data};
 }
 
@@ -158,10 +202,43 @@ double Probability::PeelOnlyReference(genotype::Mode mode) {
     return ln_mono;
 }
 
+inline
+Probability::fixed_matrices_t Probability::CreateFixedMatrices(const matrices_t &matrices) {
+    return fixed_matrices_t{peel::fixed_matrices_t<1>{matrices[0]},
+        peel::fixed_matrices_t<2>{matrices[1]}, peel::fixed_matrices_t<3>{matrices[2]},
+        peel::fixed_matrices_t<4>{matrices[3]}};
+}
+
+inline
+double Probability::PeelForwards(const fixed_matrices_t &mat) {
+    switch(work_.matrix_index) {
+    case 0:
+        return PeelForwards(std::get<0>(mat));
+    case 1:
+        return PeelForwards(std::get<1>(mat));
+    case 2:
+        return PeelForwards(std::get<2>(mat));
+    case 3:
+        return PeelForwards(std::get<3>(mat));
+    default:
+        assert(false); // should never get here
+        return 0.0;
+    }
+}
+
+// Peels a copy of work_; work_ itself is not modified
+template<int N>
+inline
+double Probability::PeelForwards(const peel::fixed_matrices_t<N> &mat) {
+    auto &work = std::get<N-1>(fixed_work_);
+    work.Assign(work_);
+    return graph_.PeelForwards(work, mat);
+}
+
 // returns 'log10 P(Data ; model)'
 inline
 double Probability::CalculateLLD() {
-    double ln_data = graph_.PeelForwards(work_, transition_matrices_[work_.matrix_index]);
+    double ln_data = PeelForwards(fixed_transition_matrices_);
     return (ln_data+work_.ln_scale)/M_LN10;
 }
 
@@ -182,21 +259,89 @@ double Probability::CalculateLLD(const A &depths, int num_obs_alleles)
     return (ln_monomorphic_ + work_.ln_scale)/M_LN10;
 }
 
-// Construct the mutation matrices for each transition
+template<typename R>
+void Probability::CalculateLLD(const R &sites, size_t num_sites, double *lld, double *ln_scale) {
+    assert(lld != nullptr && ln_scale != nullptr);
+
+    // Peel the sites that have been collected in a block
+    auto peel_block = [&](size_t k) {
+        auto &work = block_work_[k];
+        auto &index = block_sites_[k];
+        if(index.empty()) {
+            return;
+        }
+        if(index.size() < work.num_sites) {
+            work.Truncate(index.size());
+        }
+        Eigen::ArrayXd ln_data = graph_.PeelForwards(work, transition_matrices_[k]);
+        for(size_t j = 0; j < index.size(); ++j) {
+            lld[index[j]] = (ln_data[j] + ln_scale[index[j]])/M_LN10;
+        }
+        index.clear();
+    };
+
+    for(size_t i = 0; i < num_sites; ++i) {
+        const auto &depths = sites[i];
+        int num_obs_alleles = adjust_num_obs_alleles(depths.shape()[1]);
+        // calculate genotype likelihoods and store in the lower library vector
+        work_.CalculateGenotypeLikelihoods(genotyper_, depths, num_obs_alleles,
+            genotype::Mode::Likelihood);
+        ln_scale[i] = work_.ln_scale;
+        if(num_obs_alleles == 1) {
+            // Use cached value for monomorphic sites instead of peeling.
+            lld[i] = (ln_monomorphic_ + work_.ln_scale)/M_LN10;
+            continue;
+        }
+        const size_t k = num_obs_alleles-1;
+        auto &work = block_work_[k];
+        auto &index = block_sites_[k];
+        if(index.empty()) {
+            work.SetGermline(DiploidPrior(num_obs_alleles), HaploidPrior(num_obs_alleles),
+                BLOCK_SIZE);
+        }
+        work.CopyGenotypeLikelihoods(index.size(), work_);
+        index.push_back(i);
+        if(index.size() == BLOCK_SIZE) {
+            peel_block(k);
+        }
+    }
+    for(size_t k = 0; k < block_sites_.size(); ++k) {
+        peel_block(k);
+    }
+}
+
+// Construct the factored meiosis matrices of each trio child
 template<typename T>
 inline
-TransitionMatrixVector create_mutation_matrices(const RelationshipGraph &graph,
+std::vector<MeiosisFactors> create_meiosis_factors(const RelationshipGraph &graph,
     int num_obs_alleles, double k_alleles, T mutype) {
-    TransitionMatrixVector matrices(graph.num_nodes());
- 
+    std::vector<MeiosisFactors> factors(graph.num_nodes());
+
     for(size_t child = 0; child < graph.num_nodes(); ++child) {
         auto trans = graph.transition(child);
         if(trans.type == RelationshipGraph::TransitionType::Trio) {
             assert(graph.ploidy(child) == 2);
             auto dad = mutation::Model{trans.length1, k_alleles};
             auto mom = mutation::Model{trans.length2, k_alleles};
-            matrices[child] = meiosis_matrix(num_obs_alleles, dad, mom, mutype,
+            factors[child] = meiosis_factors(num_obs_alleles, dad, mom, mutype,
                 graph.ploidy(trans.parent1), graph.ploidy(trans.parent2));
+        }
+    }
+    return factors;
+}
+
+// Construct the mutation matrices for each transition
+template<typename T>
+inline
+TransitionMatrixVector create_mutation_matrices(const RelationshipGraph &graph,
+    int num_obs_alleles, double k_alleles, T mutype) {
+    TransitionMatrixVector matrices(graph.num_nodes());
+    matrices.meiosis = create_meiosis_factors(graph, num_obs_alleles, k_alleles, mutype);
+ 
+    for(size_t child = 0; child < graph.num_nodes(); ++child) {
+        auto trans = graph.transition(child);
+        if(trans.type == RelationshipGraph::TransitionType::Trio) {
+            matrices[child] = mutation::meiosis_matrix(matrices.meiosis[child]);
         } else if(trans.type == RelationshipGraph::TransitionType::Pair) {
             auto orig = mutation::Model(trans.length1, k_alleles);
             if(graph.ploidy(child) == 1) {
@@ -223,6 +368,29 @@ Probability::matrices_t Probability::CreateMutationMatrices(T mutype) const {
     return ret;
 }
 
+template<typename T>
+inline
+Probability::matrices_t Probability::CreateMutationMatrices(T mutype, MatrixCache *cache,
+    const std::string &name) const
+{
+    if(cache == nullptr) {
+        return CreateMutationMatrices(mutype);
+    }
+    const uint64_t key = MatrixCacheKey();
+    matrices_t ret;
+    MatrixCache::entry_t entry;
+    if(cache->Get(key, name, &entry) && UnflattenMatrices(entry, &ret)) {
+        // the factored meiosis matrices are cheap to construct and not cached
+        for(int i=0;i<ret.size();++i) {
+            ret[i].meiosis = create_meiosis_factors(graph_, i+1, params_.k_alleles, mutype);
+        }
+        return ret;
+    }
+    ret = CreateMutationMatrices(mutype);
+    cache->Put(key, name, FlattenMatrices(ret));
+    return ret;
+}
+
 inline
 GenotypeArray Probability::DiploidPrior(int num_obs_alleles) {
     assert(num_obs_alleles >= 1);
@@ -253,6 +421,7 @@ Probability::params_t get_model_parameters(const A& a) {
     ret.sequencing_bias = a.lib_bias;
     ret.error_rate = a.lib_error;
     ret.lib_k_alleles = a.lib_kbases;
+    ret.lib_depth_cache = a.lib_depth_cache;
 
     ret.k_alleles = a.kalleles;
 
@@ -138,6 +138,14 @@ ranges_t parse_regions(const std::string &text, const ContigIndex& index);
 // Parse slurped bed into ranges
 ranges_t parse_bed(const std::string &text, const ContigIndex& index);
 
+// Ranges that cover every contig in index
+ranges_t contig_ranges(const ContigIndex& index);
+
+// Split ranges into at most num_shards groups of consecutive ranges, such that
+// each group contains about the same number of positions. Ranges may be cut
+// at group boundaries.
+std::vector<ranges_t> shard_ranges(const ranges_t& ranges, size_t num_shards);
+
 // Task helper functions
 template<typename M>
 inline
@@ -177,6 +185,24 @@ void set_regions(std::string region, M *mpileup) {
     }
 }
 
+// Split the region argument into shards using the contigs of mpileup.
+// If region is empty, all contigs are used.
+template<typename M>
+inline
+std::vector<ranges_t> shard_regions(std::string region, const M& mpileup, size_t num_shards) {
+    regions::ContigIndex index;
+    for(auto && a : mpileup.contigs()) {
+        index.AddContig(std::move(a));
+    }
+    auto region_ext = io::at_slurp(region);
+    if(region.empty()) {
+        return shard_ranges(contig_ranges(index), num_shards);
+    } else if(region_ext == "bed") {
+        return shard_ranges(parse_bed(region, index), num_shards);
+    }
+    return shard_ranges(parse_regions(region, index), num_shards);
+}
+
 } // namespace dng::regions
 } // namespace dng
 
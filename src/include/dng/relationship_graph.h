@@ -29,6 +29,7 @@
 #include <dng/matrix.h>
 #include <dng/library.h>
 #include <dng/peeling.h>
+#include <dng/peeling_fixed.h>
 #include <dng/pedigree.h>
 #include <dng/detail/graph.h>
 #include <dng/detail/unit_test.h>
@@ -111,6 +112,45 @@ public:
         return ret;
     }
 
+    // Peel a block of sites at once. Returns the log-likelihood of each site.
+    Eigen::ArrayXd PeelForwards(peel::batch_workspace_t &work,
+                                const TransitionMatrixVector &mat) const {
+        // Peel pedigree one family at a time
+        for(std::size_t i = 0; i < peeling_batch_functions_.size(); ++i) {
+            (*peeling_batch_functions_[i])(work, family_members_[i], mat);
+        }
+
+        // Sum over roots. Eigen's vectorized log can differ from std::log in
+        // the last bit, so every site uses std::log.
+        Eigen::ArrayXd ret = Eigen::ArrayXd::Zero(work.num_sites);
+        for(auto r : roots_) {
+            auto sums = peel::column_sums(work.lower[r] * work.upper[r]);
+            for(std::size_t j = 0; j < work.num_sites; ++j) {
+                ret[j] += log(sums[j]);
+            }
+        }
+
+        return ret;
+    }
+
+    // Peel a site with N observed alleles using fixed-size storage
+    template<int N>
+    double PeelForwards(peel::fixed_workspace_t<N> &work,
+                        const peel::fixed_matrices_t<N> &mat) const {
+        // Peel pedigree one family at a time
+        for(std::size_t i = 0; i < peeling_functions_ops_.size(); ++i) {
+            peel::fixed::apply(peeling_functions_ops_[i], work, family_members_[i], mat);
+        }
+
+        // Sum over roots
+        double ret = 0.0;
+        for(auto r : roots_) {
+            ret += log((work.lower[r] * work.upper[r]).sum());
+        }
+
+        return ret;
+    }
+
     double PeelBackwards(peel::workspace_t &work,
                          const TransitionMatrixVector &mat) const {
         double ret = 0.0;
@@ -141,6 +181,19 @@ public:
         return work;
     }
 
+    peel::batch_workspace_t CreateBatchWorkspace() const {
+        peel::batch_workspace_t work;
+        work.Resize(num_nodes_);
+        work.founder_nodes = std::make_pair(first_founder_, first_nonfounder_);
+        work.germline_nodes = std::make_pair(first_founder_, first_somatic_);
+        work.somatic_nodes = std::make_pair(first_somatic_, first_library_);
+        work.library_nodes = std::make_pair(first_library_, num_nodes_);
+
+        work.ploidies = ploidies_;
+
+        return work;
+    }
+
     std::vector<std::string> BCFHeaderLines() const;
 
     const std::vector<transition_t> &transitions() const { return transitions_; }
@@ -184,6 +237,7 @@ protected:
     // Array of functions that will be called to perform the peeling
     std::vector<peel::function_t> peeling_functions_;
     std::vector<peel::function_t> peeling_reverse_functions_;
+    std::vector<peel::batch_function_t> peeling_batch_functions_;
 
     // The arguments to a peeling operation
     std::vector<peel::family_members_t> family_members_;
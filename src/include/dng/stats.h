@@ -38,6 +38,8 @@ double fisher_exact_test(int a11, int a12, int a21, int a22);
 double g_test(double a11, double a12, double a21, double a22);
 
 double ad_two_sample_test(std::vector<int> a, std::vector<int> b);
+// Sorts a and b in place instead of copying them
+double ad_two_sample_test(std::vector<int> *a, std::vector<int> *b);
 
 // Derived from Python's math.fsum
 class ExactSum {
@@ -55,6 +57,8 @@ public:
         }
         return *this;
     }
+    ExactSum(const ExactSum&) = default;
+    ExactSum(ExactSum&&) = default;
     ExactSum& operator=(const ExactSum&) = default;
     ExactSum& operator=(ExactSum&&) = default;
 
@@ -302,7 +302,8 @@ file_type_t extract_file_type(std::string path);
 enum class FileCat {
     Unknown  = 0,
     Sequence = 1,
-    Variant  = 2
+    Variant  = 2,
+    Pileup   = 4
 };
 ENABLE_ENUMFLAGS(FileCat);
 
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dng/io/ad.h>
+#include <dng/detail/varint.h>
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+using namespace dng;
+using namespace dng::io;
+
+namespace varint = dng::detail::varint;
+
+namespace {
+// "DNGAD" followed by a format version
+const uint64_t MAGIC = UINT64_C(0x01) << 56 | UINT64_C(0x4441474E44);
+
+// Reads from a block of memory
+struct membuf_t : public std::streambuf {
+    membuf_t(char *first, char *last) {
+        setg(first, first, last);
+    }
+};
+
+void put_u64(std::streambuf *out, uint64_t u) {
+    char buffer[8];
+    for(int i = 0; i < 8; ++i) {
+        buffer[i] = static_cast<char>((u >> (8*i)) & 0xFF);
+    }
+    out->sputn(buffer, 8);
+}
+
+bool get_u64(std::streambuf *in, uint64_t *u) {
+    unsigned char buffer[8];
+    if(in->sgetn(reinterpret_cast<char*>(buffer), 8) != 8) {
+        return false;
+    }
+    *u = 0;
+    for(int i = 0; i < 8; ++i) {
+        *u |= static_cast<uint64_t>(buffer[i]) << (8*i);
+    }
+    return true;
+}
+
+void put_string(std::streambuf *out, const std::string &str) {
+    varint::put(out, str.size());
+    out->sputn(str.data(), str.size());
+}
+
+[[noreturn]] void throw_corrupt(const std::string &filename) {
+    throw std::runtime_error("Unable to read ad file '" + filename + "'; the file is corrupt or truncated.");
+}
+
+uint64_t get_varint(std::streambuf *in, const std::string &filename) {
+    if(auto u = varint::get(in)) {
+        return *u;
+    }
+    throw_corrupt(filename);
+}
+
+std::string get_string(std::streambuf *in, const std::string &filename) {
+    std::string str(get_varint(in, filename), '\0');
+    if(in->sgetn(&str[0], str.size()) != static_cast<std::streamsize>(str.size())) {
+        throw_corrupt(filename);
+    }
+    return str;
+}
+} // anon namespace
+
+uint64_t io::detail::encode_ad_alleles(const int *indexes, size_t num_alleles) {
+    assert(num_alleles <= 5);
+    uint64_t code = num_alleles;
+    for(size_t i = 0; i < num_alleles; ++i) {
+        assert(0 <= indexes[i] && indexes[i] < 5);
+        code |= static_cast<uint64_t>(indexes[i]) << (3+3*i);
+    }
+    return code;
+}
+
+size_t io::detail::decode_ad_alleles(uint64_t code, std::vector<int> *indexes) {
+    assert(indexes != nullptr);
+    size_t num_alleles = code & 0x7;
+    if(num_alleles > 5) {
+        throw std::runtime_error("Unable to decode the alleles of an ad file site.");
+    }
+    indexes->resize(num_alleles);
+    for(size_t i = 0; i < num_alleles; ++i) {
+        (*indexes)[i] = (code >> (3+3*i)) & 0x7;
+    }
+    return num_alleles;
+}
+
+AdWriter::AdWriter(const std::string &filename, size_t block_size) :
+    filename_{filename}, block_size_{(block_size > 0) ? block_size : 1}
+{
+    file_.Open(filename, std::ios_base::out);
+    if(!file_.is_open()) {
+        throw std::runtime_error("Unable to open ad file '" + filename + "' for writing.");
+    }
+    std::stringbuf buffer;
+    put_u64(&buffer, MAGIC);
+    WriteBuffer(&buffer);
+}
+
+AdWriter::~AdWriter() {
+    try {
+        Close();
+    } catch(...) {
+        // destructors must not throw
+    }
+}
+
+void AdWriter::WriteHeader(const std::vector<regions::contig_t> &contigs,
+    const libraries_t &libraries) {
+    assert(libraries.names.size() == libraries.samples.size());
+    std::stringbuf buffer;
+    varint::put(&buffer, contigs.size());
+    for(auto && contig : contigs) {
+        put_string(&buffer, contig.name);
+        varint::put(&buffer, contig.length);
+    }
+    varint::put(&buffer, libraries.names.size());
+    for(size_t i = 0; i < libraries.names.size(); ++i) {
+        put_string(&buffer, libraries.names[i]);
+        put_string(&buffer, libraries.samples[i]);
+    }
+    WriteBuffer(&buffer);
+    num_libraries_ = libraries.names.size();
+}
+
+void AdWriter::Write(utility::location_t location, const std::vector<int> &indexes,
+    const pileup::allele_depths_t &depths) {
+    assert(depths.shape()[0] == num_libraries_);
+    const size_t num_alleles = depths.shape()[1];
+    assert(num_alleles <= indexes.size());
+    if(num_sites_ == 0) {
+        first_location_ = location;
+        varint::put(&locations_, location);
+    } else {
+        assert(location > last_location_);
+        varint::put(&locations_, location - last_location_);
+    }
+    last_location_ = location;
+    varint::put(&alleles_, io::detail::encode_ad_alleles(indexes.data(), num_alleles));
+    for(size_t u = 0; u < num_libraries_; ++u) {
+        for(size_t k = 0; k < num_alleles; ++k) {
+            assert(depths[u][k] >= 0);
+            varint::put(&depths_, depths[u][k]);
+        }
+    }
+    if(++num_sites_ == block_size_) {
+        WriteBlock();
+    }
+}
+
+void AdWriter::Close() {
+    if(is_closed_ || !file_.is_open()) {
+        return;
+    }
+    is_closed_ = true;
+    WriteBlock();
+
+    std::stringbuf buffer;
+    uint64_t index_offset = offset_;
+    varint::put(&buffer, index_.size());
+    for(auto && block : index_) {
+        varint::put(&buffer, block.first);
+        varint::put(&buffer, block.last - block.first);
+        varint::put(&buffer, block.offset);
+        varint::put(&buffer, block.num_sites);
+    }
+    put_u64(&buffer, index_offset);
+    put_u64(&buffer, MAGIC);
+    WriteBuffer(&buffer);
+    if(file_.rdbuf()->pubsync() != 0) {
+        throw std::runtime_error("Unable to write to ad file '" + filename_ + "'.");
+    }
+}
+
+void AdWriter::WriteBlock() {
+    if(num_sites_ == 0) {
+        return;
+    }
+    // concatenate the columns
+    std::string data = locations_.str();
+    data += alleles_.str();
+    data += depths_.str();
+
+    uLongf compressed_size = compressBound(data.size());
+    compressed_.resize(compressed_size);
+    if(compress2(reinterpret_cast<Bytef*>(&compressed_[0]), &compressed_size,
+            reinterpret_cast<const Bytef*>(data.data()), data.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        throw std::runtime_error("Unable to compress a block of ad file '" + filename_ + "'.");
+    }
+    index_.push_back({first_location_, last_location_, offset_, num_sites_});
+
+    std::stringbuf buffer;
+    varint::put(&buffer, num_sites_);
+    varint::put(&buffer, data.size());
+    varint::put(&buffer, compressed_size);
+    WriteBuffer(&buffer);
+    WriteBytes(compressed_.data(), compressed_size);
+
+    num_sites_ = 0;
+    for(auto p : {&locations_, &alleles_, &depths_}) {
+        p->str(std::string{});
+    }
+}
+
+void AdWriter::WriteBuffer(std::stringbuf *buffer) {
+    std::string str = buffer->str();
+    WriteBytes(str.data(), str.size());
+}
+
+void AdWriter::WriteBytes(const char *data, size_t size) {
+    if(file_.rdbuf()->sputn(data, size) != static_cast<std::streamsize>(size)) {
+        throw std::runtime_error("Unable to write to ad file '" + filename_ + "'.");
+    }
+    offset_ += size;
+}
+
+AdPileup::AdPileup(const std::string &filename) : filename_{filename} {
+    file_.Open(filename, std::ios_base::in);
+    if(!file_.is_open()) {
+        throw std::runtime_error("Unable to open ad file '" + filename + "' for reading.");
+    }
+    std::streambuf *in = file_.rdbuf();
+    uint64_t magic;
+    if(!get_u64(in, &magic) || magic != MAGIC) {
+        throw std::runtime_error("File '" + filename + "' is not an ad file.");
+    }
+    // header
+    size_t num_contigs = get_varint(in, filename_);
+    for(size_t i = 0; i < num_contigs; ++i) {
+        std::string name = get_string(in, filename_);
+        int length = get_varint(in, filename_);
+        contigs_.emplace_back(std::move(name), length);
+    }
+    size_t num_libraries = get_varint(in, filename_);
+    for(size_t i = 0; i < num_libraries; ++i) {
+        input_libraries_.names.push_back(get_string(in, filename_));
+        input_libraries_.samples.push_back(get_string(in, filename_));
+    }
+    ResetLibraries();
+
+    // footer and index
+    if(in->pubseekoff(-16, std::ios_base::end, std::ios_base::in) == std::streampos(-1)) {
+        throw std::runtime_error("Unable to seek in ad file '" + filename + "'; input must be a regular file.");
+    }
+    uint64_t index_offset;
+    if(!get_u64(in, &index_offset) || !get_u64(in, &magic) || magic != MAGIC) {
+        throw_corrupt(filename_);
+    }
+    if(in->pubseekpos(index_offset, std::ios_base::in) == std::streampos(-1)) {
+        throw_corrupt(filename_);
+    }
+    size_t num_blocks = get_varint(in, filename_);
+    index_.resize(num_blocks);
+    for(auto && block : index_) {
+        block.first = get_varint(in, filename_);
+        block.last = block.first + get_varint(in, filename_);
+        block.offset = get_varint(in, filename_);
+        block.num_sites = get_varint(in, filename_);
+    }
+}
+
+void AdPileup::ResetLibraries() {
+    output_libraries_ = input_libraries_;
+    selected_.resize(input_libraries_.names.size());
+    for(size_t u = 0; u < selected_.size(); ++u) {
+        selected_[u] = u;
+    }
+}
+
+void AdPileup::ReadBlock(size_t b) {
+    assert(b < index_.size());
+    if(b == current_block_) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    const auto &block = index_[b];
+    std::streambuf *in = file_.rdbuf();
+    if(in->pubseekpos(block.offset, std::ios_base::in) == std::streampos(-1)) {
+        throw_corrupt(filename_);
+    }
+    const size_t num_sites = get_varint(in, filename_);
+    uLongf size = get_varint(in, filename_);
+    const size_t compressed_size = get_varint(in, filename_);
+    if(num_sites != block.num_sites) {
+        throw_corrupt(filename_);
+    }
+    buffer_.resize(compressed_size);
+    if(in->sgetn(&buffer_[0], compressed_size) != static_cast<std::streamsize>(compressed_size)) {
+        throw_corrupt(filename_);
+    }
+    data_.resize(size);
+    if(uncompress(reinterpret_cast<Bytef*>(&data_[0]), &size,
+            reinterpret_cast<const Bytef*>(buffer_.data()), compressed_size) != Z_OK
+        || size != data_.size()) {
+        throw_corrupt(filename_);
+    }
+
+    // decode the columns
+    membuf_t column(&data_[0], &data_[0] + data_.size());
+    locations_.resize(num_sites);
+    alleles_.resize(num_sites);
+    utility::location_t location = 0;
+    for(size_t i = 0; i < num_sites; ++i) {
+        location += get_varint(&column, filename_);
+        locations_[i] = location;
+    }
+    for(size_t i = 0; i < num_sites; ++i) {
+        alleles_[i] = get_varint(&column, filename_);
+    }
+    const size_t num_libraries = input_libraries_.names.size();
+    depth_offsets_.resize(num_sites);
+    depths_.clear();
+    for(size_t i = 0; i < num_sites; ++i) {
+        depth_offsets_[i] = depths_.size();
+        size_t num_depths = num_libraries*(alleles_[i] & 0x7);
+        for(size_t k = 0; k < num_depths; ++k) {
+            depths_.push_back(get_varint(&column, filename_));
+        }
+    }
+    current_block_ = b;
+    read_time_ += std::chrono::steady_clock::now() - start;
+}
+
+// Returns the index of the first site in the current block at or after loc
+size_t AdPileup::FindSite(utility::location_t loc) const {
+    return std::lower_bound(locations_.begin(), locations_.end(), loc) - locations_.begin();
+}
+
+void AdPileup::MakeSite(size_t i) {
+    assert(i < locations_.size());
+    site_.location = locations_[i];
+    const size_t num_alleles = io::detail::decode_ad_alleles(alleles_[i], &site_.indexes);
+    site_.depths.resize(utility::make_array(selected_.size(), num_alleles));
+    const int32_t *depths = &depths_[depth_offsets_[i]];
+    for(size_t u = 0; u < selected_.size(); ++u) {
+        for(size_t k = 0; k < num_alleles; ++k) {
+            site_.depths[u][k] = depths[selected_[u]*num_alleles + k];
+        }
+    }
+}
@@ -20,6 +20,7 @@
 #include <dng/io/bam.h>
 #include <dng/cigar.h>
 #include <dng/utility.h>
+#include <dng/multithread.h>
 
 #include <boost/range/begin.hpp>
 #include <boost/range/end.hpp>
@@ -30,6 +31,13 @@
 
 #include <boost/algorithm/string/predicate.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 using namespace dng;
 using namespace dng::io;
 using namespace dng::io::detail;
@@ -49,25 +57,35 @@ int BamPileup::Advance(regions::range_t *target_range) {
     if(target_range->beg == target_range->end) {
         return 0;
     }
-    // enumerate through existing data set, updating location of reads and
-    // purge reads that do not overlap
     bool no_data = true;
-    for(auto & d : data_) {
-        auto it = d.begin();
-        while(it != d.end()) {
-            assert(it->beg < target_range->end);
-            if(target_range->beg >= it->end) {
-                node_type *p = &(*it);
-                d.erase(it++);
-                pool_.Free(p);
-                continue;
+    if(use_columns_) {
+        // purge reads that do not overlap; the positions of the remaining
+        // reads are only updated by UpdateReads
+        ExpireReads(target_range->beg);
+        columns_.Advance(target_range->beg);
+        for(auto & d : data_) {
+            no_data = (no_data && d.empty());
+        }
+    } else {
+        // enumerate through existing data set, updating location of reads and
+        // purge reads that do not overlap
+        for(auto & d : data_) {
+            auto it = d.begin();
+            while(it != d.end()) {
+                assert(it->beg < target_range->end);
+                if(target_range->beg >= it->end) {
+                    node_type *p = &(*it);
+                    d.erase(it++);
+                    pool_.Free(p);
+                    continue;
+                }
+                location_t q = it->cursor.Seek(target_range->beg);
+                it->pos = cigar::query_pos(q);
+                it->is_missing = cigar::query_del(q);
+                ++it;
             }
-            location_t q = cigar::target_to_query(target_range->beg, it->beg, it->cigar);
-            it->pos = cigar::query_pos(q);
-            it->is_missing = cigar::query_del(q);
-            ++it;
+            no_data = (no_data && d.empty());
         }
-        no_data = (no_data && d.empty());
     }
     for(;;) {
         // Fast Forward position to the next one with data.
@@ -82,85 +100,451 @@ int BamPileup::Advance(regions::range_t *target_range) {
         } else if(next_scanner_location_ > target_range->beg ) {
             break;
         }
-        location_t next_loc = utility::LOCATION_MAX;
-        // Iterate over input files
-        for(auto &scanner : scanners_) {
+        if(use_columns_) {
+            columns_.Advance(target_range->beg);
+        }
+        // Take the scanners whose next read is at or before the target. The
+        // others have nothing to add. Scanners are visited in input order, so
+        // reads are added to data_ in the same order as a linear scan.
+        due_scanners_.clear();
+        while(!scan_heap_.empty() && scan_heap_.front().first <= target_range->beg) {
+            std::pop_heap(scan_heap_.begin(), scan_heap_.end(), std::greater<scan_heap_entry_t>{});
+            due_scanners_.push_back(scan_heap_.back().second);
+            scan_heap_.pop_back();
+        }
+        std::sort(due_scanners_.begin(), due_scanners_.end());
+        for(size_t i : due_scanners_) {
+            auto &scanner = scanners_[i];
             // Scan reads from file until target_loc
             list_type new_reads = scanner(target_range->beg, pool_);
-            // Update the minimum position of the next read
-            next_loc = std::min(next_loc, scanner.next_loc());
+            // Update the position of the next read
+            scan_heap_.emplace_back(scanner.next_loc(), i);
+            std::push_heap(scan_heap_.begin(), scan_heap_.end(), std::greater<scan_heap_entry_t>{});
             // process read_groups
             while(!new_reads.empty()) {
                 node_type *p = &new_reads.front();
                 new_reads.pop_front();
-                uint8_t *rg = p->aln.aux_get("RG");
-                if( rg == nullptr ) {
-                    pool_.Free(p); // drop unknown RG's
-                    continue;    
-                }
-                auto it = read_group_to_libraries_.find(reinterpret_cast<const char *>(rg + 1));
-                if(it == read_group_to_libraries_.end()) {
-                    pool_.Free(p); // drop unknown RG's
-                    continue;
-                }
-                size_t index = it->second;
+                // reads with unknown RG's were dropped by the scanner
+                assert(0 <= p->library && p->library < data_.size());
+                size_t index = p->library;
                 // process cigar string
-                location_t q = cigar::target_to_query(target_range->beg, p->beg, p->cigar);
+                location_t q = p->cursor.Seek(target_range->beg);
                 p->pos = cigar::query_pos(q);
                 p->is_missing = cigar::query_del(q);
 
                 // push read onto correct RG
                 data_[index].push_back(*p);
                 no_data = false;
+
+                if(use_columns_) {
+                    columns_.Add(index, *p, target_range->beg, column_min_basequal_);
+                    expiring_[index].emplace_back(p->end, p);
+                    std::push_heap(expiring_[index].begin(), expiring_[index].end(),
+                        std::greater<expiring_t>{});
+                }
             }
         }
-        next_scanner_location_ = next_loc;
+        next_scanner_location_ = scan_heap_.empty() ? utility::LOCATION_MAX
+            : scan_heap_.front().first;
     }
     return 1;
 }
 
+// Remove reads whose right-most edge is at or before loc
+void BamPileup::ExpireReads(utility::location_t loc) {
+    assert(expiring_.size() == data_.size());
+    for(size_t u = 0; u < data_.size(); ++u) {
+        auto &heap = expiring_[u];
+        while(!heap.empty() && heap.front().first <= loc) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<expiring_t>{});
+            node_type *p = heap.back().second;
+            heap.pop_back();
+            data_[u].erase(data_[u].iterator_to(*p));
+            pool_.Free(p);
+        }
+    }
+}
+
+const BamPileup::data_type& BamPileup::UpdateReads(utility::location_t loc) {
+    for(auto & d : data_) {
+        for(auto & r : d) {
+            location_t q = r.cursor.Seek(loc);
+            r.pos = cigar::query_pos(q);
+            r.is_missing = cigar::query_del(q);
+        }
+    }
+    return data_;
+}
+
+void ColumnDepths::Reset(size_t num_libraries) {
+    if(num_libraries != num_libraries_) {
+        num_libraries_ = num_libraries;
+        counts_.assign(capacity_*num_libraries_, counts_t{});
+    } else {
+        std::fill(counts_.begin(), counts_.end(), counts_t{});
+    }
+    first_ = 0;
+}
+
+void ColumnDepths::Advance(utility::location_t loc) {
+    if(loc <= first_) {
+        return;
+    }
+    if(loc - first_ >= capacity_) {
+        std::fill(counts_.begin(), counts_.end(), counts_t{});
+    } else {
+        for(location_t p = first_; p < loc; ++p) {
+            auto it = counts_.begin() + (p & (capacity_-1))*num_libraries_;
+            std::fill(it, it + num_libraries_, counts_t{});
+        }
+    }
+    first_ = loc;
+}
+
+// Resize the ring buffer so that it holds at least width positions
+void ColumnDepths::Grow(size_t width) {
+    size_t capacity = std::max<size_t>(capacity_, 256);
+    while(capacity < width) {
+        capacity *= 2;
+    }
+    std::vector<counts_t> counts(capacity*num_libraries_, counts_t{});
+    for(location_t p = first_; p < first_ + capacity_; ++p) {
+        std::copy_n(counts_.begin() + (p & (capacity_-1))*num_libraries_,
+            num_libraries_, counts.begin() + (p & (capacity-1))*num_libraries_);
+    }
+    counts_ = std::move(counts);
+    capacity_ = capacity;
+}
+
+void ColumnDepths::Add(size_t library, const bam_record_t &r, utility::location_t from,
+    int min_basequal) {
+    assert(library < num_libraries_);
+    assert(first_ <= from);
+    if(r.end > first_ + capacity_) {
+        Grow(r.end - first_);
+    }
+    // Walk the cigar string, adding the aligned bases of the read.
+    // Deletions and skipped regions have no base and are not counted.
+    location_t target = r.beg;
+    size_t query = 0;
+    for(auto it = r.cigar.first; it != r.cigar.second; ++it) {
+        size_t len = bam_cigar_oplen(*it);
+        int type = bam_cigar_type(bam_cigar_op(*it));
+        if(type == 3) {
+            size_t skip = (target < from) ? std::min<size_t>(from - target, len) : 0;
+            for(size_t i = skip; i < len; ++i) {
+                int base = seq::base_index(bam_seqi(r.seq.first, query+i));
+                if(base >= 4 || r.qual.first[query+i] < min_basequal) {
+                    continue;
+                }
+                auto &counts = counts_[((target+i) & (capacity_-1))*num_libraries_ + library];
+                assert(counts[base] < 65535);
+                counts[base] += 1;
+            }
+        }
+        query += len * (type & 1);
+        target += len * ((type & 2) / 2);
+    }
+}
+
+// State shared by a scanner and its background thread. While the thread is
+// reading, only it uses the file and cache; the scanner takes them back by
+// pausing the thread.
+struct BamScan::reader_t {
+    reader_t(ConcurrentBamPool &pool, size_t queue_size) : cache{pool}, queue{queue_size} { }
+
+    ConcurrentBamPool::Cache cache; // allocates the records read by the thread
+    multithread::SpscQueue<node_type*> queue; // nullptr marks the last record
+
+    enum state_t { IDLE, READING, STOPPING };
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    state_t state{IDLE};           // protected by mutex
+    std::atomic<bool> cancel{false}; // stop reading and go idle
+    bool started{false};           // has the scanner asked the thread to read
+
+    std::exception_ptr error;      // thrown by the thread
+    std::atomic<std::chrono::steady_clock::rep> read_time{0};
+};
+
+BamScan::BamScan(File in, int min_qlen) : in_(std::move(in)), next_loc_{0},
+    min_qlen_{min_qlen} {
+    read_group_ids_ = parse_read_group_ids(in_.header()->text);
+}
+
+BamScan::BamScan(BamScan&&) = default;
+
+BamScan::~BamScan() {
+    StopThread();
+}
+
+std::chrono::steady_clock::duration BamScan::read_time() const {
+    auto ret = read_time_;
+    if(reader_) {
+        ret += std::chrono::steady_clock::duration{reader_->read_time.load()};
+    }
+    return ret;
+}
+
+void BamScan::SetRegion(const regions::range_t &region) {
+    int tid = utility::location_to_contig(region.beg);
+    assert( tid == utility::location_to_contig(region.end));
+    int beg = utility::location_to_position(region.beg);
+    int end = utility::location_to_position(region.end);
+    PauseThread();
+    in_.SetRegion(tid, beg, end);
+    next_loc_ = 0;
+}
+
+void BamScan::StartThread(ConcurrentBamPool &pool, size_t queue_size) {
+    assert(queue_size > 0);
+    StopThread();
+    reader_.reset(new reader_t{pool, queue_size});
+    reader_->thread = std::thread(&BamScan::ReaderLoop, this);
+}
+
+void BamScan::StopThread() {
+    if(!reader_) {
+        return;
+    }
+    PauseThread();
+    {
+        std::lock_guard<std::mutex> lock(reader_->mutex);
+        reader_->state = reader_t::STOPPING;
+    }
+    reader_->condition.notify_all();
+    reader_->thread.join();
+    read_time_ += std::chrono::steady_clock::duration{reader_->read_time.load()};
+    reader_.reset();
+}
+
+void BamScan::PauseThread() {
+    if(!reader_ || !reader_->started) {
+        return;
+    }
+    reader_t &r = *reader_;
+    r.cancel = true;
+    r.queue.Notify();
+    {
+        std::unique_lock<std::mutex> lock(r.mutex);
+        r.condition.wait(lock, [&r]{ return r.state == reader_t::IDLE; });
+    }
+    // the thread is idle, so the scanner can use its cache
+    node_type *p;
+    while(r.queue.TryPop(&p)) {
+        if(p != nullptr) {
+            r.cache.Free(p);
+        }
+    }
+    r.cancel = false;
+    r.started = false;
+}
+
+void BamScan::ReaderLoop() {
+    reader_t &r = *reader_;
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(r.mutex);
+            r.condition.wait(lock, [&r]{ return r.state != reader_t::IDLE; });
+            if(r.state == reader_t::STOPPING) {
+                return;
+            }
+        }
+        auto cancel = [&r]() -> bool { return r.cancel; };
+        try {
+            for(;;) {
+                node_type *p = r.cache.Malloc();
+                auto start = std::chrono::steady_clock::now();
+                bool ok = !r.cancel && ReadRecord(p);
+                r.read_time.fetch_add((std::chrono::steady_clock::now() - start).count(),
+                    std::memory_order_relaxed);
+                if(!ok) {
+                    r.cache.Free(p);
+                    p = nullptr;
+                }
+                if(!r.queue.Push(p, cancel)) {
+                    if(p != nullptr) {
+                        r.cache.Free(p);
+                    }
+                    break;
+                }
+                if(p == nullptr) {
+                    break;
+                }
+            }
+        } catch(...) {
+            r.error = std::current_exception();
+            r.queue.Push(nullptr, cancel);
+        }
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.state = reader_t::IDLE;
+        }
+        r.condition.notify_all();
+    }
+}
+
+bool BamScan::ReadRecord(node_type *p) {
+    using utility::make_location;
+    for(;;) {
+        // Try to grab a read
+        if(in_(&p->aln) < 0) {
+            return false;
+        }
+        p->cigar = p->aln.cigar();
+
+        if(min_qlen_ > 0 && cigar::query_length(p->cigar) < min_qlen_) {
+            continue;
+        }
+        p->beg = make_location(p->aln.target_id(), p->aln.position());
+        // update right-most position in the read
+        p->end = p->beg + cigar::target_length(p->cigar);
+        p->cursor.Reset(p->beg, p->cigar);
+        // drop reads with unknown RG's
+        p->library = FindLibrary(&p->aln);
+        if(p->library >= 0) {
+            break;
+        }
+    }
+    // cache pointers to data elements
+    p->seq = p->aln.seq();
+    p->qual = p->aln.seq_qual();
+    return true;
+}
+
 BamScan::list_type
 BamScan::operator()(utility::location_t target_loc, pool_type &pool) {
-    using utility::make_location;
-    // Reads from in_ until it encounters the first read
-    // that is right of pos.
+    if(next_loc_ <= target_loc) {
+        if(reader_) {
+            ReadFromThread(target_loc, pool);
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            Read(target_loc, pool);
+            read_time_ += std::chrono::steady_clock::now() - start;
+        }
+        if(next_loc_ == utility::LOCATION_MAX) {
+            // out of reads, return current buffer
+            return std::move(buffer_);
+        }
+    }
+    // Return all but the last read.
+    if(buffer_.size() <= 1) {
+        return list_type{};
+    }
+    list_type ret;
+    ret.splice(ret.end(), buffer_, buffer_.begin(), --buffer_.end());
+    return ret;
+}
+
+// Reads from in_ until it encounters the first read
+// that is right of pos.
+void BamScan::Read(utility::location_t target_loc, pool_type &pool) {
     while(next_loc_ <= target_loc) {
         node_type *p = pool.Malloc();
         do {
-            // Try to grab a read, if not return current buffer
-            if(in_(&p->aln) < 0) {
+            if(!ReadRecord(p)) {
                 pool.Free(p);
                 next_loc_ = utility::LOCATION_MAX;
-                return std::move(buffer_);
+                return;
             }
-            p->cigar = p->aln.cigar();
-
-            if(min_qlen_ > 0 && cigar::query_length(p->cigar) < min_qlen_) {
-                continue;
-            }
-
-            p->beg = make_location(p->aln.target_id(), p->aln.position());
-            // update right-most position in the read
-            p->end = p->beg + cigar::target_length(p->cigar);
         } while(p->end <= target_loc);
-
-        // cache pointers to data elements
-        p->seq = p->aln.seq();
-        p->qual = p->aln.seq_qual();
         // update the left-most position of the most recently read read.
         next_loc_ = p->beg;
         // save read
         buffer_.push_back(*p);
     }
-    // Return all but the last read.
-    if(buffer_.size() <= 1) {
-        return list_type{};
+}
+
+// Like Read, but takes the records from the background thread. Reads that
+// end before target_loc are dropped here, because the thread does not know
+// where the pileup is.
+void BamScan::ReadFromThread(utility::location_t target_loc, pool_type &pool) {
+    reader_t &r = *reader_;
+    if(!r.started) {
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.state = reader_t::READING;
+        }
+        r.condition.notify_all();
+        r.started = true;
+    }
+    while(next_loc_ <= target_loc) {
+        node_type *p = r.queue.Pop();
+        if(p == nullptr) {
+            next_loc_ = utility::LOCATION_MAX;
+            if(r.error) {
+                std::rethrow_exception(r.error);
+            }
+            return;
+        }
+        if(p->end <= target_loc) {
+            pool.Free(p);
+            continue;
+        }
+        next_loc_ = p->beg;
+        buffer_.push_back(*p);
+    }
+}
+
+void ReadGroupTable::Add(const std::string &id, int library) {
+    assert(library >= 0);
+    if(2*(size_+1) > slots_.size()) {
+        // grow the table and reinsert the existing ids
+        std::vector<slot_t> old(std::max<size_t>(16, 2*slots_.size()));
+        old.swap(slots_);
+        mask_ = slots_.size()-1;
+        size_ = 0;
+        for(auto && slot : old) {
+            if(slot.library != EMPTY) {
+                Add(slot.id, slot.library);
+            }
+        }
+    }
+    uint64_t h = hash(id.c_str());
+    size_t i = h & mask_;
+    for(; slots_[i].library != EMPTY; i = (i+1) & mask_) {
+        assert(slots_[i].id != id);
+    }
+    slots_[i].hash = h;
+    slots_[i].id = id;
+    slots_[i].library = library;
+    ++size_;
+}
+
+std::vector<std::string> dng::io::detail::parse_read_group_ids(const char *text) {
+    using boost::algorithm::starts_with;
+    std::vector<std::string> ret;
+    if(text == nullptr) {
+        return ret;
+    }
+    auto tokens = utility::make_tokenizer_dropempty(text);
+    for(auto it = tokens.begin(); it != tokens.end(); ++it) {
+        if(*it != "@RG") {
+            continue;
+        }
+        for(++it; it != tokens.end() && *it != "\n"; ++it) {
+            if(starts_with(*it, "ID:")) {
+                ret.push_back(it->substr(3));
+            }
+        }
+        if(it == tokens.end()) {
+            break;
+        }
     }
-    list_type ret;
-    ret.splice(ret.end(), buffer_, buffer_.begin(), --buffer_.end());
     return ret;
 }
 
+void BamScan::SetLibraries(const utility::StringMap &read_group_to_libraries) {
+    read_groups_ = {};
+    for(auto && a : read_group_to_libraries) {
+        read_groups_.Add(a.first, a.second);
+    }
+    single_read_group_ = (read_group_ids_.size() == 1);
+    single_library_ = single_read_group_ ? read_groups_.Find(read_group_ids_[0].c_str()) : -1;
+}
+
 void BamPileup::ParseHeader(const char* text) {
     if(text == nullptr) {
         return;
@@ -37,13 +37,14 @@ V container_subtract(const V& a, const V& b) {
     return output;
 }
 
-CallMutations::CallMutations(const RelationshipGraph &graph, params_t params)
-        : Probability(graph, params) {
+CallMutations::CallMutations(const RelationshipGraph &graph, params_t params,
+    MatrixCache *cache) : Probability(graph, params, cache) {
 
     // Create Special Transition Matrices
-    zero_mutation_matrices_ = CreateMutationMatrices(0);
-    one_mutation_matrices_ = CreateMutationMatrices(1);
-    mean_mutation_matrices_ = CreateMutationMatrices(mutation::mean_t{});
+    zero_mutation_matrices_ = CreateMutationMatrices(0, cache, "zero");
+    fixed_zero_mutation_matrices_ = CreateFixedMatrices(zero_mutation_matrices_);
+    one_mutation_matrices_ = CreateMutationMatrices(1, cache, "one");
+    mean_mutation_matrices_ = CreateMutationMatrices(mutation::mean_t{}, cache, "mean");
 
     for(size_t j=0; j < oneplus_mutation_matrices_.size(); ++j) {
         oneplus_mutation_matrices_[j] = container_subtract(transition_matrices_[j],
@@ -96,12 +97,23 @@ bool CallMutations::CalculateMutationStats(genotype::Mode mode, stats_t *stats)
     // We can't find mutations or variants if we have
     // no variation in the data
     if(matrix_index == 0 && quality_threshold() > 0.0) {
+        filter_counts_.reference_only += 1;
+        return false;
+    }
+
+    // The genotype likelihoods are scaled so that their maximum is 1, which
+    // makes P(Data) <= 1. Thus -10*log10(P(Data, mono)) is an upper bound of
+    // the quality that can be calculated without peeling.
+    if(min_quality_ > 0.0 &&
+        (-10.0/M_LN10)*PeelOnlyReference(mode) < min_quality_) {
+        filter_counts_.quality_bound += 1;
         return false;
     }
 
     auto mono = CalculateMONO(mode);
     double quality = mono.phred_score();
     if(quality < min_quality_) {
+        filter_counts_.quality += 1;
         return false;
     }
     double ln_nomut = PeelNoMutations();
@@ -110,8 +122,10 @@ bool CallMutations::CalculateMutationStats(genotype::Mode mode, stats_t *stats)
     double mutq = nomut.phred_score();
 
     if(!all_variants_ && mutq < min_quality_) {
+        filter_counts_.mutq += 1;
         return false;
     }
+    filter_counts_.passed += 1;
     if(stats == nullptr) {
         return true;
     }
@@ -123,9 +137,8 @@ bool CallMutations::CalculateMutationStats(genotype::Mode mode, stats_t *stats)
     stats->ln_zero = nomut.left;
     stats->ln_all  = nomut.right;
 
-    // Since we just called PeelNoMutations(), can call this and
-    // skip peeling forward again
-    CalculateSingleMutationStats(false, stats);
+    // PeelNoMutations() does not update work_, so peel forward again
+    CalculateSingleMutationStats(true, stats);
 
     stats->denovo = (mutq >= min_quality_ && min_quality_ > 0);
 
@@ -142,19 +142,22 @@ std::array<double,8> detail::make_alphas(double over_dispersion_hom,
 
 using detail::log_sum;
 
+constexpr int DirichletMultinomial::DEFAULT_CACHE_SIZE;
+
 DirichletMultinomial::DirichletMultinomial(double over_dispersion_hom, 
-        double over_dispersion_het, double sequencing_bias, double error_rate, double k_alleles) : 
+        double over_dispersion_het, double sequencing_bias, double error_rate, double k_alleles,
+        int cache_size) : 
     over_dispersion_hom_{over_dispersion_hom},
     over_dispersion_het_{over_dispersion_het},
     sequencing_bias_{sequencing_bias}, error_rate_{error_rate},
-    k_alleles_{k_alleles}
+    k_alleles_{k_alleles}, cache_size_{std::max(cache_size, 0)}, cache_(cache_size_)
 {
     auto alphas = detail::make_alphas(over_dispersion_hom, over_dispersion_het, 
         sequencing_bias, error_rate, k_alleles);
 
     for(int i=0; i<pochhammers_.size(); ++i) {
         pochhammers_[i] = pochhammers_t::value_type{alphas[i]};
-        for(int n=0; n<CACHE_SIZE; ++n) {
+        for(int n=0; n<cache_size_; ++n) {
             cache_[n][i] = pochhammers_[i](n);
         }
     }
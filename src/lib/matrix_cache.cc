@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dng/matrix_cache.h>
+
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace dng;
+
+namespace {
+// "DNGMTXC" followed by a format version
+const uint64_t MAGIC = UINT64_C(0x01) << 56 | UINT64_C(0x43584D54474E44);
+
+std::size_t padded(std::size_t n) {
+    return (n + 7) & ~std::size_t{7};
+}
+
+// Bounds-checked reader over the mapped file
+struct reader_t {
+    const char *data;
+    std::size_t size;
+    std::size_t pos;
+
+    bool read(uint64_t *x) {
+        if(size - pos < sizeof(uint64_t)) {
+            return false;
+        }
+        std::memcpy(x, data+pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+        return true;
+    }
+    bool skip(uint64_t n) {
+        if(size - pos < n) {
+            return false;
+        }
+        pos += n;
+        return true;
+    }
+};
+
+// Skip over the matrices of an entry, validating their sizes
+bool skip_matrices(reader_t *in) {
+    uint64_t num_matrices;
+    if(!in->read(&num_matrices)) {
+        return false;
+    }
+    for(uint64_t i = 0; i < num_matrices; ++i) {
+        uint64_t rows, cols;
+        if(!in->read(&rows) || !in->read(&cols)) {
+            return false;
+        }
+        if(cols != 0 && rows > (in->size / sizeof(double)) / cols) {
+            return false;
+        }
+        if(!in->skip(rows*cols*sizeof(double))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void write_u64(std::ofstream &out, uint64_t x) {
+    out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+} // anon namespace
+
+bool MatrixCache::Open(std::string path) {
+    Close();
+    path_ = std::move(path);
+    if(path_.empty()) {
+        return false;
+    }
+    int fd = ::open(path_.c_str(), O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || st.st_size < 3*static_cast<off_t>(sizeof(uint64_t))) {
+        ::close(fd);
+        return false;
+    }
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+
+    // Validate the file and index its entries
+    reader_t in{data_, size_, 0};
+    uint64_t magic, num_entries;
+    bool ok = in.read(&magic) && magic == MAGIC && in.read(&key_) && in.read(&num_entries);
+    for(uint64_t i = 0; ok && i < num_entries; ++i) {
+        uint64_t name_len;
+        ok = in.read(&name_len) && name_len <= size_;
+        if(!ok) {
+            break;
+        }
+        const char *name = data_ + in.pos;
+        ok = in.skip(padded(name_len));
+        if(!ok) {
+            break;
+        }
+        std::size_t offset = in.pos;
+        ok = skip_matrices(&in);
+        if(ok) {
+            index_[std::string(name, name_len)] = offset;
+        }
+    }
+    if(!ok) {
+        // treat an invalid cache as missing
+        std::string path_copy = std::move(path_);
+        Close();
+        path_ = std::move(path_copy);
+        return false;
+    }
+    return true;
+}
+
+void MatrixCache::Close() {
+    if(data_ != nullptr) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    key_ = 0;
+    index_.clear();
+}
+
+bool MatrixCache::Get(uint64_t key, const std::string &name, entry_t *out) const {
+    assert(out != nullptr);
+    auto pit = pending_.find(name);
+    if(pending_key_ == key && pit != pending_.end()) {
+        *out = pit->second;
+        return true;
+    }
+    if(data_ == nullptr || key != key_) {
+        return false;
+    }
+    auto it = index_.find(name);
+    if(it == index_.end()) {
+        return false;
+    }
+    // The entry has already been validated by Open()
+    reader_t in{data_, size_, it->second};
+    uint64_t num_matrices;
+    in.read(&num_matrices);
+    out->resize(num_matrices);
+    for(auto && m : *out) {
+        uint64_t rows, cols;
+        in.read(&rows);
+        in.read(&cols);
+        m.resize(rows, cols);
+        std::memcpy(m.data(), data_+in.pos, rows*cols*sizeof(double));
+        in.skip(rows*cols*sizeof(double));
+    }
+    return true;
+}
+
+void MatrixCache::Put(uint64_t key, const std::string &name, entry_t matrices) {
+    if(path_.empty()) {
+        return;
+    }
+    if(key != pending_key_) {
+        pending_.clear();
+        pending_key_ = key;
+    }
+    pending_[name] = std::move(matrices);
+}
+
+void MatrixCache::Save() {
+    if(path_.empty() || pending_.empty()) {
+        return;
+    }
+    // keep entries from the mapped file that were built with the same key
+    std::map<std::string, entry_t> entries;
+    if(data_ != nullptr && key_ == pending_key_) {
+        for(auto && a : index_) {
+            Get(key_, a.first, &entries[a.first]);
+        }
+    }
+    for(auto && a : pending_) {
+        entries[a.first] = std::move(a.second);
+    }
+    pending_.clear();
+
+    // write to a temporary file and rename it so readers never see a partial cache
+    std::string temp_path = path_ + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            throw std::runtime_error("unable to open matrix cache '" + temp_path + "' for writing.");
+        }
+        write_u64(out, MAGIC);
+        write_u64(out, pending_key_);
+        write_u64(out, entries.size());
+        const char zeros[8] = {0};
+        for(auto && a : entries) {
+            write_u64(out, a.first.size());
+            out.write(a.first.data(), a.first.size());
+            out.write(zeros, padded(a.first.size()) - a.first.size());
+            write_u64(out, a.second.size());
+            for(auto && m : a.second) {
+                write_u64(out, m.rows());
+                write_u64(out, m.cols());
+                out.write(reinterpret_cast<const char*>(m.data()), m.size()*sizeof(double));
+            }
+        }
+        if(!out) {
+            std::remove(temp_path.c_str());
+            throw std::runtime_error("unable to write matrix cache '" + temp_path + "'.");
+        }
+    }
+    // the mapping stays valid after the rename replaces the file
+    if(std::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        throw std::runtime_error("unable to replace matrix cache '" + path_ + "'.");
+    }
+    Open(path_);
+}
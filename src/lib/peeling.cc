@@ -17,6 +17,8 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <type_traits>
+
 #include <dng/peeling.h>
 
 #define DEBUG_PEELING 0
@@ -306,3 +308,485 @@ void dng::peel::to_child_reverse(workspace_t &work,
         work.upper[child] = mat[child].transpose() * work.super[child].matrix();
     }
 }
+
+// Batched forward operations
+//
+// Each column of upper and lower holds a site, so that transition matrices
+// are applied to a block of sites at once. The result of a site must not
+// depend on the size of the block or on its position in it, so the blocks
+// are multiplied by block_product and summed by column_sums instead of
+// Eigen's matrix products and reductions, whose order of operations depends
+// on the number of columns and the alignment of each column.
+
+namespace {
+// Calculate a*b, where each column of b holds a site. Every column of the
+// result is accumulated over the columns of a in the same order.
+Eigen::ArrayXXd block_product(const Eigen::Ref<const Eigen::MatrixXd> &a,
+                              const Eigen::Ref<const Eigen::ArrayXXd> &b) {
+    assert(a.cols() == b.rows());
+    Eigen::ArrayXXd ret = Eigen::ArrayXXd::Zero(a.rows(), b.cols());
+    for(decltype(b.cols()) j = 0; j < b.cols(); ++j) {
+        for(decltype(a.cols()) k = 0; k < a.cols(); ++k) {
+            ret.col(j) += a.col(k).array() * b(k, j);
+        }
+    }
+    return ret;
+}
+
+// Calculate P(child data | parents) for a block of sites and store the
+// result in work.temp_buffer.
+void sum_over_children(dng::peel::batch_workspace_t &work,
+                       const dng::peel::family_members_t &family, std::size_t first,
+                       const dng::TransitionMatrixVector &mat) {
+    work.temp_buffer = block_product(mat[family[first]], work.lower[family[first]]);
+    for(std::size_t i = first+1; i < family.size(); ++i) {
+        work.temp_buffer *= block_product(mat[family[i]], work.lower[family[i]]);
+    }
+}
+
+// Calculate P(~Descendent_Data & dad, mom) for a block of sites and store the
+// result in work.temp_buffer. Row d*mom_width+m holds dad=d and mom=m.
+void parents_product(dng::peel::batch_workspace_t &work, std::size_t dad, std::size_t mom) {
+    auto dad_width = work.upper[dad].rows();
+    auto mom_width = work.upper[mom].rows();
+    work.temp_parent = work.lower[mom] * work.upper[mom];
+    work.temp_buffer.resize(dad_width*mom_width, work.num_sites);
+    for(decltype(dad_width) d = 0; d < dad_width; ++d) {
+        work.temp_buffer.middleRows(d*mom_width, mom_width) = work.temp_parent.rowwise() *
+            (work.lower[dad].row(d) * work.upper[dad].row(d));
+    }
+}
+} // anon namespace
+
+// Family Order: Parent, Child
+void dng::peel::down(batch_workspace_t &work, const family_members_t &family,
+                     const TransitionMatrixVector &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.upper[child] = block_product(mat[child].transpose(),
+                                      work.upper[parent] * work.lower[parent]);
+}
+
+// Family Order: Parent, Child
+void dng::peel::down_fast(batch_workspace_t &work, const family_members_t &family,
+                          const TransitionMatrixVector &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.upper[child] = block_product(mat[child].transpose(), work.upper[parent]);
+}
+
+// Family Order: Parent, Child
+void dng::peel::up(batch_workspace_t &work, const family_members_t &family,
+                   const TransitionMatrixVector &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.lower[parent] *= block_product(mat[child], work.lower[child]);
+}
+
+// Family Order: Parent, Child
+void dng::peel::up_fast(batch_workspace_t &work, const family_members_t &family,
+                        const TransitionMatrixVector &mat) {
+    assert(family.size() == 2);
+    auto parent = family[0];
+    auto child = family[1];
+    work.lower[parent] = block_product(mat[child], work.lower[child]);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father(batch_workspace_t &work, const family_members_t &family,
+                          const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    // Sum over children
+    sum_over_children(work, family, 2, mat);
+    // Include Mom
+    auto mom_width = work.upper[mom].rows();
+    auto dad_width = work.temp_buffer.rows()/mom_width;
+    work.temp_parent = work.upper[mom] * work.lower[mom];
+    for(decltype(dad_width) d = 0; d < dad_width; ++d) {
+        work.lower[dad].row(d) *= column_sums(work.temp_buffer.middleRows(d*mom_width, mom_width) *
+                                              work.temp_parent);
+    }
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father_fast(batch_workspace_t &work,
+                               const family_members_t &family, const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    // Sum over children
+    sum_over_children(work, family, 2, mat);
+    // Include Mom
+    auto mom_width = work.upper[mom].rows();
+    auto dad_width = work.temp_buffer.rows()/mom_width;
+    work.temp_parent = work.upper[mom] * work.lower[mom];
+    work.lower[dad].resize(dad_width, work.num_sites);
+    for(decltype(dad_width) d = 0; d < dad_width; ++d) {
+        work.lower[dad].row(d) = column_sums(work.temp_buffer.middleRows(d*mom_width, mom_width) *
+                                             work.temp_parent);
+    }
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother(batch_workspace_t &work, const family_members_t &family,
+                          const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    // Sum over children
+    sum_over_children(work, family, 2, mat);
+    // Include Dad
+    auto dad_width = work.upper[dad].rows();
+    auto mom_width = work.temp_buffer.rows()/dad_width;
+    work.temp_parent = work.upper[dad] * work.lower[dad];
+    for(decltype(dad_width) d = 0; d < dad_width; ++d) {
+        work.temp_buffer.middleRows(d*mom_width, mom_width).rowwise() *= work.temp_parent.row(d);
+    }
+    for(decltype(dad_width) d = 1; d < dad_width; ++d) {
+        work.temp_buffer.topRows(mom_width) += work.temp_buffer.middleRows(d*mom_width, mom_width);
+    }
+    work.lower[mom] *= work.temp_buffer.topRows(mom_width);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother_fast(batch_workspace_t &work,
+                               const family_members_t &family, const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    // Sum over children
+    sum_over_children(work, family, 2, mat);
+    // Include Dad
+    auto dad_width = work.upper[dad].rows();
+    auto mom_width = work.temp_buffer.rows()/dad_width;
+    work.temp_parent = work.upper[dad] * work.lower[dad];
+    for(decltype(dad_width) d = 0; d < dad_width; ++d) {
+        work.temp_buffer.middleRows(d*mom_width, mom_width).rowwise() *= work.temp_parent.row(d);
+    }
+    for(decltype(dad_width) d = 1; d < dad_width; ++d) {
+        work.temp_buffer.topRows(mom_width) += work.temp_buffer.middleRows(d*mom_width, mom_width);
+    }
+    work.lower[mom] = work.temp_buffer.topRows(mom_width);
+}
+
+// Family Order: Father, Mother, Child, Child2, ....
+void dng::peel::to_child(batch_workspace_t &work, const family_members_t &family,
+                         const TransitionMatrixVector &mat) {
+    assert(family.size() >= 4);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    // Parents
+    parents_product(work, dad, mom);
+    // Sum over fullsibs
+    for(std::size_t i = 3; i < family.size(); ++i) {
+        work.temp_buffer *= block_product(mat[family[i]], work.lower[family[i]]);
+    }
+
+    work.upper[child] = block_product(mat[child].transpose(), work.temp_buffer);
+}
+
+// Family Order: Father, Mother, CHild
+void dng::peel::to_child_fast(batch_workspace_t &work, const family_members_t &family,
+                              const TransitionMatrixVector &mat) {
+    assert(family.size() == 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    parents_product(work, dad, mom);
+    work.upper[child] = block_product(mat[child].transpose(), work.temp_buffer);
+}
+
+// Forward operations using factored meiosis matrices
+//
+// The meiosis matrix of a trio child is a sum of folded products of the
+// gamete matrices of its parents (see MeiosisFactors). Peeling through the
+// gamete matrices avoids forming the Kronecker product of the parents and
+// multiplying it by the dense meiosis matrix. If a child's factors are not
+// available, the dense operations are used.
+
+namespace {
+using dng::TransitionMatrix;
+using dng::MeiosisFactors;
+
+// Calculate a*b. The templates below are shared by the single-site and the
+// batched operations; blocks of sites use block_product.
+template<typename A, typename B>
+Eigen::ArrayXXd multiply(const A &a, const B &b, std::false_type) {
+    return (a * b.matrix()).array();
+}
+
+template<typename A, typename B>
+Eigen::ArrayXXd multiply(const A &a, const B &b, std::true_type) {
+    return block_product(a, b);
+}
+
+// True if B holds a block of sites
+template<typename B>
+using is_block_t = std::integral_constant<bool, B::ColsAtCompileTime != 1>;
+
+// Sum over the genotypes of a trio child for a parent, i.e. calculate
+// sum_k to[k] * L * from[k]^T * other, where L is the symmetric allele x allele
+// matrix of the child's lower values. Each column holds a site.
+template<typename A, typename B>
+Eigen::ArrayXXd meiosis_to_parent(const std::vector<TransitionMatrix> &to,
+                                  const std::vector<TransitionMatrix> &from,
+                                  const A &lower, const B &other) {
+    assert(!to.empty() && to.size() == from.size());
+    const is_block_t<B> is_block{};
+    const int num_alleles = to[0].cols();
+    Eigen::ArrayXXd ret = Eigen::ArrayXXd::Zero(to[0].rows(), other.cols());
+    Eigen::ArrayXXd v, w;
+    for(std::size_t k = 0; k < to.size(); ++k) {
+        v = multiply(from[k].transpose(), other, is_block);
+        w.setZero(num_alleles, other.cols());
+        for(int a = 0, i = 0; a < num_alleles; ++a) {
+            for(int b = 0; b <= a; ++b, ++i) {
+                w.row(a) += lower.row(i) * v.row(b);
+                if(a != b) {
+                    w.row(b) += lower.row(i) * v.row(a);
+                }
+            }
+        }
+        ret += multiply(to[k], w, is_block);
+    }
+    return ret;
+}
+
+// Calculate the upper values of a trio child from P(~Descendent_Data & dad)
+// and P(~Descendent_Data & mom). Each column holds a site.
+template<typename A, typename B>
+Eigen::ArrayXXd meiosis_to_child(const MeiosisFactors &f, const A &dad_v, const B &mom_v) {
+    const is_block_t<A> is_block{};
+    const int num_alleles = f.dad[0].cols();
+    Eigen::ArrayXXd ret = Eigen::ArrayXXd::Zero(num_alleles*(num_alleles+1)/2, dad_v.cols());
+    Eigen::ArrayXXd u, v;
+    for(std::size_t k = 0; k < f.dad.size(); ++k) {
+        u = multiply(f.dad[k].transpose(), dad_v, is_block);
+        v = multiply(f.mom[k].transpose(), mom_v, is_block);
+        for(int a = 0, i = 0; a < num_alleles; ++a) {
+            for(int b = 0; b <= a; ++b, ++i) {
+                ret.row(i) += u.row(a) * v.row(b);
+                if(a != b) {
+                    ret.row(i) += u.row(b) * v.row(a);
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+// Calculate P(child data | dad=x, mom=y) for a single site and store it in a
+// mom_width x dad_width matrix
+void meiosis_lower(const dng::TransitionMatrixVector &mat, std::size_t child,
+                   const dng::GenotypeArray &lower, std::size_t mom_width,
+                   Eigen::MatrixXd *out) {
+    const MeiosisFactors *f = mat.meiosis_factors(child);
+    if(f == nullptr) {
+        *out = mat[child] * lower.matrix();
+        out->resize(mom_width, out->size()/mom_width);
+        return;
+    }
+    const int num_alleles = f->dad[0].cols();
+    Eigen::MatrixXd sym(num_alleles, num_alleles);
+    for(int a = 0, i = 0; a < num_alleles; ++a) {
+        for(int b = 0; b <= a; ++b, ++i) {
+            sym(a, b) = sym(b, a) = lower(i);
+        }
+    }
+    out->setZero(f->mom[0].rows(), f->dad[0].rows());
+    for(std::size_t k = 0; k < f->dad.size(); ++k) {
+        out->noalias() += f->mom[k] * sym * f->dad[k].transpose();
+    }
+}
+
+// Calculate P(child data & data of the other parent | parent) for a single site
+dng::GenotypeArray sum_over_meiosis(dng::peel::workspace_t &work,
+                                    const dng::peel::family_members_t &family,
+                                    const dng::TransitionMatrixVector &mat, bool to_father) {
+    auto dad = family[0];
+    auto mom = family[1];
+    auto other = to_father ? mom : dad;
+    dng::GenotypeArray other_v = work.upper[other] * work.lower[other];
+
+    const MeiosisFactors *f = mat.meiosis_factors(family[2]);
+    if(family.size() == 3 && f != nullptr) {
+        return to_father ? meiosis_to_parent(f->dad, f->mom, work.lower[family[2]], other_v)
+                         : meiosis_to_parent(f->mom, f->dad, work.lower[family[2]], other_v);
+    }
+    // Sum over children
+    auto mom_width = work.upper[mom].size();
+    Eigen::MatrixXd buffer, temp;
+    meiosis_lower(mat, family[2], work.lower[family[2]], mom_width, &buffer);
+    for(std::size_t i = 3; i < family.size(); ++i) {
+        meiosis_lower(mat, family[i], work.lower[family[i]], mom_width, &temp);
+        buffer.array() *= temp.array();
+    }
+    if(to_father) {
+        return (buffer.transpose() * other_v.matrix()).array();
+    }
+    return (buffer * other_v.matrix()).array();
+}
+} // anon namespace
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father_meiosis(workspace_t &work, const family_members_t &family,
+                                  const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[0]] *= sum_over_meiosis(work, family, mat, true);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father_fast_meiosis(workspace_t &work, const family_members_t &family,
+                                       const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[0]] = sum_over_meiosis(work, family, mat, true);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother_meiosis(workspace_t &work, const family_members_t &family,
+                                  const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[1]] *= sum_over_meiosis(work, family, mat, false);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother_fast_meiosis(workspace_t &work, const family_members_t &family,
+                                       const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    work.lower[family[1]] = sum_over_meiosis(work, family, mat, false);
+}
+
+// Family Order: Father, Mother, Child, Child2, ....
+void dng::peel::to_child_meiosis(workspace_t &work, const family_members_t &family,
+                                 const TransitionMatrixVector &mat) {
+    assert(family.size() >= 4);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    const MeiosisFactors *f = mat.meiosis_factors(child);
+    if(f == nullptr) {
+        return to_child(work, family, mat);
+    }
+    GenotypeArray dad_v = work.lower[dad] * work.upper[dad];
+    GenotypeArray mom_v = work.lower[mom] * work.upper[mom];
+
+    // P(~child data & dad=x, mom=y) as a mom_width x dad_width matrix
+    Eigen::MatrixXd parents = mom_v.matrix() * dad_v.matrix().transpose();
+    Eigen::MatrixXd temp;
+    for(std::size_t i = 3; i < family.size(); ++i) {
+        meiosis_lower(mat, family[i], work.lower[family[i]], mom_v.size(), &temp);
+        parents.array() *= temp.array();
+    }
+    // Sum over parents for each phased child genotype and fold them
+    const int num_alleles = f->dad[0].cols();
+    Eigen::MatrixXd phased = Eigen::MatrixXd::Zero(num_alleles, num_alleles);
+    for(std::size_t k = 0; k < f->dad.size(); ++k) {
+        phased.noalias() += f->dad[k].transpose() * parents.transpose() * f->mom[k];
+    }
+    work.upper[child].resize(num_alleles*(num_alleles+1)/2);
+    for(int a = 0, i = 0; a < num_alleles; ++a) {
+        for(int b = 0; b <= a; ++b, ++i) {
+            work.upper[child](i) = (a == b) ? phased(a, a) : phased(a, b) + phased(b, a);
+        }
+    }
+}
+
+// Family Order: Father, Mother, Child
+void dng::peel::to_child_fast_meiosis(workspace_t &work, const family_members_t &family,
+                                      const TransitionMatrixVector &mat) {
+    assert(family.size() == 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    const MeiosisFactors *f = mat.meiosis_factors(child);
+    if(f == nullptr) {
+        return to_child_fast(work, family, mat);
+    }
+    work.upper[child] = meiosis_to_child(*f, work.lower[dad] * work.upper[dad],
+                                         work.lower[mom] * work.upper[mom]);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                  const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    const MeiosisFactors *f = mat.meiosis_factors(family[2]);
+    if(family.size() > 3 || f == nullptr) {
+        return to_father(work, family, mat);
+    }
+    auto dad = family[0];
+    auto mom = family[1];
+    work.temp_parent = work.upper[mom] * work.lower[mom];
+    work.lower[dad] *= meiosis_to_parent(f->dad, f->mom, work.lower[family[2]], work.temp_parent);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_father_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                       const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    const MeiosisFactors *f = mat.meiosis_factors(family[2]);
+    if(family.size() > 3 || f == nullptr) {
+        return to_father_fast(work, family, mat);
+    }
+    auto dad = family[0];
+    auto mom = family[1];
+    work.temp_parent = work.upper[mom] * work.lower[mom];
+    work.lower[dad] = meiosis_to_parent(f->dad, f->mom, work.lower[family[2]], work.temp_parent);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                  const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    const MeiosisFactors *f = mat.meiosis_factors(family[2]);
+    if(family.size() > 3 || f == nullptr) {
+        return to_mother(work, family, mat);
+    }
+    auto dad = family[0];
+    auto mom = family[1];
+    work.temp_parent = work.upper[dad] * work.lower[dad];
+    work.lower[mom] *= meiosis_to_parent(f->mom, f->dad, work.lower[family[2]], work.temp_parent);
+}
+
+// Family Order: Father, Mother, Child1, Child2, ...
+void dng::peel::to_mother_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                       const TransitionMatrixVector &mat) {
+    assert(family.size() >= 3);
+    const MeiosisFactors *f = mat.meiosis_factors(family[2]);
+    if(family.size() > 3 || f == nullptr) {
+        return to_mother_fast(work, family, mat);
+    }
+    auto dad = family[0];
+    auto mom = family[1];
+    work.temp_parent = work.upper[dad] * work.lower[dad];
+    work.lower[mom] = meiosis_to_parent(f->mom, f->dad, work.lower[family[2]], work.temp_parent);
+}
+
+// Family Order: Father, Mother, Child, Child2, ....
+void dng::peel::to_child_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                 const TransitionMatrixVector &mat) {
+    // Full siblings require P(sibling data | dad, mom) for every pair of
+    // parental genotypes, so the dense operation is used.
+    to_child(work, family, mat);
+}
+
+// Family Order: Father, Mother, Child
+void dng::peel::to_child_fast_meiosis(batch_workspace_t &work, const family_members_t &family,
+                                      const TransitionMatrixVector &mat) {
+    assert(family.size() == 3);
+    auto dad = family[0];
+    auto mom = family[1];
+    auto child = family[2];
+    const MeiosisFactors *f = mat.meiosis_factors(child);
+    if(f == nullptr) {
+        return to_child_fast(work, family, mat);
+    }
+    work.upper[child] = meiosis_to_child(*f, work.lower[dad] * work.upper[dad],
+                                         work.lower[mom] * work.upper[mom]);
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dng/phaser.h>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace dng::phaser;
+
+namespace {
+// FNV-1a hash of a read name. Reads are matched with their mates by this key.
+inline uint64_t hash_qname(const char *str) {
+    uint64_t h = 14695981039346656037ULL;
+    for(; *str != '\0'; ++str) {
+        h = (h ^ static_cast<unsigned char>(*str)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+inline char indexed_char(std::size_t x) {
+    static const char table[] = "NACNGNNNTNNNNNNN";
+    return table[x];
+}
+} // anon namespace
+
+const char *dng::phaser::parent_of_origin(char dnm_b, char hap_b, const std::string &gt1,
+                                          const std::string &gt2, char variant_base) {
+    const char *parent_of_origin = "N/A";
+
+    if((hap_b == gt1[0]) || (hap_b == gt1[1])) {
+        if((hap_b != gt2[0]) && (hap_b != gt2[1])) {
+            if(variant_base == dnm_b) {
+                parent_of_origin = "p1";
+            } else {
+                parent_of_origin = "p2";
+            }
+        }
+    }
+
+    else if((hap_b == gt2[0]) || (hap_b == gt2[1])) {
+        if((hap_b != gt1[0]) && (hap_b != gt1[1])) {
+            if(variant_base == dnm_b) {
+                parent_of_origin = "p2";
+            } else {
+                parent_of_origin = "p1";
+            }
+        }
+    }
+
+    if((hap_b == gt1[0]) && (hap_b == gt1[1])) {
+        if(variant_base == dnm_b) {
+            parent_of_origin = "p1";
+        } else {
+            parent_of_origin = "p2";
+        }
+    } else if((hap_b == gt2[0]) && (hap_b == gt2[1])) {
+        if(variant_base == dnm_b) {
+            parent_of_origin = "p2";
+        } else {
+            parent_of_origin = "p1";
+        }
+    }
+    return parent_of_origin;
+}
+
+int dng::phaser::format_read(const hts::bam::Alignment &rec, std::string *seq_formatted) {
+    assert(seq_formatted != nullptr);
+    seq_formatted->clear();
+    const int32_t seq_len = rec.seq_qual().second - rec.seq_qual().first;
+    for(int32_t a = 0; a < seq_len; a++) {
+        // A = 1, C = 2, G = 4, T = 8
+        *seq_formatted += indexed_char(rec.seq_at(a));
+    }
+
+    // reformat the sequence based on the cigar string
+    int cig_index = 0;
+    hts::bam::cigar_t cigar = rec.cigar();
+    for(const uint32_t *c = cigar.first; c != cigar.second; ++c) {
+        int op = bam_cigar_op(*c);
+        int op_len = bam_cigar_oplen(*c);
+
+        switch(op) {
+        case BAM_CSOFT_CLIP:
+            // 'S' soft clip, erase characters
+            seq_formatted->erase(cig_index, op_len);
+            break;
+        case BAM_CMATCH:
+            // 'M' match, retain as is
+            cig_index += op_len;
+            break;
+        case BAM_CDEL:
+            // 'D' deletion, insert a '-'
+            seq_formatted->insert(cig_index, op_len, '-');
+            break;
+        case BAM_CINS:
+            // 'I' insertion, remove insert
+            seq_formatted->erase(cig_index, op_len);
+            break;
+        default:
+            return op;
+        }
+    }
+    return -1;
+}
+
+DnmPhaser::DnmPhaser(const pgt_index_t &index, const std::string &chr, long dnm_pos,
+                     char variant_base, long window) :
+    dnm_pos_{dnm_pos}, variant_base_{variant_base} {
+    auto chr_sites = index.find(chr);
+    if(chr_sites == index.end()) {
+        return;
+    }
+    const std::vector<pgt_site_t> &sites = chr_sites->second;
+    auto it = std::lower_bound(sites.begin(), sites.end(), dnm_pos - window,
+    [](const pgt_site_t &a, long pos) {
+        return a.pos < pos;
+    });
+    for(; it != sites.end() && it->pos <= dnm_pos + window; ++it) {
+        if(it->pos != dnm_pos) {
+            result_.push_back({&*it, -1, {}});
+        }
+    }
+    if(result_.empty()) {
+        return;
+    }
+    state_.resize(result_.size());
+    for(size_t s = 0; s < result_.size(); ++s) {
+        long hap_pos = result_[s].site->pos;
+        state_[s].beg = std::min(hap_pos, dnm_pos) - 1;
+        state_[s].end = std::max(hap_pos, dnm_pos);
+    }
+    // the sites are sorted by position
+    window_beg_ = std::min(state_.front().beg, dnm_pos - 1);
+    window_end_ = std::max(state_.back().end, dnm_pos);
+}
+
+void DnmPhaser::Add(hts::bam::Alignment &rec) {
+    // filter mate rescue XT:A:M
+    uint8_t *aux = rec.aux_get("XT");
+    if(aux && bam_aux2A(aux) == 'M') {
+        return;
+    }
+    const long pos = rec.position();
+    const long end_pos = rec.end_position();
+
+    int bad_op = format_read(rec, &seq_formatted_);
+    if(bad_op != -1) {
+        // a query of the span of any site this read overlaps would fail
+        for(size_t s = 0; s < result_.size(); ++s) {
+            if(result_[s].bad_cigar_op == -1 && pos < state_[s].end && end_pos > state_[s].beg) {
+                result_[s].bad_cigar_op = bad_op;
+            }
+        }
+        return;
+    }
+
+    read_t &read = reads_[hash_qname(rec.qname())];
+    const long formatted_len = seq_formatted_.length();
+    if((dnm_pos_ > pos) && ((pos + formatted_len) > dnm_pos_)) {
+        read.has_dnm = true;
+        read.dnm_base = seq_formatted_[dnm_pos_ - pos - 1];
+    }
+    // the sites covered by the read
+    auto first = std::upper_bound(result_.begin(), result_.end(), pos,
+    [](long pos, const site_phase_t &a) {
+        return pos < a.site->pos;
+    });
+    for(auto s = first; s != result_.end() && s->site->pos < pos + formatted_len; ++s) {
+        const size_t site = s - result_.begin();
+        const char hap_b = seq_formatted_[s->site->pos - pos - 1];
+        auto hap = std::find_if(read.hap_bases.begin(), read.hap_bases.end(),
+        [site](const std::pair<size_t, char> &a) {
+            return a.first == site;
+        });
+        if(hap != read.hap_bases.end()) {
+            hap->second = hap_b;
+        } else {
+            read.hap_bases.emplace_back(site, hap_b);
+        }
+    }
+    if(!read.has_dnm) {
+        return;
+    }
+    // every read with this name that overlaps a span counts its pair of bases
+    for(auto &&hap : read.hap_bases) {
+        state_t &st = state_[hap.first];
+        if(result_[hap.first].bad_cigar_op != -1 || pos >= st.end || end_pos <= st.beg) {
+            continue;
+        }
+        std::string bases;
+        bases += read.dnm_base;
+        bases += hap.second;
+        st.pair_count[bases]++;
+    }
+}
+
+std::vector<site_phase_t> DnmPhaser::Finish() {
+    for(size_t s = 0; s < result_.size(); ++s) {
+        if(result_[s].bad_cigar_op != -1) {
+            continue;
+        }
+        const pgt_site_t &site = *result_[s].site;
+        for(auto &&p : state_[s].pair_count) {
+            char dnm_b = p.first[0];
+            char hap_b = p.first[1];
+            result_[s].counts.push_back({dnm_b, hap_b,
+                parent_of_origin(dnm_b, hap_b, site.gt1, site.gt2, variant_base_), p.second});
+        }
+    }
+    // report the sites in the order of the GT file
+    std::sort(result_.begin(), result_.end(),
+    [](const site_phase_t &a, const site_phase_t &b) {
+        return a.site->line < b.site->line;
+    });
+    return std::move(result_);
+}
+
+std::vector<site_phase_t> dng::phaser::phase_dnm(hts::bam::File &bam, const pgt_index_t &index,
+                                                 const std::string &chr, long dnm_pos,
+                                                 char variant_base, long window) {
+    DnmPhaser phaser{index, chr, dnm_pos, variant_base, window};
+    if(phaser.empty()) {
+        return phaser.Finish();
+    }
+    int tid = bam.TargetNameToID(chr.c_str());
+    if(tid < 0 || phaser.window_end() <= 0) {
+        return phaser.Finish();
+    }
+    bam.SetRegion(tid, std::max(phaser.window_beg(), 0L), phaser.window_end());
+    hts::bam::Alignment rec;
+    while(bam.Read(&rec) >= 0) {
+        phaser.Add(rec);
+    }
+    return phaser.Finish();
+}
@@ -25,12 +25,12 @@
 using namespace dng;
 
 // graph_ will be initialized before work_, so we can reference it.
-Probability::Probability(RelationshipGraph graph, params_t params) :
+Probability::Probability(RelationshipGraph graph, params_t params, MatrixCache *cache) :
     graph_{std::move(graph)},
     params_(std::move(params)),
     work_{graph_.CreateWorkspace()},
     genotyper_{params_.over_dispersion_hom, params_.over_dispersion_het, params_.sequencing_bias,
-        params_.error_rate, params_.lib_k_alleles}
+        params_.error_rate, params_.lib_k_alleles, params_.lib_depth_cache}
 {
     using namespace dng;
 
@@ -38,18 +38,48 @@ Probability::Probability(RelationshipGraph graph, params_t params) :
         params_.ref_bias_hap, params_.k_alleles);
 
     // Create cache of population priors
-    for(int i=0;i<diploid_prior_.size();++i) {
-        diploid_prior_[i] = mutation::population_prior_diploid(i+1, params_.theta,
-            params_.ref_bias_hom, params_.ref_bias_het, params_.k_alleles);
-    }
+    MatrixCache::entry_t diploid, haploid;
+    const uint64_t key = (cache != nullptr) ? MatrixCacheKey() : 0;
+    if(cache != nullptr && cache->Get(key, "diploid_prior", &diploid)
+        && cache->Get(key, "haploid_prior", &haploid)
+        && diploid.size() == diploid_prior_.size() && haploid.size() == haploid_prior_.size()) {
+        for(int i=0;i<diploid_prior_.size();++i) {
+            diploid_prior_[i] = diploid[i].col(0).array();
+        }
+        for(int i=0;i<haploid_prior_.size();++i) {
+            haploid_prior_[i] = haploid[i].col(0).array();
+        }
+    } else {
+        for(int i=0;i<diploid_prior_.size();++i) {
+            diploid_prior_[i] = mutation::population_prior_diploid(i+1, params_.theta,
+                params_.ref_bias_hom, params_.ref_bias_het, params_.k_alleles);
+        }
 
-    for(int i=0;i<haploid_prior_.size();++i) {
-        haploid_prior_[i] = mutation::population_prior_haploid(i+1, params_.theta,
-            params_.ref_bias_hap, params_.k_alleles);
+        for(int i=0;i<haploid_prior_.size();++i) {
+            haploid_prior_[i] = mutation::population_prior_haploid(i+1, params_.theta,
+                params_.ref_bias_hap, params_.k_alleles);
+        }
+        if(cache != nullptr) {
+            diploid.clear();
+            haploid.clear();
+            for(auto && a : diploid_prior_) {
+                diploid.push_back(a.matrix());
+            }
+            for(auto && a : haploid_prior_) {
+                haploid.push_back(a.matrix());
+            }
+            cache->Put(key, "diploid_prior", std::move(diploid));
+            cache->Put(key, "haploid_prior", std::move(haploid));
+        }
     }
 
     // Calculate mutation matrices
-    transition_matrices_ = CreateMutationMatrices(mutation::transition_t{});
+    transition_matrices_ = CreateMutationMatrices(mutation::transition_t{}, cache, "transition");
+    fixed_transition_matrices_ = CreateFixedMatrices(transition_matrices_);
+
+    for(auto && work : block_work_) {
+        work = graph_.CreateBatchWorkspace();
+    }
 
     // Precalculate monomorphic histories
     size_t num_libraries = work_.library_nodes.second - work_.library_nodes.first;
@@ -59,3 +89,52 @@ Probability::Probability(RelationshipGraph graph, params_t params) :
     ln_monomorphic_ = graph_.PeelForwards(work_, transition_matrices_[0]);
 }
 
+
+uint64_t Probability::MatrixCacheKey() const {
+    CacheKey key;
+    // bump the version if the calculation of matrices or priors changes
+    key(uint64_t{1})(MAXIMUM_NUMBER_ALLELES);
+
+    key(graph_.labels().size());
+    for(auto && a : graph_.labels()) {
+        key(a);
+    }
+    for(auto && a : graph_.ploidies()) {
+        key(a);
+    }
+    for(auto && a : graph_.transitions()) {
+        key(a.type)(a.parent1)(a.parent2)(a.length1)(a.length2);
+    }
+    key(graph_.library_names().size());
+    for(auto && a : graph_.library_names()) {
+        key(a);
+    }
+
+    key(params_.theta)(params_.ref_bias_hom)(params_.ref_bias_het)(params_.ref_bias_hap);
+    key(params_.over_dispersion_hom)(params_.over_dispersion_het)(params_.sequencing_bias);
+    key(params_.error_rate)(params_.lib_k_alleles)(params_.k_alleles);
+
+    return key.value();
+}
+
+MatrixCache::entry_t Probability::FlattenMatrices(const matrices_t &matrices) {
+    MatrixCache::entry_t ret;
+    for(auto && a : matrices) {
+        ret.insert(ret.end(), a.begin(), a.end());
+    }
+    return ret;
+}
+
+bool Probability::UnflattenMatrices(const MatrixCache::entry_t &entry, matrices_t *matrices) const {
+    assert(matrices != nullptr);
+    const size_t num_nodes = graph_.num_nodes();
+    if(entry.size() != matrices->size()*num_nodes) {
+        return false;
+    }
+    auto it = entry.begin();
+    for(auto && a : *matrices) {
+        a.assign(it, it+num_nodes);
+        it += num_nodes;
+    }
+    return true;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dng/io/reference_image.h>
+#include <dng/matrix_cache.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace dng::io;
+
+constexpr int ReferenceImage::MASK_SHIFT;
+
+namespace {
+// "DNGREF2" followed by a format version
+const uint64_t MAGIC = UINT64_C(0x01) << 56 | UINT64_C(0x32464552474E44);
+
+// The number of bases fetched from the reference at a time while building.
+// Must be a multiple of 4 and of the mask block size.
+const int CHUNK_SIZE = 1 << 20;
+
+std::size_t padded(std::size_t n) {
+    return (n + 7) & ~std::size_t{7};
+}
+
+std::size_t num_mask_words(uint64_t length) {
+    uint64_t num_blocks = (length + (1 << ReferenceImage::MASK_SHIFT) - 1) >> ReferenceImage::MASK_SHIFT;
+    return (num_blocks + 63) / 64;
+}
+
+// Bounds-checked reader over the mapped file
+struct reader_t {
+    const char *data;
+    std::size_t size;
+    std::size_t pos;
+
+    bool read(uint64_t *x) {
+        if(size - pos < sizeof(uint64_t)) {
+            return false;
+        }
+        std::memcpy(x, data+pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+        return true;
+    }
+    bool skip(uint64_t n) {
+        if(size - pos < n) {
+            return false;
+        }
+        pos += n;
+        return true;
+    }
+    // Is [offset, offset+n) an 8-byte aligned section of the file
+    bool contains(uint64_t offset, uint64_t n) const {
+        return offset % 8 == 0 && offset <= size && n <= size - offset;
+    }
+};
+
+void write_u64(std::ofstream &out, uint64_t x) {
+    out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+void write_padding(std::ofstream &out, std::size_t n) {
+    const char zeros[8] = {0};
+    out.write(zeros, padded(n) - n);
+}
+} // anon namespace
+
+bool ReferenceImage::Open(const std::string &path, uint64_t key) {
+    Close();
+    if(path.empty()) {
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || st.st_size < 3*static_cast<off_t>(sizeof(uint64_t))) {
+        ::close(fd);
+        return false;
+    }
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+
+    // Validate the file and index its sequences
+    reader_t in{data_, size_, 0};
+    uint64_t magic, file_key, num_contigs;
+    bool ok = in.read(&magic) && magic == MAGIC && in.read(&file_key) && file_key == key
+        && in.read(&num_contigs) && num_contigs <= size_;
+    for(uint64_t i = 0; ok && i < num_contigs; ++i) {
+        uint64_t name_len;
+        ok = in.read(&name_len) && name_len <= size_;
+        if(!ok) {
+            break;
+        }
+        std::string name(data_ + in.pos, std::min<std::size_t>(name_len, size_ - in.pos));
+        uint64_t length, bases_offset, mask_offset, runs_offset, num_runs;
+        ok = in.skip(padded(name_len)) && in.read(&length) && in.read(&bases_offset)
+            && in.read(&mask_offset) && in.read(&runs_offset) && in.read(&num_runs)
+            && length < 0x80000000 && num_runs <= size_
+            && in.contains(bases_offset, (length+3)/4)
+            && in.contains(mask_offset, num_mask_words(length)*sizeof(uint64_t))
+            && in.contains(runs_offset, num_runs*2*sizeof(uint32_t));
+        if(!ok) {
+            break;
+        }
+        contig_t c;
+        c.length = static_cast<int>(length);
+        c.bases = reinterpret_cast<const uint8_t*>(data_ + bases_offset);
+        c.mask = reinterpret_cast<const uint64_t*>(data_ + mask_offset);
+        c.n_runs = reinterpret_cast<const uint32_t*>(data_ + runs_offset);
+        c.num_n_runs = num_runs;
+        names_[name] = static_cast<int>(contigs_.size());
+        contigs_.push_back(c);
+    }
+    if(!ok) {
+        // treat an invalid image as missing
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void ReferenceImage::Close() {
+    if(data_ != nullptr) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    contigs_.clear();
+    names_.clear();
+}
+
+uint64_t ReferenceImage::Key(const std::string &fasta_path, const faidx_t *fai) {
+    assert(fai != nullptr);
+    CacheKey key;
+    key(std::string{"ReferenceImage"});
+    // a modified reference will have a new size or modification time
+    struct stat st;
+    if(::stat(fasta_path.c_str(), &st) == 0) {
+        key(static_cast<uint64_t>(st.st_size))(static_cast<int64_t>(st.st_mtime));
+    }
+    int num_contigs = faidx_nseq(fai);
+    key(num_contigs);
+    for(int i = 0; i < num_contigs; ++i) {
+        const char *name = faidx_iseq(fai, i);
+        key(std::string{name})(faidx_seq_len(fai, name));
+    }
+    return key.value();
+}
+
+int ReferenceImage::contig_index(const char *name) const {
+    if(name == nullptr) {
+        return -1;
+    }
+    auto it = names_.find(name);
+    return (it != names_.end()) ? it->second : -1;
+}
+
+bool ReferenceImage::InNRun(const contig_t &c, int pos) const {
+    // find the last run that begins at or before pos
+    uint64_t lo = 0, hi = c.num_n_runs;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi-lo)/2;
+        if(c.n_runs[2*mid] <= static_cast<uint32_t>(pos)) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 && static_cast<uint32_t>(pos) < c.n_runs[2*(lo-1)+1];
+}
+
+void ReferenceImage::Copy(int contig, int first, int last, char *out) const {
+    assert(0 <= contig && contig < count());
+    assert(out != nullptr);
+    const contig_t &c = contigs_[contig];
+    for(int pos = first; pos < last; ++pos) {
+        *out++ = (0 <= pos && pos < c.length) ?
+            "ACGT"[(c.bases[pos >> 2] >> ((pos & 3)*2)) & 3] : 'N';
+    }
+    out -= (last - first);
+    if(last <= 0 || c.num_n_runs == 0) {
+        return;
+    }
+    // The runs are sorted and do not overlap, so their flattened boundaries
+    // are sorted too. Start at the run that contains first or follows it.
+    const uint32_t *runs_end = c.n_runs + 2*c.num_n_runs;
+    const uint32_t *p = std::upper_bound(c.n_runs, runs_end,
+        static_cast<uint32_t>(std::max(first, 0)));
+    for(uint64_t i = (p - c.n_runs)/2; i < c.num_n_runs; ++i) {
+        if(c.n_runs[2*i] >= static_cast<uint32_t>(last)) {
+            break;
+        }
+        int b = std::max<int>(c.n_runs[2*i], first);
+        int e = std::min<int>(c.n_runs[2*i+1], last);
+        if(b < e) {
+            std::memset(out + (b-first), 'N', e-b);
+        }
+    }
+}
+
+void ReferenceImage::Build(faidx_t *fai, uint64_t key, const std::string &path) {
+    assert(fai != nullptr);
+    // write to a temporary file and rename it so readers never see a partial image
+    std::string temp_path = path + ".tmp" + std::to_string(::getpid());
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if(!out) {
+        throw std::runtime_error("unable to open reference image '" + temp_path + "' for writing.");
+    }
+    auto fail = [&](const std::string &msg) {
+        out.close();
+        std::remove(temp_path.c_str());
+        throw std::runtime_error(msg);
+    };
+
+    const int num_contigs = faidx_nseq(fai);
+    write_u64(out, MAGIC);
+    write_u64(out, key);
+    write_u64(out, num_contigs);
+    // offsets are filled in after the sequences are written
+    std::vector<std::streamoff> header_pos(num_contigs);
+    for(int i = 0; i < num_contigs; ++i) {
+        std::string name = faidx_iseq(fai, i);
+        write_u64(out, name.size());
+        out.write(name.data(), name.size());
+        write_padding(out, name.size());
+        write_u64(out, faidx_seq_len(fai, name.c_str()));
+        header_pos[i] = out.tellp();
+        for(int j = 0; j < 4; ++j) {
+            write_u64(out, 0);
+        }
+    }
+
+    std::vector<uint8_t> packed;
+    std::vector<uint64_t> mask;
+    std::vector<uint32_t> runs;
+    std::vector<uint64_t> offsets(4*num_contigs);
+    for(int i = 0; i < num_contigs; ++i) {
+        const char *name = faidx_iseq(fai, i);
+        const int length = faidx_seq_len(fai, name);
+        mask.assign(num_mask_words(length), 0);
+        runs.clear();
+
+        offsets[4*i] = out.tellp();
+        for(int first = 0; first < length; first += CHUNK_SIZE) {
+            int last = std::min(first + CHUNK_SIZE, length);
+            int len = 0;
+            std::unique_ptr<char[], void(*)(void *)> seq{
+                faidx_fetch_seq(fai, name, first, last-1, &len), free};
+            if(!seq || len != last-first) {
+                fail("unable to read sequence '" + std::string{name} + "' from the reference.");
+            }
+            packed.assign((len+3)/4, 0);
+            for(int k = 0; k < len; ++k) {
+                int pos = first + k;
+                uint8_t code;
+                switch(seq[k]) {
+                case 'A': case 'a': code = 0; break;
+                case 'C': case 'c': code = 1; break;
+                case 'G': case 'g': code = 2; break;
+                case 'T': case 't': code = 3; break;
+                default:
+                    code = 0;
+                    if(!runs.empty() && runs.back() == static_cast<uint32_t>(pos)) {
+                        runs.back() += 1;
+                    } else {
+                        runs.push_back(pos);
+                        runs.push_back(pos+1);
+                    }
+                    int block = pos >> MASK_SHIFT;
+                    mask[block >> 6] |= UINT64_C(1) << (block & 63);
+                }
+                packed[k >> 2] |= code << ((k & 3)*2);
+            }
+            out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        }
+        write_padding(out, (length+3)/4);
+        offsets[4*i+1] = out.tellp();
+        out.write(reinterpret_cast<const char*>(mask.data()), mask.size()*sizeof(uint64_t));
+        offsets[4*i+2] = out.tellp();
+        out.write(reinterpret_cast<const char*>(runs.data()), runs.size()*sizeof(uint32_t));
+        write_padding(out, runs.size()*sizeof(uint32_t));
+        offsets[4*i+3] = runs.size()/2;
+    }
+    for(int i = 0; i < num_contigs; ++i) {
+        out.seekp(header_pos[i]);
+        for(int j = 0; j < 4; ++j) {
+            write_u64(out, offsets[4*i+j]);
+        }
+    }
+    out.close();
+    if(!out) {
+        fail("unable to write reference image '" + temp_path + "'.");
+    }
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        throw std::runtime_error("unable to replace reference image '" + path + "'.");
+    }
+}
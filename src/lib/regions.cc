@@ -223,3 +223,52 @@ dng::regions::ranges_t dng::regions::parse_bed(const std::string &text, const Co
         throw std::invalid_argument("Parsing of bed failed.");
     }    
 }
+
+dng::regions::ranges_t dng::regions::contig_ranges(const ContigIndex& index) {
+    ranges_t ranges;
+    for(int tid = 0; tid < index.contigs().size(); ++tid) {
+        ranges.emplace_back(tid, 0, index.contig(tid).length);
+    }
+    return ranges;
+}
+
+// Shard k covers the positions [total*k/num_shards, total*(k+1)/num_shards)
+// when the positions of all ranges are laid end to end.
+std::vector<dng::regions::ranges_t> dng::regions::shard_ranges(const ranges_t& ranges, size_t num_shards) {
+    if(num_shards == 0) {
+        num_shards = 1;
+    }
+    location_t total = 0;
+    for(auto && r : ranges) {
+        total += r.end - r.beg;
+    }
+
+    std::vector<ranges_t> shards;
+    ranges_t current;
+    location_t done = 0;
+    size_t k = 0;
+    for(auto r : ranges) {
+        while(r.beg < r.end) {
+            const location_t boundary = (k+1 == num_shards) ? total :
+                static_cast<location_t>(total*(k+1)/num_shards);
+            const location_t len = std::min(r.end - r.beg, boundary - done);
+            if(len > 0) {
+                current.emplace_back(r.beg, r.beg+len);
+                r.beg += len;
+                done += len;
+            }
+            if(done == boundary && k+1 < num_shards) {
+                // finish this shard; empty shards are skipped
+                if(!current.empty()) {
+                    shards.push_back(std::move(current));
+                    current.clear();
+                }
+                k += 1;
+            }
+        }
+    }
+    if(!current.empty()) {
+        shards.push_back(std::move(current));
+    }
+    return shards;
+}
@@ -190,9 +190,11 @@ void dng::RelationshipGraph::ConstructPeelingMachine() {
     peeling_functions_.clear();
     peeling_functions_ops_.clear();
     peeling_reverse_functions_.clear();
+    peeling_batch_functions_.clear();
     peeling_functions_.reserve(peeling_ops_.size());
     peeling_functions_ops_.reserve(peeling_ops_.size());
     peeling_reverse_functions_.reserve(peeling_ops_.size());
+    peeling_batch_functions_.reserve(peeling_ops_.size());
     std::vector<std::size_t> lower_written(num_nodes_, -1);
     for(std::size_t i = 0 ; i < peeling_ops_.size(); ++i) {
         peel::Op a = peeling_ops_[i];
@@ -221,9 +223,13 @@ void dng::RelationshipGraph::ConstructPeelingMachine() {
         }
         b = do_fast ? (int)Op::UPFAST + b : b;
 
+        // Trio families peel through the factored meiosis matrices of the children
+        bool is_trio = (fam.size() >= 3 && transitions_[fam[2]].type == TransitionType::Trio);
+
         peeling_functions_ops_.push_back(static_cast<peel::Op>(b));
-        peeling_functions_.push_back(functions[b]);
+        peeling_functions_.push_back(is_trio ? meiosis_functions[b] : functions[b]);
         peeling_reverse_functions_.push_back(reverse_functions[b]);
+        peeling_batch_functions_.push_back(is_trio ? batch_meiosis_functions[b] : batch_functions[b]);
 
         // If the operation writes to a lower value, make note of it
         if(info[b].writes_lower) {
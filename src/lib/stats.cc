@@ -362,27 +362,32 @@ double dng::stats::g_test(double a11, double a12, double a21, double a22) {
 
 double dng::stats::ad_two_sample_test(std::vector<int> a,
                                       std::vector<int> b) {
+    return ad_two_sample_test(&a, &b);
+}
+
+double dng::stats::ad_two_sample_test(std::vector<int> *pa,
+                                      std::vector<int> *pb) {
     using namespace std;
     using namespace boost;
+    assert(pa != nullptr && pb != nullptr);
+    auto &a = *pa;
+    auto &b = *pb;
     assert(a.size() > 0 && b.size() > 0);
 
     sort(a);
     sort(b);
-    vector<int> Z(a.size() + b.size());
-    merge(a, b, Z.begin());
 
-    auto ait = a.begin();
-    auto bit = b.begin();
     double A2 = 0.0, Ma = 0.0, Mb = 0.0;
     double na = a.size(), nb = b.size();
     double N = na + nb;
+    const size_t z_size = a.size() + b.size();
 
     double H = 1.0 / na + 1.0 / nb;
     double h = 0.0, g = 0.0;
 
-    for(size_t i = 1; i < Z.size(); ++i) {
+    for(size_t i = 1; i < z_size; ++i) {
         h += 1.0 / i;
-        for(size_t j = i + 1; j < Z.size(); ++j) {
+        for(size_t j = i + 1; j < z_size; ++j) {
             g += 1.0 / ((N - i) * j);
         }
     }
@@ -399,24 +404,20 @@ double dng::stats::ad_two_sample_test(std::vector<int> a,
                  (N - 3.0));
 
     // Check for degenerate sample
-    auto zit = adjacent_find(Z, std::not_equal_to<int> {});
-    if(zit == Z.end()) {
+    if(a.front() == a.back() && b.front() == b.back() && a.front() == b.front()) {
         return -1.0 / sqrt(var);
     }
 
-    for(; zit != Z.end(); ++zit) {
-        auto next = zit;
-        while(++next != Z.end()) {
-            if(*zit != *next) {
-                break;
-            }
-            zit = next;
-        }
+    // Walk over the distinct values of both samples in sorted order
+    auto ait = a.begin();
+    auto bit = b.begin();
+    while(ait != a.end() || bit != b.end()) {
+        int z = (bit == b.end() || (ait != a.end() && *ait < *bit)) ? *ait : *bit;
 
         size_t fa = 0, fb = 0;
-        for(; ait != a.end() && *ait == *zit; ++ait, ++fa)
+        for(; ait != a.end() && *ait == z; ++ait, ++fa)
             /*noop*/;
-        for(; bit != b.end() && *bit == *zit; ++bit, ++fb)
+        for(; bit != b.end() && *bit == z; ++bit, ++fb)
             /*noop*/;
         Ma += 0.5 * fa;
         Mb += 0.5 * fb;
@@ -21,6 +21,12 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+// Workaround for using boost::fusion::invoke and c++11 lambdas before boost 1.58
+#include <boost/version.hpp>
+#if BOOST_VERSION < 105800
+#   define BOOST_RESULT_OF_USE_TR1_WITH_DECLTYPE_FALLBACK 1
+#endif
+
 #include <cstdlib>
 #include <fstream>
 
@@ -30,6 +36,7 @@
 #include <chrono>
 #include <sstream>
 #include <string>
+#include <memory>
 
 #include <boost/range/algorithm/replace.hpp>
 #include <boost/range/algorithm/max_element.hpp>
@@ -37,8 +44,10 @@
 #include <boost/range/algorithm/replace_if.hpp>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 
 #include <dng/task/call.h>
+#include <dng/multithread.h>
 #include <dng/relationship_graph.h>
 #include <dng/fileio.h>
 #include <dng/seq.h>
@@ -51,6 +60,7 @@
 
 #include <dng/io/bam.h>
 #include <dng/io/bcf.h>
+#include <dng/io/ad.h>
 
 #include <htslib/faidx.h>
 #include <htslib/khash.h>
@@ -65,6 +75,7 @@ namespace {
 
 int process_bam(task::Call::argument_type &arg);
 int process_bcf(task::Call::argument_type &arg);
+int process_ad(task::Call::argument_type &arg);
 
 }
 
@@ -81,11 +92,12 @@ using namespace task;
 int task::Call::operator()(Call::argument_type &arg) {
     // Determine the type of input files
     auto it = arg.input.begin();
-    FileCat mode = utility::input_category(*it, FileCat::Sequence|FileCat::Variant, FileCat::Unknown);
+    const auto input_mask = FileCat::Sequence|FileCat::Variant|FileCat::Pileup;
+    FileCat mode = utility::input_category(*it, input_mask, FileCat::Unknown);
     for(++it; it != arg.input.end(); ++it) {
         // Make sure different types of input files aren't mixed together
-        if(utility::input_category(*it, FileCat::Sequence|FileCat::Variant, FileCat::Sequence) != mode) {
-            throw std::invalid_argument("Mixing sequencing, and variant file types is not supported.");
+        if(utility::input_category(*it, input_mask, FileCat::Sequence) != mode) {
+            throw std::invalid_argument("Mixing sequencing, variant, and pileup file types is not supported.");
         }
     }
 
@@ -95,6 +107,9 @@ int task::Call::operator()(Call::argument_type &arg) {
     } else if(mode == utility::FileCat::Variant) {
         // vcf, bcf
         return process_bcf(arg);
+    } else if(mode == utility::FileCat::Pileup) {
+        // ad
+        return process_ad(arg);
     } else {
         throw std::invalid_argument("Unknown input data file type.");
     }
@@ -103,9 +118,31 @@ int task::Call::operator()(Call::argument_type &arg) {
 
 namespace {
 
+// Buffers used to output a site. They keep their capacity between sites, so
+// that the vectors and strings used to build a record are not reallocated
+// once they have grown to fit the largest site. This does not cover the
+// model or htslib, which can still allocate memory while a site is called.
+// The unit tests check that the helpers that use these buffers, i.e.
+// stats::ad_two_sample_test and Variant::TrimAlleles, do not allocate.
+struct output_buffers_t {
+    pileup::stats_t depth_stats;
+
+    std::vector<int> base_index_to_allele;
+    std::vector<int32_t> ad_info, adf_info, adr_info;
+    std::vector<int32_t> ad_counts, adf_counts, adr_counts; // nodes x alleles
+    std::vector<int> qual_ref, qual_alt, pos_ref, pos_alt, base_ref, base_alt;
+
+    std::vector<float> float_vector;
+    std::vector<int32_t> int32_vector;
+    std::string dnt;
+
+    hts::bcf::trim_buffers_t trim;
+};
+
 void add_stats_to_output(const CallMutations::stats_t& call_stats, const pileup::stats_t& depth_stats,
     const RelationshipGraph &graph,
     const peel::workspace_t &work,
+    output_buffers_t *buffers,
     hts::bcf::Variant *record);
 
 // Helper function to determines if output should be bcf file, vcf file, or stdout. Also
@@ -203,11 +240,14 @@ void vcf_add_header_text(const task::Call::argument_type &arg,
 }
 
 template<typename A, typename M, typename R>
-hts::bcf::File open_vcf_output(const A& arg, const M& mpileup, const R& relationship_graph,
-    bool add_read_stats) {
+hts::bcf::File open_vcf_output(const std::pair<std::string, std::string> &out_file,
+    const A& arg, const M& mpileup, const R& relationship_graph, bool add_read_stats,
+    hts::ThreadPool *io_pool = nullptr) {
    // Begin writing VCF header
-    auto out_file = vcf_get_output_mode(arg);
     hts::bcf::File vcfout(out_file.first.c_str(), out_file.second.c_str());
+    if(io_pool != nullptr) {
+        vcfout.SetThreadPool(io_pool);
+    }
     vcf_add_header_text(arg, add_read_stats, &vcfout);
 
     for(auto && contig : mpileup.contigs()) {
@@ -226,48 +266,286 @@ hts::bcf::File open_vcf_output(const A& arg, const M& mpileup, const R& relation
     return vcfout;
 }
 
-// Processes bam, sam, and cram files.
-int process_bam(task::Call::argument_type &arg) {
-    // Open Reference
-    if(arg.fasta.empty()){
-        throw std::invalid_argument("Path to reference file must be specified with --fasta when processing bam/sam/cram files.");
+template<typename A, typename M, typename R>
+hts::bcf::File open_vcf_output(const A& arg, const M& mpileup, const R& relationship_graph,
+    bool add_read_stats, hts::ThreadPool *io_pool = nullptr) {
+    return open_vcf_output(vcf_get_output_mode(arg), arg, mpileup, relationship_graph,
+        add_read_stats, io_pool);
+}
+
+// Temporary files that are removed when this object is destroyed
+struct temp_files_t {
+    temp_files_t(size_t num_files, const std::string &model) {
+        namespace fs = boost::filesystem;
+        for(size_t i = 0; i < num_files; ++i) {
+            paths.push_back(fs::temp_directory_path() / fs::unique_path(model));
+        }
+    }
+    ~temp_files_t() {
+        boost::system::error_code ec;
+        for(auto && p : paths) {
+            boost::filesystem::remove(p, ec);
+        }
+    }
+    std::vector<boost::filesystem::path> paths;
+};
+
+// A compact copy of the information that dng-call uses from a read
+struct site_read_t {
+    int32_t pos;          // position of the site in the read
+    uint16_t library;     // index of the library of the read
+    uint8_t base;         // base index of the call
+    uint8_t base_qual;    // quality of the base call
+    uint8_t map_qual;     // mapping quality of the read
+    bool is_reversed;     // is the read on the reverse strand?
+};
+
+// A snapshot of the pileup at a site, which can be processed independently
+// of the BamPileup that produced it.
+struct site_t {
+    utility::location_t location;
+    std::string alleles;
+    std::vector<int> indexes;
+    pileup::allele_depths_t depths;
+    std::vector<site_read_t> reads;
+};
+
+// A model, and its output buffers, used to process one site at a time
+struct caller_t {
+    CallMutations model;
+    CallMutations::stats_t stats;
+    output_buffers_t output;
+};
+
+// Number of sites rejected at each stage of calling
+struct site_counts_t {
+    uint64_t no_data{0};
+    CallMutations::filter_counts_t model;
+    // genotype likelihood cache lookups
+    uint64_t cache_hits{0};
+    uint64_t cache_misses{0};
+
+    site_counts_t& operator+=(const site_counts_t &other) {
+        no_data += other.no_data;
+        model += other.model;
+        cache_hits += other.cache_hits;
+        cache_misses += other.cache_misses;
+        return *this;
     }
-    io::Fasta reference{arg.fasta.c_str()};
 
-    // Open input files
-    auto mpileup = io::BamPileup::open_and_setup(arg);
+    void AddModel(const CallMutations &caller) {
+        model += caller.filter_counts();
+        cache_hits += caller.work().likelihood_cache.hits();
+        cache_misses += caller.work().likelihood_cache.misses();
+    }
+};
+
+void print_site_counts(std::ostream &out, const site_counts_t &counts) {
+    out << "filter\tsites\n"
+        << "no_data\t" << counts.no_data << "\n"
+        << "reference_only\t" << counts.model.reference_only << "\n"
+        << "quality_bound\t" << counts.model.quality_bound << "\n"
+        << "quality\t" << counts.model.quality << "\n"
+        << "mutq\t" << counts.model.mutq << "\n"
+        << "passed\t" << counts.model.passed << "\n";
+    out << "cache\tlookups\n"
+        << "hits\t" << counts.cache_hits << "\n"
+        << "misses\t" << counts.cache_misses << "\n";
+}
 
-    auto relationship_graph = create_relationship_graph(arg, &mpileup);
+// Copy the information needed to call a site from the pileup
+template<typename A, typename F>
+void make_site(const io::BamPileup::data_type &data, utility::location_t loc,
+    const A& count_alleles, const pileup::allele_depths_t &read_depths, F filter_read,
+    site_t *site) {
+    assert(site != nullptr);
+    site->location = loc;
+    site->alleles = count_alleles.alleles_str();
+    site->indexes.assign(count_alleles.indexes.begin(), count_alleles.indexes.end());
+    site->depths.resize(utility::make_array(read_depths.shape()[0], read_depths.shape()[1]));
+    site->depths = read_depths;
+    site->reads.clear();
+    for(size_t u = 0; u < data.size(); ++u) {
+        for(auto && r : data[u]) {
+            if(filter_read(r)) {
+                continue;
+            }
+            site->reads.push_back({static_cast<int32_t>(r.pos), static_cast<uint16_t>(u),
+                static_cast<uint8_t>(seq::base_index(r.base())), r.base_qual(),
+                static_cast<uint8_t>(r.aln.map_qual()), r.aln.is_reversed()});
+        }
+    }
+}
 
-    // Open Output
-    auto vcfout = open_vcf_output(arg, mpileup, relationship_graph, true);
+// Run the model on a site, and fill in record if the site should be output.
+// Returns true if record was updated.
+bool call_site(const site_t &site, const bam_hdr_t *h, const RelationshipGraph &relationship_graph,
+    caller_t *caller, hts::bcf::Variant *record) {
+    assert(caller != nullptr && record != nullptr);
+    auto &model = caller->model;
+    auto &stats = caller->stats;
 
-    // Record for each output
-    auto record = vcfout.InitVariant();
+    const size_t num_nodes = relationship_graph.num_nodes();
+    const size_t library_start = relationship_graph.library_nodes().first;
 
-    // Construct Calling Object
-    CallMutations model{relationship_graph, get_model_parameters(arg)};
-    model.quality_threshold(arg.min_quality, arg.all);
+    const auto &read_depths = site.depths;
+    size_t n_sz = read_depths.shape()[1];
+
+    model.SetupWorkspace(read_depths, n_sz, dng::genotype::Mode::LogLikelihood);
+    if(!model.CalculateMutationStats(dng::genotype::Mode::LogLikelihood, &stats)) {
+        return false;
+    }
+
+    // Calculate target position and fetch sequence name
+    int contig = utility::location_to_contig(site.location);
+    int position = utility::location_to_position(site.location);
+
+    record->update_filter("PASS");
+    record->update_alleles(site.alleles);
+
+    // Measure total depth and sort nucleotides in descending order
+    auto &buffers = caller->output;
+    auto &depth_stats = buffers.depth_stats;
+    pileup::calculate_stats(read_depths, &depth_stats);
+
+    add_stats_to_output(stats, depth_stats, relationship_graph, model.work(), &buffers, record);
+    // Map character_indexes to alleles
+    auto &base_index_to_allele = buffers.base_index_to_allele;
+    base_index_to_allele.assign(site.indexes.size(), -1);
+    for(size_t u=0;u<site.indexes.size();++u) {
+        base_index_to_allele[site.indexes[u]] = u;
+    }
+
+    // Turn allele frequencies into AD format; order will need to match REF+ALT ordering of nucleotides
+    auto &ad_info = buffers.ad_info;
+    auto &adf_info = buffers.adf_info;
+    auto &adr_info = buffers.adr_info;
+    ad_info.assign(n_sz, 0);
+    adf_info.assign(n_sz, 0);
+    adr_info.assign(n_sz, 0);
+    auto &ad_counts = buffers.ad_counts;
+    auto &adf_counts = buffers.adf_counts;
+    auto &adr_counts = buffers.adr_counts;
+    size_t missing_len = library_start*n_sz;
+    ad_counts.assign(num_nodes*n_sz, 0);
+    std::fill_n(ad_counts.begin(), missing_len, hts::bcf::int32_missing);
+    adf_counts.assign(num_nodes*n_sz, 0);
+    std::fill_n(adf_counts.begin(), missing_len, hts::bcf::int32_missing);
+    adr_counts.assign(num_nodes*n_sz, 0);
+    std::fill_n(adr_counts.begin(), missing_len, hts::bcf::int32_missing);
+
+    auto &qual_ref = buffers.qual_ref;
+    auto &qual_alt = buffers.qual_alt;
+    auto &pos_ref = buffers.pos_ref;
+    auto &pos_alt = buffers.pos_alt;
+    auto &base_ref = buffers.base_ref;
+    auto &base_alt = buffers.base_alt;
+    for(auto p : {&qual_ref, &qual_alt, &pos_ref, &pos_alt, &base_ref, &base_alt}) {
+        p->clear();
+        p->reserve(depth_stats.dp);
+    }
+    double rms_mq = 0.0;
+
+    for(auto && r : site.reads) {
+        const size_t pos = library_start + r.library;
+        const size_t base_allele = base_index_to_allele[r.base];
+        assert(base_allele != -1);
+        const size_t k = pos*n_sz + base_allele;
+        // all depths
+        ad_counts[k] += 1;
+        ad_info[base_allele] += 1;
+        // Forward Depths, avoiding branching
+        adf_counts[k]  += !r.is_reversed;
+        adf_info[base_allele] += !r.is_reversed;
+        // Reverse Depths
+        adr_counts[k]  += r.is_reversed;
+        adr_info[base_allele] += r.is_reversed;
+        // Mapping quality
+        rms_mq += r.map_qual*r.map_qual;
+        (base_allele == 0 ? &qual_ref : &qual_alt)->push_back(r.map_qual);
+        // Positions
+        (base_allele == 0 ? &pos_ref : &pos_alt)->push_back(r.pos);
+        // Base Calls
+        (base_allele == 0 ? &base_ref : &base_alt)->push_back(r.base_qual);
+    }
+    rms_mq = sqrt(rms_mq/(qual_ref.size()+qual_alt.size()));
+
+    record->update_format("AD",  ad_counts);
+    record->update_format("ADF", adf_counts);
+    record->update_format("ADR", adr_counts);
+
+    record->update_info("AD",  ad_info);
+    record->update_info("ADF", adf_info);
+    record->update_info("ADR", adr_info);
+    record->update_info("MQ", static_cast<float>(rms_mq));
+
+    int a11 = adf_info[0];
+    int a21 = adr_info[0];
+    int a12 = 0, a22 = 0;
+    for(int k = 1; k < n_sz; ++k) {
+        a12 += adf_info[k];
+        a22 += adr_info[k];
+    }
+    if(a11+a21 > 0 && a12+a22 > 0) {
+        // Fisher Exact Test for strand bias
+        double fs_info = dng::stats::fisher_exact_test(a11, a12, a21, a22);
+
+        double mq_info = dng::stats::ad_two_sample_test(&qual_ref, &qual_alt);
+        double rp_info = dng::stats::ad_two_sample_test(&pos_ref, &pos_alt);
+        double bq_info = dng::stats::ad_two_sample_test(&base_ref, &base_alt);
+
+        record->update_info("FS", static_cast<float>(phred(fs_info)));
+        record->update_info("MQTa", static_cast<float>(mq_info));
+        record->update_info("RPTa", static_cast<float>(rp_info));
+        record->update_info("BQTa", static_cast<float>(bq_info));
+    }
+
+    record->target(h->target_name[contig]);
+    record->position(position);
+
+    record->TrimAlleles(stats.af_min, &buffers.trim);
+    return true;
+}
+
+// A block of consecutive sites that is processed by a single worker
+struct batch_t {
+    std::vector<site_t> sites;
+    size_t num_sites{0};
+    std::vector<std::unique_ptr<hts::bcf::Variant>> records;
+    size_t num_records{0};
+};
+
+// Call the sites in a pileup and write them to vcfout
+void call_bam(const task::Call::argument_type &arg, io::BamPileup *pmpileup,
+    io::Fasta *preference, const RelationshipGraph &relationship_graph,
+    const caller_t &prototype, hts::bcf::File *pvcfout, site_counts_t *pcounts) {
+    assert(pmpileup != nullptr && preference != nullptr && pvcfout != nullptr);
+    assert(pcounts != nullptr);
+    auto &mpileup = *pmpileup;
+    auto &reference = *preference;
+    auto &vcfout = *pvcfout;
+    auto &counts = *pcounts;
+
+    caller_t caller = prototype;
+    const bool skip_reference_only = (prototype.model.quality_threshold() > 0.0);
 
-    // Calculated stats
-    CallMutations::stats_t stats;
-  
     // Parameters used by site calculation function
-    const size_t num_nodes = relationship_graph.num_nodes();
-    const size_t library_start = relationship_graph.library_nodes().first;
     const int min_basequal = arg.min_basequal;
     auto filter_read = [min_basequal](
-    decltype(mpileup)::data_type::value_type::const_reference r) -> bool {
+    io::BamPileup::data_type::value_type::const_reference r) -> bool {
         return (r.is_missing
         || r.base_qual() < min_basequal
         || seq::base_index(r.base()) >= 4);
     };
 
-    decltype(mpileup)::Alleles count_alleles(mpileup.num_libraries());
+    io::BamPileup::Alleles count_alleles(mpileup.num_libraries());
+    mpileup.EnableColumns(min_basequal);
 
     auto h = mpileup.header();
 
-    mpileup([&](const decltype(mpileup)::data_type & data, utility::location_t loc) {
+    // Copy the pileup at a site into a snapshot.
+    // Returns false if the site has no data.
+    auto pileup_site = [&](utility::location_t loc, site_t *site) -> bool {
         // Calculate target position and fetch sequence name
         int contig = utility::location_to_contig(loc);
         int position = utility::location_to_position(loc);
@@ -277,133 +555,261 @@ int process_bam(task::Call::argument_type &arg) {
         char ref_base = reference.FetchBase(h->target_name[contig],position);
         size_t ref_index = seq::char_index(ref_base);
 
-        auto read_depths = count_alleles(data, ref_index, filter_read);
-        size_t n_sz = read_depths.shape()[1];
-        if(n_sz == 0) {
-            return;
+        const auto &read_depths = count_alleles(mpileup.columns(), loc, ref_index);
+        if(read_depths.shape()[1] == 0) {
+            counts.no_data += 1;
+            return false;
         }
-
-        model.SetupWorkspace(read_depths, n_sz, dng::genotype::Mode::LogLikelihood);
-        if(!model.CalculateMutationStats(dng::genotype::Mode::LogLikelihood, &stats)) {
-            return;
+        // Sites without variation can not be called, so reject them before
+        // copying the reads and calculating genotype likelihoods.
+        if(read_depths.shape()[1] == 1 && skip_reference_only) {
+            counts.model.reference_only += 1;
+            return false;
         }
+        make_site(mpileup.UpdateReads(loc), loc, count_alleles, read_depths,
+            filter_read, site);
+        return true;
+    };
+
+    if(arg.threads <= 1) {
+        // Record for each output
+        auto record = vcfout.InitVariant();
+        site_t site;
+        mpileup([&](const io::BamPileup::data_type & data, utility::location_t loc) {
+            if(!pileup_site(loc, &site)) {
+                return;
+            }
+            if(!call_site(site, h, relationship_graph, &caller, &record)) {
+                return;
+            }
+            vcfout.WriteRecord(record);
+            record.Clear();
+        });
+        counts.AddModel(caller.model);
+        return;
+    }
 
-        record.update_filter("PASS");
-        record.update_alleles(count_alleles.alleles_str());
+    // Sites are collected into batches on this thread and called on worker threads.
+    // Finished batches are written in the order that they were created, so the
+    // output is identical to the serial algorithm.
+    const size_t num_threads = arg.threads;
+    const size_t batch_size = (arg.batch_size > 0) ? arg.batch_size : 1;
 
-        // Measure total depth and sort nucleotides in descending order
-        pileup::stats_t depth_stats;
-        pileup::calculate_stats(read_depths, &depth_stats);
+    multithread::ObjectPool<caller_t> callers(num_threads, caller);
 
-        add_stats_to_output(stats, depth_stats, relationship_graph, model.work(), &record);
-        // Map character_indexes to alleles
-        std::vector<int> base_index_to_allele(count_alleles.indexes.size(),-1);
-        for(size_t u=0;u<count_alleles.indexes.size();++u) {
-            base_index_to_allele[count_alleles.indexes[u]] = u;
+    auto process_batch = [&](batch_t *batch) {
+        auto worker = callers.Acquire();
+        batch->num_records = 0;
+        for(size_t i = 0; i < batch->num_sites; ++i) {
+            if(batch->num_records == batch->records.size()) {
+                batch->records.emplace_back(new hts::bcf::Variant{vcfout});
+            }
+            auto *record = batch->records[batch->num_records].get();
+            if(call_site(batch->sites[i], h, relationship_graph, worker.get(), record)) {
+                batch->num_records += 1;
+            }
         }
+    };
 
-        // Turn allele frequencies into AD format; order will need to match REF+ALT ordering of nucleotides
-        std::vector<int32_t> ad_info(n_sz, 0);
-        std::vector<int32_t> adf_info(n_sz, 0);
-        std::vector<int32_t> adr_info(n_sz, 0);
-        boost::multi_array<int32_t,2> ad_counts(utility::make_array(num_nodes, n_sz));
-        boost::multi_array<int32_t,2> adf_counts(utility::make_array(num_nodes, n_sz));
-        boost::multi_array<int32_t,2> adr_counts(utility::make_array(num_nodes, n_sz));
-        size_t missing_len = library_start*n_sz;
-        std::fill_n(ad_counts.data(), missing_len, hts::bcf::int32_missing);
-        std::fill_n(ad_counts.data()+missing_len, ad_counts.num_elements()-missing_len, 0);
-        std::fill_n(adf_counts.data(), missing_len, hts::bcf::int32_missing);
-        std::fill_n(adf_counts.data()+missing_len, adf_counts.num_elements()-missing_len, 0);
-        std::fill_n(adr_counts.data(), missing_len, hts::bcf::int32_missing);
-        std::fill_n(adr_counts.data()+missing_len, adr_counts.num_elements()-missing_len, 0);
-
-        std::vector<int> qual_ref, qual_alt, pos_ref, pos_alt, base_ref, base_alt;
-        qual_ref.reserve(depth_stats.dp);
-        qual_alt.reserve(depth_stats.dp);
-        pos_ref.reserve(depth_stats.dp);
-        pos_alt.reserve(depth_stats.dp);
-        base_ref.reserve(depth_stats.dp);
-        base_alt.reserve(depth_stats.dp);
-        double rms_mq = 0.0;
-
-        for(size_t u = 0; u < data.size(); ++u) {
-            const size_t pos = library_start + u;
-            for(auto && r : data[u]) {
-                if(filter_read(r)) {
-                    continue;
-                }
-                const size_t base_allele = base_index_to_allele[seq::base_index(r.base())];
-                assert(base_allele != -1);
-                // all depths
-                ad_counts[pos][base_allele] += 1;
-                ad_info[base_allele] += 1;
-                // Forward Depths, avoiding branching
-                adf_counts[pos][base_allele]  += !r.aln.is_reversed();
-                adf_info[base_allele] += !r.aln.is_reversed();
-                // Reverse Depths
-                adr_counts[pos][base_allele]  += r.aln.is_reversed();
-                adr_info[base_allele] += r.aln.is_reversed();
-                // Mapping quality
-                rms_mq += r.aln.map_qual()*r.aln.map_qual();
-                (base_allele == 0 ? &qual_ref : &qual_alt)->push_back(r.aln.map_qual());
-                // Positions
-                (base_allele == 0 ? &pos_ref : &pos_alt)->push_back(r.pos);
-                // Base Calls
-                (base_allele == 0 ? &base_ref : &base_alt)->push_back(r.base_qual());
+    auto write_batch = [&](batch_t *batch) {
+        for(size_t i = 0; i < batch->num_records; ++i) {
+            vcfout.WriteRecord(*batch->records[i]);
+            batch->records[i]->Clear();
+        }
+        batch->num_sites = 0;
+        batch->num_records = 0;
+    };
+
+    {
+        // Exceptions thrown by workers are rethrown here when their batch
+        // would have been written.
+        multithread::OrderedBatchQueue<batch_t> queue(num_threads,
+            process_batch, write_batch, [batch_size]() {
+                batch_t *batch = new batch_t;
+                batch->sites.resize(batch_size);
+                return batch;
+            });
+
+        mpileup([&](const io::BamPileup::data_type & data, utility::location_t loc) {
+            batch_t *current = queue.current();
+            if(current == nullptr) {
+                current = queue.NewBatch();
             }
+            if(!pileup_site(loc, &current->sites[current->num_sites])) {
+                return;
+            }
+            if(++current->num_sites < batch_size) {
+                return;
+            }
+            queue.Submit();
+        });
+        if(queue.current() != nullptr) {
+            queue.Submit();
         }
-        rms_mq = sqrt(rms_mq/(qual_ref.size()+qual_alt.size()));
-
-        record.update_format("AD",  ad_counts.data(), ad_counts.num_elements());
-        record.update_format("ADF", adf_counts.data(), adf_counts.num_elements());
-        record.update_format("ADR", adr_counts.data(), adr_counts.num_elements());
-
-        record.update_info("AD",  ad_info);
-        record.update_info("ADF", adf_info);
-        record.update_info("ADR", adr_info);
-        record.update_info("MQ", static_cast<float>(rms_mq));
-
-        int a11 = adf_info[0];
-        int a21 = adr_info[0];
-        int a12 = 0, a22 = 0;
-        for(int k = 1; k < n_sz; ++k) {
-            a12 += adf_info[k];
-            a22 += adr_info[k];
+        queue.Flush();
+    }
+    for(auto && worker : callers.objects()) {
+        counts.AddModel(worker.model);
+    }
+}
+
+// Run the model on a site that only has allele depths, and fill in record if
+// the site should be output. set_alleles(record) sets the alleles of the site.
+// Returns true if record was updated.
+template<typename D, typename F>
+bool call_depths_site(const D &read_depths, size_t n_alleles, F set_alleles,
+    const char *target, int position, const RelationshipGraph &relationship_graph,
+    caller_t *caller, hts::bcf::Variant *record) {
+    assert(caller != nullptr && record != nullptr);
+    auto &model = caller->model;
+    auto &stats = caller->stats;
+    auto &buffers = caller->output;
+
+    model.SetupWorkspace(read_depths, n_alleles, dng::genotype::Mode::LogLikelihood);
+    if(!model.CalculateMutationStats(dng::genotype::Mode::LogLikelihood, &stats)) {
+        return false;
+    }
+
+    // Set alleles
+    record->update_filter("PASS");
+    set_alleles(record);
+
+    // Measure total depth and sort nucleotides in descending order
+    auto &depth_stats = buffers.depth_stats;
+    pileup::calculate_stats(read_depths, &depth_stats);
+
+    add_stats_to_output(stats, depth_stats, relationship_graph, model.work(), &buffers, record);
+
+    // Turn allele frequencies into AD format; order will need to match REF+ALT ordering of nucleotides
+    const size_t num_nodes = relationship_graph.num_nodes();
+    const size_t library_start = relationship_graph.library_nodes().first;
+    auto &ad_info = buffers.ad_info;
+    auto &ad_counts = buffers.ad_counts;
+    ad_info.assign(n_alleles, 0);
+    ad_counts.assign(num_nodes*n_alleles, hts::bcf::int32_missing);
+
+    for(size_t u = 0; u < read_depths.size(); ++u) {
+        const size_t pos = (library_start+u)*n_alleles;
+        size_t k = 0;
+        for(; k < read_depths[u].size(); ++k) {
+            int count = read_depths[u][k];
+            ad_counts[pos+k] = count;
+            ad_info[k] += count;
         }
-        if(a11+a21 > 0 && a12+a22 > 0) {
-            // Fisher Exact Test for strand bias
-            double fs_info = dng::stats::fisher_exact_test(a11, a12, a21, a22);
-
-            double mq_info = dng::stats::ad_two_sample_test(qual_ref, qual_alt);
-            double rp_info = dng::stats::ad_two_sample_test(pos_ref, pos_alt);
-            double bq_info = dng::stats::ad_two_sample_test(base_ref, base_alt);
-
-            record.update_info("FS", static_cast<float>(phred(fs_info)));
-            record.update_info("MQTa", static_cast<float>(mq_info));
-            record.update_info("RPTa", static_cast<float>(rp_info));
-            record.update_info("BQTa", static_cast<float>(bq_info));
+        for(; k < n_alleles; ++k) {
+            ad_counts[pos+k] = 0;
         }
+    }
+    record->update_format("AD", ad_counts);
+    record->update_info("AD", ad_info);
 
-        record.target(h->target_name[contig]);
-        record.position(position);
+    record->target(target);
+    record->position(position);
 
-        record.TrimAlleles(stats.af_min);
-        vcfout.WriteRecord(record);
-        record.Clear();
+    record->TrimAlleles(stats.af_min, &buffers.trim);
+    return true;
+}
+
+// Processes bam, sam, and cram files.
+int process_bam(task::Call::argument_type &arg) {
+    // Open Reference
+    if(arg.fasta.empty()){
+        throw std::invalid_argument("Path to reference file must be specified with --fasta when processing bam/sam/cram files.");
+    }
+    io::Fasta reference{arg.fasta.c_str(), arg.fasta_cache};
+
+    // Threads shared by all files; must be created before the files
+    hts::ThreadPool io_pool{arg.io_threads};
+
+    // Open input files
+    auto mpileup = io::BamPileup::open_and_setup(arg, &io_pool);
+
+    auto relationship_graph = create_relationship_graph(arg, &mpileup);
+
+    // Open Output
+    auto vcfout = open_vcf_output(arg, mpileup, relationship_graph, true, &io_pool);
+
+    // Construct Calling Object
+    MatrixCache matrix_cache{arg.matrix_cache};
+    caller_t caller{{relationship_graph, get_model_parameters(arg), &matrix_cache}, {}};
+    caller.model.quality_threshold(arg.min_quality, arg.all);
+    matrix_cache.Save();
+
+    if(arg.shards <= 1) {
+        site_counts_t counts;
+        call_bam(arg, &mpileup, &reference, relationship_graph, caller, &vcfout, &counts);
+        if(arg.report_filters) {
+            print_site_counts(std::cerr, counts);
+        }
+        if(arg.report_io) {
+            io::print_file_times(std::cerr, mpileup.read_times());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Split the regions into shards that are processed independently. The first
+    // shard is written directly to the output, and the others are written to
+    // temporary files that are appended to the output in order.
+    auto shards = regions::shard_regions(arg.region, mpileup, arg.shards);
+    temp_files_t temp_files(shards.empty() ? 0 : shards.size()-1,
+        "dng-call-%%%%-%%%%-%%%%-%%%%.bcf");
+
+    std::vector<site_counts_t> shard_counts(shards.size());
+    std::vector<std::vector<io::file_time_t>> shard_times(shards.size());
+
+    multithread::run_in_parallel(shards.size(), [&](size_t i) {
+        if(i == 0) {
+            mpileup.SetRegions(shards[0]);
+            call_bam(arg, &mpileup, &reference, relationship_graph, caller, &vcfout,
+                &shard_counts[0]);
+            shard_times[0] = mpileup.read_times();
+            return;
+        }
+        io::Fasta shard_reference{arg.fasta.c_str(), arg.fasta_cache};
+        auto shard_mpileup = io::BamPileup::open_and_setup(arg, &io_pool);
+        shard_mpileup.SelectLibraries(relationship_graph.library_names());
+        shard_mpileup.SetRegions(shards[i]);
+        auto shard_vcfout = open_vcf_output({temp_files.paths[i-1].string(), "wbu"},
+            arg, shard_mpileup, relationship_graph, true, &io_pool);
+        call_bam(arg, &shard_mpileup, &shard_reference, relationship_graph, caller,
+            &shard_vcfout, &shard_counts[i]);
+        shard_times[i] = shard_mpileup.read_times();
     });
 
+    for(auto && path : temp_files.paths) {
+        hts::bcf::File shard_vcfin(path.string().c_str(), "r");
+        vcfout.AppendRecords(&shard_vcfin);
+    }
+    if(arg.report_filters) {
+        site_counts_t counts;
+        for(auto && a : shard_counts) {
+            counts += a;
+        }
+        print_site_counts(std::cerr, counts);
+    }
+    if(arg.report_io) {
+        std::vector<io::file_time_t> times;
+        for(auto && a : shard_times) {
+            io::add_file_times(&times, a);
+        }
+        io::print_file_times(std::cerr, times);
+    }
+
     return EXIT_SUCCESS;
 }
 
 // Process vcf, bcf input data
 int process_bcf(task::Call::argument_type &arg) {
+    // Threads shared by all files; must be created before the files
+    hts::ThreadPool io_pool{arg.io_threads};
+
     // Read input data
-    auto mpileup = io::BcfPileup::open_and_setup(arg);
+    auto mpileup = io::BcfPileup::open_and_setup(arg, &io_pool);
 
     auto relationship_graph = create_relationship_graph(arg, &mpileup);
 
     // Open Output
-    auto vcfout = open_vcf_output(arg, mpileup, relationship_graph, false);
+    auto vcfout = open_vcf_output(arg, mpileup, relationship_graph, false, &io_pool);
 
     // Record for each output
     auto record = vcfout.InitVariant();
@@ -412,20 +818,17 @@ int process_bcf(task::Call::argument_type &arg) {
     const bcf_hdr_t *header = mpileup.reader().header(0); // TODO: fixthis
     const size_t num_libs = mpileup.num_libraries();
 
-    CallMutations model{relationship_graph, get_model_parameters(arg)};
-    model.quality_threshold(arg.min_quality, arg.all);
-
-    // Calculated stats
-    CallMutations::stats_t stats;
-
-    // Parameters used by site calculation function
-    const size_t num_nodes = relationship_graph.num_nodes();
-    const size_t library_start = relationship_graph.library_nodes().first;
+    MatrixCache matrix_cache{arg.matrix_cache};
+    caller_t caller{{relationship_graph, get_model_parameters(arg), &matrix_cache}, {}};
+    caller.model.quality_threshold(arg.min_quality, arg.all);
+    matrix_cache.Save();
 
     // allocate space for ad. bcf_get_format_int32 uses realloc internally
     int n_ad_capacity = num_libs*5;
     auto ad = hts::bcf::make_buffer<int>(n_ad_capacity);
 
+    uint64_t num_no_data = 0;
+
     // run calculation based on the depths at each site.
     mpileup([&](const decltype(mpileup)::data_type & rec) {
         // Read all the Allele Depths for every sample into an AD array
@@ -433,6 +836,7 @@ int process_bcf(task::Call::argument_type &arg) {
         if(n_ad <= 0) {
             // AD tag is missing, so we do nothing at this time
             // TODO: support using calculated genotype likelihoods
+            num_no_data += 1;
             return;
         }
         assert(n_ad % num_libs == 0);
@@ -445,51 +849,85 @@ int process_bcf(task::Call::argument_type &arg) {
 
         pileup::allele_depths_ref_t read_depths(ad.get(), make_array(num_libs,n_sz));
 
-        model.SetupWorkspace(read_depths, n_alleles, dng::genotype::Mode::LogLikelihood);
-        if(!model.CalculateMutationStats(dng::genotype::Mode::LogLikelihood, &stats)) {
+        auto set_alleles = [rec,n_alleles](hts::bcf::Variant *r) {
+            r->update_alleles(const_cast<const char**>(rec->d.allele), n_alleles);
+        };
+        if(!call_depths_site(read_depths, n_alleles, set_alleles,
+                mpileup.contigs()[rec->rid].name.c_str(), rec->pos,
+                relationship_graph, &caller, &record)) {
             return;
         }
+        vcfout.WriteRecord(record);
+        record.Clear();
+    });
+    if(arg.report_filters) {
+        site_counts_t counts;
+        counts.no_data = num_no_data;
+        counts.AddModel(caller.model);
+        print_site_counts(std::cerr, counts);
+    }
+    if(arg.report_io) {
+        io::print_file_times(std::cerr, mpileup.read_times());
+    }
+    return EXIT_SUCCESS;
+}
 
-        // Set alleles
-        record.update_filter("PASS");     
-        record.update_alleles(const_cast<const char**>(rec->d.allele), n_alleles);
-
-        // Measure total depth and sort nucleotides in descending order
-        pileup::stats_t depth_stats;
-        pileup::calculate_stats(read_depths, &depth_stats);
+// Process ad input data
+int process_ad(task::Call::argument_type &arg) {
+    // Read input data
+    auto mpileup = io::AdPileup::open_and_setup(arg);
 
-        add_stats_to_output(stats, depth_stats, relationship_graph, model.work(), &record);
+    auto relationship_graph = create_relationship_graph(arg, &mpileup);
 
-        // Turn allele frequencies into AD format; order will need to match REF+ALT ordering of nucleotides
-        std::vector<int32_t> ad_info(n_alleles, 0);
-        boost::multi_array<int32_t,2> ad_counts(utility::make_array(num_nodes, n_alleles));
-        std::fill_n(ad_counts.data(), ad_counts.num_elements(), hts::bcf::int32_missing);
+    // Open Output
+    hts::ThreadPool io_pool{arg.io_threads};
+    auto vcfout = open_vcf_output(arg, mpileup, relationship_graph, false, &io_pool);
 
-        for(size_t u = 0; u < read_depths.size(); ++u) {
-            size_t k = 0;
-            for(; k < read_depths[u].size(); ++k) {
-                int count = read_depths[u][k];
-                ad_counts[library_start+u][k] = count;
-                ad_info[k] += count;
-            }
-            for(; k < n_alleles; ++k) {
-                ad_counts[library_start+u][k] = 0;
-            }
-        }
-        record.update_format("AD", ad_counts.data(), ad_counts.num_elements());
-        record.update_info("AD", ad_info);
+    // Record for each output
+    auto record = vcfout.InitVariant();
 
-        // Calculate target position and fetch sequence name
-        int contig =  rec->rid;
-        int position = rec->pos;
+    MatrixCache matrix_cache{arg.matrix_cache};
+    caller_t caller{{relationship_graph, get_model_parameters(arg), &matrix_cache}, {}};
+    caller.model.quality_threshold(arg.min_quality, arg.all);
+    matrix_cache.Save();
 
-        record.target(mpileup.contigs()[contig].name.c_str());
-        record.position(position);
+    site_counts_t counts;
+    std::string alleles;
 
-        record.TrimAlleles(stats.af_min);
+    mpileup([&](const io::AdPileup::data_type &site) {
+        const size_t n_alleles = site.indexes.size();
+        // Sites without variation can not be called
+        if(n_alleles == 1 && caller.model.quality_threshold() > 0.0) {
+            counts.model.reference_only += 1;
+            return;
+        }
+        auto set_alleles = [&](hts::bcf::Variant *r) {
+            alleles.clear();
+            for(size_t u = 0; u < n_alleles; ++u) {
+                if(u > 0) {
+                    alleles += ',';
+                }
+                alleles += seq::indexed_char(site.indexes[u]);
+            }
+            r->update_alleles(alleles);
+        };
+        int contig = utility::location_to_contig(site.location);
+        int position = utility::location_to_position(site.location);
+        if(!call_depths_site(site.depths, n_alleles, set_alleles,
+                mpileup.contigs()[contig].name.c_str(), position,
+                relationship_graph, &caller, &record)) {
+            return;
+        }
         vcfout.WriteRecord(record);
         record.Clear();
     });
+    if(arg.report_filters) {
+        counts.AddModel(caller.model);
+        print_site_counts(std::cerr, counts);
+    }
+    if(arg.report_io) {
+        io::print_file_times(std::cerr, mpileup.read_times());
+    }
     return EXIT_SUCCESS;
 }
 
@@ -511,8 +949,9 @@ void append_genotype(const hts::bcf::Variant& rec, int gt, int ploidy, std::stri
 }
 
 void add_stats_to_output(const CallMutations::stats_t& call_stats, const pileup::stats_t& depth_stats,
-    const RelationshipGraph &graph, const peel::workspace_t &work, hts::bcf::Variant *record) {
-    assert(record != nullptr);
+    const RelationshipGraph &graph, const peel::workspace_t &work, output_buffers_t *buffers,
+    hts::bcf::Variant *record) {
+    assert(buffers != nullptr && record != nullptr);
 
     using namespace hts::bcf;
 
@@ -537,7 +976,8 @@ void add_stats_to_output(const CallMutations::stats_t& call_stats, const pileup:
 
     bool has_single_mut = (call_stats.dnp >= call_stats.dnp_min && call_stats.dnp_min > 0.0);
     if(has_single_mut) {
-        std::string dnt;
+        std::string &dnt = buffers->dnt;
+        dnt.clear();
         size_t pos = call_stats.dnl;
         int sz = record->num_alleles();
 
@@ -575,8 +1015,8 @@ void add_stats_to_output(const CallMutations::stats_t& call_stats, const pileup:
 
     record->update_info("DP", depth_stats.dp);
 
-    std::vector<float> float_vector;
-    std::vector<int32_t> int32_vector;
+    auto &float_vector = buffers->float_vector;
+    auto &int32_vector = buffers->int32_vector;
 
     int32_vector.assign(2*num_nodes, hts::bcf::int32_missing);
 
@@ -35,6 +35,7 @@
 #include <vector>
 #include <stack>
 #include <numeric>
+#include <memory>
 
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/algorithm/replace.hpp>
@@ -56,6 +57,7 @@
 #include <dng/io/ped.h>
 #include <dng/io/bam.h>
 #include <dng/io/bcf.h>
+#include <dng/io/ad.h>
 #include <dng/depths.h>
 #include <dng/multithread.h>
 
@@ -74,6 +76,7 @@ using utility::make_array;
 namespace {
 int process_bam(LogLike::argument_type &arg);
 int process_bcf(LogLike::argument_type &arg);
+int process_ad(LogLike::argument_type &arg);
 } // anon namespace
 
 // The main loop for dng-loglike application
@@ -88,10 +91,11 @@ int task::LogLike::operator()(task::LogLike::argument_type &arg) {
 
     // Check that all input formats are of same category
     auto it = arg.input.begin();
-    FileCat mode = utility::input_category(*it, FileCat::Sequence|FileCat::Variant, FileCat::Sequence);
+    const auto input_mask = FileCat::Sequence|FileCat::Variant|FileCat::Pileup;
+    FileCat mode = utility::input_category(*it, input_mask, FileCat::Sequence);
     for(++it; it != arg.input.end(); ++it) {
-        if(utility::input_category(*it, FileCat::Sequence|FileCat::Variant, FileCat::Sequence) != mode) {
-            throw std::invalid_argument("Mixing sam/bam/cram and vcf/bcf input files is not supported.");
+        if(utility::input_category(*it, input_mask, FileCat::Sequence) != mode) {
+            throw std::invalid_argument("Mixing sam/bam/cram, vcf/bcf, and ad input files is not supported.");
         }
     }
     // Execute sub tasks based on input type
@@ -100,6 +104,9 @@ int task::LogLike::operator()(task::LogLike::argument_type &arg) {
         return process_bcf(arg);
     } else if(mode == FileCat::Sequence) {
         return process_bam(arg);
+    } else if(mode == FileCat::Pileup) {
+        // ad
+        return process_ad(arg);
     } else {
         throw std::invalid_argument("Unknown input data file type.");
     }
@@ -118,38 +125,121 @@ void output_loglike_results(std::ostream &o, double total, double observed) {
          << "log_observed\t" << observed << "\n";
 }
 
-int process_bam(LogLike::argument_type &arg) {
-    // Open Reference
-    if(arg.fasta.empty()){
-        throw std::invalid_argument("Path to reference file must be specified with --fasta when processing bam/sam/cram files.");
+// A block of sites that is processed by a single worker
+struct loglike_batch_t {
+    std::vector<pileup::allele_depths_t> depths;
+    size_t num_sites{0};
+
+    std::vector<double> lld;
+    std::vector<double> ln_scale;
+};
+
+// Sums the log-likelihoods of sites. Sites are copied into batches, so that
+// the model can peel sites in blocks. If more than one thread is used, batches
+// are processed by a pool of workers, each with its own copy of the model.
+// Results are added to the sums on the calling thread, and exceptions thrown
+// by workers are rethrown there. The log-likelihood of a site does not depend
+// on the other sites in its batch, and ExactSum is exact, so the result does
+// not depend on the number of threads, the batch size, or how batches are
+// scheduled.
+class LoglikeSum {
+public:
+    LoglikeSum(const Probability &model, int num_threads, int batch_size);
+
+    template<typename A>
+    void Add(const A &depths);
+
+    // Wait for all sites to be processed and add the sums to sum_data and
+    // sum_scale
+    void Finish(dng::stats::ExactSum *sum_data, dng::stats::ExactSum *sum_scale);
+
+private:
+    void Process(loglike_batch_t *batch);
+    void Write(loglike_batch_t *batch);
+
+    size_t batch_size_;
+
+    multithread::ObjectPool<Probability> models_;
+
+    dng::stats::ExactSum sum_data_;
+    dng::stats::ExactSum sum_scale_;
+
+    // must be declared last so that workers finish before the rest is destroyed
+    multithread::OrderedBatchQueue<loglike_batch_t> queue_;
+};
+
+LoglikeSum::LoglikeSum(const Probability &model, int num_threads, int batch_size) :
+    batch_size_((batch_size > 0) ? batch_size : 1),
+    models_((num_threads > 1) ? num_threads : 1, model),
+    queue_((num_threads > 1) ? num_threads : 0,
+        [this](loglike_batch_t *batch) { Process(batch); },
+        [this](loglike_batch_t *batch) { Write(batch); },
+        [this]() {
+            loglike_batch_t *batch = new loglike_batch_t;
+            batch->depths.resize(batch_size_);
+            return batch;
+        })
+{
+}
+
+template<typename A>
+void LoglikeSum::Add(const A &depths) {
+    loglike_batch_t *batch = queue_.current();
+    if(batch == nullptr) {
+        batch = queue_.NewBatch();
+    }
+    auto &d = batch->depths[batch->num_sites];
+    d.resize(make_array(depths.shape()[0], depths.shape()[1]));
+    d = depths;
+    if(++batch->num_sites == batch_size_) {
+        queue_.Submit();
     }
-    io::Fasta reference{arg.fasta.c_str()};
+}
 
-    // Open input files
-    auto mpileup = io::BamPileup::open_and_setup(arg);
+void LoglikeSum::Process(loglike_batch_t *batch) {
+    auto model = models_.Acquire();
+    batch->lld.resize(batch->num_sites);
+    batch->ln_scale.resize(batch->num_sites);
+    model->CalculateLLD(batch->depths, batch->num_sites, batch->lld.data(),
+        batch->ln_scale.data());
+}
 
-    auto relationship_graph = create_relationship_graph(arg, &mpileup);
+void LoglikeSum::Write(loglike_batch_t *batch) {
+    for(size_t i = 0; i < batch->num_sites; ++i) {
+        sum_data_ += batch->lld[i];
+        sum_scale_ += batch->ln_scale[i];
+    }
+    batch->num_sites = 0;
+}
 
-    Probability model{relationship_graph, get_model_parameters(arg)};
+void LoglikeSum::Finish(dng::stats::ExactSum *sum_data, dng::stats::ExactSum *sum_scale) {
+    assert(sum_data != nullptr && sum_scale != nullptr);
+    if(queue_.current() != nullptr && queue_.current()->num_sites > 0) {
+        queue_.Submit();
+    }
+    queue_.Flush();
 
-    const size_t num_nodes = relationship_graph.num_nodes();
-    const size_t library_start = relationship_graph.library_nodes().first;
-    const int min_basequal = arg.min_basequal;
-    auto filter_read = [min_basequal](
-    decltype(mpileup)::data_type::value_type::const_reference r) -> bool {
-        return (r.is_missing
-        || r.base_qual() < min_basequal
-        || seq::base_index(r.base()) >= 4);
-    };
+    *sum_data += sum_data_;
+    *sum_scale += sum_scale_;
+}
 
-    decltype(mpileup)::Alleles count_alleles(mpileup.num_libraries());
+// Sum the log-likelihoods of the sites in a pileup
+void loglike_bam(const LogLike::argument_type &arg, io::BamPileup *pmpileup,
+    io::Fasta *preference, const Probability &model,
+    dng::stats::ExactSum *sum_data, dng::stats::ExactSum *sum_scale) {
+    assert(pmpileup != nullptr && preference != nullptr);
+    assert(sum_data != nullptr && sum_scale != nullptr);
+    auto &mpileup = *pmpileup;
+    auto &reference = *preference;
+
+    LoglikeSum sum(model, arg.threads, arg.batch_size);
+
+    io::BamPileup::Alleles count_alleles(mpileup.num_libraries());
+    mpileup.EnableColumns(arg.min_basequal);
 
-    // Treat sequence_data and variant data separately
-    dng::stats::ExactSum sum_data;
-    dng::stats::ExactSum sum_scale;
     auto h = mpileup.header();
     
-    mpileup([&](const decltype(mpileup)::data_type & data, utility::location_t loc) {
+    mpileup([&](const io::BamPileup::data_type & data, utility::location_t loc) {
         // Calculate target position and fetch sequence name
         int contig = utility::location_to_contig(loc);
         int position = utility::location_to_position(loc);
@@ -159,25 +249,95 @@ int process_bam(LogLike::argument_type &arg) {
         char ref_base = reference.FetchBase(h->target_name[contig],position);
         size_t ref_index = seq::char_index(ref_base);
 
-        auto read_depths = count_alleles(data, ref_index, filter_read);
+        auto read_depths = count_alleles(mpileup.columns(), loc, ref_index);
         size_t n_sz = read_depths.shape()[1];
         if(n_sz == 0) {
             return;
         }
 
-        double loglike = model.CalculateLLD(read_depths, n_sz);
-        sum_data += loglike;
-        sum_scale += model.work().ln_scale;
+        sum.Add(read_depths);
+    });
+
+    sum.Finish(sum_data, sum_scale);
+}
+
+int process_bam(LogLike::argument_type &arg) {
+    // Open Reference
+    if(arg.fasta.empty()){
+        throw std::invalid_argument("Path to reference file must be specified with --fasta when processing bam/sam/cram files.");
+    }
+    io::Fasta reference{arg.fasta.c_str(), arg.fasta_cache};
+
+    // Threads shared by all files; must be created before the files
+    hts::ThreadPool io_pool{arg.io_threads};
+
+    // Open input files
+    auto mpileup = io::BamPileup::open_and_setup(arg, &io_pool);
+
+    auto relationship_graph = create_relationship_graph(arg, &mpileup);
+
+    MatrixCache matrix_cache{arg.matrix_cache};
+    Probability model{relationship_graph, get_model_parameters(arg), &matrix_cache};
+    matrix_cache.Save();
+
+    // Treat sequence_data and variant data separately
+    dng::stats::ExactSum sum_data;
+    dng::stats::ExactSum sum_scale;
+
+    if(arg.shards <= 1) {
+        loglike_bam(arg, &mpileup, &reference, model, &sum_data, &sum_scale);
+        output_loglike_results(cout, sum_data.result(), sum_scale.result()/M_LN10);
+        if(arg.report_io) {
+            io::print_file_times(std::cerr, mpileup.read_times());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Split the regions into shards that are processed independently, and
+    // merge their partial sums. As with threads, the result does not depend
+    // on the number of shards.
+    auto shards = regions::shard_regions(arg.region, mpileup, arg.shards);
+    std::vector<dng::stats::ExactSum> shard_data(shards.size()), shard_scale(shards.size());
+    std::vector<std::vector<io::file_time_t>> shard_times(shards.size());
+
+    multithread::run_in_parallel(shards.size(), [&](size_t i) {
+        if(i == 0) {
+            mpileup.SetRegions(shards[0]);
+            loglike_bam(arg, &mpileup, &reference, model, &shard_data[0], &shard_scale[0]);
+            shard_times[0] = mpileup.read_times();
+            return;
+        }
+        io::Fasta shard_reference{arg.fasta.c_str(), arg.fasta_cache};
+        auto shard_mpileup = io::BamPileup::open_and_setup(arg, &io_pool);
+        shard_mpileup.SelectLibraries(relationship_graph.library_names());
+        shard_mpileup.SetRegions(shards[i]);
+        loglike_bam(arg, &shard_mpileup, &shard_reference, model, &shard_data[i], &shard_scale[i]);
+        shard_times[i] = shard_mpileup.read_times();
     });
 
+    for(size_t i = 0; i < shards.size(); ++i) {
+        sum_data += shard_data[i];
+        sum_scale += shard_scale[i];
+    }
+
     output_loglike_results(cout, sum_data.result(), sum_scale.result()/M_LN10);
+    if(arg.report_io) {
+        std::vector<io::file_time_t> times;
+        for(auto && a : shard_times) {
+            io::add_file_times(&times, a);
+        }
+        io::print_file_times(std::cerr, times);
+    }
 
     return EXIT_SUCCESS;
 }
 
 int process_bcf(LogLike::argument_type &arg) {
+    // Threads shared by all files; must be created before the files
+    hts::ThreadPool io_pool{arg.io_threads};
+
     // Read input data
-    auto mpileup = io::BcfPileup::open_and_setup(arg);
+    auto mpileup = io::BcfPileup::open_and_setup(arg, &io_pool);
 
     auto relationship_graph = create_relationship_graph(arg, &mpileup);
 
@@ -185,10 +345,10 @@ int process_bcf(LogLike::argument_type &arg) {
     const bcf_hdr_t *header = mpileup.reader().header(0); // TODO: fixthis
     const int num_libs = mpileup.num_libraries();
 
-    Probability model{relationship_graph, get_model_parameters(arg)};
-
-    const size_t num_nodes = relationship_graph.num_nodes();
-    const size_t library_start = relationship_graph.library_nodes().first;
+    MatrixCache matrix_cache{arg.matrix_cache};
+    Probability model{relationship_graph, get_model_parameters(arg), &matrix_cache};
+    matrix_cache.Save();
+    LoglikeSum sum(model, arg.threads, arg.batch_size);
 
     // allocate space for ad. bcf_get_format_int32 uses realloc internally
     int n_ad_capacity = num_libs*5;
@@ -216,13 +376,42 @@ int process_bcf(LogLike::argument_type &arg) {
 
         pileup::allele_depths_ref_t read_depths(ad.get(), make_array(num_libs,n_sz));
 
-        double loglike = model.CalculateLLD(read_depths,n_sz);
-        sum_data += loglike;
-        sum_scale += model.work().ln_scale;
+        sum.Add(read_depths);
     });
+    sum.Finish(&sum_data, &sum_scale);
 
     // output results
     output_loglike_results(cout, sum_data.result(), sum_scale.result()/M_LN10);
+    if(arg.report_io) {
+        io::print_file_times(std::cerr, mpileup.read_times());
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int process_ad(LogLike::argument_type &arg) {
+    // Read input data
+    auto mpileup = io::AdPileup::open_and_setup(arg);
+
+    auto relationship_graph = create_relationship_graph(arg, &mpileup);
+
+    MatrixCache matrix_cache{arg.matrix_cache};
+    Probability model{relationship_graph, get_model_parameters(arg), &matrix_cache};
+    matrix_cache.Save();
+    LoglikeSum sum(model, arg.threads, arg.batch_size);
+
+    dng::stats::ExactSum sum_data;
+    dng::stats::ExactSum sum_scale;
+
+    mpileup([&](const io::AdPileup::data_type &site) {
+        sum.Add(site.depths);
+    });
+    sum.Finish(&sum_data, &sum_scale);
+
+    output_loglike_results(cout, sum_data.result(), sum_scale.result()/M_LN10);
+    if(arg.report_io) {
+        io::print_file_times(std::cerr, mpileup.read_times());
+    }
 
     return EXIT_SUCCESS;
 }
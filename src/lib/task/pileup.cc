@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <iostream>
+
+#include <dng/task/pileup.h>
+#include <dng/utility.h>
+#include <dng/seq.h>
+#include <dng/io/utility.h>
+#include <dng/io/fasta.h>
+#include <dng/io/bam.h>
+#include <dng/io/ad.h>
+
+using namespace dng;
+using namespace dng::task;
+
+using dng::utility::FileCat;
+
+// The main loop for dng-pileup application
+// argument_type arg holds the processed command line arguments
+int task::Pileup::operator()(Pileup::argument_type &arg) {
+    for(auto && in : arg.input) {
+        utility::input_category(in, FileCat::Sequence, FileCat::Sequence);
+    }
+    // Open Reference
+    if(arg.fasta.empty()){
+        throw std::invalid_argument("Path to reference file must be specified with --fasta when processing bam/sam/cram files.");
+    }
+    io::Fasta reference{arg.fasta.c_str(), arg.fasta_cache};
+
+    // Threads shared by all files; must be created before the files
+    hts::ThreadPool io_pool{arg.io_threads};
+
+    // Open input files
+    auto mpileup = io::BamPileup::open_and_setup(arg, &io_pool);
+
+    // Open Output
+    io::AdWriter output{arg.output, static_cast<size_t>(std::max(arg.block_size, 1))};
+    output.WriteHeader(mpileup.contigs(), mpileup.libraries());
+
+    io::BamPileup::Alleles count_alleles(mpileup.num_libraries());
+    mpileup.EnableColumns(arg.min_basequal);
+
+    auto h = mpileup.header();
+
+    mpileup([&](const io::BamPileup::data_type & data, utility::location_t loc) {
+        // Calculate target position and fetch sequence name
+        int contig = utility::location_to_contig(loc);
+        int position = utility::location_to_position(loc);
+
+        // Calculate reference base
+        assert(0 <= contig && contig < h->n_targets);
+        char ref_base = reference.FetchBase(h->target_name[contig],position);
+        size_t ref_index = seq::char_index(ref_base);
+
+        const auto &read_depths = count_alleles(mpileup.columns(), loc, ref_index);
+        if(read_depths.shape()[1] == 0) {
+            return;
+        }
+        output.Write(loc, count_alleles.indexes, read_depths);
+    });
+    output.Close();
+
+    if(arg.report_io) {
+        io::print_file_times(std::cerr, mpileup.read_times());
+    }
+    return EXIT_SUCCESS;
+}
@@ -74,7 +74,8 @@ file_type_t extract_file_type(std::string path) {
 
 static const std::string file_category_keys[] = {
     "bam","sam","cram",
-    "bcf","vcf"
+    "bcf","vcf",
+    "ad"
 };
 
 FileCat file_category(const std::string &ext) {
@@ -86,6 +87,8 @@ FileCat file_category(const std::string &ext) {
     case 3:
     case 4:
         return FileCat::Variant;
+    case 5:
+        return FileCat::Pileup;
     default:
     	break;
     };
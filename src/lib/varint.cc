@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Reed A. Cartwright
+ * Authors:  Reed A. Cartwright <reed@cartwrig.ht>
+ *
+ * This file is part of DeNovoGear.
+ *
+ * DeNovoGear is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dng/detail/varint.h>
+
+namespace dng { namespace detail { namespace varint {
+
+// Continue decoding a varint whose first byte had its MSB set
+boost::optional<uint64_t> get_fallback(bytebuf_t *in, uint64_t first_byte) {
+    assert(in != nullptr);
+    uint64_t u = first_byte & 0x7F;
+    // a 64-bit number is encoded in at most 10 bytes
+    for(int shift = 7; shift < 70; shift += 7) {
+        bytebuf_t::int_type n = in->sbumpc();
+        if(bytebuf_t::traits_type::eq_int_type(n, bytebuf_t::traits_type::eof())) {
+            return boost::none;
+        }
+        uint64_t b = static_cast<uint8_t>(bytebuf_t::traits_type::to_char_type(n));
+        u |= (b & 0x7F) << shift;
+        if(!(b & 0x80)) {
+            return u;
+        }
+    }
+    // the encoding is too long
+    return boost::none;
+}
+
+bool put(bytebuf_t *out, uint64_t val) {
+    assert(out != nullptr);
+    char buffer[10];
+    int n = 0;
+    while(val >= 0x80) {
+        buffer[n++] = static_cast<char>((val & 0x7F) | 0x80);
+        val >>= 7;
+    }
+    buffer[n++] = static_cast<char>(val);
+    return out->sputn(buffer, n) == n;
+}
+
+}}} // dng::detail::varint